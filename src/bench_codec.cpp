@@ -0,0 +1,100 @@
+/*
+bench_codec.cpp: messages/s and heap allocations per message of the udp message encoding:
+	bench_codec [num_message]
+	msgpack send: std::stringstream + msgpack::pack + str() (the former do_send)
+	msgpack receive: msgpack::unpack into an object_handle + convert (the former do_receive)
+	codec send/receive: packUdpData/unpackUdpData (udp_codec.h), preallocated buffer, parsed in place
+Also checks that the codec output is byte identical to msgpack::pack and decodes back.
+*/
+
+#include "udp_codec.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <string>
+
+static std::atomic<uint64_t> num_alloc{ 0 }; // number of operator new calls
+
+void* operator new(size_t size) {
+	num_alloc.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = malloc(size > 0 ? size : 1)) { return p; }
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static volatile double sink; // keeps the results alive
+
+template<class F>
+static void bench(const char* name, int num_message, F f) {
+	const uint64_t alloc_begin = num_alloc;
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < num_message; i++) { f(i); }
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%-18s %12.0f messages/s %8.1f ns/message %6.2f allocations/message\n", name,
+		num_message / elapsed, elapsed / num_message * 1e9, (double)(num_alloc - alloc_begin) / num_message);
+}
+
+int main(int argc, char* argv[])
+{
+	const int num_message = argc > 1 ? atoi(argv[1]) : 2000000;
+
+	UdpDataSend msg_send;
+	for (int j = 0; j < 4; j++) {
+		msg_send.jointAngle[j] = 0.1 * j;
+		msg_send.jointSpeed[j] = -2.5 * j;
+		msg_send.actuation[j] = 0.01 * j;
+	}
+	for (int j = 0; j < 3; j++) { msg_send.acceleration[j] = 9.81 * j; msg_send.position[j] = 0.3 * j; }
+	for (int j = 0; j < 6; j++) { msg_send.orientation[j] = j / 6.; }
+
+	// wire compatibility
+	char buffer[UDP_PACKED_MAX_SIZE];
+	msg_send.T = 1.5;
+	const size_t size = packUdpData(msg_send, buffer);
+	std::stringstream send_stream;
+	msgpack::pack(send_stream, msg_send);
+	const std::string reference = send_stream.str();
+	const bool identical = reference.size() == size && memcmp(reference.data(), buffer, size) == 0;
+	UdpDataSend decoded;
+	const bool decoded_ok = unpackUdpData(buffer, size, decoded) && memcmp(&decoded, &msg_send, sizeof(decoded)) == 0;
+	printf("UdpDataSend: %zu bytes, identical to msgpack::pack: %s, decodes back: %s\n", size,
+		identical ? "yes" : "NO", decoded_ok ? "yes" : "NO");
+
+	UdpDataReceive msg_rec;
+	msg_rec.T = 2.5;
+	for (int j = 0; j < 4; j++) { msg_rec.jointSpeed[j] = 1.0 + j; }
+	char rec_buffer[UDP_PACKED_MAX_SIZE];
+	const size_t rec_size = packUdpData(msg_rec, rec_buffer);
+	printf("%d messages, UdpDataSend packed, UdpDataReceive (%zu bytes) unpacked\n", num_message, rec_size);
+
+	bench("msgpack send", num_message, [&](int i) {
+		msg_send.T = i;
+		std::stringstream send_stream;
+		msgpack::pack(send_stream, msg_send);
+		std::string const& data = send_stream.str();
+		sink = data[data.size() - 1];
+	});
+	bench("codec send", num_message, [&](int i) {
+		msg_send.T = i;
+		const size_t n = packUdpData(msg_send, buffer);
+		sink = buffer[n - 1];
+	});
+	UdpDataReceive msg;
+	bench("msgpack receive", num_message, [&](int) {
+		msgpack::object_handle oh = msgpack::unpack(rec_buffer, rec_size);
+		msgpack::object obj = oh.get();
+		obj.convert(msg);
+		sink = msg.jointSpeed[3];
+	});
+	bench("codec receive", num_message, [&](int) {
+		unpackUdpData(rec_buffer, rec_size, msg);
+		sink = msg.jointSpeed[3];
+	});
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+bench_integrator.cpp: explicit (dt=5e-5) vs implicit (Integrator::IMPLICIT) and XPBD (Integrator::XPBD)
+integration at larger timesteps on the flexipod robot walking with a trotting gait (walking_trot.ipynb):
+	bench_integrator [--reorder] [model_path] [runtime_s] [num_threads]
+Each variant runs runtime_s (default 2 s) of simulation from the same initial state with the same gait,
+the errors are measured against the explicit dt=5e-5 run at the sample times of each variant:
+	com error: distance between the body com positions [m]
+	joint error: difference of the measured joint angles [rad]
+*/
+
+#include "sim_cpu.h"
+#include "flexipod.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+struct Variant {
+	const char* name;
+	Integrator integrator;
+	double dt;
+};
+
+struct Trajectory {
+	std::vector<double> T; // simulation time of each update()
+	std::vector<Vec3d> com_pos; // body com position of each update()
+	std::vector<double> joint_pos; // joint angles of each update(), num_joint per update()
+	double sim_rate = 0; // simulated seconds per wall second
+	double cg_iter = 0; // CG iterations per step (Integrator::IMPLICIT)
+	bool stable = true;
+};
+
+static double wrapAngle(double a) { // wrap to [-pi,pi)
+	return a - 2 * M_PI * floor((a + M_PI) / (2 * M_PI));
+}
+
+int main(int argc, char* argv[])
+{
+	bool reorder = false;
+	std::vector<const char*> args; // positional arguments
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--reorder") == 0) { reorder = true; }
+		else { args.push_back(argv[i]); }
+	}
+	const char* model_path = args.size() > 0 ? args[0] : "../src/data.msgpack";
+	double runtime = args.size() > 1 ? atof(args[1]) : 2; // simulation time [s]
+	int num_threads = args.size() > 2 ? atoi(args[2]) : 0; // 0: use the openmp default
+
+	MASS robot_mass; // one robot (host)
+	SPRING robot_spring;
+	JOINT robot_joint;
+	FlexipodIndex index = loadFlexipod(model_path, reorder, robot_mass, robot_spring, robot_joint); // msgpack or binary model
+
+	const double gait_frequency = 1.0; // [Hz]
+	std::vector<Variant> variants = { // the first variant is the reference
+		{"explicit", Integrator::EXPLICIT, 5e-5},
+		{"explicit", Integrator::EXPLICIT, 5e-4},
+		{"implicit", Integrator::IMPLICIT, 5e-4},
+		{"implicit", Integrator::IMPLICIT, 1e-3},
+		{"implicit", Integrator::IMPLICIT, 2.5e-3},
+		{"xpbd", Integrator::XPBD, 5e-4},
+		{"xpbd", Integrator::XPBD, 1e-3},
+		{"xpbd", Integrator::XPBD, 2.5e-3},
+	};
+	std::vector<Trajectory> trajectories;
+	for (const Variant& variant : variants) {
+		CpuSimulation sim(robot_mass, robot_spring, robot_joint, 1);
+		sim.num_threads = num_threads;
+		sim.dt = variant.dt; // timestep
+		sim.id_restable_spring_start = index.id_restable_spring_start;
+		sim.id_resetable_spring_end = index.id_resetable_spring_end;
+		sim.id_oxyz_start = index.id_oxyz_start;
+		sim.id_oxyz_end = index.id_oxyz_end;
+		sim.setMaxJointSpeed(600. / 60. * 2 * M_PI);
+		sim.global_acc = Vec3d(0, 0, -9.8);
+		sim.createPlane(Vec3d(0, 0, 1), 0, 0.6, 0.6);
+		sim.force_assembly = ForceAssembly::GATHER;
+		sim.integrator = variant.integrator;
+		sim.start();
+
+		Trajectory traj;
+		auto start = std::chrono::steady_clock::now();
+		while (sim.T < runtime) {
+			trotJointVel(sim.T, gait_frequency, sim.joint_vel_desired.data(), sim.joint.size());
+			sim.update();
+			Vec3d com = sim.instance_state[0].com_pos;
+			if (!(com.norm() < 1e3)) { // diverged (or nan)
+				traj.stable = false;
+				break;
+			}
+			traj.T.push_back(sim.T);
+			traj.com_pos.push_back(com);
+			traj.joint_pos.insert(traj.joint_pos.end(), sim.joint_pos.begin(), sim.joint_pos.end());
+		}
+		auto end = std::chrono::steady_clock::now();
+		traj.sim_rate = sim.T / std::chrono::duration<double>(end - start).count();
+		traj.cg_iter = sim.implicit.num_step > 0 ? (double)sim.implicit.num_iter / sim.implicit.num_step : 0;
+		trajectories.push_back(traj);
+	}
+
+	const Trajectory& ref = trajectories[0];
+	const size_t num_joint = ref.joint_pos.size() / ref.com_pos.size();
+	printf("%.1f s trot\n", runtime);
+	printf("%-9s %8s %12s %8s %8s %12s %14s %16s\n", "variant", "dt[s]", "sim s/wall s", "speedup", "CG iter",
+		"com travel[m]", "max com err[m]", "max joint err[rad]");
+	for (size_t v = 0; v < trajectories.size(); v++) {
+		const Trajectory& traj = trajectories[v];
+		if (!traj.stable) {
+			printf("%-9s %8.1e %12s (diverged at T=%.3f s)\n", variants[v].name, variants[v].dt, "-",
+				traj.T.empty() ? 0. : traj.T.back());
+			continue;
+		}
+		double max_com = 0, max_joint = 0;
+		size_t k = 0; // reference sample nearest in time
+		for (size_t i = 0; i < traj.T.size(); i++) {
+			while (k + 1 < ref.T.size() && fabs(ref.T[k + 1] - traj.T[i]) <= fabs(ref.T[k] - traj.T[i])) { k++; }
+			max_com = std::max(max_com, (traj.com_pos[i] - ref.com_pos[k]).norm());
+			for (size_t j = 0; j < num_joint; j++) {
+				max_joint = std::max(max_joint, fabs(wrapAngle(traj.joint_pos[i * num_joint + j] - ref.joint_pos[k * num_joint + j])));
+			}
+		}
+		printf("%-9s %8.1e %12.4f %8.2f %8.1f %12.4f %14.3e %16.3e\n", variants[v].name, variants[v].dt,
+			traj.sim_rate, traj.sim_rate / ref.sim_rate, traj.cg_iter,
+			(traj.com_pos.back() - traj.com_pos.front()).norm(), max_com, max_joint);
+	}
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+bench_obstacles.cpp: cost of the contact and mass passes (ContactForceCpu, MassUpdateCpu) against the number of
+static obstacles, the linear constraint loops vs the bounding volume hierarchy of ObstacleSet (obstacle.h):
+	bench_obstacles [--counts 1,10,100,1000,10000] [--threads 1] [--repeat 20] [model_path]
+The obstacles are scattered through the box around the robot (0.5 m margin), so that some masses are
+inside them as in a cluttered scene:
+	balls_linear: n balls as global constraints (createBall(), CudaBall), every mass tests every ball
+	balls_bvh: the same balls (zero length capsules) in an ObstacleSet
+	mixed_bvh: n boxes, capsules and triangles in an ObstacleSet
+	mixed_build: ObstacleSet::build() of the mixed set (ns/pass: one build)
+All masses are in the contact pass. ns/mass is the time of one step per mass, contacts the masses inside an obstacle.
+*/
+
+#include "sim_cpu.h"
+#include "flexipod.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+constexpr int NUM_TRIAL = 5; // timings per row, the median is reported
+
+/* median wall time [ns] of one call of fn, over NUM_TRIAL timings of repeat calls */
+template<class Fn>
+static double timeCall(int repeat, Fn fn) {
+	fn(); // warm up
+	std::vector<double> trial(NUM_TRIAL);
+	for (double& t : trial) {
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeat; r++) { fn(); }
+		t = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / repeat;
+	}
+	std::sort(trial.begin(), trial.end());
+	return trial[NUM_TRIAL / 2];
+}
+
+/* same as above for a pass with orphaned "omp for", each timing runs in one parallel region */
+template<class Fn>
+static double timePass(int repeat, int num_threads, Fn fn) {
+	return timeCall(1, [&] {
+#pragma omp parallel num_threads(num_threads)
+		for (int r = 0; r < repeat; r++) { fn(); }
+	}) / repeat;
+}
+
+static int countContacts(const MASS& mass, const CudaObstacles& obstacles) {
+	int num_contact = 0;
+	for (int i = 0; i < mass.num; i++) {
+		Vec3d normal;
+		double disp, friction_k, friction_s;
+		num_contact += obstacles.contact(mass.pos[i], normal, disp, friction_k, friction_s);
+	}
+	return num_contact;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<int> counts = { 1, 10, 100, 1000, 10000 };
+	int num_threads = 1, repeat = 20;
+	std::vector<const char*> args; // positional arguments
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--counts") == 0 && i + 1 < argc) {
+			counts.clear();
+			std::stringstream list(argv[++i]);
+			std::string item;
+			while (std::getline(list, item, ',')) { counts.push_back(atoi(item.c_str())); }
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) { num_threads = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) { repeat = atoi(argv[++i]); }
+		else { args.push_back(argv[i]); }
+	}
+	const char* model_path = args.size() > 0 ? args[0] : "../src/data.msgpack";
+
+	MASS robot_mass; // one robot (host)
+	SPRING robot_spring;
+	JOINT robot_joint;
+	FlexipodIndex index = loadFlexipod(model_path, false, robot_mass, robot_spring, robot_joint);
+	CpuSimulation sim(robot_mass, robot_spring, robot_joint, 1);
+	sim.num_threads = num_threads;
+	sim.dt = 5e-5;
+	sim.id_restable_spring_start = index.id_restable_spring_start;
+	sim.id_resetable_spring_end = index.id_resetable_spring_end;
+	sim.id_oxyz_start = index.id_oxyz_start;
+	sim.id_oxyz_end = index.id_oxyz_end;
+	sim.setMaxJointSpeed(600. / 60. * 2 * M_PI);
+	sim.global_acc = Vec3d(0, 0, -9.8);
+	sim.start();
+	const MASS& mass = sim.mass;
+	SurfaceIndex all_masses;
+	for (int i = 0; i < mass.num; i++) { all_masses.id.push_back(i); }
+	auto step = [&](const CUDA_GLOBAL_CONSTRAINTS& c) {
+		ContactForceCpu(mass, all_masses, c);
+		MassUpdateCpu(mass, sim.global_acc, 0);
+	};
+
+	Vec3d lo = mass.pos[0], hi = mass.pos[0]; // box around the robot
+	for (int i = 1; i < mass.num; i++) {
+		const Vec3d& p = mass.pos[i];
+		lo = Vec3d(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+		hi = Vec3d(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+	}
+	lo -= Vec3d(0.5, 0.5, 0.5);
+	hi += Vec3d(0.5, 0.5, 0.5);
+	printf("%d masses, obstacles within (%.2f %.2f %.2f)..(%.2f %.2f %.2f) m, %d threads\n",
+		mass.num, lo.x, lo.y, lo.z, hi.x, hi.y, hi.z, num_threads);
+	printf("%9s %-13s %14s %10s %9s\n", "obstacles", "pass", "ns/pass", "ns/mass", "contacts");
+
+	for (const int n : counts) {
+		std::mt19937 rng(n);
+		std::uniform_real_distribution<double> uniform(0, 1);
+		auto random = [&](double a, double b) { return a + (b - a) * uniform(rng); };
+		auto randomPoint = [&] { return Vec3d(random(lo.x, hi.x), random(lo.y, hi.y), random(lo.z, hi.z)); };
+		auto randomDirection = [&] { return Vec3d(random(-1, 1), random(-1, 1), random(-1, 1)) + Vec3d(1e-3, 0, 0); };
+
+		std::vector<CudaBall> balls(n);
+		ObstacleSet ball_set, mixed_set;
+		for (CudaBall& ball : balls) {
+			ball._center = randomPoint();
+			ball._radius = random(0.01, 0.05);
+			ball_set.addCapsule(ball._center, ball._center, ball._radius);
+		}
+		for (int k = 0; k < n; k++) {
+			const Vec3d p = randomPoint();
+			switch (k % 3) {
+			case 0: mixed_set.addBox(p, Vec3d(random(0.01, 0.05), random(0.01, 0.05), random(0.01, 0.05)), randomDirection(), randomDirection()); break;
+			case 1: mixed_set.addCapsule(p, p + 0.1 * randomDirection(), random(0.01, 0.03)); break;
+			default: mixed_set.addTriangle(p, p + 0.1 * randomDirection(), p + 0.1 * randomDirection(), 0.02); break;
+			}
+		}
+		ball_set.build();
+		mixed_set.build();
+		const CudaObstacles ball_view = ball_set.view(), mixed_view = mixed_set.view();
+		const CUDA_GLOBAL_CONSTRAINTS linear = { nullptr, balls.data(), 0, balls.size() };
+		const CUDA_GLOBAL_CONSTRAINTS ball_bvh = { nullptr, nullptr, 0, 0, nullptr, &ball_view };
+		const CUDA_GLOBAL_CONSTRAINTS mixed_bvh = { nullptr, nullptr, 0, 0, nullptr, &mixed_view };
+
+		auto row = [&](const char* pass, double ns, int num_contact) {
+			printf("%9d %-13s %14.1f %10.2f %9d\n", n, pass, ns, ns / mass.num, num_contact);
+		};
+		// dt = 0: the passes do not move the masses, every call sees the same state
+		row("balls_linear", timePass(repeat, num_threads, [&] { step(linear); }), countContacts(mass, ball_view));
+		row("balls_bvh", timePass(repeat, num_threads, [&] { step(ball_bvh); }), countContacts(mass, ball_view));
+		row("mixed_bvh", timePass(repeat, num_threads, [&] { step(mixed_bvh); }), countContacts(mass, mixed_view));
+		ObstacleSet copy = mixed_set;
+		row("mixed_build", timeCall(1, [&] { copy.build(); }), 0);
+	}
+	return 0;
+}
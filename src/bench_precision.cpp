@@ -0,0 +1,116 @@
+/*
+bench_precision.cpp: accuracy and throughput of the SoA storage precisions (Precision::FP64, MIXED, FP32)
+on the flexipod robot walking with a trotting gait (walking_trot.ipynb):
+	bench_precision [--reorder] [model_path] [runtime_s] [num_threads]
+Each precision runs runtime_s (default 10 s) of simulation from the same initial state with the same
+joint commands, the errors are measured against the Precision::FP64 run every update():
+	com error: distance between the body com positions [m]
+	joint drift: difference of the measured joint angles [rad]
+*/
+
+#include "sim_cpu.h"
+#include "flexipod.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+static double wrapAngle(double a) { // wrap to [-pi,pi)
+	return a - 2 * M_PI * floor((a + M_PI) / (2 * M_PI));
+}
+
+struct Variant {
+	const char* name;
+	Precision precision;
+	SimdIsa simd_isa; // only used by Precision::FP64
+};
+
+struct Trajectory {
+	std::vector<Vec3d> com_pos; // body com position of each update()
+	std::vector<double> joint_pos; // joint angles of each update(), num_joint per update()
+	double rate = 0; // spring updates per second
+};
+
+int main(int argc, char* argv[])
+{
+	bool reorder = false;
+	std::vector<const char*> args; // positional arguments
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--reorder") == 0) { reorder = true; }
+		else { args.push_back(argv[i]); }
+	}
+	const char* model_path = args.size() > 0 ? args[0] : "../src/data.msgpack";
+	double runtime = args.size() > 1 ? atof(args[1]) : 10; // simulation time [s]
+	int num_threads = args.size() > 2 ? atoi(args[2]) : 0; // 0: use the openmp default
+
+	MASS robot_mass; // one robot (host)
+	SPRING robot_spring;
+	JOINT robot_joint;
+	FlexipodIndex index = loadFlexipod(model_path, reorder, robot_mass, robot_spring, robot_joint); // msgpack or binary model
+
+	const double gait_frequency = 1.0; // [Hz]
+	const SimdIsa isa = detectSimdIsa();
+	std::vector<Variant> variants = { // the first variant is the reference
+		{"fp64", Precision::FP64, isa},
+		{"mixed", Precision::MIXED, SimdIsa::SCALAR},
+		{"fp32", Precision::FP32, SimdIsa::SCALAR},
+	};
+	if (isa != SimdIsa::SCALAR) { variants.push_back({ "fp64 scalar", Precision::FP64, SimdIsa::SCALAR }); }
+	std::vector<Trajectory> trajectories;
+	for (const Variant& variant : variants) {
+		CpuSimulation sim(robot_mass, robot_spring, robot_joint, 1);
+		sim.num_threads = num_threads;
+		sim.dt = 5e-5; // timestep
+		sim.id_restable_spring_start = index.id_restable_spring_start;
+		sim.id_resetable_spring_end = index.id_resetable_spring_end;
+		sim.id_oxyz_start = index.id_oxyz_start;
+		sim.id_oxyz_end = index.id_oxyz_end;
+		sim.setMaxJointSpeed(600. / 60. * 2 * M_PI);
+		sim.global_acc = Vec3d(0, 0, -9.8);
+		sim.createPlane(Vec3d(0, 0, 1), 0, 0.6, 0.6);
+		sim.data_layout = DataLayout::SOA;
+		sim.precision = variant.precision;
+		sim.simd_isa = variant.simd_isa;
+		sim.start();
+
+		Trajectory traj;
+		auto start = std::chrono::steady_clock::now();
+		while (sim.T < runtime) {
+			trotJointVel(sim.T, gait_frequency, sim.joint_vel_desired.data(), sim.joint.size());
+			sim.update();
+			traj.com_pos.push_back(sim.instance_state[0].com_pos);
+			traj.joint_pos.insert(traj.joint_pos.end(), sim.joint_pos.begin(), sim.joint_pos.end());
+		}
+		auto end = std::chrono::steady_clock::now();
+		double duration = std::chrono::duration<double>(end - start).count();// [seconds]
+		traj.rate = (double)sim.spring.num * NUM_QUEUED_KERNELS * traj.com_pos.size() / duration;
+		trajectories.push_back(traj);
+	}
+
+	const Trajectory& ref = trajectories[0];
+	const size_t num_joint = ref.joint_pos.size() / ref.com_pos.size();
+	printf("%.1f s trot, com travel: %.4f m\n", runtime, (ref.com_pos.back() - ref.com_pos.front()).norm());
+	printf("%-12s %16s %10s %14s %14s %16s %16s\n", "variant", "spring update/s", "speedup",
+		"max com err[m]", "end com err[m]", "max joint err[rad]", "end joint err[rad]");
+	for (size_t p = 0; p < trajectories.size(); p++) {
+		const Trajectory& traj = trajectories[p];
+		double max_com = 0, max_joint = 0, end_joint = 0;
+		for (size_t i = 0; i < ref.com_pos.size(); i++) {
+			max_com = std::max(max_com, (traj.com_pos[i] - ref.com_pos[i]).norm());
+		}
+		for (size_t i = 0; i < ref.joint_pos.size(); i++) {
+			double err = fabs(wrapAngle(traj.joint_pos[i] - ref.joint_pos[i]));
+			max_joint = std::max(max_joint, err);
+			if (i >= ref.joint_pos.size() - num_joint) { end_joint = std::max(end_joint, err); }
+		}
+		double end_com = (traj.com_pos.back() - ref.com_pos.back()).norm();
+		printf("%-12s %16.3e %10.2f %14.3e %14.3e %16.3e %16.3e\n", variants[p].name,
+			traj.rate, traj.rate / ref.rate, max_com, end_com, max_joint, end_joint);
+	}
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+bench_shm.cpp: round-trip latency between the simulation and a python controller on the same host,
+shared memory (ShmServer, shm_server.h) vs loopback udp (PosixUdpServer, network_posix.h):
+	bench_shm shm [num_round]	then: python3 src/shm_client.py echo shm
+	bench_shm udp [num_round]	then: python3 src/shm_client.py echo udp
+Each round publishes a state report with T=round and waits for the command carrying the same T,
+like one control tick of a controller answering every state report.
+*/
+
+#include "shm_server.h"
+#include "network_posix.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+template<class Server>
+static int runRounds(Server& server, int num_round) {
+	LatencyHistogram round_trip; // publishState() to waitCommand() returning the matching command
+	UdpDataSend msg_send;
+	UdpDataReceive msg_rec;
+	int num_lost = 0;
+	printf("waiting for the controller...\n");
+	auto start = std::chrono::steady_clock::now();
+	for (int r = -1; r < num_round; r++) { // round -1: wait for the controller to attach
+		msg_send.T = r;
+		const auto publish_time = std::chrono::steady_clock::now();
+		server.publishState(msg_send);
+		const auto timeout = r < 0 ? std::chrono::milliseconds(100) : std::chrono::milliseconds(1000);
+		bool received = false;
+		for (int k = 0; k < (r < 0 ? 600 : 1) && !received; k++) { // up to 60 s for the first command
+			if (r < 0 && k > 0) { server.publishState(msg_send); } // the udp state may have been sent before the controller bound its port
+			while (server.waitCommand(msg_rec, timeout)) {
+				if (msg_rec.T == r) { received = true; break; } // skip stale replies
+			}
+		}
+		if (r < 0) {
+			if (!received) { printf("no controller\n"); return 1; }
+			start = std::chrono::steady_clock::now();
+			continue;
+		}
+		if (received) { round_trip.recordSince(publish_time); }
+		else { num_lost++; }
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%d rounds in %.3f s, %.0f round trips/s, %d lost\n", num_round, elapsed, num_round / elapsed, num_lost);
+	round_trip.print("round trip");
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	const bool use_udp = argc > 1 && strcmp(argv[1], "udp") == 0;
+	const int num_round = argc > 2 ? atoi(argv[2]) : 20000;
+	int result;
+	if (use_udp) {
+		PosixUdpServer server; // ports 32001 (local) and 32000 (controller)
+		server.run();
+		result = runRounds(server, num_round);
+		server.close();
+	}
+	else {
+		ShmServer server;
+		server.run();
+		result = runRounds(server, num_round);
+		server.close();
+	}
+	return result;
+}
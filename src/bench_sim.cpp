@@ -0,0 +1,312 @@
+/*
+bench_sim.cpp: benchmark suite of the cpu simulation core (sim_cpu.h), one row per pass, model size and
+thread count, printed as a table, csv or json for tracking regressions:
+	bench_sim [--csv|--json] [--out path] [--threads 1,2,4] [--instances 1,4] [--synthetic 1000,10000] [--repeat 100] [model_path|-]
+	--out: write the results to path instead of stdout (which also gets the model and start() messages)
+	--threads: openmp thread counts, default: 1 and the openmp default
+	--instances: packed copies of the model (InstanceLayout), the model size sweep
+	--synthetic: mass counts of the synthetic robots (model_gen.h, jittered lattice, 4 legs), the mass count sweep
+	--repeat: calls per timing, the reported time is the median of NUM_TRIAL timings
+	model_path: msgpack or binary model (default ../src/data.msgpack), "-": only the synthetic models
+Passes (items: what items/s counts):
+	spring_scatter, spring_gather: spring forces with atomics / into the incidence buffer (springs)
+	mass_update, mass_update_contact: euler integration without / with the contact pass of the surface masses
+		against the ground plane (masses), the difference is the contact evaluation
+	mass_update_contact_all: as mass_update_contact with all masses in the contact pass, the cost without the
+		compacted surface masses (masses)
+	mass_update_terrain: as mass_update_contact with a flat 4 x 4 m heightfield (terrain.h) at 2 cm instead of
+		the plane, the same contacts, the difference is the cell lookup (masses)
+	mass_gather_contact: sum of the incident spring forces, contact and integration (masses)
+	joint_rotation: rotate the joint points (joint points)
+	readback: copy pos/vel/acc to host buffers and measure the joints and body state (masses)
+	snapshot_save, snapshot_restore, snapshot_restore_one: snapshot slots of all / one instance (masses)
+	update_scatter, update_gather: CpuSimulation::update(), NUM_QUEUED_KERNELS steps (spring steps)
+	collision_build: self collision broad phase, spatial hash and neighbor lists of the rest state (surface masses)
+	collision_contact: self collision forces from the neighbor lists (surface masses)
+	model_load: load and build the model from model_path (masses)
+*/
+
+#include "sim_cpu.h"
+#include "flexipod.h"
+#include "model_gen.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+constexpr int NUM_TRIAL = 5; // timings per row, the median is reported
+
+struct Row {
+	std::string model;
+	int num_instance;
+	int num_mass; // all instances
+	int num_spring; // all instances
+	int num_threads;
+	std::string pass;
+	double ns_per_call;
+	double items_per_s;
+};
+
+/* robot of a benchmark run, one instance (host) */
+struct Robot {
+	std::string name;
+	MASS mass;
+	SPRING spring;
+	JOINT joint;
+	FlexipodIndex index;
+};
+
+/* median wall time [ns] of one call of fn, over NUM_TRIAL timings of repeat calls */
+template<class Fn>
+static double timeCall(int repeat, Fn fn) {
+	fn(); // warm up
+	std::vector<double> trial(NUM_TRIAL);
+	for (double& t : trial) {
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeat; r++) { fn(); }
+		t = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / repeat;
+	}
+	std::sort(trial.begin(), trial.end());
+	return trial[NUM_TRIAL / 2];
+}
+
+/* same as above for a pass with orphaned "omp for", each timing runs in one parallel region */
+template<class Fn>
+static double timePass(int repeat, int num_threads, Fn fn) {
+	return timeCall(1, [&] {
+#pragma omp parallel num_threads(num_threads)
+		for (int r = 0; r < repeat; r++) { fn(); }
+	}) / repeat;
+}
+
+/* synthetic robot: the procedural 4-legged flexipod (model_gen.h) with about num_mass masses */
+static Robot generateRobot(int num_mass) {
+	GeneratorOptions options;
+	options.num_mass = num_mass;
+	Model bot = generateModel(options);
+	Robot robot;
+	robot.name = generatedModelName(options);
+	robot.mass.init(bot.vertices.size(), true);
+	robot.spring.init(bot.edges.size(), true);
+	robot.index = buildFlexipod(bot, robot.mass, robot.spring);
+	robot.joint.init(bot.Joints, true);
+	return robot;
+}
+
+static Robot loadRobot(const char* model_path, double& load_ns) {
+	Robot robot;
+	robot.name = model_path;
+	auto start = std::chrono::steady_clock::now();
+	robot.index = loadFlexipod(model_path, false, robot.mass, robot.spring, robot.joint);
+	load_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return robot;
+}
+
+static void benchRobot(const Robot& robot, int num_instance, int num_threads, int repeat, std::vector<Row>& rows) {
+	CpuSimulation sim(robot.mass, robot.spring, robot.joint, num_instance);
+	sim.num_threads = num_threads;
+	sim.dt = 5e-5;
+	sim.force_assembly = ForceAssembly::GATHER; // builds the incidence for spring_gather
+	sim.num_snapshot_slot = 2;
+	sim.id_restable_spring_start = robot.index.id_restable_spring_start;
+	sim.id_resetable_spring_end = robot.index.id_resetable_spring_end;
+	sim.id_oxyz_start = robot.index.id_oxyz_start;
+	sim.id_oxyz_end = robot.index.id_oxyz_end;
+	sim.setMaxJointSpeed(600. / 60. * 2 * M_PI);
+	sim.global_acc = Vec3d(0, 0, -9.8);
+	sim.createPlane(Vec3d(0, 0, 1), 0, 0.6, 0.6); // used by update(), the passes get their constraints below
+	sim.start();
+	for (int i = 0; i < sim.joint.size(); i++) { sim.joint_vel_desired[i] = i % 2 ? 10. : -10.; } // walking-like joint motion
+	sim.update(); // settle the joint control
+
+	std::vector<CudaContactPlane> planes(1); // same as createPlane(Vec3d(0, 0, 1), 0, 0.6, 0.6)
+	planes[0]._normal = Vec3d(0, 0, 1);
+	planes[0]._offset = 0;
+	planes[0]._FRICTION_K = 0.6;
+	planes[0]._FRICTION_S = 0.6;
+	CUDA_GLOBAL_CONSTRAINTS contact = { planes.data(), nullptr, planes.size(), 0 };
+	Heightfield ground(201, 201, 0.02); // flat at z=0 as planes[0]
+	ground.setFriction(0.6, 0.6);
+	const CudaHeightfield ground_view = ground.view();
+	CUDA_GLOBAL_CONSTRAINTS terrain = { nullptr, nullptr, 0, 0, &ground_view };
+
+	const MASS& mass = sim.mass;
+	const SPRING& spring = sim.spring;
+	const int num_mass = mass.num;
+	const int num_spring = spring.num;
+	const int n_threads = num_threads > 0 ? num_threads :
+#ifdef _OPENMP
+		omp_get_max_threads();
+#else
+		1;
+#endif
+	auto add = [&](const char* pass, double ns, double items) {
+		rows.push_back({ robot.name, num_instance, num_mass, num_spring, n_threads, pass, ns, items / ns * 1e9 });
+	};
+	sim.saveSnapshot(1); // each pass starts from here, the passes alone do not keep the state physical
+
+	add("spring_scatter", timePass(repeat, n_threads, [&] { SpringUpdateCpu(mass, spring); }), num_spring);
+	add("spring_gather", timePass(repeat, n_threads, [&] { SpringForceCpu(mass, spring, sim.incidence); }), num_spring);
+	sim.restoreSnapshot(1);
+	add("mass_update", timePass(repeat, n_threads, [&] { MassUpdateCpu(mass, sim.global_acc, sim.dt); }), num_mass);
+	sim.restoreSnapshot(1);
+	add("mass_update_contact", timePass(repeat, n_threads, [&] {
+		ContactForceCpu(mass, sim.surface, contact);
+		MassUpdateCpu(mass, sim.global_acc, sim.dt);
+	}), num_mass);
+	sim.restoreSnapshot(1);
+	SurfaceIndex all_masses;
+	for (int i = 0; i < num_mass; i++) { all_masses.id.push_back(i); }
+	add("mass_update_contact_all", timePass(repeat, n_threads, [&] {
+		ContactForceCpu(mass, all_masses, contact);
+		MassUpdateCpu(mass, sim.global_acc, sim.dt);
+	}), num_mass);
+	sim.restoreSnapshot(1);
+	add("mass_update_terrain", timePass(repeat, n_threads, [&] {
+		ContactForceCpu(mass, sim.surface, terrain);
+		MassUpdateCpu(mass, sim.global_acc, sim.dt);
+	}), num_mass);
+	sim.restoreSnapshot(1);
+	add("mass_gather_contact", timePass(repeat, n_threads,
+		[&] {
+			GatherForceCpu(mass, sim.incidence);
+			ContactForceCpu(mass, sim.surface, contact);
+			MassUpdateCpu(mass, sim.global_acc, sim.dt);
+		}), num_mass);
+	sim.restoreSnapshot(1);
+	add("joint_rotation", timePass(repeat, n_threads, [&] { rotateJointCpu(mass, sim.joint); }), sim.joint.points.num);
+	sim.restoreSnapshot(1);
+
+	std::vector<Vec3d> pos(num_mass), vel(num_mass), acc(num_mass); // host copies, as CopyPosVelAccFrom
+	add("readback", timeCall(repeat, [&] {
+		std::copy(mass.pos, mass.pos + num_mass, pos.begin());
+		std::copy(mass.vel, mass.vel + num_mass, vel.begin());
+		std::copy(mass.acc, mass.acc + num_mass, acc.begin());
+		measureJoints(mass, sim.joint, sim.joint_pos.data(), sim.joint_vel.data(), NUM_QUEUED_KERNELS * sim.dt);
+		for (int k = 0; k < num_instance; k++) {
+			const int offset = sim.layout.jointOffset(k);
+			sim.instance_state[k] = measureModelState(mass, sim.id_oxyz_start + sim.layout.massOffset(k), sim.layout.num_joint,
+				sim.joint_pos.data() + offset, sim.joint_vel.data() + offset, sim.joint_vel_cmd.data() + offset);
+		}
+	}), num_mass);
+	sim.restoreSnapshot(1);
+
+	add("snapshot_save", timeCall(repeat, [&] { sim.saveSnapshot(1); }), num_mass);
+	add("snapshot_restore", timeCall(repeat, [&] { sim.restoreSnapshot(1); }), num_mass);
+	add("snapshot_restore_one", timeCall(repeat, [&] { sim.restoreSnapshot(1, num_instance - 1); }), num_mass / num_instance);
+
+	const int num_update = std::max(repeat / NUM_QUEUED_KERNELS, 1);
+	sim.force_assembly = ForceAssembly::SCATTER;
+	add("update_scatter", timeCall(num_update, [&] { sim.update(); }), (double)num_spring * NUM_QUEUED_KERNELS);
+	sim.restoreSnapshot(1);
+	sim.force_assembly = ForceAssembly::GATHER;
+	add("update_gather", timeCall(num_update, [&] { sim.update(); }), (double)num_spring * NUM_QUEUED_KERNELS);
+	sim.restoreSnapshot(0); // the start state, the large synthetic robots diverge at this dt
+
+	SelfCollision collision; // the instances overlap, each collides with itself
+	collision.init(mass, spring, sim.layout, n_threads);
+	add("collision_build", timePass(repeat, n_threads, [&] { collision.build(mass); }), collision.numSurface());
+	add("collision_contact", timePass(repeat, n_threads, [&] { collision.applyForce(mass); }), collision.numSurface());
+	sim.restoreSnapshot(1);
+}
+
+/* s as a json string literal */
+static std::string jsonString(const std::string& s) {
+	std::string quoted = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\') { quoted += '\\'; }
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+/* comma separated integers, e.g. "1,2,4" */
+static std::vector<int> parseList(const char* s) {
+	std::vector<int> list;
+	for (const char* p = s; *p != '\0';) {
+		char* end;
+		const long v = strtol(p, &end, 10);
+		if (end == p) { break; }
+		list.push_back((int)v);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return list;
+}
+
+int main(int argc, char* argv[])
+{
+	enum class Format { TABLE, CSV, JSON } format = Format::TABLE;
+	std::vector<int> threads = { 1 };
+#ifdef _OPENMP
+	if (omp_get_max_threads() > 1) { threads.push_back(omp_get_max_threads()); }
+#endif
+	std::vector<int> instances = { 1, 4 };
+	std::vector<int> synthetic = { 1000, 10000 };
+	int repeat = 100;
+	const char* model_path = "../src/data.msgpack";
+	const char* out_path = nullptr;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--csv") == 0) { format = Format::CSV; }
+		else if (strcmp(argv[i], "--json") == 0) { format = Format::JSON; }
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) { threads = parseList(argv[++i]); }
+		else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) { instances = parseList(argv[++i]); }
+		else if (strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc) { synthetic = parseList(argv[++i]); }
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) { out_path = argv[++i]; }
+		else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) { repeat = std::max(atoi(argv[++i]), 1); }
+		else { model_path = argv[i]; }
+	}
+
+	std::vector<Row> rows;
+	if (strcmp(model_path, "-") != 0) {
+		double load_ns;
+		Robot robot = loadRobot(model_path, load_ns);
+		rows.push_back({ robot.name, 1, robot.mass.num, robot.spring.num, 1, "model_load", load_ns, robot.mass.num / load_ns * 1e9 });
+		for (int num_instance : instances) {
+			for (int num_threads : threads) { benchRobot(robot, std::max(num_instance, 1), num_threads, repeat, rows); }
+		}
+	}
+	for (int num_mass : synthetic) {
+		Robot robot = generateRobot(num_mass);
+		for (int num_threads : threads) { benchRobot(robot, 1, num_threads, repeat, rows); }
+	}
+
+	FILE* out = out_path != nullptr ? fopen(out_path, "w") : stdout;
+	if (out == nullptr) { perror(out_path); return 1; }
+	if (format == Format::CSV) {
+		fprintf(out, "model,num_instance,num_mass,num_spring,num_threads,pass,ns_per_call,items_per_s\n");
+		for (const Row& r : rows) {
+			fprintf(out, "%s,%d,%d,%d,%d,%s,%.1f,%.4e\n", r.model.c_str(), r.num_instance, r.num_mass, r.num_spring,
+				r.num_threads, r.pass.c_str(), r.ns_per_call, r.items_per_s);
+		}
+	}
+	else if (format == Format::JSON) {
+		fprintf(out, "[\n");
+		for (size_t i = 0; i < rows.size(); i++) {
+			const Row& r = rows[i];
+			fprintf(out, "  {\"model\": %s, \"num_instance\": %d, \"num_mass\": %d, \"num_spring\": %d, \"num_threads\": %d, "
+				"\"pass\": \"%s\", \"ns_per_call\": %.1f, \"items_per_s\": %.4e}%s\n", jsonString(r.model).c_str(), r.num_instance,
+				r.num_mass, r.num_spring, r.num_threads, r.pass.c_str(), r.ns_per_call, r.items_per_s, i + 1 < rows.size() ? "," : "");
+		}
+		fprintf(out, "]\n");
+	}
+	else {
+		fprintf(out, "%-24s %4s %8s %8s %4s %-22s %14s %12s\n", "model", "inst", "masses", "springs", "thr", "pass", "ns/call", "items/s");
+		for (const Row& r : rows) {
+			fprintf(out, "%-24s %4d %8d %8d %4d %-22s %14.1f %12.3e\n", r.model.c_str(), r.num_instance, r.num_mass, r.num_spring,
+				r.num_threads, r.pass.c_str(), r.ns_per_call, r.items_per_s);
+		}
+	}
+	if (out != stdout) { fclose(out); }
+	return 0;
+}
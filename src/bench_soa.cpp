@@ -0,0 +1,92 @@
+/*
+bench_soa.cpp: microbenchmark of the cpu dynamics update, AoS (MASS/SPRING) vs SoA (MASS_SOA/SPRING_SOA)
+storage with the scalar and the vectorized (AVX2/AVX-512) kernels, on the flexipod robot:
+	bench_soa [--reorder] [model_path] [num_update] [num_threads]
+Each variant runs num_update updates (NUM_QUEUED_KERNELS dynamics updates each) from the same initial state,
+the position error is the max deviation from the AoS scatter variant (the original update)
+*/
+
+#include "sim_cpu.h"
+#include "flexipod.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+struct Variant {
+	const char* name;
+	DataLayout data_layout;
+	ForceAssembly force_assembly;
+	SimdIsa simd_isa;
+};
+
+int main(int argc, char* argv[])
+{
+	bool reorder = false;
+	std::vector<const char*> args; // positional arguments
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--reorder") == 0) { reorder = true; }
+		else { args.push_back(argv[i]); }
+	}
+	const char* model_path = args.size() > 0 ? args[0] : "../src/data.msgpack";
+	int num_update = args.size() > 1 ? atoi(args[1]) : 100; // number of updates per variant
+	int num_threads = args.size() > 2 ? atoi(args[2]) : 0; // 0: use the openmp default
+
+	MASS robot_mass; // one robot (host)
+	SPRING robot_spring;
+	JOINT robot_joint;
+	FlexipodIndex index = loadFlexipod(model_path, reorder, robot_mass, robot_spring, robot_joint); // msgpack or binary model
+
+	std::vector<Variant> variants = {
+		{"aos scatter", DataLayout::AOS, ForceAssembly::SCATTER, SimdIsa::SCALAR},
+		{"aos gather", DataLayout::AOS, ForceAssembly::GATHER, SimdIsa::SCALAR},
+		{"soa scalar", DataLayout::SOA, ForceAssembly::GATHER, SimdIsa::SCALAR},
+	};
+	const SimdIsa isa = detectSimdIsa();
+	if (isa >= SimdIsa::AVX2) { variants.push_back({ "soa avx2", DataLayout::SOA, ForceAssembly::GATHER, SimdIsa::AVX2 }); }
+	if (isa >= SimdIsa::AVX512) { variants.push_back({ "soa avx512", DataLayout::SOA, ForceAssembly::GATHER, SimdIsa::AVX512 }); }
+
+	std::vector<Vec3d> pos_ref; // final positions of "aos scatter"
+	std::vector<double> rate(variants.size());
+	std::vector<double> error(variants.size());
+	for (size_t v = 0; v < variants.size(); v++) {
+		CpuSimulation sim(robot_mass, robot_spring, robot_joint, 1);
+		sim.num_threads = num_threads;
+		sim.dt = 5e-5; // timestep
+		sim.id_oxyz_start = index.id_oxyz_start;
+		sim.id_oxyz_end = index.id_oxyz_end;
+		sim.setMaxJointSpeed(600. / 60. * 2 * M_PI);
+		sim.global_acc = Vec3d(0, 0, -9.8);
+		sim.createPlane(Vec3d(0, 0, 1), 0, 0.6, 0.6);
+		sim.data_layout = variants[v].data_layout;
+		sim.force_assembly = variants[v].force_assembly;
+		sim.simd_isa = variants[v].simd_isa;
+		sim.start();
+		for (int i = 0; i < sim.joint.size(); i++) { sim.joint_vel_desired[i] = i % 2 ? 10. : -10.; } // walking-like joint motion
+
+		sim.update(); // warm up
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 1; i < num_update; i++) { sim.update(); }
+		auto end = std::chrono::steady_clock::now();
+		double duration = std::chrono::duration<double>(end - start).count();// [seconds]
+		rate[v] = (double)sim.spring.num * NUM_QUEUED_KERNELS * (num_update - 1) / duration;
+
+		if (v == 0) { pos_ref.assign(sim.mass.pos, sim.mass.pos + sim.mass.num); }
+		else {
+			for (int i = 0; i < sim.mass.num; i++) {
+				error[v] = std::max(error[v], (sim.mass.pos[i] - pos_ref[i]).norm());
+			}
+		}
+	}
+
+	printf("%-12s %16s %10s %16s\n", "variant", "spring update/s", "speedup", "max pos error[m]");
+	for (size_t v = 0; v < variants.size(); v++) {
+		printf("%-12s %16.3e %10.2f %16.3e\n", variants[v].name, rate[v], rate[v] / rate[0], error[v]);
+	}
+	return 0;
+}
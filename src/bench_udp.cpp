@@ -0,0 +1,159 @@
+/*
+bench_udp.cpp: loopback benchmark of the linux udp transport (PosixUdpServer, network_posix.h):
+	bench_udp [num_robot] [num_round] [port_local] [port_remote]
+An echo controller thread listens on port_remote+i for robot i (one epoll over all its sockets) and
+answers every state report with a MOTOR_SPEED_COMMEND carrying the same T. Each round the physics
+side publishes the state of all robots at once and waits for all the commands, so one round is
+one sendmmsg batch out and one recvmmsg batch back in the best case.
+Reports the packets/s (state reports + commands) and the round-trip latency from publishState()
+to the command popped by waitCommand().
+*/
+
+#include "network_posix.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/* echo controller: one socket per robot, replies to each state report with a command */
+class EchoController {
+public:
+	std::atomic<bool> flag_should_close{ false };
+	std::atomic<uint64_t> num_echoed{ 0 };
+
+	EchoController(int port_remote, int num_robot) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) { throw std::runtime_error("EchoController: epoll_create1"); }
+		sock.resize(num_robot);
+		for (int i = 0; i < num_robot; i++) {
+			sock[i] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			sockaddr_in add;
+			memset(&add, 0, sizeof(add));
+			add.sin_family = AF_INET;
+			add.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			add.sin_port = htons(port_remote + i);
+			if (sock[i] < 0 || bind(sock[i], (const sockaddr*)&add, sizeof(add)) < 0) {
+				throw std::runtime_error("EchoController: cannot bind port " + std::to_string(port_remote + i));
+			}
+			epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.u32 = i;
+			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock[i], &ev);
+		}
+		thread = std::thread(&EchoController::run, this);
+	}
+	~EchoController() {
+		flag_should_close = true;
+		thread.join();
+		for (int s : sock) { close(s); }
+		close(epoll_fd);
+	}
+
+private:
+	static constexpr int BATCH_SIZE = 16;
+	int epoll_fd;
+	std::vector<int> sock;
+	std::thread thread;
+
+	void run() {
+		std::vector<epoll_event> events(sock.size());
+		char buffer[BATCH_SIZE][PosixUdpServer::MAX_PACKET_SIZE];
+		sockaddr_in sources[BATCH_SIZE];
+		mmsghdr msgs[BATCH_SIZE];
+		iovec iovs[BATCH_SIZE];
+		char replies[BATCH_SIZE][UDP_PACKED_MAX_SIZE];
+		mmsghdr reply_msgs[BATCH_SIZE];
+		iovec reply_iovs[BATCH_SIZE];
+		UdpDataSend state;
+		UdpDataReceive command;
+		command.header = UDP_HEADER::MOTOR_SPEED_COMMEND;
+		while (!flag_should_close) {
+			const int n = epoll_wait(epoll_fd, events.data(), (int)events.size(), 10);
+			for (int i = 0; i < n; i++) {
+				const int s = sock[events[i].data.u32];
+				for (int k = 0; k < BATCH_SIZE; k++) {
+					iovs[k].iov_base = buffer[k];
+					iovs[k].iov_len = sizeof(buffer[k]);
+					memset(&msgs[k], 0, sizeof(mmsghdr));
+					msgs[k].msg_hdr.msg_name = &sources[k];
+					msgs[k].msg_hdr.msg_namelen = sizeof(sources[k]);
+					msgs[k].msg_hdr.msg_iov = &iovs[k];
+					msgs[k].msg_hdr.msg_iovlen = 1;
+				}
+				const int num_msg = recvmmsg(s, msgs, BATCH_SIZE, MSG_DONTWAIT, nullptr);
+				if (num_msg <= 0) { continue; }
+				for (int k = 0; k < num_msg; k++) {
+					unpackUdpData(buffer[k], msgs[k].msg_len, state);
+					command.T = state.T;
+					for (int j = 0; j < 4; j++) { command.jointSpeed[j] = state.jointSpeed[j]; }
+					reply_iovs[k].iov_base = replies[k];
+					reply_iovs[k].iov_len = packUdpData(command, replies[k]);
+					memset(&reply_msgs[k], 0, sizeof(mmsghdr));
+					reply_msgs[k].msg_hdr.msg_name = &sources[k];
+					reply_msgs[k].msg_hdr.msg_namelen = msgs[k].msg_hdr.msg_namelen;
+					reply_msgs[k].msg_hdr.msg_iov = &reply_iovs[k];
+					reply_msgs[k].msg_hdr.msg_iovlen = 1;
+				}
+				const int num_sent = sendmmsg(s, reply_msgs, num_msg, 0);
+				if (num_sent > 0) { num_echoed += num_sent; }
+			}
+		}
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	const int num_robot = argc > 1 ? atoi(argv[1]) : 16;
+	const int num_round = argc > 2 ? atoi(argv[2]) : 20000;
+	const int port_local = argc > 3 ? atoi(argv[3]) : 33001;
+	const int port_remote = argc > 4 ? atoi(argv[4]) : 33100;
+	printf("bench_udp: %d robots, %d rounds, local port %d, controller ports %d-%d\n",
+		num_robot, num_round, port_local, port_remote, port_remote + num_robot - 1);
+
+	EchoController controller(port_remote, num_robot);
+	PosixUdpServer server(port_local, port_remote, "127.0.0.1", num_robot);
+	server.run();
+
+	LatencyHistogram round_trip; // publishState() to waitCommand() returning the matching command
+	UdpDataSend msg_send;
+	UdpDataReceive msg_rec;
+	std::vector<std::chrono::steady_clock::time_point> publish_time(num_robot);
+	int num_lost = 0; // rounds where a command did not come back within the timeout
+	const auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < num_round; r++) {
+		msg_send.T = r;
+		for (int i = 0; i < num_robot; i++) {
+			msg_send.jointSpeed[0] = i;
+			publish_time[i] = std::chrono::steady_clock::now();
+			server.publishState(msg_send, i);
+		}
+		for (int i = 0; i < num_robot; i++) {
+			bool received = false;
+			while (server.waitCommand(msg_rec, std::chrono::milliseconds(100), i)) {
+				if (msg_rec.T == r && msg_rec.jointSpeed[0] == i) { received = true; break; } // skip stale replies
+			}
+			if (received) { round_trip.recordSince(publish_time[i]); }
+			else { num_lost++; }
+		}
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const uint64_t num_sent = server.num_sent, num_received = server.num_received;
+	server.close();
+
+	printf("%.3f s, %.0f round trips/s, %.0f packets/s (%llu state reports + %llu commands), %d lost\n",
+		elapsed, round_trip.size() / elapsed, (num_sent + num_received) / elapsed,
+		(unsigned long long)num_sent, (unsigned long long)num_received, num_lost);
+	round_trip.print("round trip");
+	return 0;
+}
@@ -0,0 +1,186 @@
+/*
+channel.h: lock-free hand-off between the physics thread and the udp threads (network.h)
+	Seqlock<T>: latest value of T (e.g. the robot state report), one writer, readers never block the writer
+	SpscRing<T,N>: single-producer/single-consumer queue of T (e.g. the commands), no message is overwritten
+	Notifier: blocking wait for a Seqlock/SpscRing consumer, the producer only locks when a consumer sleeps
+	LatencyHistogram: log2 histogram of latencies in nanoseconds, written by one thread, read by any
+Header only, C++14 (also included by the cuda sources).
+*/
+
+#ifndef TITAN_CHANNEL_H
+#define TITAN_CHANNEL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+
+/* single writer sequence lock holding the latest value of a trivially copyable T,
+   the value is stored as relaxed atomic words, so a torn read is detected and retried (no data race) */
+template<class T>
+class Seqlock {
+	static_assert(std::is_trivially_copyable<T>::value, "Seqlock requires a trivially copyable type");
+	static constexpr size_t NUM_WORD = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+public:
+	Seqlock() {
+		for (size_t i = 0; i < NUM_WORD; i++) { word[i].store(0, std::memory_order_relaxed); }
+	}
+
+	/* publish value (writer thread only) */
+	void store(const T& value) {
+		uint64_t buffer[NUM_WORD] = {};
+		memcpy(buffer, &value, sizeof(T));
+		const uint64_t s = seq.load(std::memory_order_relaxed);
+		seq.store(s + 1, std::memory_order_relaxed); // odd: write in progress
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < NUM_WORD; i++) { word[i].store(buffer[i], std::memory_order_relaxed); }
+		seq.store(s + 2, std::memory_order_release);
+	}
+
+	/* copy the latest value to value, returns its version (number of store() calls, 0: never stored) */
+	uint64_t load(T& value) const {
+		uint64_t buffer[NUM_WORD];
+		for (;;) {
+			const uint64_t s0 = seq.load(std::memory_order_acquire);
+			if (s0 & 1) { continue; } // the writer is in the middle of store()
+			for (size_t i = 0; i < NUM_WORD; i++) { buffer[i] = word[i].load(std::memory_order_relaxed); }
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq.load(std::memory_order_relaxed) == s0) {
+				memcpy(&value, buffer, sizeof(T));
+				return s0 / 2;
+			}
+		}
+	}
+
+	/* version of the latest value, compare with the one returned by load() to detect a new value */
+	inline uint64_t version() const { return seq.load(std::memory_order_acquire) / 2; }
+
+private:
+	std::atomic<uint64_t> seq{ 0 }; // 2*version, odd while a store() is in progress
+	std::atomic<uint64_t> word[NUM_WORD];
+};
+
+/* bounded single-producer/single-consumer ring buffer, N must be a power of 2,
+   push() fails when full instead of overwriting (e.g. a RESET command is never lost) */
+template<class T, size_t N>
+class SpscRing {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing size must be a power of 2");
+public:
+	/* producer thread only, returns false if the ring is full */
+	bool push(const T& value) {
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == N) { return false; }
+		buffer[h & (N - 1)] = value;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+	/* consumer thread only, returns false if the ring is empty */
+	bool pop(T& value) {
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) { return false; }
+		value = buffer[t & (N - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	inline bool empty() const { return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire); }
+
+private:
+	alignas(64) std::atomic<size_t> head{ 0 }; // next slot to write, owned by the producer
+	alignas(64) std::atomic<size_t> tail{ 0 }; // next slot to read, owned by the consumer
+	alignas(64) T buffer[N]; // own cache line: the producer writes it while the consumer polls tail
+};
+
+/* blocking wait for a lock-free channel: the consumer sleeps on a condition variable until
+   the producer calls notify() after publishing, notify() only takes the mutex if a consumer is waiting */
+class Notifier {
+public:
+	/* call after publishing (push/store) */
+	void notify() {
+		std::atomic_thread_fence(std::memory_order_seq_cst); // order the publish before reading num_waiting
+		if (num_waiting.load(std::memory_order_relaxed) > 0) {
+			std::lock_guard<std::mutex> lck(mutex);
+			cv.notify_all();
+		}
+	}
+
+	/* wait until ready() or timeout, returns ready() */
+	template<class Predicate, class Rep, class Period>
+	bool waitFor(Predicate ready, const std::chrono::duration<Rep, Period>& timeout) {
+		if (ready()) { return true; }
+		std::unique_lock<std::mutex> lck(mutex);
+		num_waiting.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst); // order num_waiting before checking ready()
+		bool result = cv.wait_for(lck, timeout, ready);
+		num_waiting.fetch_sub(1, std::memory_order_relaxed);
+		return result;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::atomic<int> num_waiting{ 0 };
+};
+
+/* log2 histogram of latencies [ns], bucket k counts [2^k, 2^(k+1)) ns,
+   record() from one thread, the statistics can be read from any thread */
+class LatencyHistogram {
+public:
+	static constexpr int NUM_BUCKET = 40; // up to ~18 minutes
+
+	LatencyHistogram() { clear(); }
+
+	void record(int64_t ns) {
+		if (ns < 0) { ns = 0; }
+		int k = 0;
+		while (k < NUM_BUCKET - 1 && (ns >> (k + 1)) > 0) { k++; }
+		bucket[k].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+		sum_ns.fetch_add(ns, std::memory_order_relaxed);
+		if (ns > max_ns.load(std::memory_order_relaxed)) { max_ns.store(ns, std::memory_order_relaxed); }
+	}
+	/* record the time elapsed since start */
+	inline void recordSince(const std::chrono::steady_clock::time_point& start) {
+		record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	inline uint64_t size() const { return count.load(std::memory_order_relaxed); }
+	inline double mean() const { uint64_t n = size(); return n > 0 ? (double)sum_ns.load(std::memory_order_relaxed) / n : 0.; }
+	inline int64_t maximum() const { return max_ns.load(std::memory_order_relaxed); }
+
+	/* upper bound [ns] of the bucket holding the p-th quantile (0<=p<=1) */
+	int64_t percentile(double p) const {
+		const uint64_t n = size();
+		if (n == 0) { return 0; }
+		uint64_t target = (uint64_t)(p * n), cumulative = 0;
+		for (int k = 0; k < NUM_BUCKET; k++) {
+			cumulative += bucket[k].load(std::memory_order_relaxed);
+			if (cumulative > target) { return (int64_t)2 << k; }
+		}
+		return maximum();
+	}
+
+	/* print count, mean, p50, p99 and max in microseconds */
+	void print(const char* name) const {
+		printf("%s: %llu samples, mean %.1f us, p50 <%.1f us, p99 <%.1f us, max %.1f us\n", name,
+			(unsigned long long)size(), mean() * 1e-3, percentile(0.5) * 1e-3, percentile(0.99) * 1e-3, maximum() * 1e-3);
+	}
+
+	void clear() {
+		for (int k = 0; k < NUM_BUCKET; k++) { bucket[k].store(0, std::memory_order_relaxed); }
+		count.store(0, std::memory_order_relaxed);
+		sum_ns.store(0, std::memory_order_relaxed);
+		max_ns.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> bucket[NUM_BUCKET];
+	std::atomic<uint64_t> count;
+	std::atomic<int64_t> sum_ns;
+	std::atomic<int64_t> max_ns;
+};
+
+#endif // TITAN_CHANNEL_H
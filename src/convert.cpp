@@ -0,0 +1,47 @@
+/*
+convert.cpp: convert a msgpack robot model (model.h) to the binary model format (model_file.h)
+	flexipod_convert [--reorder] input.msgpack output.model
+	--reorder: reorder the masses and springs for memory locality (Model::reorder) before writing,
+	           the converted file is then loaded without reordering at every start
+*/
+
+#include "model_file.h"
+#include "flexipod.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+	bool reorder = false;
+	std::vector<const char*> args; // positional arguments
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--reorder") == 0) { reorder = true; }
+		else { args.push_back(argv[i]); }
+	}
+	if (args.size() != 2) {
+		fprintf(stderr, "usage: flexipod_convert [--reorder] input.msgpack output.model\n");
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	Model bot(args[0]); //defined in model.h
+	if (reorder) { bot.reorder(numBody(bot)); } // reorder the body and the legs
+	auto loaded = std::chrono::steady_clock::now();
+	if (!writeModelFile(bot, args[1])) {
+		fprintf(stderr, "flexipod_convert: cannot write %s\n", args[1]);
+		return 1;
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	// read back to validate the file
+	MappedModel mapped(args[1]);
+	printf("%s -> %s: %d masses, %d springs, %d joints, %zu bytes%s\n", args[0], args[1],
+		mapped.num_vertex, mapped.num_edge, mapped.num_joint, mapped.fileSize(), reorder ? " (reordered)" : "");
+	printf("msgpack load:%.2f ms, write:%.2f ms\n",
+		std::chrono::duration<double, std::milli>(loaded - start).count(),
+		std::chrono::duration<double, std::milli>(end - loaded).count());
+	return 0;
+}
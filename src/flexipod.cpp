@@ -0,0 +1,240 @@
+/*
+flexipod.cpp: build the flexipod robot from a Model, see flexipod.h
+*/
+
+#include "flexipod.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+/* set the mass and spring parameters, the geometry (mass.pos, mass.color, mass.constrain, spring.edge)
+   must be set, bot is a Model or a MappedModel */
+template<class ModelType>
+static FlexipodIndex setFlexipodParameters(const ModelType& bot, MASS& mass, SPRING& spring) {
+
+	const int num_mass = mass.num; // number of mass
+	const int num_spring = spring.num; // number of spring
+	const int num_joint = bot.Joints.size();//number of rotational joint
+	const int num_body = numBody(bot); // body and legs
+
+	FlexipodIndex index;
+
+	const double m = 6e-4;// mass per vertex
+	//const double m = 2.5/(double)num_mass;// mass per vertex
+
+	const double spring_constant =m*2.4e6; //spring constant for silicone leg
+	//const double spring_damping = m*1.8e2; // damping for spring
+	const double spring_damping = m * 1.5e2; // damping for spring
+
+	constexpr double scale_high = 2;// scaling factor high
+	//const double scale_low = 0.5; // scaling factor low
+	constexpr double scale_probe = 0.08; // scaling factor for the probing points, e.g. coordinates
+
+	const double spring_constant_rigid = spring_constant* scale_high;//spring constant for rigid spring
+
+	const double spring_constant_restable = spring_constant * scale_high; // spring constant for resetable spring
+	const double spring_damping_restable = spring_damping*2.4; // spring damping for resetable spring
+
+	// spring coefficient for the probing springs, e.g. coordinates
+	const double spring_constant_probe_anchor = spring_constant * scale_probe; // spring constant for coordiates anchor springs
+	const double spring_constant_probe_self = spring_constant * scale_probe* scale_high; // spring constant for coordiates self springs
+	const double spring_damping_probe = spring_damping * scale_probe * scale_high;
+
+#pragma omp parallel for
+	for (int i = 0; i < num_mass; i++)
+	{
+		mass.m[i] = m; // mass [kg]
+	}
+#pragma omp parallel for
+	for (int i = 0; i < num_spring; i++)
+	{
+		spring.damping[i] = spring_damping; // spring constant
+		spring.rest[i] = (mass.pos[spring.edge[i].x] - mass.pos[spring.edge[i].y]).norm(); // spring rest length
+
+		// longer spring will have a smalller influence
+		spring.k[i] = spring_constant * radius_knn / std::max(spring.rest[i], mimimun_radius); // spring constant
+		//spring.k[i] = spring_constant; // spring constant
+
+		spring.resetable[i] = false; // set all spring as non-resetable
+	}
+
+/*bot.idVertices: body,leg0,leg1,leg2,leg3,anchor0,anchor1,anchor2,anchor3,
+				oxyz_body,oxyz_joint0_body,oxyz_joint0_leg0,oxyz_joint1_body,oxyz_joint1_leg1,
+				oxyz_joint2_body,oxyz_joint2_leg2,oxyz_joint3_body,oxyz_joint3_leg3,the end
+ bot.idEdges: body, leg0, leg1, leg2, leg3, anchors, rotsprings, fricsprings, oxyz_self_springs, oxyz_anchor_springs, the end
+ (with 4 joints, one leg and one anchor per joint in general, e.g. the generated models of model_gen.h) */
+
+	// set higher mass value for robot body
+	for (int i = bot.idVertices[0]; i < bot.idVertices[1]; i++)
+	{
+		mass.m[i] = m*1.8; // accounting for addional mass for electornics
+	}
+	// set lower mass value for leg
+	for (int i = bot.idVertices[1]; i < bot.idVertices[num_body]; i++)
+	{
+		mass.m[i] = m * 0.3; // 80% infill,no skin
+	}
+
+	// set the mass value for joint
+	for (int i = 0; i < bot.Joints.size(); i++)
+	{
+		for (int j : bot.Joints[i].left)
+		{
+			mass.m[j] = m*1.4;
+		}
+		for (int j : bot.Joints[i].right)
+		{
+			mass.m[j] = m*1.4;
+		}
+	}
+
+	// set higher spring constant for the robot body
+	for (int i = 0; i < bot.idEdges[1]; i++)
+	{
+		//spring.k[i] = spring_constant_rigid;
+		spring.k[i] *= scale_high;
+	}
+	// set higher spring constant for the rotational joints
+	for (int i = bot.idEdges[num_body]; i < bot.idEdges[num_body +1]; i++)
+	{
+		spring.k[i] = spring_constant_rigid; // joints anchors
+		//spring.k[i] *= scale_high;
+	}
+	for (int i = bot.idEdges[num_body +1]; i < bot.idEdges[num_body +2]; i++)
+	{
+		spring.k[i] = spring_constant_rigid; // joints rotation spring
+		//spring.k[i] *= scale_high;
+		//spring.damping[i] = spring_damping_restable;
+	}
+
+	index.id_restable_spring_start = bot.idEdges[num_body + 2]; // resetable spring (frictional spring)
+	index.id_resetable_spring_end = bot.idEdges[num_body + 3];
+	for (int i = index.id_restable_spring_start; i < index.id_resetable_spring_end; i++)
+	{
+		spring.k[i] = spring_constant_restable;// resetable spring, reset the rest length per dynamic update
+		spring.damping[i] = spring_damping_restable;
+		spring.resetable[i] = true;
+	}
+
+	/*oxyz_body,oxyz_joint0_body,oxyz_joint0_leg0,oxyz_joint1_body,oxyz_joint1_leg1,
+				oxyz_joint2_body,oxyz_joint2_leg2,oxyz_joint3_body,oxyz_joint3_leg3,*/
+	index.id_oxyz_start = bot.idVertices[num_body + num_joint];
+	index.id_oxyz_end = bot.idVertices[num_body + num_joint + 1 + 2* num_joint];
+
+	// set lower mass for the anchored coordinate systems
+	for (int i = index.id_oxyz_start; i < index.id_oxyz_end; i++)
+	{
+		mass.m[i] = m * scale_probe; // mass [kg]
+	}
+
+	for (int i = bot.idEdges[num_body + 3]; i < bot.idEdges[num_body + 4]; i++)
+	{
+		spring.k[i] = spring_constant_probe_self;// oxyz_self_springs
+		spring.damping[i] = spring_damping_probe;
+	}
+	for (int i = bot.idEdges[num_body + 4]; i < bot.idEdges[num_body + 5]; i++)
+	{
+		spring.k[i] = spring_constant_probe_anchor;// oxyz_anchor_springs
+		spring.damping[i] = spring_damping_probe;
+	}
+
+	double total_mass = 0;
+#pragma omp parallel for reduction(+:total_mass)
+	for (int i = 0; i < num_mass; i++){total_mass += mass.m[i];}
+
+	double body_mass = 0;
+	for (int i = bot.idVertices[0]; i < bot.idVertices[1]; i++)
+	{body_mass+= mass.m[i];}// calculate body mass
+
+	double leg_mass = 0;
+	for (int i = bot.idVertices[1]; i < bot.idVertices[std::min(num_body, 2)]; i++)
+	{leg_mass += mass.m[i];}// calculate leg mass
+
+	double joint_mass = 0;
+	for (int i = 0; i < std::min(num_joint, 1); i++) {
+		for (int j : bot.Joints[i].right)
+		{joint_mass+=mass.m[j];}// calculate joint mass
+	}
+
+	printf("total mass:%.2f kg, body mass:%.2f kg, per leg mass:%.2f kg (soft part:%.2f kg)\n",
+		total_mass, body_mass, leg_mass, leg_mass - joint_mass);
+
+	return index;
+}
+
+FlexipodIndex buildFlexipod(const Model& bot, MASS& mass, SPRING& spring) {
+	const int num_mass = bot.vertices.size(); // number of mass
+	const int num_spring = bot.edges.size(); // number of spring
+#pragma omp parallel for
+	for (int i = 0; i < num_mass; i++)
+	{
+		mass.pos[i]= bot.vertices[i]; // position (Vec3d) [m]
+		mass.color[i]= bot.colors[i]; // color (Vec3d) [0.0-1.0]
+		mass.constrain[i] = bot.isSurface[i];// set constraint to true for suface points, and false otherwise
+	}
+#pragma omp parallel for
+	for (int i = 0; i < num_spring; i++)
+	{
+		spring.edge[i] = bot.edges[i]; // the (left,right) mass index of the spring
+	}
+	FlexipodIndex index = setFlexipodParameters(bot, mass, spring);
+	index.vertex_order = bot.vertex_order;
+	return index;
+}
+
+FlexipodIndex buildFlexipod(const MappedModel& bot, MASS& mass, SPRING& spring) {
+	// the columns have the layout of MASS/SPRING, copy them directly from the mapped file
+	std::copy(bot.vertices, bot.vertices + bot.num_vertex, mass.pos); // position [m]
+	std::copy(bot.colors, bot.colors + bot.num_vertex, mass.color); // color [0.0-1.0]
+	std::copy(bot.edges, bot.edges + bot.num_edge, spring.edge); // the (left,right) mass index of the spring
+	for (int i = 0; i < bot.num_vertex; i++) {
+		mass.constrain[i] = bot.is_surface[i] != 0;// set constraint to true for suface points, and false otherwise
+	}
+	FlexipodIndex index = setFlexipodParameters(bot, mass, spring);
+	if (bot.vertex_order != nullptr) { index.vertex_order.assign(bot.vertex_order, bot.vertex_order + bot.num_vertex); }
+	return index;
+}
+
+FlexipodIndex loadFlexipod(const char* model_path, bool reorder, MASS& mass, SPRING& spring, JOINT& joint) {
+	FlexipodIndex index;
+	if (isModelFile(model_path)) { // binary model (model_file.h), mapped instead of parsed
+		MappedModel bot(model_path);
+		if (reorder && !bot.reordered) {
+			printf("--reorder is ignored for a binary model, convert it with flexipod_convert --reorder\n");
+		}
+		mass.init(bot.num_vertex, true);
+		spring.init(bot.num_edge, true);
+		index = buildFlexipod(bot, mass, spring);
+		joint.init(bot.Joints, true);
+	}
+	else {
+		Model bot(model_path); //defined in model.h
+		if (reorder) { bot.reorder(numBody(bot)); } // reorder the body and the legs
+		mass.init(bot.vertices.size(), true);
+		spring.init(bot.edges.size(), true);
+		index = buildFlexipod(bot, mass, spring);
+		joint.init(bot.Joints, true);
+	}
+	return index;
+}
+
+/* joint speed of the trotting gait at phase [0-1), normalized to one cycle per unit phase (WalkingTrot.GetVel) */
+static double trotVel(double phase, double stance_ratio = 0.6,
+	double stance_start_angle = M_PI / 4, double stance_end_angle = 3 * M_PI / 4) {
+	const double contact_angle = stance_end_angle - stance_start_angle;
+	const double vel_air = (2 * M_PI - contact_angle) / (1 - stance_ratio);
+	const double vel_stance = contact_angle / stance_ratio; // ground contact velocity (normalized)
+	phase -= floor(phase);
+	const double phase_stance_start = stance_start_angle / vel_air;
+	if (phase >= phase_stance_start && phase < phase_stance_start + stance_ratio) { return vel_stance; }
+	return vel_air;
+}
+
+void trotJointVel(double T, double frequency, double* joint_vel, int num_joint) {
+	const double phase = T * frequency;
+	const double vel[4] = { trotVel(phase), trotVel(phase + 0.5), -trotVel(phase), -trotVel(phase + 0.5) };
+	for (int i = 0; i < num_joint; i++) { joint_vel[i] = vel[i % 4] * frequency; }
+}
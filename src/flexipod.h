@@ -0,0 +1,48 @@
+/*
+flexipod.h: build the flexipod robot (mass, spring parameters) from a Model or a MappedModel (model_file.h),
+shared by the cuda simulation (main.cu) and the headless cpu simulation (headless.cpp)
+*/
+
+#ifndef FLEXIPOD_H
+#define FLEXIPOD_H
+
+#include "model.h"
+#include "model_file.h"
+
+#include <cmath>
+#include <vector>
+
+constexpr int num_body = 5;//number of bodies: body,leg0,leg1,leg2,leg3
+
+/* number of bodies of a Model or a MappedModel: the body and one leg per joint (num_body for data.msgpack) */
+template<class ModelType>
+inline int numBody(const ModelType& bot) { return 1 + (int)bot.Joints.size(); }
+
+constexpr double radius_poisson = 10 * 1e-3; // poisson disk sampling radius of the slicer
+const double radius_knn = radius_poisson * sqrt(3.0); // k-nearest neighbour radius of the springs
+constexpr double mimimun_radius = radius_poisson * 0.5;
+
+/* index ranges of the robot, set Simulation::id_* with these */
+struct FlexipodIndex {
+	int id_restable_spring_start = 0; // resetable springs start index (inclusive)
+	int id_resetable_spring_end = 0; // resetable springs start index (exclusive)
+	int id_oxyz_start = 0;// coordinate oxyz start index (inclusive)
+	int id_oxyz_end = 0; // coordinate oxyz end index (exclusive)
+	std::vector<int> vertex_order; // original index of each mass if the model was reordered (Model::vertex_order), empty otherwise
+};
+
+/*set the mass and spring (host) from the robot model bot, mass and spring must be allocated
+  with bot.vertices.size() and bot.edges.size(), prints the mass summary*/
+FlexipodIndex buildFlexipod(const Model& bot, MASS& mass, SPRING& spring);
+/* same as above from a mapped binary model file, mass and spring allocated with bot.num_vertex and bot.num_edge */
+FlexipodIndex buildFlexipod(const MappedModel& bot, MASS& mass, SPRING& spring);
+
+/* allocate (host) mass, spring and joint and build the robot from model_path, a msgpack model (model.h)
+   or a binary model (model_file.h), reorder: reorder the masses and springs of a msgpack model (Model::reorder) */
+FlexipodIndex loadFlexipod(const char* model_path, bool reorder, MASS& mass, SPRING& spring, JOINT& joint);
+
+/* desired joint speeds [rad/s] of the trotting gait (walking_trot.ipynb) at time T [s],
+   joint order: front left, back left, back right, front right, repeated for num_joint joints */
+void trotJointVel(double T, double frequency, double* joint_vel, int num_joint);
+
+#endif // FLEXIPOD_H
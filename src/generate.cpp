@@ -0,0 +1,70 @@
+/*
+generate.cpp: write a procedural robot (model_gen.h) in the binary model format (model_file.h)
+	flexipod_generate [--lattice] [--legs 4] [--masses 100000] [--radius 0.01] [--knn 0.0173] [--seed 0] [--reorder] output.model
+	--lattice: cubic lattice instead of the jittered lattice
+	--legs: number of legs (joints), 0: the body only
+	--masses: number of masses of the body and the legs, scales the robot (default: the sizes of data.msgpack, about 10000 masses)
+	--radius, --knn: [m] sampling spacing and spring radius (default: radius_poisson, radius_knn)
+	--reorder: reorder the masses and springs for memory locality (Model::reorder) before writing
+The output runs like any model, e.g. flexipod_headless output.model or bench_sim output.model
+*/
+
+#include "model_gen.h"
+#include "model_file.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+	GeneratorOptions options;
+	bool reorder = false;
+	std::vector<const char*> args; // positional arguments
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--lattice") == 0) { options.sampling = Sampling::LATTICE; }
+		else if (strcmp(argv[i], "--legs") == 0 && i + 1 < argc) { options.num_leg = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--masses") == 0 && i + 1 < argc) { options.num_mass = atoll(argv[++i]); }
+		else if (strcmp(argv[i], "--radius") == 0 && i + 1 < argc) { options.radius = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--knn") == 0 && i + 1 < argc) { options.radius_knn = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) { options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10); }
+		else if (strcmp(argv[i], "--reorder") == 0) { reorder = true; }
+		else { args.push_back(argv[i]); }
+	}
+	if (args.size() != 1) {
+		fprintf(stderr, "usage: flexipod_generate [--lattice] [--legs 4] [--masses 100000] [--radius 0.01] [--knn 0.0173] "
+			"[--seed 0] [--reorder] output.model\n");
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	Model bot;
+	try {
+		bot = generateModel(options);
+	}
+	catch (const std::runtime_error& e) {
+		fprintf(stderr, "flexipod_generate: %s\n", e.what());
+		return 1;
+	}
+	if (reorder) { bot.reorder(numBody(bot)); } // reorder the body and the legs
+	auto generated = std::chrono::steady_clock::now();
+	if (!writeModelFile(bot, args[0])) {
+		fprintf(stderr, "flexipod_generate: cannot write %s\n", args[0]);
+		return 1;
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	size_t num_joint_point = 0;
+	for (const StdJoint& joint : bot.Joints) { num_joint_point += joint.left.size() + joint.right.size(); }
+	printf("%s -> %s: %zu masses, %zu springs (%.1f neighbours per mass), %zu joints (%zu joint points)%s\n",
+		generatedModelName(options).c_str(), args[0], bot.vertices.size(), bot.edges.size(),
+		2.0 * (bot.idEdges[numBody(bot)]) / bot.idVertices[numBody(bot)], bot.Joints.size(), num_joint_point,
+		reorder ? " (reordered)" : "");
+	printf("generate:%.2f ms, write:%.2f ms\n",
+		std::chrono::duration<double, std::milli>(generated - start).count(),
+		std::chrono::duration<double, std::milli>(end - generated).count());
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+headless.cpp: run the flexipod simulation on the cpu backend (sim_cpu.h),
+without CUDA, GLFW or GLEW. e.g. for rollouts on cpu-only machines:
+	flexipod_headless [--reorder] [--lockstep udp|shm] [--max-step 100000] [--profile interval_s] [--trace path]
+		[--record path] [--record-channels joint,command,com] [--record-interval 1] [--collision self|all] [--spacing 0]
+		[--terrain rough|path.pgm] [--terrain-scale 0.02,0.03] [--obstacles clutter:N|mesh.stl|mesh.obj]
+		[--obstacles-scale 1] [--obstacles-offset 0,0,0] [model_path] [runtime_s] [num_threads] [num_instance]
+	--reorder: reorder the masses and springs for memory locality (Model::reorder), --record keeps the original order
+	--collision: collide the surface masses of each instance with themselves (self, e.g. leg against leg) or also
+		with the other instances (all), with a spatial hash broad phase (sim_collision.h)
+	--spacing: [m] place instance k at k * spacing along y (the instances overlap by default)
+	--terrain: replace the ground plane by a heightfield (terrain.h) centered under the robots: random rough
+		ground of 4 x 4 m or a grayscale pgm image, --terrain-scale: [m] grid spacing, maximum height,
+		the robots start above the highest point
+	--obstacles: static obstacles in a bounding volume hierarchy (obstacle.h): N random steps, ramps and logs
+		within 1 m of the robots, or the triangles of a mesh scaled by --obstacles-scale (e.g. 0.001 for mm)
+		and moved by --obstacles-offset [m]
+	--record: stream a trajectory file to path (recorder.h, read it with trajectory.py), of the channels
+		position,sensor,joint,command,com or all (sensor: the oxyz points) every --record-interval updates
+	--profile: print the per-phase timers and counters (profiler.h) every interval_s of wall time (0: at the end)
+	--trace: write the timed phases of every thread as a chrome trace to path at the end
+		(both need a build with -DUSE_PROFILE=ON)
+	--lockstep: step only on the controller's STEP_COMMEND (lockstep.h) over udp (ports 32001/32000+robot)
+		or shared memory (/flexipod_shm), instance k is robot k, ForceAssembly::GATHER, linux only
+	--max-step: lockstep: a STEP_COMMEND runs at most this many updates (a larger num_step is clamped)
+	model_path: msgpack model (model.h) or binary model (model_file.h, from flexipod_convert)
+*/
+
+#include "sim_cpu.h"
+#include "flexipod.h"
+#include "profiler.h"
+#include "recorder.h"
+#ifdef LOCKSTEP_SERVER
+#include "lockstep.h"
+#include "network_posix.h"
+#include "shm_server.h"
+#endif // LOCKSTEP_SERVER
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+int main(int argc, char* argv[])
+{
+	bool reorder = false;
+	const char* lockstep = nullptr; // transport of --lockstep
+	int max_step = LOCKSTEP_MAX_STEP; // --max-step
+	double profile_interval = -1; // [s] --profile, <0: no report
+	const char* trace_path = nullptr; // --trace
+	const char* record_path = nullptr; // --record
+	RecorderOptions record_options;
+	const char* collision = nullptr; // --collision
+	double spacing = 0; // [m] --spacing
+	const char* terrain_path = nullptr; // --terrain
+	double terrain_cell = 0.02, terrain_height = 0.03; // [m] --terrain-scale
+	const char* obstacles_path = nullptr; // --obstacles
+	double obstacles_scale = 1; // --obstacles-scale
+	Vec3d obstacles_offset(0, 0, 0); // [m] --obstacles-offset
+	std::vector<const char*> args; // positional arguments
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--reorder") == 0) { reorder = true; }
+		else if (strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc) { lockstep = argv[++i]; }
+		else if (strcmp(argv[i], "--max-step") == 0 && i + 1 < argc) { max_step = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) { profile_interval = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) { trace_path = argv[++i]; }
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) { record_path = argv[++i]; }
+		else if (strcmp(argv[i], "--record-channels") == 0 && i + 1 < argc) {
+			try { record_options.channels = parseRecordChannels(argv[++i]); }
+			catch (const std::runtime_error& e) { printf("%s\n", e.what()); return 1; }
+		}
+		else if (strcmp(argv[i], "--record-interval") == 0 && i + 1 < argc) { record_options.interval = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--collision") == 0 && i + 1 < argc) { collision = argv[++i]; }
+		else if (strcmp(argv[i], "--spacing") == 0 && i + 1 < argc) { spacing = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--terrain") == 0 && i + 1 < argc) { terrain_path = argv[++i]; }
+		else if (strcmp(argv[i], "--terrain-scale") == 0 && i + 1 < argc) {
+			sscanf(argv[++i], "%lf,%lf", &terrain_cell, &terrain_height);
+		}
+		else if (strcmp(argv[i], "--obstacles") == 0 && i + 1 < argc) { obstacles_path = argv[++i]; }
+		else if (strcmp(argv[i], "--obstacles-scale") == 0 && i + 1 < argc) { obstacles_scale = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--obstacles-offset") == 0 && i + 1 < argc) {
+			sscanf(argv[++i], "%lf,%lf,%lf", &obstacles_offset.x, &obstacles_offset.y, &obstacles_offset.z);
+		}
+		else { args.push_back(argv[i]); }
+	}
+	const char* model_path = args.size() > 0 ? args[0] : "../src/data.msgpack";
+	double runtime = args.size() > 1 ? atof(args[1]) : 10; // simulation time [s]
+	int num_threads = args.size() > 2 ? atoi(args[2]) : 0; // 0: use the openmp default
+	int num_instance = args.size() > 3 ? atoi(args[3]) : 1; // number of robots simulated together
+
+	auto start = std::chrono::steady_clock::now();
+
+	MASS robot_mass; // one robot (host)
+	SPRING robot_spring;
+	JOINT robot_joint;
+	FlexipodIndex index = loadFlexipod(model_path, reorder, robot_mass, robot_spring, robot_joint);
+	auto loaded = std::chrono::steady_clock::now();
+	printf("model load:%.2f ms\n", std::chrono::duration<double, std::milli>(loaded - start).count());
+
+	CpuSimulation sim(robot_mass, robot_spring, robot_joint, num_instance);
+	robot_mass.release(); // packed into sim, which frees its own copy
+	robot_spring.release();
+	robot_joint.release();
+	sim.num_threads = num_threads;
+	if (lockstep != nullptr) { sim.force_assembly = ForceAssembly::GATHER; } // no atomics: reproducible rollouts
+	sim.dt = 5e-5; // timestep
+
+	sim.id_restable_spring_start = index.id_restable_spring_start;
+	sim.id_resetable_spring_end = index.id_resetable_spring_end;
+	sim.id_oxyz_start = index.id_oxyz_start;
+	sim.id_oxyz_end = index.id_oxyz_end;
+	sim.vertex_order = index.vertex_order;
+
+	// set max speed for each joint
+	double max_rpm = 600;//maximun revolution per minute
+	sim.setMaxJointSpeed(max_rpm / 60. * 2 * M_PI);//max joint speed in rad/s
+
+	sim.global_acc = Vec3d(0, 0, -9.8); // global acceleration
+	if (terrain_path == nullptr) { sim.createPlane(Vec3d(0, 0, 1), 0, 0.6, 0.6); }
+	else {
+		try {
+			Heightfield terrain = strcmp(terrain_path, "rough") == 0 ?
+				Heightfield::rough((int)std::lround(4 / terrain_cell) + 1, (int)std::lround(4 / terrain_cell) + 1,
+					terrain_cell, terrain_height, 0.2) :
+				Heightfield::loadPgm(terrain_path, terrain_cell, terrain_height);
+			terrain.setFriction(0.6, 0.6);
+			terrain.center(0, 0.5 * (num_instance - 1) * spacing);
+			sim.createTerrain(terrain);
+			const double lift = terrain.maxHeight();
+			for (int i = 0; i < sim.mass.num; i++) { sim.mass.pos[i].z += lift; }
+			printf("terrain: %d x %d heights, %.3f m spacing, %.3f m high\n", terrain.nx, terrain.ny, terrain.cell, lift);
+		}
+		catch (const std::runtime_error& e) { printf("%s\n", e.what()); return 1; }
+	}
+	if (obstacles_path != nullptr) {
+		try {
+			ObstacleSet obstacles;
+			if (strncmp(obstacles_path, "clutter:", 8) == 0) { obstacles = ObstacleSet::clutter(atoi(obstacles_path + 8), 1.0); }
+			else {
+				obstacles.friction_k = 0.6;
+				obstacles.friction_s = 0.6;
+				obstacles.loadMesh(obstacles_path, obstacles_scale, obstacles_offset);
+			}
+			auto build_start = std::chrono::steady_clock::now();
+			obstacles.build();
+			printf("obstacles: %zu primitives, hierarchy of depth %d built in %.2f ms\n", obstacles.primitive.size(), obstacles.depth(),
+				std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count());
+			sim.createObstacles(obstacles);
+		}
+		catch (const std::runtime_error& e) { printf("%s\n", e.what()); return 1; }
+	}
+
+	for (int k = 1; k < num_instance && spacing != 0; k++) { // before start(): the backup holds the placement
+		for (int i = sim.layout.massOffset(k); i < sim.layout.massOffset(k + 1); i++) { sim.mass.pos[i].y += k * spacing; }
+	}
+	if (collision != nullptr) {
+		if (strcmp(collision, "self") != 0 && strcmp(collision, "all") != 0) { printf("--collision: self or all\n"); return 1; }
+		sim.self_collision = true;
+		sim.collision.between_instances = strcmp(collision, "all") == 0;
+	}
+
+#ifndef PROFILE
+	if (profile_interval >= 0 || trace_path != nullptr) {
+		printf("--profile/--trace: built without PROFILE (cmake -DUSE_PROFILE=ON), nothing is recorded\n");
+	}
+#endif // !PROFILE
+	if (profile_interval > 0) { profiler().setReportInterval(profile_interval); }
+	if (trace_path != nullptr) { profiler().enableTrace(); }
+
+	TrajectoryRecorder recorder;
+	if (record_path != nullptr) {
+		for (int id = index.id_oxyz_start; id < index.id_oxyz_end; id++) { record_options.sensor.push_back(id); }
+		record_options.vertex_order = index.vertex_order; // recorded in the original order
+		try { recorder.open(record_path, record_options, sim.layout, sim.dt); }
+		catch (const std::runtime_error& e) { printf("%s\n", e.what()); return 1; }
+		sim.recorder = &recorder;
+	}
+
+	sim.start();
+	if (lockstep == nullptr) { sim.run(runtime); }
+#ifdef LOCKSTEP_SERVER
+	else if (strcmp(lockstep, "shm") == 0) {
+		ShmServer server("/flexipod_shm", num_instance);
+		serveLockstep(sim, server, runtime, max_step);
+		server.close();
+	}
+	else {
+		PosixUdpServer server(32001, 32000, "127.0.0.1", num_instance);
+		server.run();
+		serveLockstep(sim, server, runtime, max_step);
+		server.close();
+	}
+#else
+	else { printf("--lockstep is not available in this build\n"); return 1; }
+#endif // LOCKSTEP_SERVER
+
+	if (recorder.isOpen()) {
+		recorder.close();
+		printf("record: %llu frames of %zu values, %llu dropped, %.2f MB\n", (unsigned long long)recorder.numRecorded(),
+			recorder.numValue(), (unsigned long long)recorder.numDropped(), recorder.bytesWritten() * 1e-6);
+	}
+	if (profile_interval >= 0) { profiler().report(); }
+	if (trace_path != nullptr && !profiler().writeChromeTrace(trace_path)) { printf("cannot write %s\n", trace_path); }
+
+	auto end = std::chrono::steady_clock::now();
+	printf("main():Elapsed time:%d ms \n",
+		(int)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+lockstep.h: lockstep stepping over the controller transports (network_posix.h, shm_server.h, network.h),
+for deterministic training loops. The controller sends STEP_COMMEND with the joint speeds and num_step,
+the simulation runs exactly num_step updates (NUM_QUEUED_KERNELS*dt each) with those speeds, reports the
+state once, then waits for the next command: no update is missed or repeated however slow either side is.
+    RESET: restore the backed up state, applied before the next step
+    MOTOR_SPEED_COMMEND: set the joint speeds without stepping
+    STEP_COMMEND: set the joint speeds, run num_step updates and report the state, num_step 0 only reports,
+        num_step is clamped to [0, max_step] (LOCKSTEP_MAX_STEP by default)
+Simulation::lockstep (sim.h) serves it in update_physics(), serveLockstep() serves a CpuSimulation
+(flexipod_headless --lockstep), CpuSimulation::step() is the in-process equivalent.
+*/
+
+#ifndef TITAN_LOCKSTEP_H
+#define TITAN_LOCKSTEP_H
+
+#include "udp_message.h"
+#include "sim_cpu.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+/* updates run for the num_step of a STEP_COMMEND */
+inline int clampNumStep(const int num_step, const int max_step = LOCKSTEP_MAX_STEP) {
+	return std::min(std::max(num_step, 0), max_step);
+}
+
+/* fill the state report of one robot (same as Simulation::update_physics), T: simulation time [s] */
+inline void fillStateReport(UdpDataSend& msg, const double T, const ModelState& state, const double max_joint_vel) {
+	msg.header = UDP_HEADER::ROBOT_STATE_REPORT;
+	msg.T = T;
+	for (int i = 0; i < 4; i++) {
+		msg.jointAngle[i] = state.joint_pos[i];
+		msg.jointSpeed[i] = state.joint_vel[i];
+		msg.actuation[i] = state.joint_vel_cmd[i] / max_joint_vel;
+	}
+	for (int i = 0; i < 3; i++) {
+		msg.acceleration[i] = state.com_acc[i];
+		msg.position[i] = state.com_pos[i];
+		msg.orientation[i] = state.ox[i];
+		msg.orientation[3 + i] = state.oy[i];
+	}
+}
+
+/* serve instance k of sim to robot k of server in lockstep until sim.T reaches runtime [s] or the server closes.
+   All instances are updated together: each round runs the fewest updates left among the robots, so a robot
+   whose step is done waits for the others; its report time is the time since its last reset (instance_T).
+   max_step: bound of the num_step of a STEP_COMMEND (clampNumStep) */
+template<class Server>
+void serveLockstep(CpuSimulation& sim, Server& server, const double runtime, const int max_step = LOCKSTEP_MAX_STEP) {
+	const int num_robot = sim.layout.num_instance;
+	const int num_joint = std::min(sim.layout.num_joint, 4);
+	std::vector<int> num_step_remaining(num_robot, 0); // updates left of the current STEP_COMMEND of each robot
+	UdpDataSend msg_send;
+	UdpDataReceive msg_rec;
+	auto report = [&](int k) { // measured again: a reset since the last update changed the state
+		PROFILE_SCOPE(Phase::UDP);
+		PROFILE_COUNT(Counter::STATE_SENT, 1);
+		const int offset = sim.layout.jointOffset(k);
+		fillStateReport(msg_send, sim.instance_T[k], measureModelState(sim.mass, sim.id_oxyz_start + sim.layout.massOffset(k),
+			sim.layout.num_joint, sim.joint_pos.data() + offset, sim.joint_vel.data() + offset, sim.joint_vel_cmd.data() + offset),
+			sim.max_joint_vel);
+		server.publishState(msg_send, k);
+	};
+	for (int k = 0; k < num_robot; k++) { report(k); }
+
+	while (sim.T < runtime) {
+		for (int k = 0; k < num_robot; k++) {
+			PROFILE_SCOPE(Phase::UDP_WAIT); // the controller's turn
+			while (num_step_remaining[k] == 0) {
+				if (!server.waitCommand(msg_rec, std::chrono::milliseconds(100), k)) {
+					if (server.flag_should_close) { return; }
+					continue;
+				}
+				PROFILE_COUNT(Counter::COMMAND_RECEIVED, 1);
+				switch (msg_rec.header)
+				{
+				case UDP_HEADER::RESET:
+					sim.resetInstance(k);
+					break;
+				case UDP_HEADER::STEP_COMMEND:
+					num_step_remaining[k] = clampNumStep(msg_rec.num_step, max_step);
+					if (num_step_remaining[k] == 0) { report(k); }
+					// fall through
+				case UDP_HEADER::MOTOR_SPEED_COMMEND:
+					std::copy(msg_rec.jointSpeed, msg_rec.jointSpeed + num_joint, sim.jointVelDesired(k));
+					break;
+				default:
+					break;
+				}
+			}
+		}
+		const int num_update = *std::min_element(num_step_remaining.begin(), num_step_remaining.end());
+		sim.step(num_update);
+		for (int k = 0; k < num_robot; k++) {
+			num_step_remaining[k] -= num_update;
+			if (num_step_remaining[k] == 0) { report(k); }
+		}
+	}
+}
+
+#endif // TITAN_LOCKSTEP_H
@@ -0,0 +1,742 @@
+/*modified from the orginal Titan simulation libaray:https://github.com/jacobaustin123/Titan
+ref: J. Austin, R. Corrales-Fatou, S. Wyetzner, and H. Lipson, "Titan: A Parallel Asynchronous Library for Multi-Agent and Soft-Body Robotics using NVIDIA CUDA," ICRA 2020, May 2020.
+
+model.h defines the robot model (Model) and the flat mass/spring/joint containers
+(MASS, SPRING, JOINT) shared by the cuda simulation (sim.h) and the cpu backend (sim_cpu.h).
+With CPU_ONLY defined it does not depend on the cuda toolkit, all memory is on the host.
+*/
+
+#ifndef TITAN_MODEL_H
+#define TITAN_MODEL_H
+
+#include "vec.h"
+
+#include <msgpack.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cstdint>
+#include <new>
+#include <sstream>
+#include <fstream>
+#include <string.h>
+
+#ifdef CPU_ONLY
+typedef struct CUstream_st* cudaStream_t; // opaque stream handle, unused in the cpu only build
+#else
+#include <cuda_runtime.h>
+
+#define gpuErrchk(ans) { gpuAssert((ans), __FILE__, __LINE__); }
+inline void gpuAssert(cudaError_t code, const char* file, int line, bool abort = true)
+{
+	if (code != cudaSuccess)
+	{
+		fprintf(stderr, "Cuda failure: %s %s %d\n", cudaGetErrorString(code), file, line);
+		exit(code);
+	}
+}
+
+/*  helper function to free device/host memory given host_or_device_ptr */
+using cudaFreeFcnType = cudaError_t(*)(void*); // helper type for the free memory function
+inline cudaFreeFcnType FreeMemoryFcn(void* host_or_device_ptr) {
+	cudaFreeFcnType freeMemory;
+	cudaPointerAttributes attributes;
+	gpuErrchk(cudaPointerGetAttributes(&attributes, host_or_device_ptr));
+	if (attributes.type == cudaMemoryType::cudaMemoryTypeHost) {// host memory
+		freeMemory = &cudaFreeHost;
+	}
+	else { freeMemory = &cudaFree; }// device memory
+	printf("Memory type for d_data %i\n", attributes.type);
+	return freeMemory;
+}
+#endif // CPU_ONLY
+
+constexpr size_t HOST_MEMORY_ALIGNMENT = 64; // [bytes] alignment of host arrays in the cpu only build (cache line)
+
+/*  helper function to allocate device/host memory, e.g:
+	MallocFcnType allocateMemory = allocateMemoryFcn(on_host);
+	allocateMemory((void**)&m, num * sizeof(double));
+	on_host=true: pinned host memory (cudaMallocHost), on_host=false: device memory (cudaMalloc)
+	in the cpu only build both are aligned host memory */
+using MallocFcnType = void(*)(void**, size_t);
+inline MallocFcnType allocateMemoryFcn(bool on_host) {// ref: https://www.cprogramming.com/tutorial/function-pointers.html
+#ifdef CPU_ONLY
+	return [](void** ptr, size_t size) { *ptr = ::operator new(size, std::align_val_t(HOST_MEMORY_ALIGNMENT)); };
+#else
+	if (on_host) { return [](void** ptr, size_t size) { cudaMallocHost(ptr, size); }; }// allocate on host (pinned)
+	else { return [](void** ptr, size_t size) { cudaMalloc(ptr, size); }; }
+#endif // CPU_ONLY
+}
+
+/* free memory allocated with allocateMemoryFcn(on_host), nullptr is ignored */
+inline void freeMemory(void* ptr, bool on_host) {
+	if (ptr == nullptr) { return; }
+#ifdef CPU_ONLY
+	::operator delete(ptr, std::align_val_t(HOST_MEMORY_ALIGNMENT));
+#else
+	if (on_host) { cudaFreeHost(ptr); }
+	else { cudaFree(ptr); }
+#endif // CPU_ONLY
+}
+
+/* copy num_bytes from src to dst, host or device memory is inferred (cudaMemcpyDefault) */
+inline void copyMemory(void* dst, const void* src, size_t num_bytes, cudaStream_t stream = (cudaStream_t)0) {
+#ifdef CPU_ONLY
+	memcpy(dst, src, num_bytes);
+#else
+	cudaMemcpyAsync(dst, src, num_bytes, cudaMemcpyDefault, stream);
+#endif // CPU_ONLY
+}
+
+/* set num_bytes of ptr to zero */
+inline void setMemoryZero(void* ptr, size_t num_bytes, bool on_host) {
+#ifdef CPU_ONLY
+	memset(ptr, 0, num_bytes);
+#else
+	if (on_host) { memset(ptr, 0, num_bytes); }
+	else { cudaMemset(ptr, 0, num_bytes); }
+#endif // CPU_ONLY
+}
+
+/* set num_bytes of ptr to the byte value (e.g. 1: an array of bool set to true) */
+inline void setMemoryBytes(void* ptr, int value, size_t num_bytes, bool on_host) {
+#ifdef CPU_ONLY
+	memset(ptr, value, num_bytes);
+#else
+	if (on_host) { memset(ptr, value, num_bytes); }
+	else { cudaMemset(ptr, value, num_bytes); }
+#endif // CPU_ONLY
+}
+
+/* check the error of the last memory operation (no-op in the cpu only build) */
+inline void checkMemoryError() {
+#ifndef CPU_ONLY
+	gpuErrchk(cudaPeekAtLastError());
+#endif // !CPU_ONLY
+}
+
+struct StdJoint {
+	std::vector<int> left;// the indices of the left points
+	std::vector<int> right;// the indices of the right points
+	std::vector<int> anchor;// the 2 indices of the anchor points: left_anchor_id,right_anchor_id
+	int leftCoord;
+	int rightCoord;
+	MSGPACK_DEFINE(left, right, anchor, leftCoord, rightCoord);
+};
+class Model {
+public:
+	std::vector<std::vector<double> > vertices;// the mass xyzs
+	std::vector<std::vector<int> > edges;//the spring ids
+	std::vector<bool> isSurface;// whether the mass is near the surface
+	std::vector<int> idVertices;// the edge id of the vertices
+	std::vector<int> idEdges;// the edge id of the springs
+	std::vector<std::vector<double> > colors;// the mass xyzs
+	std::vector<StdJoint> Joints;// the joints
+	MSGPACK_DEFINE(vertices, edges, isSurface, idVertices, idEdges, colors, Joints) // write the member variables that you want to pack
+	Model() {}
+	Model(const char* file_path) {
+		// get the msgpack robot model
+		// read the file once into a buffer of its size, then deserialize the serialized data
+		std::ifstream ifs(file_path, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+		std::vector<char> buffer(ifs ? (size_t)ifs.tellg() : 0);
+		ifs.seekg(0);
+		ifs.read(buffer.data(), buffer.size());
+		msgpack::unpacked upd;//unpacked data
+		msgpack::unpack(upd, buffer.data(), buffer.size());
+		//    std::cout << upd.get() << std::endl;
+		upd.get().convert(*this);
+	}
+
+	std::vector<int> vertex_order;// original index of each vertex after reorder(), empty if not reordered
+	std::vector<int> vertex_index;// current index of each original vertex after reorder(), empty if not reordered
+	std::vector<int> edge_order;// original index of each edge after reorder(), empty if not reordered
+
+	/* reorder the vertices of the first num_vertex_group groups (see idVertices) along a space filling
+	(morton) curve and sort the edges of every group (see idEdges) by their vertices, so that the
+	springs access nearby masses in the dynamics update. Each group keeps its index range, so idVertices,
+	idEdges and the index ranges derived from them are unchanged, the edges and the joints are remapped.
+	The groups whose order matters (e.g. the oxyz coordinates) must not be among the first num_vertex_group.
+	Use vertex_order/vertex_index/edge_order to map between the original and the current indices */
+	void reorder(int num_vertex_group) {
+		const int num_vertex = vertices.size();
+		const int num_edge = edges.size();
+		std::vector<int> order(num_vertex);// original index of each vertex (this call)
+		std::iota(order.begin(), order.end(), 0);
+		for (int g = 0; g < num_vertex_group && g + 1 < (int)idVertices.size(); g++) {
+			const int begin = idVertices[g];
+			const int end = idVertices[g + 1];
+			double lo[3], hi[3];// bounding box of the group
+			for (int d = 0; d < 3; d++) {
+				lo[d] = std::numeric_limits<double>::max();
+				hi[d] = std::numeric_limits<double>::lowest();
+			}
+			for (int i = begin; i < end; i++) {
+				for (int d = 0; d < 3; d++) {
+					lo[d] = std::min(lo[d], vertices[i][d]);
+					hi[d] = std::max(hi[d], vertices[i][d]);
+				}
+			}
+			std::vector<std::pair<uint64_t, int> > key(end - begin);// (morton code, vertex index)
+			for (int i = begin; i < end; i++) {
+				uint32_t q[3];// position quantized to 21 bits per axis
+				for (int d = 0; d < 3; d++) {
+					double t = hi[d] > lo[d] ? (vertices[i][d] - lo[d]) / (hi[d] - lo[d]) : 0.;
+					q[d] = (uint32_t)(t * ((1 << 21) - 1));
+				}
+				key[i - begin] = { mortonCode(q[0], q[1], q[2]), i };
+			}
+			std::sort(key.begin(), key.end());
+			for (int i = begin; i < end; i++) { order[i] = key[i - begin].second; }
+		}
+		std::vector<int> index(num_vertex);// current index of each vertex (this call)
+		for (int i = 0; i < num_vertex; i++) { index[order[i]] = i; }
+
+		// permute the vertices
+		std::vector<std::vector<double> > old_vertices(vertices);
+		std::vector<std::vector<double> > old_colors(colors);
+		std::vector<bool> old_is_surface(isSurface);
+		for (int i = 0; i < num_vertex; i++) {
+			vertices[i] = old_vertices[order[i]];
+			colors[i] = old_colors[order[i]];
+			isSurface[i] = old_is_surface[order[i]];
+		}
+
+		// remap the edges, then sort the edges of each group by (lower, higher) vertex index
+		for (auto& e : edges) {
+			e[0] = index[e[0]];
+			e[1] = index[e[1]];
+		}
+		std::vector<int> e_order(num_edge);// original index of each edge (this call)
+		std::iota(e_order.begin(), e_order.end(), 0);
+		auto edgeKey = [this](int i) {
+			return std::make_pair(std::min(edges[i][0], edges[i][1]), std::max(edges[i][0], edges[i][1]));
+		};
+		for (int g = 0; g + 1 < (int)idEdges.size(); g++) {
+			std::stable_sort(e_order.begin() + idEdges[g], e_order.begin() + idEdges[g + 1],
+				[&edgeKey](int a, int b) { return edgeKey(a) < edgeKey(b); });
+		}
+		std::vector<std::vector<int> > old_edges(edges);
+		for (int i = 0; i < num_edge; i++) { edges[i] = old_edges[e_order[i]]; }
+
+		// remap the joints
+		for (auto& joint : Joints) {
+			for (int& j : joint.left) { j = index[j]; }
+			for (int& j : joint.right) { j = index[j]; }
+			for (int& j : joint.anchor) { j = index[j]; }
+			joint.leftCoord = index[joint.leftCoord];
+			joint.rightCoord = index[joint.rightCoord];
+		}
+
+		// compose with the previous reorder (if any)
+		if (vertex_order.empty()) {
+			vertex_order = order;
+			edge_order = e_order;
+		}
+		else {
+			std::vector<int> old_vertex_order(vertex_order), old_edge_order(edge_order);
+			for (int i = 0; i < num_vertex; i++) { vertex_order[i] = old_vertex_order[order[i]]; }
+			for (int i = 0; i < num_edge; i++) { edge_order[i] = old_edge_order[e_order[i]]; }
+		}
+		vertex_index.resize(num_vertex);
+		for (int i = 0; i < num_vertex; i++) { vertex_index[vertex_order[i]] = i; }
+	}
+
+private:
+	/* interleave the bits of 3 21-bit integers (morton code / z-order curve) */
+	static inline uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+		auto split = [](uint64_t v) {
+			v &= 0x1fffff;
+			v = (v | v << 32) & 0x1f00000000ffff;
+			v = (v | v << 16) & 0x1f0000ff0000ff;
+			v = (v | v << 8) & 0x100f00f00f00f00f;
+			v = (v | v << 4) & 0x10c30c30c30c30c3;
+			v = (v | v << 2) & 0x1249249249249249;
+			return v;
+		};
+		return split(x) | split(y) << 1 | split(z) << 2;
+	}
+};
+
+struct ModelState {
+	Vec3d com_pos; // (measured) position of the body com (nominal)
+	Vec3d com_acc; // (measured) acceleration of the body com (nomial)
+	Vec3d ox; // (measured) normalized ox direction of the body com (nominal)
+	Vec3d oy; // (measured) normalized oy direction of the body com (nominal)
+	double joint_pos[4]; // (measured) joint angle array in rad, initialized in start()
+	double joint_vel[4]; // (measured) joint speed array in rad/s, initialized in start()
+	double joint_vel_cmd[4]; // (commended) joint speed array in rad/s, initialized in start()
+	// TODO: change the constant "4"
+};
+
+struct MASS {
+	double* m = nullptr;
+	Vec3d* pos = nullptr;
+	Vec3d* vel = nullptr;
+	Vec3d* acc = nullptr;
+	Vec3d* force = nullptr;
+	Vec3d* force_extern = nullptr;
+	Vec3d* color = nullptr;
+	bool* fixed = nullptr;
+	bool* constrain = nullptr;//whether to apply constrain on the mass, must be set true for constraint to work
+	int num = 0;
+	inline int size() { return num; }
+
+	MASS() { }
+	MASS(int num, bool on_host) {
+		init(num, on_host);
+	}
+	/* initialize and copy the state from other MASS object. must keep the second argument*/
+	MASS(MASS other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
+		init(other.num, on_host);
+		copyFrom(other, stream);
+	}
+	void init(int num, bool on_host = true) {
+		MallocFcnType allocateMemory = allocateMemoryFcn(on_host);// choose approipate malloc function
+		allocateMemory((void**)&m, num * sizeof(double));
+		allocateMemory((void**)&pos, num * sizeof(Vec3d));
+		allocateMemory((void**)&vel, num * sizeof(Vec3d));
+		allocateMemory((void**)&acc, num * sizeof(Vec3d));
+		allocateMemory((void**)&force, num * sizeof(Vec3d));
+		allocateMemory((void**)&force_extern, num * sizeof(Vec3d));
+		allocateMemory((void**)&color, num * sizeof(Vec3d));
+		allocateMemory((void**)&fixed, num * sizeof(bool));
+		allocateMemory((void**)&constrain, num * sizeof(bool));
+
+		checkMemoryError();
+		this->num = num;
+		setMemoryZero(vel, num * sizeof(Vec3d), on_host);// set vel,acc,force to 0
+		setMemoryZero(acc, num * sizeof(Vec3d), on_host);
+		setMemoryZero(force, num * sizeof(Vec3d), on_host);
+		setMemoryZero(force_extern, num * sizeof(Vec3d), on_host);
+		setMemoryZero(fixed, num * sizeof(bool), on_host);// not fixed by default
+		setMemoryBytes(constrain, 1, num * sizeof(bool), on_host);// constrained by default, buildFlexipod() keeps the surface masses
+
+
+	}
+	/* free the arrays allocated by init(), only by their owner: the copies of a MASS are views of the same arrays */
+	void release(bool on_host = true) {
+		for (void* ptr : { (void*)m, (void*)pos, (void*)vel, (void*)acc, (void*)force, (void*)force_extern,
+			(void*)color, (void*)fixed, (void*)constrain }) {
+			freeMemory(ptr, on_host);
+		}
+		*this = MASS();
+	}
+
+	void copyFrom(const MASS& other, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(m, other.m, num * sizeof(double), stream);
+		copyMemory(pos, other.pos, num * sizeof(Vec3d), stream);
+		copyMemory(vel, other.vel, num * sizeof(Vec3d), stream);
+		copyMemory(acc, other.acc, num * sizeof(Vec3d), stream);
+		copyMemory(force, other.force, num * sizeof(Vec3d), stream);
+		copyMemory(force_extern, other.force_extern, num * sizeof(Vec3d), stream);
+		copyMemory(color, other.color, num * sizeof(Vec3d), stream);
+		copyMemory(fixed, other.fixed, num * sizeof(bool), stream);
+		copyMemory(constrain, other.constrain, num * sizeof(bool), stream);
+
+		//this->num = other.num;
+		checkMemoryError();
+	}
+	/* copy count masses starting at offset from other (same offset in both), e.g. to reset one packed instance */
+	void copyFrom(const MASS& other, int offset, int count, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(m + offset, other.m + offset, count * sizeof(double), stream);
+		copyMemory(pos + offset, other.pos + offset, count * sizeof(Vec3d), stream);
+		copyMemory(vel + offset, other.vel + offset, count * sizeof(Vec3d), stream);
+		copyMemory(acc + offset, other.acc + offset, count * sizeof(Vec3d), stream);
+		copyMemory(force + offset, other.force + offset, count * sizeof(Vec3d), stream);
+		copyMemory(force_extern + offset, other.force_extern + offset, count * sizeof(Vec3d), stream);
+		copyMemory(color + offset, other.color + offset, count * sizeof(Vec3d), stream);
+		copyMemory(fixed + offset, other.fixed + offset, count * sizeof(bool), stream);
+		copyMemory(constrain + offset, other.constrain + offset, count * sizeof(bool), stream);
+		checkMemoryError();
+	}
+	/* copy the mutable state (pos, vel, acc, force) from other, e.g. to restore a backup */
+	void copyStateFrom(const MASS& other, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(pos, other.pos, num * sizeof(Vec3d), stream);
+		copyMemory(vel, other.vel, num * sizeof(Vec3d), stream);
+		copyMemory(acc, other.acc, num * sizeof(Vec3d), stream);
+		copyMemory(force, other.force, num * sizeof(Vec3d), stream);
+		checkMemoryError();
+	}
+	void CopyPosVelAccFrom(MASS& other, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(pos, other.pos, num * sizeof(Vec3d), stream);
+		copyMemory(vel, other.vel, num * sizeof(Vec3d), stream);
+		copyMemory(acc, other.acc, num * sizeof(Vec3d), stream);
+		checkMemoryError();
+
+	}
+};
+
+struct SPRING {
+	double* k = nullptr; // spring constant (N/m)
+	double* rest = nullptr; // spring rest length (meters)
+	double* damping = nullptr; // damping on the masses.
+	Vec2i* edge = nullptr;// (left,right) mass indices of the spring
+	bool* resetable = nullptr; // a flag indicating whether to reset every dynamic update
+	int num = 0;
+	inline int size() { return num; }
+
+	SPRING() {}
+	SPRING(int num, bool on_host) {
+		init(num, on_host);
+	}
+	/* initialize and copy the state from other SPRING object. must keep the second argument*/
+	SPRING(SPRING other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
+		init(other.num, on_host);
+		copyFrom(other, stream);
+	}
+
+	void init(int num, bool on_host = true) { // initialize
+		MallocFcnType allocateMemory = allocateMemoryFcn(on_host);// choose approipate malloc function
+		allocateMemory((void**)&k, num * sizeof(double));
+		allocateMemory((void**)&rest, num * sizeof(double));
+		allocateMemory((void**)&damping, num * sizeof(double));
+		allocateMemory((void**)&edge, num * sizeof(Vec2i));
+		allocateMemory((void**)&resetable, num * sizeof(bool));
+		checkMemoryError();
+		this->num = num;
+	}
+	/* free the arrays allocated by init(), only by their owner (see MASS::release) */
+	void release(bool on_host = true) {
+		for (void* ptr : { (void*)k, (void*)rest, (void*)damping, (void*)edge, (void*)resetable }) { freeMemory(ptr, on_host); }
+		*this = SPRING();
+	}
+	void copyFrom(const SPRING& other, cudaStream_t stream = (cudaStream_t)0) { // assuming we have enough streams
+		copyMemory(k, other.k, num * sizeof(double), stream);
+		copyMemory(rest, other.rest, num * sizeof(double), stream);
+		copyMemory(damping, other.damping, num * sizeof(double), stream);
+		copyMemory(edge, other.edge, num * sizeof(Vec2i), stream);
+		copyMemory(resetable, other.resetable, num * sizeof(bool), stream);
+		checkMemoryError();
+		//this->num = other.num;
+	}
+	/* copy count springs starting at offset from other (same offset in both), e.g. to reset one packed instance */
+	void copyFrom(const SPRING& other, int offset, int count, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(k + offset, other.k + offset, count * sizeof(double), stream);
+		copyMemory(rest + offset, other.rest + offset, count * sizeof(double), stream);
+		copyMemory(damping + offset, other.damping + offset, count * sizeof(double), stream);
+		copyMemory(edge + offset, other.edge + offset, count * sizeof(Vec2i), stream);
+		copyMemory(resetable + offset, other.resetable + offset, count * sizeof(bool), stream);
+		checkMemoryError();
+	}
+	/* copy the rest length (the only spring state changed by the simulation) from other */
+	void copyRestFrom(const SPRING& other, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(rest, other.rest, num * sizeof(double), stream);
+		checkMemoryError();
+	}
+};
+
+/* mass-centric (CSR) incidence of the springs, used to gather the spring forces per mass
+   without atomics (ForceAssembly::GATHER): the springs connected to mass i are
+   springId[offset[i]] ... springId[offset[i+1]-1], in increasing spring index (fixed summation order) */
+struct SpringIncidence {
+	int* offset = nullptr; // start of the springs of each mass, size num_mass+1
+	int* springId = nullptr; // index of the incident spring
+	int* dir = nullptr; // direction: left (edge.x)=-1, right (edge.y)=+1
+	Vec3d* force = nullptr; // per-spring force buffer, force on the right mass of the spring, size num_spring
+	int num_mass = 0; // number of masses
+	int num_spring = 0; // number of springs
+	int num = 0; // the length of array "springId", 2*num_spring
+	inline int size() { return num; }
+
+	SpringIncidence() {}
+	/* build (host) from the spring edges */
+	SpringIncidence(const SPRING& spring, int num_mass) { init(spring, num_mass); }
+	/* initialize and copy the state from other SpringIncidence object. must keep the second argument*/
+	SpringIncidence(SpringIncidence other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
+		init(other.num_mass, other.num_spring, on_host);
+		copyFrom(other, stream);
+	}
+	void init(int num_mass, int num_spring, bool on_host = true) {
+		this->num_mass = num_mass;
+		this->num_spring = num_spring;
+		this->num = 2 * num_spring;
+		MallocFcnType allocateMemory = allocateMemoryFcn(on_host);// choose approipate malloc function
+		allocateMemory((void**)&offset, (num_mass + 1) * sizeof(int));
+		allocateMemory((void**)&springId, num * sizeof(int));
+		allocateMemory((void**)&dir, num * sizeof(int));
+		allocateMemory((void**)&force, num_spring * sizeof(Vec3d));
+		checkMemoryError();
+		setMemoryZero(force, num_spring * sizeof(Vec3d), on_host);
+	}
+	/* free the arrays allocated by init(), only by their owner (see MASS::release) */
+	void release(bool on_host = true) {
+		for (void* ptr : { (void*)offset, (void*)springId, (void*)dir, (void*)force }) { freeMemory(ptr, on_host); }
+		*this = SpringIncidence();
+	}
+	void init(const SPRING& spring, int num_mass) { // counting sort of the spring ends by mass (host)
+		init(num_mass, spring.num, true);
+		for (int i = 0; i <= num_mass; i++) { offset[i] = 0; }
+		for (int i = 0; i < spring.num; i++) { // count the springs of each mass
+			offset[spring.edge[i].x + 1]++;
+			offset[spring.edge[i].y + 1]++;
+		}
+		for (int i = 0; i < num_mass; i++) { offset[i + 1] += offset[i]; }
+		std::vector<int> next(offset, offset + num_mass);// next free slot of each mass
+		for (int i = 0; i < spring.num; i++) {
+			int k = next[spring.edge[i].x]++;
+			springId[k] = i;
+			dir[k] = -1;
+			k = next[spring.edge[i].y]++;
+			springId[k] = i;
+			dir[k] = 1;
+		}
+	}
+	void copyFrom(const SpringIncidence& other, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(offset, other.offset, (num_mass + 1) * sizeof(int), stream);
+		copyMemory(springId, other.springId, num * sizeof(int), stream);
+		copyMemory(dir, other.dir, num * sizeof(int), stream);
+		copyMemory(force, other.force, num_spring * sizeof(Vec3d), stream);
+		checkMemoryError();
+	}
+};
+
+
+struct RotAnchors { // the anchors that belongs to the rotational joints
+	Vec2i* edge = nullptr; // index of the (left,right) anchor of the joint
+	Vec3d* dir = nullptr; // direction of the joint,normalized
+	double* theta = nullptr;// the angular increment per joint update
+
+	int* leftCoord = nullptr; // the index of left coordintate (oxyz) start for all joints (flat view)
+	int* rightCoord = nullptr;// the index of right coordintate (oxyz) start for all joints (flat view)
+
+	int num = 0; // num of anchor
+	inline int size() { return num; }
+
+	RotAnchors() {}
+	RotAnchors(std::vector<StdJoint> std_joints, bool on_host = true) { init(std_joints, on_host); }
+
+	/* initialize and copy the state from other RotAnchors object. must keep the second argument*/
+	RotAnchors(RotAnchors other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
+		init(other.num, on_host);
+		copyFrom(other, stream);
+	}
+	void init(int num, bool on_host) {
+		this->num = num;
+		MallocFcnType allocateMemory = allocateMemoryFcn(on_host);// choose approipate malloc function
+		allocateMemory((void**)&edge, num * sizeof(Vec2i));
+		allocateMemory((void**)&dir, num * sizeof(Vec3d));
+		allocateMemory((void**)&theta, num * sizeof(double));
+		allocateMemory((void**)&leftCoord, num * sizeof(int));
+		allocateMemory((void**)&rightCoord, num * sizeof(int));
+		checkMemoryError();
+	}
+	/* free the arrays allocated by init(), only by their owner (see MASS::release) */
+	void release(bool on_host = true) {
+		for (void* ptr : { (void*)edge, (void*)dir, (void*)theta, (void*)leftCoord, (void*)rightCoord }) { freeMemory(ptr, on_host); }
+		*this = RotAnchors();
+	}
+
+	void init(std::vector<StdJoint> std_joints, bool on_host = true) {
+		init(std_joints.size(), on_host);
+
+		if (on_host) { // copy the std_joints to this
+			for (int joint_id = 0; joint_id < num; joint_id++)
+			{
+				edge[joint_id] = std_joints[joint_id].anchor;
+				leftCoord[joint_id] = std_joints[joint_id].leftCoord;
+				rightCoord[joint_id] = std_joints[joint_id].rightCoord;
+				theta[joint_id] = 0; // no rotation until the first joint control update
+			}
+		}
+	}
+
+	void copyFrom(const RotAnchors& other, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(edge, other.edge, num * sizeof(Vec2i), stream);
+		copyMemory(dir, other.dir, num * sizeof(Vec3d), stream);
+		copyMemory(theta, other.theta, num * sizeof(double), stream);
+		copyMemory(leftCoord, other.leftCoord, num * sizeof(int), stream);
+		copyMemory(rightCoord, other.rightCoord, num * sizeof(int), stream);
+		checkMemoryError();
+
+	}
+	void copyThetaFrom(const RotAnchors& other, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(theta, other.theta, num * sizeof(double), stream);
+	}
+	/* copy the theta of count anchors starting at offset from other (same offset in both) */
+	void copyThetaFrom(const RotAnchors& other, int offset, int count, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(theta + offset, other.theta + offset, count * sizeof(double), stream);
+	}
+};
+
+struct RotPoints { // the points that belongs to the rotational joints
+	int* massId = nullptr; // index of the left mass and right mass
+	// the directional anchor index of which the mass is rotated about, 
+	int* anchorId = nullptr;// e.g, k: the k-th anchor,left mass, -k: the k-th anchor, right mass
+	int* dir = nullptr; // direction: left=-1,right=+1
+	int num = 0; // the length of array "id"
+	inline int size() { return num; }
+
+	RotPoints() {}
+	RotPoints(std::vector<StdJoint> std_joints, bool on_host) { init(std_joints, on_host); }
+	/* initialize and copy the state from other RotPoints object. must keep the second argument*/
+	RotPoints(RotPoints other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
+		init(other.num, on_host);
+		copyFrom(other, stream);
+	}
+	void init(int num, bool on_host = true) {
+		this->num = num;
+		// allocate on host or device
+		MallocFcnType allocateMemory = allocateMemoryFcn(on_host);// choose approipate malloc function	
+		allocateMemory((void**)&massId, num * sizeof(int));
+		allocateMemory((void**)&anchorId, num * sizeof(int));
+		allocateMemory((void**)&dir, num * sizeof(int));
+		checkMemoryError();
+	}
+	/* free the arrays allocated by init(), only by their owner (see MASS::release) */
+	void release(bool on_host = true) {
+		for (void* ptr : { (void*)massId, (void*)anchorId, (void*)dir }) { freeMemory(ptr, on_host); }
+		*this = RotPoints();
+	}
+	void init(std::vector<StdJoint> std_joints, bool on_host = true) {
+		num = 0;
+		for (auto& std_joint : std_joints)
+		{
+			num += std_joint.left.size() + std_joint.right.size();
+		}// get the total number of the points in all joints
+		init(num, on_host);
+
+		if (on_host) { // copy the std_joints to this
+			size_t offset = 0;//offset the index by "offset"
+			for (auto joint_id = 0; joint_id < std_joints.size(); joint_id++)
+			{
+				StdJoint& std_joint = std_joints[joint_id];
+
+				for (auto i = 0; i < std_joint.left.size(); i++)
+				{
+					massId[offset + i] = std_joint.left[i];
+					anchorId[offset + i] = joint_id;
+					dir[offset + i] = -1;
+				}
+				offset += std_joint.left.size();//increment offset by num of left
+
+				for (auto i = 0; i < std_joint.right.size(); i++)
+				{
+					massId[offset + i] = std_joint.right[i];
+					anchorId[offset + i] = joint_id;
+					dir[offset + i] = 1;
+				}
+				offset += std_joint.right.size();//increment offset by num of right
+			}
+		}
+	}
+	void copyFrom(const RotPoints& other, cudaStream_t stream = (cudaStream_t)0) {
+		copyMemory(massId, other.massId, num * sizeof(int), stream);
+		copyMemory(anchorId, other.anchorId, num * sizeof(int), stream);
+		copyMemory(dir, other.dir, num * sizeof(int), stream);
+		checkMemoryError();
+
+	}
+};
+
+struct JOINT {
+	RotPoints points;
+	RotAnchors anchors;
+
+	JOINT() {};
+	JOINT(std::vector<StdJoint> std_joints, bool on_host = true) { init(std_joints, on_host); };
+
+	/* initialize and copy the state from other JOINT object. must keep the second argument*/
+	JOINT(JOINT other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
+		points = RotPoints(other.points, on_host, stream);
+		anchors = RotAnchors(other.anchors, on_host, stream);
+	}
+
+	void copyFrom(const JOINT& other, cudaStream_t stream = (cudaStream_t)0) {
+		points.copyFrom(other.points, stream); // copy from the other points
+		anchors.copyFrom(other.anchors, stream); // copy from the other anchor
+	}
+
+	void init(std::vector<StdJoint> std_joints, bool on_host = true) {
+		anchors.init(std_joints, on_host);//initialize anchor
+		points.init(std_joints, on_host);
+	}
+	/* free the arrays allocated by init(), only by their owner (see MASS::release) */
+	void release(bool on_host = true) {
+		points.release(on_host);
+		anchors.release(on_host);
+	}
+	inline int size() { return anchors.num; }
+};
+
+
+/* index offsets of num_instance copies of one robot packed in flat MASS/SPRING/JOINT arrays,
+   instance i owns the masses [i*num_mass,(i+1)*num_mass), the springs [i*num_spring,(i+1)*num_spring),
+   the joints (anchors) [i*num_joint,(i+1)*num_joint) and the joint points [i*num_joint_point,(i+1)*num_joint_point).
+   The instances do not share masses or springs, so the kernels step all of them in one pass */
+struct InstanceLayout {
+	int num_instance = 1; // number of packed instances
+	int num_mass = 0; // number of masses per instance
+	int num_spring = 0; // number of springs per instance
+	int num_joint = 0; // number of joints per instance
+	int num_joint_point = 0; // number of joint points per instance
+
+	InstanceLayout() {}
+	InstanceLayout(int num_instance, int num_mass, int num_spring, int num_joint, int num_joint_point) :
+		num_instance(num_instance), num_mass(num_mass), num_spring(num_spring),
+		num_joint(num_joint), num_joint_point(num_joint_point) {}
+
+	inline int massOffset(int instance) const { return instance * num_mass; }
+	inline int springOffset(int instance) const { return instance * num_spring; }
+	inline int jointOffset(int instance) const { return instance * num_joint; }
+	inline int jointPointOffset(int instance) const { return instance * num_joint_point; }
+};
+
+/* allocate (host) and fill mass, spring and joint with num_instance copies of the (host) robot
+   src_mass, src_spring, src_joint, the mass indices and the anchor indices are offset per instance */
+inline InstanceLayout packInstances(const MASS& src_mass, const SPRING& src_spring, const JOINT& src_joint,
+	const int num_instance, MASS& mass, SPRING& spring, JOINT& joint) {
+	InstanceLayout layout(num_instance, src_mass.num, src_spring.num, src_joint.anchors.num, src_joint.points.num);
+
+	mass.init(layout.num_mass * num_instance, true);
+	spring.init(layout.num_spring * num_instance, true);
+	joint.anchors.init(layout.num_joint * num_instance, true);
+	joint.points.init(layout.num_joint_point * num_instance, true);
+
+	for (int k = 0; k < num_instance; k++)
+	{
+		const int mass_offset = layout.massOffset(k);
+		const int spring_offset = layout.springOffset(k);
+		const int joint_offset = layout.jointOffset(k);
+		const int point_offset = layout.jointPointOffset(k);
+		for (int i = 0; i < layout.num_mass; i++)
+		{
+			mass.m[mass_offset + i] = src_mass.m[i];
+			mass.pos[mass_offset + i] = src_mass.pos[i];
+			mass.vel[mass_offset + i] = src_mass.vel[i];
+			mass.acc[mass_offset + i] = src_mass.acc[i];
+			mass.force[mass_offset + i] = src_mass.force[i];
+			mass.force_extern[mass_offset + i] = src_mass.force_extern[i];
+			mass.color[mass_offset + i] = src_mass.color[i];
+			mass.fixed[mass_offset + i] = src_mass.fixed[i];
+			mass.constrain[mass_offset + i] = src_mass.constrain[i];
+		}
+		for (int i = 0; i < layout.num_spring; i++)
+		{
+			spring.k[spring_offset + i] = src_spring.k[i];
+			spring.rest[spring_offset + i] = src_spring.rest[i];
+			spring.damping[spring_offset + i] = src_spring.damping[i];
+			spring.edge[spring_offset + i] = Vec2i(src_spring.edge[i].x + mass_offset, src_spring.edge[i].y + mass_offset);
+			spring.resetable[spring_offset + i] = src_spring.resetable[i];
+		}
+		for (int i = 0; i < layout.num_joint; i++)
+		{
+			const RotAnchors& a = src_joint.anchors;
+			joint.anchors.edge[joint_offset + i] = Vec2i(a.edge[i].x + mass_offset, a.edge[i].y + mass_offset);
+			joint.anchors.theta[joint_offset + i] = a.theta[i];
+			joint.anchors.leftCoord[joint_offset + i] = a.leftCoord[i] + mass_offset;
+			joint.anchors.rightCoord[joint_offset + i] = a.rightCoord[i] + mass_offset;
+		}
+		for (int i = 0; i < layout.num_joint_point; i++)
+		{
+			joint.points.massId[point_offset + i] = src_joint.points.massId[i] + mass_offset;
+			joint.points.anchorId[point_offset + i] = src_joint.points.anchorId[i] + joint_offset;
+			joint.points.dir[point_offset + i] = src_joint.points.dir[i];
+		}
+	}
+	return layout;
+}
+
+
+#endif // TITAN_MODEL_H
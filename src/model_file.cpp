@@ -0,0 +1,223 @@
+/*
+model_file.cpp: write and memory-map the binary robot model format, see model_file.h
+*/
+
+#include "model_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+constexpr int JOINT_FIELDS = 6; // leftCoord, rightCoord, anchor left, anchor right, num left, num right
+
+static_assert(sizeof(Vec3d) == 3 * sizeof(double), "VERTICES/COLORS are read in place as Vec3d");
+static_assert(sizeof(Vec2i) == 2 * sizeof(int32_t), "EDGES are read in place as Vec2i");
+
+static inline uint64_t alignUp(uint64_t offset) {
+	return (offset + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT;
+}
+
+bool writeModelFile(const Model& bot, const char* file_path) {
+	const size_t num_vertex = bot.vertices.size();
+	const size_t num_edge = bot.edges.size();
+
+	// flatten the nested vectors of the msgpack model
+	std::vector<Vec3d> vertices(num_vertex), colors(num_vertex);
+	std::vector<uint8_t> is_surface(num_vertex);
+	for (size_t i = 0; i < num_vertex; i++) {
+		vertices[i] = bot.vertices[i];
+		colors[i] = bot.colors[i];
+		is_surface[i] = bot.isSurface[i];
+	}
+	std::vector<Vec2i> edges(num_edge);
+	for (size_t i = 0; i < num_edge; i++) { edges[i] = bot.edges[i]; }
+	std::vector<int32_t> joints, joint_points;
+	for (const StdJoint& j : bot.Joints) {
+		const int32_t fields[JOINT_FIELDS] = { j.leftCoord, j.rightCoord,
+			j.anchor.size() > 0 ? j.anchor[0] : -1, j.anchor.size() > 1 ? j.anchor[1] : -1,
+			(int32_t)j.left.size(), (int32_t)j.right.size() };
+		joints.insert(joints.end(), fields, fields + JOINT_FIELDS);
+		joint_points.insert(joint_points.end(), j.left.begin(), j.left.end());
+		joint_points.insert(joint_points.end(), j.right.begin(), j.right.end());
+	}
+
+	const bool reordered = !bot.vertex_order.empty();
+
+	const void* section_data[MODEL_NUM_SECTION] = { vertices.data(), edges.data(), colors.data(), is_surface.data(),
+		bot.idVertices.data(), bot.idEdges.data(), joints.data(), joint_points.data(), bot.vertex_order.data() };
+	const uint64_t section_size[MODEL_NUM_SECTION] = { num_vertex * sizeof(Vec3d), num_edge * sizeof(Vec2i),
+		num_vertex * sizeof(Vec3d), num_vertex * sizeof(uint8_t), bot.idVertices.size() * sizeof(int32_t),
+		bot.idEdges.size() * sizeof(int32_t), joints.size() * sizeof(int32_t), joint_points.size() * sizeof(int32_t),
+		bot.vertex_order.size() * sizeof(int32_t) };
+
+	ModelFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MODEL_FILE_MAGIC, sizeof(header.magic));
+	header.version = MODEL_FILE_VERSION;
+	header.endian = MODEL_FILE_ENDIAN;
+	header.num_section = MODEL_NUM_SECTION;
+	header.reordered = reordered ? 1 : 0;
+	uint64_t offset = alignUp(sizeof(ModelFileHeader));
+	for (int s = 0; s < MODEL_NUM_SECTION; s++) {
+		header.section[s].offset = offset;
+		header.section[s].size = section_size[s];
+		offset = alignUp(offset + section_size[s]);
+	}
+	header.file_size = offset;
+
+	std::ofstream ofs(file_path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+	if (!ofs) { return false; }
+	const char padding[MODEL_FILE_ALIGNMENT] = {};
+	ofs.write((const char*)&header, sizeof(header));
+	uint64_t written = sizeof(header);
+	for (int s = 0; s < MODEL_NUM_SECTION; s++) {
+		ofs.write(padding, header.section[s].offset - written);
+		ofs.write((const char*)section_data[s], section_size[s]);
+		written = header.section[s].offset + section_size[s];
+	}
+	ofs.write(padding, header.file_size - written);
+	return ofs.good();
+}
+
+bool isModelFile(const char* file_path) {
+	char magic[sizeof(MODEL_FILE_MAGIC)];
+	FILE* file = fopen(file_path, "rb");
+	if (file == nullptr) { return false; }
+	const bool is_model = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+		memcmp(magic, MODEL_FILE_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return is_model;
+}
+
+MappedModel::MappedModel(const char* file_path) {
+	const std::string path_str(file_path);
+#ifdef _WIN32
+	HANDLE file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) { throw std::runtime_error("MappedModel: cannot open " + path_str); }
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	size = (size_t)file_size.QuadPart;
+	HANDLE mapping = size > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	file_handle = file;
+	mapping_handle = mapping;
+	if (mapping != nullptr) { data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0); }
+#else
+	const int fd = open(file_path, O_RDONLY);
+	if (fd < 0) { throw std::runtime_error("MappedModel: cannot open " + path_str); }
+	struct stat st;
+	size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+	if (size > 0) {
+		void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		data = addr != MAP_FAILED ? (const char*)addr : nullptr;
+	}
+	close(fd); // the mapping keeps the file open
+#endif
+
+	try {
+		if (data == nullptr || size < sizeof(ModelFileHeader)) {
+			throw std::runtime_error("MappedModel: cannot map " + path_str);
+		}
+		const ModelFileHeader& header = *(const ModelFileHeader*)data;
+		if (memcmp(header.magic, MODEL_FILE_MAGIC, sizeof(header.magic)) != 0) {
+			throw std::runtime_error("MappedModel: not a binary model file " + path_str);
+		}
+		if (header.endian != MODEL_FILE_ENDIAN || header.version != MODEL_FILE_VERSION ||
+			header.num_section != MODEL_NUM_SECTION || header.file_size > size) {
+			throw std::runtime_error("MappedModel: unsupported version, byte order or truncated file " + path_str);
+		}
+		reordered = header.reordered != 0;
+
+		uint64_t count, num_color, num_surface, num_id_vertices, num_id_edges, num_joint_points;
+		vertices = (const Vec3d*)sectionData(header, MODEL_VERTICES, sizeof(Vec3d), count);
+		num_vertex = (int)count;
+		edges = (const Vec2i*)sectionData(header, MODEL_EDGES, sizeof(Vec2i), count);
+		num_edge = (int)count;
+		colors = (const Vec3d*)sectionData(header, MODEL_COLORS, sizeof(Vec3d), num_color);
+		is_surface = (const uint8_t*)sectionData(header, MODEL_SURFACE, sizeof(uint8_t), num_surface);
+		const int32_t* id_vertices = (const int32_t*)sectionData(header, MODEL_ID_VERTICES, sizeof(int32_t), num_id_vertices);
+		const int32_t* id_edges = (const int32_t*)sectionData(header, MODEL_ID_EDGES, sizeof(int32_t), num_id_edges);
+		const int32_t* joints = (const int32_t*)sectionData(header, MODEL_JOINTS, JOINT_FIELDS * sizeof(int32_t), count);
+		num_joint = (int)count;
+		const int32_t* joint_points = (const int32_t*)sectionData(header, MODEL_JOINT_POINTS, sizeof(int32_t), num_joint_points);
+		if (num_color != (uint64_t)num_vertex || num_surface != (uint64_t)num_vertex) {
+			throw std::runtime_error("MappedModel: inconsistent vertex sections " + path_str);
+		}
+		uint64_t num_order;
+		const int32_t* order = (const int32_t*)sectionData(header, MODEL_VERTEX_ORDER, sizeof(int32_t), num_order);
+		if (num_order != (reordered ? (uint64_t)num_vertex : 0)) {
+			throw std::runtime_error("MappedModel: inconsistent vertex order section " + path_str);
+		}
+		std::vector<bool> seen(num_order, false); // the order must be a permutation
+		for (uint64_t i = 0; i < num_order; i++) {
+			if (order[i] < 0 || (uint64_t)order[i] >= num_order || seen[order[i]]) {
+				throw std::runtime_error("MappedModel: the vertex order is not a permutation " + path_str);
+			}
+			seen[order[i]] = true;
+		}
+		if (reordered) { vertex_order = order; }
+
+		idVertices.assign(id_vertices, id_vertices + num_id_vertices);
+		idEdges.assign(id_edges, id_edges + num_id_edges);
+		Joints.resize(num_joint);
+		uint64_t k = 0; // start of the points of joint i in joint_points
+		for (int i = 0; i < num_joint; i++) {
+			const int32_t* fields = joints + (size_t)i * JOINT_FIELDS;
+			const uint64_t num_left = (uint64_t)fields[4], num_right = (uint64_t)fields[5];
+			if (k + num_left + num_right > num_joint_points) {
+				throw std::runtime_error("MappedModel: inconsistent joint sections " + path_str);
+			}
+			StdJoint& joint = Joints[i];
+			joint.leftCoord = fields[0];
+			joint.rightCoord = fields[1];
+			joint.anchor = { fields[2], fields[3] };
+			joint.left.assign(joint_points + k, joint_points + k + num_left);
+			joint.right.assign(joint_points + k + num_left, joint_points + k + num_left + num_right);
+			k += num_left + num_right;
+		}
+	}
+	catch (...) {
+		unmap(); // the destructor does not run when the constructor throws
+		throw;
+	}
+}
+
+MappedModel::~MappedModel() { unmap(); }
+
+void MappedModel::unmap() {
+#ifdef _WIN32
+	if (data != nullptr) { UnmapViewOfFile(data); }
+	if (mapping_handle != nullptr) { CloseHandle((HANDLE)mapping_handle); }
+	if (file_handle != nullptr) { CloseHandle((HANDLE)file_handle); }
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+#else
+	if (data != nullptr) { munmap((void*)data, size); }
+#endif
+	data = nullptr;
+}
+
+const void* MappedModel::sectionData(const ModelFileHeader& header, ModelFileSectionId id,
+	uint64_t element_size, uint64_t& count) const {
+	const ModelFileSection& section = header.section[id];
+	if (section.offset % MODEL_FILE_ALIGNMENT != 0 || section.size % element_size != 0 ||
+		section.offset > header.file_size || section.size > header.file_size - section.offset) {
+		throw std::runtime_error("MappedModel: invalid section " + std::to_string(id));
+	}
+	count = section.size / element_size;
+	return data + section.offset;
+}
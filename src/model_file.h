@@ -0,0 +1,101 @@
+/*
+model_file.h: versioned binary robot model format, a flat alternative to the msgpack Model (model.h).
+The file is a ModelFileHeader followed by columnar sections, each aligned to MODEL_FILE_ALIGNMENT:
+	VERTICES	double[num_vertex][3]	mass positions (same layout as Vec3d)
+	EDGES		int32[num_edge][2]		spring (left,right) mass ids (same layout as Vec2i)
+	COLORS		double[num_vertex][3]	mass colors
+	SURFACE		uint8[num_vertex]		whether the mass is near the surface
+	ID_VERTICES	int32[]					group ranges of the vertices (Model::idVertices)
+	ID_EDGES	int32[]					group ranges of the edges (Model::idEdges)
+	JOINTS		int32[num_joint][6]		leftCoord, rightCoord, anchor left, anchor right, num left, num right
+	JOINT_POINTS	int32[]				left then right point ids of each joint
+	VERTEX_ORDER	int32[num_vertex]	original index of each mass if reordered (Model::vertex_order), else empty
+MappedModel maps the file read-only (mmap/MapViewOfFile), the sections are used in place: the pages
+are shared by all processes loading the same file and nothing is parsed or unpacked.
+Convert a msgpack model with flexipod_convert (convert.cpp).
+*/
+
+#ifndef TITAN_MODEL_FILE_H
+#define TITAN_MODEL_FILE_H
+
+#include "model.h"
+
+#include <cstdint>
+#include <vector>
+
+constexpr char MODEL_FILE_MAGIC[8] = { 'F','L','X','M','O','D','E','L' };
+constexpr uint32_t MODEL_FILE_VERSION = 1;
+constexpr uint32_t MODEL_FILE_ENDIAN = 0x01020304; // reads back differently on a machine of the other byte order
+constexpr uint64_t MODEL_FILE_ALIGNMENT = 64; // [bytes] alignment of the sections (cache line)
+
+enum ModelFileSectionId {
+	MODEL_VERTICES = 0,
+	MODEL_EDGES,
+	MODEL_COLORS,
+	MODEL_SURFACE,
+	MODEL_ID_VERTICES,
+	MODEL_ID_EDGES,
+	MODEL_JOINTS,
+	MODEL_JOINT_POINTS,
+	MODEL_VERTEX_ORDER,
+	MODEL_NUM_SECTION
+};
+
+struct ModelFileSection {
+	uint64_t offset; // [bytes] from the start of the file, multiple of MODEL_FILE_ALIGNMENT
+	uint64_t size; // [bytes]
+};
+
+struct ModelFileHeader {
+	char magic[8]; // MODEL_FILE_MAGIC
+	uint32_t version; // MODEL_FILE_VERSION
+	uint32_t endian; // MODEL_FILE_ENDIAN
+	uint64_t file_size; // [bytes]
+	uint32_t num_section; // MODEL_NUM_SECTION
+	uint32_t reordered; // 1 if the model was reordered (Model::reorder) before writing, then VERTEX_ORDER holds the order
+	ModelFileSection section[MODEL_NUM_SECTION];
+};
+
+/* write bot to file_path in the binary model format, with bot.vertex_order if it was reordered,
+   returns false if the file cannot be written */
+bool writeModelFile(const Model& bot, const char* file_path);
+
+/* whether file_path starts with MODEL_FILE_MAGIC */
+bool isModelFile(const char* file_path);
+
+/* read-only mapping of a binary model file, throws std::runtime_error if the file is missing or invalid */
+class MappedModel {
+public:
+	int num_vertex = 0;
+	int num_edge = 0;
+	int num_joint = 0;
+	bool reordered = false;
+
+	const Vec3d* vertices = nullptr; // [num_vertex]
+	const Vec2i* edges = nullptr; // [num_edge]
+	const Vec3d* colors = nullptr; // [num_vertex]
+	const uint8_t* is_surface = nullptr; // [num_vertex]
+	const int32_t* vertex_order = nullptr; // [num_vertex] original index of each mass if reordered, nullptr otherwise
+	std::vector<int> idVertices; // group ranges (small, copied)
+	std::vector<int> idEdges;
+	std::vector<StdJoint> Joints; // joints (small, copied)
+
+	MappedModel(const char* file_path);
+	~MappedModel();
+	MappedModel(const MappedModel&) = delete;
+	MappedModel& operator=(const MappedModel&) = delete;
+
+	inline size_t fileSize() const { return size; }
+
+private:
+	const char* data = nullptr; // start of the mapping
+	size_t size = 0; // [bytes] size of the mapping
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+	void unmap();
+	const void* sectionData(const ModelFileHeader& header, ModelFileSectionId id, uint64_t element_size, uint64_t& count) const;
+};
+
+#endif // TITAN_MODEL_FILE_H
@@ -0,0 +1,378 @@
+/*
+model_gen.cpp: procedural soft-body robots, see model_gen.h
+*/
+
+#include "model_gen.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr int NUM_OXYZ_POINT = 7; // o, o+d*e0, o+d*e1, o+d*e2, o-d*e0, o-d*e1, o-d*e2
+constexpr int NUM_OXYZ_ANCHOR = 20; // each oxyz point is anchored to its 20 nearest masses of the part
+
+struct Box {
+	Vec3d lo, hi;
+};
+
+/* number of lattice points of spacing h along each axis of box, returns the number of points */
+int64_t latticeSize(const Box& box, double h, int n[3]) {
+	for (int d = 0; d < 3; d++) { n[d] = std::max((int)std::floor((box.hi[d] - box.lo[d]) / h + 1e-9) + 1, 1); }
+	return (int64_t)n[0] * n[1] * n[2];
+}
+
+/* uniform grid over a set of points for radius queries, cell: [m] cell size */
+class PointGrid {
+public:
+	PointGrid(const std::vector<Vec3d>& pos, const std::vector<int>& ids, double cell) : pos(pos), cell(cell) {
+		lo = Vec3d(HUGE_VAL, HUGE_VAL, HUGE_VAL);
+		Vec3d hi = -lo;
+		for (int i : ids) {
+			for (int d = 0; d < 3; d++) {
+				lo[d] = std::min(lo[d], pos[i][d]);
+				hi[d] = std::max(hi[d], pos[i][d]);
+			}
+		}
+		for (int d = 0; d < 3; d++) { n[d] = ids.empty() ? 1 : (int)((hi[d] - lo[d]) / cell) + 1; }
+		// counting sort of the ids by cell
+		cell_start.assign((size_t)n[0] * n[1] * n[2] + 1, 0);
+		for (int i : ids) { cell_start[cellOf(pos[i]) + 1]++; }
+		for (size_t c = 1; c < cell_start.size(); c++) { cell_start[c] += cell_start[c - 1]; }
+		sorted.resize(ids.size());
+		std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+		for (int i : ids) { sorted[fill[cellOf(pos[i])]++] = i; }
+	}
+
+	/* call fn(j, squared distance) for every point j closer than r to p */
+	template<class Fn>
+	void forEachWithin(const Vec3d& p, double r, Fn fn) const {
+		int c_lo[3], c_hi[3];
+		for (int d = 0; d < 3; d++) {
+			c_lo[d] = std::max((int)std::floor((p[d] - r - lo[d]) / cell), 0);
+			c_hi[d] = std::min((int)std::floor((p[d] + r - lo[d]) / cell), n[d] - 1);
+		}
+		const double r2 = r * r;
+		for (int z = c_lo[2]; z <= c_hi[2]; z++) for (int y = c_lo[1]; y <= c_hi[1]; y++) for (int x = c_lo[0]; x <= c_hi[0]; x++) {
+			const size_t c = ((size_t)z * n[1] + y) * n[0] + x;
+			for (int k = cell_start[c]; k < cell_start[c + 1]; k++) {
+				const int j = sorted[k];
+				const double d2 = (pos[j] - p).SquaredSum();
+				if (d2 < r2) { fn(j, d2); }
+			}
+		}
+	}
+
+private:
+	const std::vector<Vec3d>& pos;
+	double cell;
+	Vec3d lo;
+	int n[3];
+	std::vector<int> cell_start; // start of each cell in sorted
+	std::vector<int> sorted; // the ids ordered by cell
+
+	size_t cellOf(const Vec3d& p) const {
+		int c[3];
+		for (int d = 0; d < 3; d++) { c[d] = std::min(std::max((int)((p[d] - lo[d]) / cell), 0), n[d] - 1); }
+		return ((size_t)c[2] * n[1] + c[1]) * n[0] + c[0];
+	}
+};
+
+/* the points of one robot being generated */
+struct Builder {
+	const GeneratorOptions& opt;
+	std::vector<Vec3d> pos;
+	std::vector<Vec3d> color;
+	std::vector<bool> is_surface;
+	uint32_t rng;
+
+	Builder(const GeneratorOptions& opt) : opt(opt), rng(opt.seed * 2654435761u + 1) {}
+
+	int add(const Vec3d& p, const Vec3d& c, bool surface = false) {
+		pos.push_back(p);
+		color.push_back(c);
+		is_surface.push_back(surface);
+		return (int)pos.size() - 1;
+	}
+
+	/* uniform in [-0.5,0.5), xorshift32: the same models on every platform */
+	double uniform() {
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		return rng * (1.0 / 4294967296.0) - 0.5;
+	}
+
+	/* fill the box with a (jittered) lattice of spacing radius, centered in the box */
+	std::vector<int> sampleBox(const Box& box, const Vec3d& c) {
+		const double h = opt.radius;
+		int n[3];
+		latticeSize(box, h, n);
+		Vec3d start;
+		for (int d = 0; d < 3; d++) { start[d] = 0.5 * (box.lo[d] + box.hi[d] - (n[d] - 1) * h); }
+		const double jitter = opt.sampling == Sampling::JITTERED ? 0.5 * h : 0.; // up to radius/4 either way
+		std::vector<int> ids;
+		ids.reserve((size_t)n[0] * n[1] * n[2]);
+		for (int z = 0; z < n[2]; z++) for (int y = 0; y < n[1]; y++) for (int x = 0; x < n[0]; x++) {
+			Vec3d p = start + Vec3d(x, y, z) * h;
+			if (jitter > 0) { p += Vec3d(uniform(), uniform(), uniform()) * jitter; }
+			const bool surface = x == 0 || y == 0 || z == 0 || x == n[0] - 1 || y == n[1] - 1 || z == n[2] - 1;
+			ids.push_back(add(p, c, surface));
+		}
+		return ids;
+	}
+
+	/* springs between the points of ids closer than radius_knn, each pair once */
+	void connect(const std::vector<int>& ids, std::vector<Vec2i>& edges) const {
+		PointGrid grid(pos, ids, opt.radius_knn);
+		for (int i : ids) {
+			grid.forEachWithin(pos[i], opt.radius_knn, [&](int j, double) {
+				if (j > i) { edges.push_back(Vec2i(i, j)); }
+			});
+		}
+	}
+
+	/* oxyz coordinate system at origin, e1 x e2 = e0, returns the index of the origin */
+	int addOxyz(const Vec3d& origin, const Vec3d& e1, const Vec3d& e2) {
+		const double d = 1.6 * opt.radius; // 16 mm for the slicer radius
+		const Vec3d e0 = cross(e1, e2);
+		const Vec3d c(1, 0, 0);
+		const int o = add(origin, c);
+		for (const Vec3d& e : { e0, e1, e2 }) { add(origin + e * d, c); }
+		for (const Vec3d& e : { e0, e1, e2 }) { add(origin - e * d, c); }
+		return o;
+	}
+
+	/* springs between the points of the oxyz at o (all pairs) and to the NUM_OXYZ_ANCHOR nearest points of a part */
+	void anchorOxyz(int o, const PointGrid& grid, std::vector<Vec2i>& self_edges, std::vector<Vec2i>& anchor_edges) const {
+		for (int i = o; i < o + NUM_OXYZ_POINT; i++) {
+			for (int j = i + 1; j < o + NUM_OXYZ_POINT; j++) { self_edges.push_back(Vec2i(i, j)); }
+		}
+		for (int i = o; i < o + NUM_OXYZ_POINT; i++) {
+			std::vector<std::pair<double, int> > near; // (squared distance, point)
+			for (double r = 2 * opt.radius; near.size() < NUM_OXYZ_ANCHOR && r < 1e3 * opt.radius; r *= 2) {
+				near.clear();
+				grid.forEachWithin(pos[i], r, [&near](int j, double d2) { near.push_back({ d2, j }); });
+			}
+			const size_t num_near = std::min(near.size(), (size_t)NUM_OXYZ_ANCHOR);
+			std::partial_sort(near.begin(), near.begin() + num_near, near.end());
+			for (size_t k = 0; k < num_near; k++) { anchor_edges.push_back(Vec2i(i, near[k].second)); }
+		}
+	}
+};
+
+/* leg k: side (+1: +y, -1: -y), joint axis position along x, direction of the leg from the axis along x */
+struct LegPlacement {
+	double side;
+	double x;
+	double dir;
+};
+
+std::vector<LegPlacement> placeLegs(int num_leg, double body_length, double hub) {
+	// +y side from front to back, then -y side from back to front (front left, back left, back right, front right)
+	const int num_left = (num_leg + 1) / 2;
+	const int num_right = num_leg / 2;
+	auto axisX = [&](int k, int n) { return n > 1 ? (0.5 * body_length - hub) * (1 - 2.0 * k / (n - 1)) : 0.; };
+	std::vector<LegPlacement> legs;
+	for (int k = 0; k < num_left; k++) { legs.push_back({ 1, axisX(k, num_left), 0 }); }
+	for (int k = num_right - 1; k >= 0; k--) { legs.push_back({ -1, axisX(k, num_right), 0 }); }
+	for (LegPlacement& leg : legs) { leg.dir = leg.x < 0 ? -1 : 1; }
+	return legs;
+}
+
+/* geometry of the robot with the sizes of opt multiplied by scale */
+struct RobotLayout {
+	double hub; // [m] radius of the leg around the joint axis
+	double joint_radius; // [m] the joint points are closer than this to the axis
+	double joint_depth; // [m] depth of the joint points into the body along y
+	double z_axis; // [m] height of the joint axes, the middle of the body
+	double y_face; // [m] |y| of the body faces next to the legs
+	double leg_thickness; // [m] along y
+	Box body;
+	std::vector<LegPlacement> legs;
+	std::vector<Box> leg_boxes;
+};
+
+RobotLayout layoutRobot(const GeneratorOptions& opt, double scale) {
+	const double h = opt.radius;
+	const Vec3d body = opt.body_size * scale;
+	const Vec3d leg = opt.leg_size * scale;
+	RobotLayout layout;
+	layout.hub = 0.5 * leg.z;
+	layout.joint_radius = std::max(layout.hub, 1.5 * h);
+	layout.joint_depth = std::max(leg.y, 2 * h);
+	layout.z_axis = h + 0.5 * body.z;
+	layout.y_face = 0.5 * body.y;
+	layout.leg_thickness = leg.y;
+	layout.body = { Vec3d(-0.5 * body.x, -0.5 * body.y, h), Vec3d(0.5 * body.x, 0.5 * body.y, h + body.z) };
+	layout.legs = placeLegs(opt.num_leg, body.x, layout.hub);
+
+	double leg_length = leg.x;
+	const int num_per_side = (opt.num_leg + 1) / 2;
+	if (num_per_side > 2) { // keep the legs along a side apart
+		leg_length = std::min(leg_length, (body.x - 2 * layout.hub) / (num_per_side - 1) - 2 * layout.hub - h);
+	}
+	if (body.x < 4 * layout.hub || leg_length < h) {
+		throw std::runtime_error("generateModel: the legs do not fit along the body, use fewer legs or a longer body");
+	}
+	for (const LegPlacement& p : layout.legs) {
+		const double y_in = layout.y_face + h; // one spacing between the body and the leg
+		const double y_out = y_in + leg.y;
+		const double x_a = p.x - p.dir * layout.hub;
+		const double x_b = p.x + p.dir * leg_length;
+		layout.leg_boxes.push_back({ Vec3d(std::min(x_a, x_b), p.side > 0 ? y_in : -y_out, layout.z_axis - layout.hub),
+			Vec3d(std::max(x_a, x_b), p.side > 0 ? y_out : -y_in, layout.z_axis + layout.hub) });
+	}
+	return layout;
+}
+
+/* number of masses of the body and the legs */
+int64_t countMasses(const RobotLayout& layout, double h) {
+	int n[3];
+	int64_t num_mass = latticeSize(layout.body, h, n);
+	for (const Box& box : layout.leg_boxes) { num_mass += latticeSize(box, h, n); }
+	return num_mass;
+}
+
+void appendGroup(Model& bot, const std::vector<Vec2i>& edges) {
+	for (const Vec2i& e : edges) { bot.edges.push_back({ e.x, e.y }); }
+	bot.idEdges.push_back((int)bot.edges.size());
+}
+
+} // namespace
+
+Model generateModel(const GeneratorOptions& options) {
+	GeneratorOptions opt = options;
+	if (opt.radius <= 0 || opt.radius_knn <= opt.radius) {
+		throw std::runtime_error("generateModel: radius must be >0 and radius_knn > radius");
+	}
+	if (opt.num_leg < 0) { throw std::runtime_error("generateModel: num_leg must be >=0"); }
+	const double h = opt.radius;
+
+	double scale = 1;
+	if (opt.num_mass > 0) { // the smallest scale with at least num_mass masses (bisection, the count grows with the scale)
+		double lo = 0, hi = 1;
+		auto fits = [&](double scale) { // the legs fit and there are enough masses
+			try { return countMasses(layoutRobot(opt, scale), h) >= opt.num_mass; }
+			catch (const std::runtime_error&) { return false; }
+		};
+		while (!fits(hi)) {
+			lo = hi;
+			hi *= 2;
+			if (hi > 1e6) { throw std::runtime_error("generateModel: num_mass is out of range"); }
+		}
+		for (int i = 0; i < 50 && hi - lo > 1e-9 * hi; i++) {
+			const double mid = 0.5 * (lo + hi);
+			if (fits(mid)) { hi = mid; }
+			else { lo = mid; }
+		}
+		scale = hi;
+	}
+	const RobotLayout layout = layoutRobot(opt, scale);
+	const std::vector<LegPlacement>& legs = layout.legs;
+
+	Builder builder(opt);
+	std::vector<std::vector<int> > parts; // body, legs
+	parts.push_back(builder.sampleBox(layout.body, Vec3d(0.6, 0.6, 0.6)));
+	const Vec3d leg_color[4] = { Vec3d(0.9, 0.5, 0.1), Vec3d(0.1, 0.6, 0.9), Vec3d(0.2, 0.8, 0.3), Vec3d(0.8, 0.3, 0.8) };
+	for (size_t k = 0; k < legs.size(); k++) { parts.push_back(builder.sampleBox(layout.leg_boxes[k], leg_color[k % 4])); }
+
+	Model bot;
+	bot.idVertices.push_back(0);
+	for (const std::vector<int>& part : parts) { bot.idVertices.push_back(part.back() + 1); } // body, legs
+
+	// joints: the anchor pair on the axis, the body points (left) and the leg points (right) around the axis
+	std::vector<StdJoint> joints(legs.size());
+	for (size_t k = 0; k < legs.size(); k++) {
+		const LegPlacement& leg = legs[k];
+		const double y_face = layout.y_face; // body face next to the leg
+		const double z_axis = layout.z_axis;
+		const Vec3d a0(leg.x, leg.side * (y_face - layout.joint_depth), z_axis);
+		const Vec3d a1(leg.x, leg.side * (y_face + h + layout.leg_thickness), z_axis);
+		joints[k].anchor = { builder.add(a0, Vec3d(1, 0, 0)), builder.add(a1, Vec3d(1, 0, 0)) };
+		bot.idVertices.push_back((int)builder.pos.size()); // anchor k
+		auto nearAxis = [&](int i) {
+			const Vec3d& p = builder.pos[i];
+			return (p.x - leg.x) * (p.x - leg.x) + (p.z - z_axis) * (p.z - z_axis) < layout.joint_radius * layout.joint_radius;
+		};
+		for (int i : parts[0]) {
+			if (nearAxis(i) && leg.side * builder.pos[i].y > y_face - layout.joint_depth) { joints[k].left.push_back(i); }
+		}
+		for (int i : parts[k + 1]) {
+			if (nearAxis(i)) { joints[k].right.push_back(i); }
+		}
+		if (joints[k].left.empty() || joints[k].right.empty()) {
+			throw std::runtime_error("generateModel: a joint has no points, radius is too large for the robot size");
+		}
+	}
+
+	// oxyz_body at the body center (e0=+y, e1=+z, e2=+x), oxyz_joint_body and oxyz_joint_leg at the middle of
+	// the anchors (e0 perpendicular to the axis, e1=+z, e2 along the axis), as in the slicer output
+	const int oxyz_body = builder.addOxyz(Vec3d(0, 0, layout.z_axis), Vec3d(0, 0, 1), Vec3d(1, 0, 0));
+	bot.idVertices.push_back((int)builder.pos.size());
+	for (size_t k = 0; k < legs.size(); k++) {
+		const Vec3d& a0 = builder.pos[joints[k].anchor[0]];
+		const Vec3d& a1 = builder.pos[joints[k].anchor[1]];
+		const Vec3d axis = (a1 - a0) / (a1 - a0).norm();
+		joints[k].leftCoord = builder.addOxyz(0.5 * (a0 + a1), Vec3d(0, 0, 1), axis);
+		bot.idVertices.push_back((int)builder.pos.size());
+		joints[k].rightCoord = builder.addOxyz(0.5 * (a0 + a1), Vec3d(0, 0, 1), axis);
+		bot.idVertices.push_back((int)builder.pos.size());
+	}
+
+	// springs
+	bot.idEdges.push_back(0);
+	for (const std::vector<int>& part : parts) { // body, legs
+		std::vector<Vec2i> edges;
+		builder.connect(part, edges);
+		appendGroup(bot, edges);
+	}
+	std::vector<Vec2i> anchors, rot_springs, fric_springs;
+	for (const StdJoint& joint : joints) {
+		anchors.push_back(Vec2i(joint.anchor[0], joint.anchor[1]));
+		for (int a : joint.anchor) {
+			for (int i : joint.left) { rot_springs.push_back(Vec2i(a, i)); }
+			for (int i : joint.right) { rot_springs.push_back(Vec2i(a, i)); }
+		}
+		PointGrid grid(builder.pos, joint.right, opt.radius_knn);
+		for (int i : joint.left) { // friction springs across the joint, reset every update
+			grid.forEachWithin(builder.pos[i], 2 * opt.radius_knn, [&](int j, double) { fric_springs.push_back(Vec2i(i, j)); });
+		}
+	}
+	appendGroup(bot, anchors);
+	appendGroup(bot, rot_springs);
+	appendGroup(bot, fric_springs);
+
+	std::vector<Vec2i> oxyz_self, oxyz_anchor;
+	std::vector<PointGrid> grids;
+	grids.reserve(parts.size());
+	for (const std::vector<int>& part : parts) { grids.emplace_back(builder.pos, part, opt.radius_knn); }
+	builder.anchorOxyz(oxyz_body, grids[0], oxyz_self, oxyz_anchor);
+	for (size_t k = 0; k < joints.size(); k++) {
+		builder.anchorOxyz(joints[k].leftCoord, grids[0], oxyz_self, oxyz_anchor);
+		builder.anchorOxyz(joints[k].rightCoord, grids[k + 1], oxyz_self, oxyz_anchor);
+	}
+	appendGroup(bot, oxyz_self);
+	appendGroup(bot, oxyz_anchor);
+
+	const size_t num_vertex = builder.pos.size();
+	bot.vertices.resize(num_vertex);
+	bot.colors.resize(num_vertex);
+	for (size_t i = 0; i < num_vertex; i++) {
+		bot.vertices[i] = { builder.pos[i].x, builder.pos[i].y, builder.pos[i].z };
+		bot.colors[i] = { builder.color[i].x, builder.color[i].y, builder.color[i].z };
+	}
+	bot.isSurface = std::move(builder.is_surface);
+	bot.Joints = std::move(joints);
+	return bot;
+}
+
+std::string generatedModelName(const GeneratorOptions& options) {
+	std::string name = options.sampling == Sampling::LATTICE ? "lattice" : "jittered";
+	name += "_" + std::to_string(options.num_leg) + "leg";
+	if (options.num_mass > 0) { name += "_" + std::to_string(options.num_mass); }
+	return name;
+}
@@ -0,0 +1,45 @@
+/*
+model_gen.h: procedural soft-body robots in the Model format (model.h) for scaling studies, from a few
+hundred to millions of masses, with the group layout of the slicer output (data.msgpack) so that
+buildFlexipod (flexipod.h) sets them up like the flexipod:
+	idVertices: body, leg0..legN-1, anchor pair of each joint, oxyz_body, (oxyz_joint_body, oxyz_joint_leg) of each joint
+	idEdges: body, leg0..legN-1, anchors, rotation springs, friction (resetable) springs, oxyz self, oxyz anchor
+The body and the legs are boxes sampled on a lattice or a jittered lattice (poisson-like, min distance about
+radius/2) of spacing radius, the springs connect the masses of a part closer than radius_knn (radius_poisson and
+radius_knn of the slicer by default). Each leg hangs on a rotational joint along y on a long side of the body.
+Write a generated model with flexipod_generate (generate.cpp).
+*/
+
+#ifndef TITAN_MODEL_GEN_H
+#define TITAN_MODEL_GEN_H
+
+#include "model.h"
+#include "flexipod.h"
+
+#include <cstdint>
+#include <string>
+
+enum class Sampling {
+	LATTICE, // cubic lattice of spacing radius
+	JITTERED // cubic lattice jittered by up to radius/4 per axis, irregular springs like the slicer output
+};
+
+struct GeneratorOptions {
+	Sampling sampling = Sampling::JITTERED;
+	int num_leg = 4; // legs alternately front/back along the +y side then back/front along the -y side, 0: the body only
+	double radius = radius_poisson; // [m] sampling spacing
+	double radius_knn = ::radius_knn; // [m] the springs connect the masses closer than this
+	int64_t num_mass = 0; // if >0: scale the sizes below to the smallest robot with at least num_mass masses in the body and the legs
+	Vec3d body_size = Vec3d(0.36, 0.21, 0.07); // [m] x,y,z size of the body box (data.msgpack: 0.357 x 0.212 x 0.067)
+	Vec3d leg_size = Vec3d(0.2, 0.05, 0.06); // [m] length (x, from the joint axis), thickness (y), height (z) of a leg box
+	uint32_t seed = 0; // seed of the jitter
+};
+
+/* generate the robot, throws std::runtime_error if the options are invalid.
+   The lowest masses are at z=radius. A Model costs about 60 bytes per spring and 100 bytes per mass */
+Model generateModel(const GeneratorOptions& options);
+
+/* short name of the generated model, e.g. "jittered_4leg_10000" */
+std::string generatedModelName(const GeneratorOptions& options);
+
+#endif // TITAN_MODEL_GEN_H
@@ -1,4 +1,4 @@
-// Network.h header file for C++ UDP
+// Network.h header file for C++ UDP (Winsock and asio), see network_posix.h for linux
 #ifndef NETWORK_H
 #define NETWORK_H
 
@@ -12,6 +12,10 @@
 #include <thread>
 #include <time.h> // for timeout setup
 #include <atomic> // for atomic data sharing
+#include <chrono>
+
+#include "udp_message.h" // messages and lock-free channels between the physics thread and the udp threads
+#include "udp_codec.h" // allocation-free msgpack encoding of the messages
 
 // copied from: https://adaickalavan.github.io/programming/udp-socket-programming-in-cpp-and-python/
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
@@ -21,35 +25,6 @@
 
 
 
-enum UDP_HEADER:int{
-    RESET=15,
-    ROBOT_STATE_REPORT=14,
-    MOTOR_SPEED_COMMEND=13,
-    MOTOR_POS_COMMEND=12};
-MSGPACK_ADD_ENUM(UDP_HEADER); // msgpack macro,refer to https://github.com/msgpack/msgpack-c/blob/cpp_master/example/cpp03/enum.cpp
-
-class UdpDataSend {/*the info to be sent to the high level controller*/
-public:
-    UDP_HEADER header = UDP_HEADER::ROBOT_STATE_REPORT;
-    double T = 0;
-    double jointAngle[4] = { 0 };
-    double jointSpeed[4] = { 0 };
-    double acceleration[3] = { 0 };
-    double orientation[6] = { 0 };
-    double actuation[4] = { 0 };
-    double position[3] = { 0 };
-    MSGPACK_DEFINE(header, T, jointAngle, jointSpeed, acceleration,orientation, actuation, position)
-};
-
-class UdpDataReceive {/*the high level command to be received */
-public:
-    UDP_HEADER header = UDP_HEADER::MOTOR_SPEED_COMMEND;
-    double T;
-    double jointSpeed[4] = { 0 };
-    MSGPACK_DEFINE(header, T, jointSpeed)
-};
-
-
 class WSASession
 {
 public:
@@ -169,24 +144,15 @@ private:
     SOCKET sock;
 };
 
-class WsaUdpServer {
+class WsaUdpServer : public UdpChannels {
 private:
-    UdpDataReceive _msg_rec; // struct to be received, private
-    UdpDataSend _msg_send; // struct to be sent, private
     std::mutex mutex_running;
     std::condition_variable cv_running;
 public:
-    UdpDataReceive msg_rec; // struct to be received, public
-    UdpDataSend msg_send; // struct to be sent, public
-
     int port_local; // local port
     int port_remote; // remote port
     std::string ip_remote; // remote ip
 
-    bool flag_should_send = false;// flag indicating whether to send udp packet
-    bool flag_should_close = false; // flag indicating whether to stop sending/receiving
-    bool flag_new_received = false; // flag indicating a new message has received
-
     bool flag_sender_thread_closed = false; // flag indicating the thread_udp_send is finished
     bool flag_receiver_thread_closed = false;// flag indicating the thread_udp_receive is finished
 
@@ -207,9 +173,10 @@ public:
         socket.SetTimeout();
     }
 
-    /* loop for receiving the udp packet */
+    /* loop for receiving the udp packet, blocks in RecvFrom() until a packet arrives or the timeout */
     void do_receive()
     {
+        UdpDataReceive msg;
         while (!flag_should_close) {
             try {
                 int n_bytes_received;
@@ -220,15 +187,10 @@ public:
                     //}
                     //printf("\n");
 
-                    // Unpack data
-                    msgpack::object_handle oh = msgpack::unpack(recv_buffer_, n_bytes_received);
-                    msgpack::object obj = oh.get();
-                    obj.convert(_msg_rec);  // use private value to prevent modification during convert
-                    msg_rec = _msg_rec;
-
-                    //TODO notify the simulation thread
-                    //TODO use condition variable
-                    flag_new_received = true;
+                    // Unpack data in place, a malformed packet is ignored
+                    if (unpackUdpData(recv_buffer_, n_bytes_received, msg)) {
+                        pushCommand(msg); // notify the simulation thread
+                    }
                 }
             }
             catch (std::system_error) {
@@ -236,7 +198,6 @@ public:
                 //printf("timed out\n");
                 //printf( __FILE__, __LINE__);
             }  
-            std::this_thread::sleep_for(std::chrono::microseconds(1));
         }
 
         std::lock_guard<std::mutex> lck(mutex_running); // could just use lock_guard
@@ -244,22 +205,18 @@ public:
         cv_running.notify_one();
     }
 
-    /* loop for sending the udp packet */
+    /* loop for sending the udp packet, sleeps until the physics thread publishes a new state */
     void do_send()
     {
         try {
+            StampedState stamped;
+            uint64_t version = 0; // version of the last state sent
             while (!flag_should_close) {
-                if (flag_should_send) {
-                    // Pack data into msgpack
-                    _msg_send = msg_send; // copy to private value to prevent modification during pack
-                    std::stringstream send_stream;
-                    msgpack::pack(send_stream, _msg_send);
-                    std::string const& data = send_stream.str();
-                    socket.SendTo(ip_remote, port_remote, data.c_str(), data.size());
-                    //TODO use condition variable
-                    flag_should_send = false;//reset flag_should_send
-                }
-                std::this_thread::sleep_for(std::chrono::microseconds(1));
+                if (!waitState(stamped, version, std::chrono::milliseconds(100))) { continue; }
+                // Pack data into msgpack
+                const size_t size = packUdpData(stamped.msg, send_buffer_);
+                socket.SendTo(ip_remote, port_remote, send_buffer_, size);
+                send_latency.recordSince(stamped.publish_time);
             }
         }
         catch (std::exception& e) {
@@ -277,7 +234,7 @@ public:
         thread_udp_send = std::thread(&WsaUdpServer::do_send, this);
     }
     void close() {
-        flag_should_close = true;//just to be sure
+        requestClose();
 
         std::unique_lock<std::mutex> lck(mutex_running); // refer to:https://en.cppreference.com/w/cpp/thread/condition_variable
         cv_running.wait(lck, [this] {return flag_sender_thread_closed& flag_receiver_thread_closed; });
@@ -290,6 +247,7 @@ public:
             thread_udp_receive.join();
             //printf("thread_udp_receive joined\n");
         }
+        send_latency.print("UDP state report latency");
         printf("UDP server closed\n");
     }
 
@@ -300,22 +258,16 @@ public:
 private:
     enum { max_length = 1024 };
     char recv_buffer_[max_length];// data received from the remote endponit
+    char send_buffer_[UDP_PACKED_MAX_SIZE];// packed state report, reused
 };
 
 
-class AsioUdpServer {
+class AsioUdpServer : public UdpChannels {
 public:
-    UdpDataReceive msg_rec; // struct to be received
-    UdpDataSend msg_send; // struct to be sent
-
     int port_local; // local port
     int port_remote; // remote port
     std::string ip_remote; // remote ip
 
-    bool flag_should_send = false;// flag indicating whether to send udp packet
-    bool flag_should_close = false; // flag indicating whether to stop sending/receiving
-    bool flag_new_received = false; // flag indicating a new message has received
-
     asio::io_context io_context; // asio io context for the socket
     std::thread thread_udp_send; // thread for sending udp
     std::thread thread_udp_receive; // thread for receiving udp
@@ -332,49 +284,46 @@ public:
         remote_endpoint = asio::ip::udp::endpoint(asio::ip::address::from_string(ip_remote), port_remote);
         socket.connect(remote_endpoint);// connect to remote_endpoint
     }
-    /* loop for receiving the udp packet */
+    /* loop for receiving the udp packet, one receive is pending at a time,
+       run_for() blocks until it completes or the timeout */
     void do_receive()
     {
+        bool receiving = false; // whether an async_receive is pending
+        UdpDataReceive msg;
         while (!flag_should_close) {
-            socket.async_receive(// receive from remote_endpoint
-                asio::buffer(recv_buffer_, max_length),
-                [this](std::error_code ec, std::size_t bytes_recvd)
-                {
-                    if (!ec && bytes_recvd > 0)
+            if (!receiving) {
+                receiving = true;
+                socket.async_receive(// receive from remote_endpoint
+                    asio::buffer(recv_buffer_, max_length),
+                    [this, &receiving, &msg](std::error_code ec, std::size_t bytes_recvd)
                     {
-                        //for (int i = 0; i < bytes_recvd; i++) {//prints the data in hex format
-                        //	printf("%02x", reinterpret_cast<unsigned char*>(recv_buffer_)[i]);
-                        //}
-                        //printf("\n");
-
-                        // Unpack data
-                        msgpack::object_handle oh = msgpack::unpack(recv_buffer_, bytes_recvd);
-                        msgpack::object obj = oh.get();
-                        obj.convert(msg_rec);
-                        //TODO notify the simulation thread
-                        //TODO use condition variable
-                        flag_new_received = true;
-                    }
-                });
+                        receiving = false;
+                        if (!ec && bytes_recvd > 0)
+                        {
+                            // Unpack data in place, a malformed packet is ignored
+                            if (unpackUdpData(recv_buffer_, bytes_recvd, msg)) {
+                                pushCommand(msg); // notify the simulation thread
+                            }
+                        }
+                    });
+            }
             io_context.run_for(std::chrono::duration<int, std::milli>(10));
-            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            if (io_context.stopped()) { io_context.restart(); } // ran out of work
         }
     }
 
-    /* loop for sending the udp packet */
+    /* loop for sending the udp packet, sleeps until the physics thread publishes a new state */
     void do_send()
     {
         try {
+            StampedState stamped;
+            uint64_t version = 0; // version of the last state sent
             while (!flag_should_close) {
-                while (!flag_should_send) { std::this_thread::sleep_for(std::chrono::microseconds(100)); }
+                if (!waitState(stamped, version, std::chrono::milliseconds(100))) { continue; }
                 // Pack data into msgpack
-                std::stringstream send_stream;
-                msgpack::pack(send_stream, msg_send);
-                socket.send(asio::buffer(send_stream.str()));//send to remote_endpoint
-                //std::string const& data = send_stream.str();
-                //socket.send(asio::buffer(data.c_str(), data.size()));//send to remote_endpoint
-                //TODO use condition variable
-                flag_should_send = false;//reset flag_should_send
+                const size_t size = packUdpData(stamped.msg, send_buffer_);
+                socket.send(asio::buffer(send_buffer_, size));//send to remote_endpoint
+                send_latency.recordSince(stamped.publish_time);
             }
         }
         catch (std::system_error e) {
@@ -389,17 +338,19 @@ public:
     }
 
     ~AsioUdpServer() { //TODO automatically close it...
-        flag_should_close = true;//just to be sure
+        requestClose();
         thread_udp_send.join();
         thread_udp_receive.join();
         io_context.stop();
         socket.close();
+        send_latency.print("UDP state report latency");
     }
 private:
     asio::ip::udp::socket socket;//local socket for sending and reciving udp packets
     asio::ip::udp::endpoint remote_endpoint;
     enum { max_length = 1024 };
     char recv_buffer_[max_length];// data received from the remote endponit    
+    char send_buffer_[UDP_PACKED_MAX_SIZE];// packed state report, reused
 };
 
 
@@ -0,0 +1,214 @@
+/*
+network_posix.cpp: linux udp transport (epoll, eventfd, recvmmsg/sendmmsg), see network_posix.h
+*/
+
+#include "network_posix.h"
+
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+
+static inline std::system_error errnoError(const char* what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+PosixUdpServer::PosixUdpServer(int port_local, int port_remote, std::string ip_remote, int num_robot) {
+    this->port_local = port_local;
+    this->port_remote = port_remote;
+    this->ip_remote = ip_remote;
+    this->num_robot = num_robot;
+    try {
+        sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock < 0) { throw errnoError("PosixUdpServer: socket"); }
+        sockaddr_in add;
+        memset(&add, 0, sizeof(add));
+        add.sin_family = AF_INET;
+        add.sin_addr.s_addr = htonl(INADDR_ANY);
+        add.sin_port = htons(port_local);
+        if (bind(sock, (const sockaddr*)&add, sizeof(add)) < 0) { throw errnoError("PosixUdpServer: bind"); }
+
+        in_addr ip;
+        if (inet_pton(AF_INET, ip_remote.c_str(), &ip) != 1) {
+            throw std::system_error(EINVAL, std::generic_category(), "PosixUdpServer: invalid ip_remote " + ip_remote);
+        }
+        endpoint.resize(num_robot);
+        for (int i = 0; i < num_robot; i++) {
+            endpoint[i].reset(new PosixUdpEndpoint());
+            sockaddr_in& remote = endpoint[i]->remote_address;
+            memset(&remote, 0, sizeof(remote));
+            remote.sin_family = AF_INET;
+            remote.sin_addr = ip;
+            remote.sin_port = htons(port_remote + i);
+        }
+
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) { throw errnoError("PosixUdpServer: eventfd"); }
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) { throw errnoError("PosixUdpServer: epoll_create1"); }
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = sock;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0) { throw errnoError("PosixUdpServer: epoll_ctl"); }
+        ev.data.fd = event_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev) < 0) { throw errnoError("PosixUdpServer: epoll_ctl"); }
+    }
+    catch (...) {
+        closeFds(); // the destructor does not run when the constructor throws
+        throw;
+    }
+}
+
+PosixUdpServer::~PosixUdpServer() {
+    if (thread_udp_io.joinable()) { close(); }
+    closeFds();
+}
+
+void PosixUdpServer::closeFds() {
+    if (epoll_fd >= 0) { ::close(epoll_fd); }
+    if (event_fd >= 0) { ::close(event_fd); }
+    if (sock >= 0) { ::close(sock); }
+    epoll_fd = event_fd = sock = -1;
+}
+
+void PosixUdpServer::run() {
+    thread_udp_io = std::thread(&PosixUdpServer::do_io, this);
+}
+
+void PosixUdpServer::close() {
+    flag_should_close = true;
+    const uint64_t one = 1;
+    if (write(event_fd, &one, sizeof(one)) < 0) {} // wake the io thread, fails only if the counter is full
+    for (auto& e : endpoint) { e->requestClose(); } // wake the physics threads in waitCommand()
+    if (thread_udp_io.joinable()) { thread_udp_io.join(); }
+    send_latency.print("UDP state report latency");
+    printf("UDP server closed: %llu packets sent, %llu received, %llu ignored\n", (unsigned long long)num_sent,
+        (unsigned long long)num_received, (unsigned long long)num_ignored);
+}
+
+void PosixUdpServer::publishState(const UdpDataSend& msg, int robot) {
+    endpoint[robot]->publishState(msg);
+    if (!wake_pending.exchange(true)) { // only the first publish since the io thread woke up writes the eventfd
+        const uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) < 0) {}
+    }
+}
+
+void PosixUdpServer::do_io() {
+    try {
+        epoll_event events[2];
+        while (!flag_should_close) {
+            const int n = epoll_wait(epoll_fd, events, 2, 100);
+            if (n < 0) {
+                if (errno == EINTR) { continue; }
+                throw errnoError("PosixUdpServer: epoll_wait");
+            }
+            for (int i = 0; i < n; i++) {
+                if (events[i].data.fd == event_fd) {
+                    uint64_t count;
+                    if (read(event_fd, &count, sizeof(count)) < 0) {} // reset the counter, EAGAIN if already read
+                    wake_pending = false; // clear before scanning, a later publish wakes us again
+                    sendStates();
+                }
+                else { receiveCommands(); }
+            }
+        }
+    }
+    catch (std::exception& e) {
+        printf("[%s:%d]: %s\n", __FILE__, __LINE__, e.what());
+    }
+}
+
+void PosixUdpServer::sendStates() {
+    mmsghdr msgs[BATCH_SIZE];
+    iovec iovs[BATCH_SIZE];
+    PosixUdpEndpoint* batch[BATCH_SIZE]; // endpoint of each packet in msgs
+    int num_scanned = 0; // every robot is scanned once, starting from next_robot
+    while (num_scanned < num_robot) {
+        int num_msg = 0;
+        for (; num_scanned < num_robot && num_msg < BATCH_SIZE; num_scanned++) {
+            PosixUdpEndpoint& e = *endpoint[(next_robot + num_scanned) % num_robot];
+            if (!e.takeState(e.stamped, e.version_sent)) { continue; }
+            iovs[num_msg].iov_base = e.send_buffer;
+            iovs[num_msg].iov_len = packUdpData(e.stamped.msg, e.send_buffer);
+            memset(&msgs[num_msg], 0, sizeof(mmsghdr));
+            msgs[num_msg].msg_hdr.msg_name = &e.remote_address;
+            msgs[num_msg].msg_hdr.msg_namelen = sizeof(e.remote_address);
+            msgs[num_msg].msg_hdr.msg_iov = &iovs[num_msg];
+            msgs[num_msg].msg_hdr.msg_iovlen = 1;
+            batch[num_msg++] = &e;
+        }
+        int num_done = 0;
+        while (num_done < num_msg) {
+            const int n = sendmmsg(sock, msgs + num_done, num_msg - num_done, 0);
+            if (n < 0) {
+                if (errno == EINTR) { continue; }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) { // socket buffer full: drop, the next state replaces it
+                    num_done = num_msg;
+                    break;
+                }
+                // e.g. ECONNREFUSED reported for an earlier packet: skip this packet and send the rest
+                num_done++;
+                continue;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            for (int k = num_done; k < num_done + n; k++) {
+                const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - batch[k]->stamped.publish_time).count();
+                batch[k]->send_latency.record(ns); // per robot
+                send_latency.record(ns);
+            }
+            num_sent += n;
+            num_done += n;
+        }
+    }
+    next_robot = (next_robot + 1) % num_robot; // rotate which robot goes first when a batch is full
+}
+
+void PosixUdpServer::receiveCommands() {
+    mmsghdr msgs[BATCH_SIZE];
+    iovec iovs[BATCH_SIZE];
+    sockaddr_in sources[BATCH_SIZE];
+    for (int k = 0; k < BATCH_SIZE; k++) {
+        iovs[k].iov_base = recv_buffer[k];
+        iovs[k].iov_len = MAX_PACKET_SIZE;
+    }
+    UdpDataReceive msg;
+    for (;;) { // drain the socket, epoll is level triggered
+        for (int k = 0; k < BATCH_SIZE; k++) {
+            memset(&msgs[k], 0, sizeof(mmsghdr));
+            msgs[k].msg_hdr.msg_name = &sources[k];
+            msgs[k].msg_hdr.msg_namelen = sizeof(sources[k]);
+            msgs[k].msg_hdr.msg_iov = &iovs[k];
+            msgs[k].msg_hdr.msg_iovlen = 1;
+        }
+        const int n = recvmmsg(sock, msgs, BATCH_SIZE, MSG_DONTWAIT, nullptr);
+        if (n < 0) {
+            if (errno == EINTR || errno == ECONNREFUSED) { continue; } // ECONNREFUSED: icmp of an earlier send
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+            throw errnoError("PosixUdpServer: recvmmsg");
+        }
+        for (int k = 0; k < n; k++) {
+            const int robot = (int)ntohs(sources[k].sin_port) - port_remote;
+            if (robot < 0 || robot >= num_robot || msgs[k].msg_len == 0 ||
+                sources[k].sin_addr.s_addr != endpoint[robot]->remote_address.sin_addr.s_addr) {
+                num_ignored++;
+                continue;
+            }
+            if (!unpackUdpData(recv_buffer[k], msgs[k].msg_len, msg)) { // not a UdpDataReceive
+                num_ignored++;
+                continue;
+            }
+            endpoint[robot]->pushCommand(msg); // notify the physics thread of this robot
+            num_received++;
+        }
+        if (n < BATCH_SIZE) { return; }
+    }
+}
@@ -0,0 +1,91 @@
+/*
+network_posix.h: linux udp transport with the same interface as WsaUdpServer (network.h).
+One non-blocking socket and one io thread serve num_robot simulated robots:
+    robot i sends its state reports to ip_remote:port_remote+i and receives the commands from there,
+    the io thread sleeps in epoll_wait until a robot publishes a state (eventfd) or packets arrive,
+    then sends all new states with one sendmmsg and drains the socket with recvmmsg.
+Test it on loopback with bench_udp (echo controller, packets/s and round-trip latency).
+*/
+
+#ifndef NETWORK_POSIX_H
+#define NETWORK_POSIX_H
+
+#include "udp_message.h"
+#include "udp_codec.h"
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* channels of one robot served by PosixUdpServer */
+class PosixUdpEndpoint : public UdpChannels {
+    friend class PosixUdpServer;
+    sockaddr_in remote_address; // the controller of this robot
+    uint64_t version_sent = 0; // version of the last state sent
+    StampedState stamped; // the state being sent
+    char send_buffer[UDP_PACKED_MAX_SIZE]; // packed state, reused
+};
+
+class PosixUdpServer {
+public:
+    static constexpr int BATCH_SIZE = 64; // maximum number of packets per sendmmsg/recvmmsg call
+    static constexpr int MAX_PACKET_SIZE = 1024; // [bytes]
+
+    int port_local; // local port
+    int port_remote; // remote port of robot 0, robot i uses port_remote+i
+    std::string ip_remote; // remote ip
+    int num_robot; // number of robots (endpoints)
+
+    LatencyHistogram send_latency; // time from publishState() to sendmmsg() returning, all robots
+    std::atomic<uint64_t> num_sent{ 0 }; // number of packets sent
+    std::atomic<uint64_t> num_received{ 0 }; // number of packets received and queued
+    std::atomic<uint64_t> num_ignored{ 0 }; // number of packets from unknown addresses or not unpackable
+    std::atomic<bool> flag_should_close{ false }; // flag indicating whether to stop sending/receiving
+
+    std::thread thread_udp_io; // io thread, sends and receives for all robots
+
+    /* bind port_local, throws std::system_error if the socket cannot be created or bound */
+    PosixUdpServer(int port_local = 32001,
+        int port_remote = 32000,
+        std::string ip_remote = "127.0.0.1",
+        int num_robot = 1);
+    ~PosixUdpServer();
+    PosixUdpServer(const PosixUdpServer&) = delete;
+    PosixUdpServer& operator=(const PosixUdpServer&) = delete;
+
+    /*run this to start receiving and sending udp*/
+    void run();
+    void close();
+
+    /* physics thread of robot: publish the state report, replaces the one not yet sent */
+    void publishState(const UdpDataSend& msg, int robot = 0);
+    /* physics thread of robot: pop the oldest received command, returns false if there is none */
+    inline bool pollCommand(UdpDataReceive& msg, int robot = 0) { return endpoint[robot]->pollCommand(msg); }
+    /* physics thread of robot: wait up to timeout for a command, returns false on timeout or close */
+    template<class Rep, class Period>
+    bool waitCommand(UdpDataReceive& msg, const std::chrono::duration<Rep, Period>& timeout, int robot = 0) {
+        return endpoint[robot]->waitCommand(msg, timeout);
+    }
+    inline uint64_t numDroppedCommand(int robot = 0) const { return endpoint[robot]->num_dropped_command; }
+
+private:
+    int sock = -1; // non-blocking udp socket bound to port_local
+    int epoll_fd = -1;
+    int event_fd = -1; // written by publishState() to wake the io thread
+    std::atomic<bool> wake_pending{ false }; // an eventfd write is pending, avoids a syscall per publishState()
+    std::vector<std::unique_ptr<PosixUdpEndpoint>> endpoint; // [num_robot]
+    int next_robot = 0; // robot to start the next send batch from (round robin)
+    char recv_buffer[BATCH_SIZE][MAX_PACKET_SIZE]; // data received from the remote endpoints
+
+    void do_io(); // io thread loop
+    void sendStates(); // send the new states of all robots in batches
+    void receiveCommands(); // receive until the socket is drained, queue the commands per robot
+    void closeFds();
+};
+
+#endif // NETWORK_POSIX_H
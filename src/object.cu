@@ -27,110 +27,8 @@ const glm::vec3 OLIVEDRAB(0.42, 0.56, 0.14);
 #include<glm/gtx/quaternion.hpp> // for rotation
 #endif
 
-//__device__ const double K_NORMAL = 100; // normal force coefficient for contact constraints
-//__device__ const double DAMPING_NORMAL = 3; // normal damping coefficient per kg mass
-__device__ const double K_NORMAL = 100; // normal force coefficient for contact constraints
-__device__ const double DAMPING_NORMAL = 1; // normal damping coefficient per kg mass
-
-//CUDA_CALLABLE_MEMBER CudaBall::CudaBall(const Vec3d & center, double radius) {
-//    _center = center;
-//    _radius = radius;
-//}
-//
-//CUDA_CALLABLE_MEMBER CudaBall::CudaBall(const Ball & b) {
-//    _center = b._center;
-//    _radius = b._radius;
-//}
-
-__device__ void CudaBall::applyForce(Vec3d& force, const Vec3d& pos) {
-    double dist = (pos - _center).norm();
-    if (dist < _radius) {
-        force += K_NORMAL * (pos - _center) / dist;
-    }
-}
-
-//CUDA_CALLABLE_MEMBER CudaContactPlane::CudaContactPlane(const Vec3d & normal, double offset) {
-//    _normal = normal / normal.norm();
-//    _offset = offset;
-//    _FRICTION_S = 0.0;
-//    _FRICTION_K = 0.0;
-//}
-//
-//CudaContactPlane::CudaContactPlane(const ContactPlane & p) {
-//    _normal = p._normal;
-//    _offset = p._offset;
-//
-//    _FRICTION_S = p._FRICTION_S;
-//    _FRICTION_K = p._FRICTION_K;
-//}
-
-//CUDA_CALLABLE_MEMBER void CudaContactPlane::applyForce(Vec3d& force, const Vec3d& pos, const Vec3d& vel) {
-//    //    m -> force += (disp < 0) ? - disp * K_NORMAL * _normal : 0 * _normal; // TODO fix this for the host
-//    
-//    double disp = _normal.dot(pos) - _offset; // displacement into the plane
-//#ifdef __CUDA_ARCH__
-//    if(signbit(disp)){ // Determine whether the floating-point value a is negative:https://docs.nvidia.com/cuda/cuda-math-api/group__CUDA__MATH__DOUBLE.html#group__CUDA__MATH__DOUBLE_1g2bd7d6942a8b25ae518636dab9ad78a7
-//#else
-//    if (disp < 0) {// if inside the plane
-//#endif
-//        Vec3d f_normal = _normal.dot(force) * _normal; // normal force
-//
-//        if (_FRICTION_S > 0 || _FRICTION_K > 0) {
-//            Vec3d v_t = vel - _normal.dot(vel) * _normal; // velocity tangential to the plane
-//            double v_t_norm = v_t.norm();
-//
-//            if (v_t_norm > 1e-10) { // kinetic friction domain
-//                double friction_mag = _FRICTION_K * f_normal.norm();
-//                force -=  friction_mag / v_t_norm * v_t;
-//            }
-//            else { // static friction
-//                Vec3d f_t = force - f_normal; //  force tangential to the plain
-//                if (_FRICTION_S * f_normal.norm() > f_t.norm()) {
-//                    force -= f_t;
-//                }
-//            }
-//        }
-//        force -= disp * _normal * K_NORMAL;// displacement force
-//    }
-//}
-
-
-__device__ void CudaContactPlane::applyForce(Vec3d& force, const Vec3d& pos, const Vec3d& vel) {
-    //    m -> force += (disp < 0) ? - disp * K_NORMAL * _normal : 0 * _normal; // TODO fix this for the host
-
-    double disp = _normal.dot(pos) - _offset; // displacement into the plane
-#ifdef __CUDA_ARCH__
-    if (signbit(disp)) { // Determine whether the floating-point value a is negative:https://docs.nvidia.com/cuda/cuda-math-api/group__CUDA__MATH__DOUBLE.html#group__CUDA__MATH__DOUBLE_1g2bd7d6942a8b25ae518636dab9ad78a7
-#else
-    if (disp < 0) {// if inside the plane
-#endif
-        ////Vec3d f_normal = _normal.dot(force) * _normal; // normal force (only if infinite stiff)
-        Vec3d f_normal = -disp * _normal * K_NORMAL; // ground spring model
-        //if (_FRICTION_S > 0 || _FRICTION_K > 0) {
-        Vec3d v_n = _normal.dot(vel) * _normal; // velocity normal to the plane
-            Vec3d v_t = vel - v_n; // velocity tangential to the plane
-            double v_t_norm = v_t.norm();
-            if (v_t_norm > 1e-8) { // kinetic friction domain
-                //      <----friction magnitude------>   <-friction direction->
-                force -= _FRICTION_K * f_normal.norm() / v_t_norm * v_t;
-            }
-            else { // static friction
-                Vec3d f_t = force - f_normal; //  force tangential to the plain
-                if (_FRICTION_S * f_normal.norm() > f_t.norm()) {
-                    force -= f_t;
-                }
-                else {// kinetic friction again
-                    //       <----friction magnitude------> <- friction direction->
-                    force -= _FRICTION_K * f_normal.norm() / v_t_norm * v_t;
-                }
-            }
-        //}
-        force -= disp * _normal * K_NORMAL;// displacement force
-        force -= v_n * DAMPING_NORMAL;
-    }
-    }
-
-
+// K_NORMAL, DAMPING_NORMAL and the applyForce() of CudaBall/CudaContactPlane
+// are defined in object.h, they are shared by the cuda kernels and the cpu backend
 
 #ifdef GRAPHICS
 
@@ -24,7 +24,9 @@ ref: J. Austin, R. Corrales-Fatou, S. Wyetzner, and H. Lipson, 
 
 #include <vector>
 
+#ifdef __CUDACC__
 #include <thrust/device_vector.h>
+#endif
 
 
 struct CUDA_MASS;
@@ -43,6 +45,9 @@ class Mass;
 #define CUDA_DEVICE
 #endif
 
+constexpr double K_NORMAL = 100; // normal force coefficient for contact constraints
+constexpr double DAMPING_NORMAL = 1; // normal damping coefficient per kg mass
+
 class Constraint { // constraint like plane or sphere which applies force to masses
 public:
     virtual ~Constraint() = default;
@@ -93,7 +98,12 @@ struct CudaBall {
     //CUDA_CALLABLE_MEMBER CudaBall(const Vec3d & center, double radius);
     //CUDA_CALLABLE_MEMBER CudaBall(const Ball & b);
 
-    __device__ void applyForce(Vec3d& force, const Vec3d& pos);
+    CUDA_CALLABLE_MEMBER void applyForce(Vec3d& force, const Vec3d& pos) {
+        double dist = (pos - _center).norm();
+        if (dist < _radius) {
+            force += K_NORMAL * (pos - _center) / dist;
+        }
+    }
 
     double _radius;
     Vec3d _center;
@@ -136,9 +146,44 @@ struct ContactPlane : public Constraint {
 #endif
 };
 
+/* contact (ground spring model) and friction force of a mass displaced disp < 0 into a surface with the
+   given normal, defined inline so that the cuda kernels and the cpu backend apply exactly the same contact model */
+inline CUDA_CALLABLE_MEMBER void applyContactForce(Vec3d& force, const Vec3d& vel, const Vec3d& normal, const double disp,
+    const double friction_k, const double friction_s) {
+    Vec3d f_normal = -disp * normal * K_NORMAL; // ground spring model
+    Vec3d v_n = dot(normal, vel) * normal; // velocity normal to the plane
+    Vec3d v_t = vel - v_n; // velocity tangential to the plane
+    double v_t_norm = v_t.norm();
+    if (v_t_norm > 1e-8) { // kinetic friction domain
+        //      <----friction magnitude------>   <-friction direction->
+        force -= friction_k * f_normal.norm() / v_t_norm * v_t;
+    }
+    else { // static friction
+        Vec3d f_t = force - f_normal; //  force tangential to the plain
+        if (friction_s * f_normal.norm() > f_t.norm()) {
+            force -= f_t;
+        }
+        else {// kinetic friction again
+            //       <----friction magnitude------> <- friction direction->
+            force -= friction_k * f_normal.norm() / v_t_norm * v_t;
+        }
+    }
+    force -= disp * normal * K_NORMAL;// displacement force
+    force -= v_n * DAMPING_NORMAL;
+}
+
 struct CudaContactPlane {
 
-    __device__  void applyForce(Vec3d& force, const Vec3d& pos, const Vec3d& vel);
+    CUDA_CALLABLE_MEMBER void applyForce(Vec3d& force, const Vec3d& pos, const Vec3d& vel) {
+        double disp = _normal.dot(pos) - _offset; // displacement into the plane
+#ifdef __CUDA_ARCH__
+        if (signbit(disp)) { // Determine whether the floating-point value a is negative:https://docs.nvidia.com/cuda/cuda-math-api/group__CUDA__MATH__DOUBLE.html#group__CUDA__MATH__DOUBLE_1g2bd7d6942a8b25ae518636dab9ad78a7
+#else
+        if (disp < 0) {// if inside the plane
+#endif
+            applyContactForce(force, vel, _normal, disp, _FRICTION_K, _FRICTION_S);
+        }
+    }
 
     Vec3d _normal;
     double _offset;
@@ -146,7 +191,169 @@ struct CudaContactPlane {
     double _FRICTION_S = 0.0;
 };
 
+/* heightfield terrain z = h(x, y): heights on a regular grid (bilinear in between) with a friction per cell,
+   a flat view of Heightfield (terrain.h). A mass is looked up in its cell in O(1) whatever the grid size and
+   below the surface it gets the contact force of the plane tangent there. Outside the grid the border heights
+   extend flat. */
+struct CudaHeightfield {
+
+    /* true if pos is below the surface: the surface normal, the displacement along it (< 0, the vertical
+       depth projected on the normal) and the friction coefficients of the cell */
+    CUDA_CALLABLE_MEMBER bool contact(const Vec3d& pos, Vec3d& normal, double& disp, double& friction_k, double& friction_s) const {
+        if (pos.z >= _z_max) { return false; } // above the highest point, no lookup
+        double u = (pos.x - _x0) * _inv_cell; // grid coordinates
+        double v = (pos.y - _y0) * _inv_cell;
+        if (!(u == u && v == v)) { return false; } // nan
+        double gx = 1, gy = 1; // 0: clamped to the border, flat in that direction
+        if (u < 0) { u = 0; gx = 0; }
+        else if (u > _nx - 1) { u = _nx - 1; gx = 0; }
+        if (v < 0) { v = 0; gy = 0; }
+        else if (v > _ny - 1) { v = _ny - 1; gy = 0; }
+        const int i = (int)u < _nx - 2 ? (int)u : _nx - 2;
+        const int j = (int)v < _ny - 2 ? (int)v : _ny - 2;
+        const double fu = u - i, fv = v - j;
+        const double* h = _height + j * _nx + i;
+        const double h00 = h[0], h10 = h[1], h01 = h[_nx], h11 = h[_nx + 1];
+        const double depth = pos.z - ((1 - fv) * ((1 - fu) * h00 + fu * h10) + fv * ((1 - fu) * h01 + fu * h11));
+        if (!(depth < 0)) { return false; } // above the surface
+        const double dzdx = gx * ((1 - fv) * (h10 - h00) + fv * (h11 - h01)) * _inv_cell;
+        const double dzdy = gy * ((1 - fu) * (h01 - h00) + fu * (h11 - h10)) * _inv_cell;
+        const double inv_len = 1 / sqrt(1 + dzdx * dzdx + dzdy * dzdy);
+        normal = Vec3d(-dzdx * inv_len, -dzdy * inv_len, inv_len);
+        disp = depth * inv_len;
+        friction_k = _friction_k[j * (_nx - 1) + i];
+        friction_s = _friction_s[j * (_nx - 1) + i];
+        return true;
+    }
+
+    CUDA_CALLABLE_MEMBER void applyForce(Vec3d& force, const Vec3d& pos, const Vec3d& vel) const {
+        Vec3d normal;
+        double disp, friction_k, friction_s;
+        if (contact(pos, normal, disp, friction_k, friction_s)) {
+            applyContactForce(force, vel, normal, disp, friction_k, friction_s);
+        }
+    }
+
+    double _x0, _y0; // [m] position of height[0][0]
+    double _inv_cell; // [1/m] 1 / grid spacing
+    int _nx, _ny; // number of heights along x and y (>= 2)
+    const double* _height; // [m] [ny][nx]
+    double _z_max; // [m] maximum of _height
+    const double* _friction_k; // kinetic friction coefficient of each cell [ny-1][nx-1]
+    const double* _friction_s; // static friction coefficient of each cell [ny-1][nx-1]
+};
 
+enum OBSTACLE_TYPE {
+    OBSTACLE_BOX, OBSTACLE_CAPSULE, OBSTACLE_TRIANGLE
+};
+
+/* primitive of a static obstacle set (ObstacleSet, obstacle.h) */
+struct ObstaclePrimitive {
+
+    /* true if pos is inside: the outward normal and the displacement along it (< 0) */
+    CUDA_CALLABLE_MEMBER bool contact(const Vec3d& pos, Vec3d& normal, double& disp) const {
+        if (_type == OBSTACLE_BOX) { // out through the nearest face
+            const Vec3d d = pos - _p[0];
+            const double half[3] = { _p[1].x, _p[1].y, _p[1].z };
+            disp = -1e300;
+            for (int k = 0; k < 3; k++) {
+                const double x = dot(_p[2 + k], d);
+                const double gap = (x < 0 ? -x : x) - half[k];
+                if (!(gap < 0)) { return false; }
+                if (gap > disp) {
+                    disp = gap;
+                    normal = x < 0 ? -_p[2 + k] : _p[2 + k];
+                }
+            }
+            return true;
+        }
+        if (_type == OBSTACLE_CAPSULE) { // out from the nearest point of the axis
+            const Vec3d ab = _p[1] - _p[0];
+            const double len2 = ab.SquaredSum();
+            double t = len2 > 0 ? dot(pos - _p[0], ab) / len2 : 0;
+            t = t < 0 ? 0 : (t > 1 ? 1 : t);
+            const Vec3d d = pos - (_p[0] + t * ab);
+            const double dist2 = d.SquaredSum();
+            if (!(dist2 < _radius * _radius)) { return false; }
+            const double dist = sqrt(dist2);
+            normal = dist > 1e-12 ? d / dist : Vec3d(0, 0, 1);
+            disp = dist - _radius;
+            return true;
+        }
+        // triangle: one sided, a skin of thickness _radius behind the face (counter-clockwise seen from outside)
+        const double h = dot(_p[3], pos - _p[0]);
+        if (!(h < 0 && h > -_radius)) { return false; }
+        if (dot(cross(_p[1] - _p[0], pos - _p[0]), _p[3]) < 0 || dot(cross(_p[2] - _p[1], pos - _p[1]), _p[3]) < 0 ||
+            dot(cross(_p[0] - _p[2], pos - _p[2]), _p[3]) < 0) { return false; } // not above the face
+        normal = _p[3];
+        disp = h;
+        return true;
+    }
+
+    int _type; // OBSTACLE_TYPE
+    double _radius; // capsule: radius, triangle: thickness [m]
+    Vec3d _p[5]; // box: center, half extents, 3 axes; capsule: 2 ends; triangle: 3 vertices, normal
+    double _FRICTION_K;
+    double _FRICTION_S;
+};
+
+/* node of the flattened bounding volume hierarchy of an obstacle set, depth first: the left child of an
+   inner node is the next node */
+struct ObstacleNode {
+    Vec3d _lo, _hi; // bounding box of the contact regions of the primitives below
+    int _first; // leaf: first primitive, inner node: right child
+    int _count; // leaf: number of primitives, 0: inner node
+};
+
+/* static obstacles (boxes, capsules, triangle meshes) in a bounding volume hierarchy, a flat view of ObstacleSet
+   (obstacle.h): a mass only tests the primitives of the leaves whose box contains it, O(log n) for n obstacles */
+struct CudaObstacles {
+
+    /* true if pos is inside an obstacle: the normal, displacement (< 0) and friction of the deepest one,
+       a single contact per mass so that the faces of a mesh sharing an edge do not add up */
+    CUDA_CALLABLE_MEMBER bool contact(const Vec3d& pos, Vec3d& normal, double& disp, double& friction_k, double& friction_s) const {
+        int stack[OBSTACLE_MAX_DEPTH + 1];
+        int top = 0;
+        stack[top++] = 0;
+        disp = 0;
+        bool found = false;
+        while (top > 0) {
+            const int n = stack[--top];
+            const ObstacleNode& node = _node[n];
+            if (!(pos.x >= node._lo.x && pos.x <= node._hi.x && pos.y >= node._lo.y && pos.y <= node._hi.y &&
+                pos.z >= node._lo.z && pos.z <= node._hi.z)) { continue; } // also skips nan
+            if (node._count == 0) {
+                stack[top++] = node._first;
+                stack[top++] = n + 1;
+                continue;
+            }
+            for (int k = node._first; k < node._first + node._count; k++) {
+                Vec3d primitive_normal;
+                double primitive_disp;
+                if (_primitive[k].contact(pos, primitive_normal, primitive_disp) && primitive_disp < disp) {
+                    normal = primitive_normal;
+                    disp = primitive_disp;
+                    friction_k = _primitive[k]._FRICTION_K;
+                    friction_s = _primitive[k]._FRICTION_S;
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+    CUDA_CALLABLE_MEMBER void applyForce(Vec3d& force, const Vec3d& pos, const Vec3d& vel) const {
+        Vec3d normal;
+        double disp, friction_k, friction_s;
+        if (contact(pos, normal, disp, friction_k, friction_s)) {
+            applyContactForce(force, vel, normal, disp, friction_k, friction_s);
+        }
+    }
+
+    static constexpr int OBSTACLE_MAX_DEPTH = 48; // of the hierarchy, ObstacleSet::build() splits at the median
+    const ObstacleNode* _node; // [num_node], the root first
+    const ObstaclePrimitive* _primitive; // in the order of the leaves
+};
 
 struct CUDA_GLOBAL_CONSTRAINTS {
     CudaContactPlane * d_planes;
@@ -154,6 +361,22 @@ struct CUDA_GLOBAL_CONSTRAINTS {
 
     size_t num_planes;
     size_t num_balls;
+
+    const CudaHeightfield* d_terrain = nullptr; // nullptr: no terrain
+    const CudaObstacles* d_obstacles = nullptr; // nullptr: no obstacles
+
+    inline CUDA_CALLABLE_MEMBER bool empty() const {
+        return num_planes == 0 && num_balls == 0 && d_terrain == nullptr && d_obstacles == nullptr;
+    }
+
+    /* add the contact forces of all constraints on a mass at pos with velocity vel to force
+       (the spring and external force on the mass, used by the static friction) */
+    CUDA_CALLABLE_MEMBER void applyForce(Vec3d& force, const Vec3d& pos, const Vec3d& vel) const {
+        for (int j = 0; j < num_planes; j++) { d_planes[j].applyForce(force, pos, vel); }
+        for (int j = 0; j < num_balls; j++) { d_balls[j].applyForce(force, pos); }
+        if (d_terrain != nullptr) { d_terrain->applyForce(force, pos, vel); }
+        if (d_obstacles != nullptr) { d_obstacles->applyForce(force, pos, vel); }
+    }
 };
 
 
@@ -0,0 +1,267 @@
+/*
+obstacle.cpp: static obstacle sets in a bounding volume hierarchy, see obstacle.h
+*/
+
+#include "obstacle.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+void ObstacleSet::addBox(const Vec3d& center, const Vec3d& half_extent, const Vec3d& axis_x, const Vec3d& axis_y) {
+	Vec3d x = axis_x / axis_x.norm();
+	Vec3d y = axis_y - dot(axis_y, x) * x; // Gram-Schmidt
+	y /= y.norm();
+	ObstaclePrimitive box = {};
+	box._type = OBSTACLE_BOX;
+	box._p[0] = center;
+	box._p[1] = half_extent;
+	box._p[2] = x;
+	box._p[3] = y;
+	box._p[4] = cross(x, y);
+	box._FRICTION_K = friction_k;
+	box._FRICTION_S = friction_s;
+	primitive.push_back(box);
+	node.clear();
+}
+
+void ObstacleSet::addCapsule(const Vec3d& a, const Vec3d& b, double radius) {
+	ObstaclePrimitive capsule = {};
+	capsule._type = OBSTACLE_CAPSULE;
+	capsule._radius = radius;
+	capsule._p[0] = a;
+	capsule._p[1] = b;
+	capsule._FRICTION_K = friction_k;
+	capsule._FRICTION_S = friction_s;
+	primitive.push_back(capsule);
+	node.clear();
+}
+
+void ObstacleSet::addTriangle(const Vec3d& a, const Vec3d& b, const Vec3d& c, double thickness) {
+	Vec3d normal = cross(b - a, c - a);
+	const double area2 = normal.norm();
+	if (!(area2 > 1e-18)) { return; } // degenerate, no face to push out of
+	ObstaclePrimitive triangle = {};
+	triangle._type = OBSTACLE_TRIANGLE;
+	triangle._radius = thickness;
+	triangle._p[0] = a;
+	triangle._p[1] = b;
+	triangle._p[2] = c;
+	triangle._p[3] = normal / area2;
+	triangle._FRICTION_K = friction_k;
+	triangle._FRICTION_S = friction_s;
+	primitive.push_back(triangle);
+	node.clear();
+}
+
+size_t ObstacleSet::loadMesh(const std::string& path, double scale, const Vec3d& offset, double thickness) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) { throw std::runtime_error("ObstacleSet: cannot open " + path); }
+	const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	const size_t num_before = primitive.size();
+	auto transform = [&](double x, double y, double z) { return Vec3d(x, y, z) * scale + offset; };
+	std::string extension = path.size() > 4 ? path.substr(path.size() - 4) : "";
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char ch) { return (char)tolower(ch); });
+
+	if (extension == ".obj") { // v x y z, f v1[/vt/vn] v2 v3 ... (a polygon is a fan)
+		std::vector<Vec3d> vertex;
+		std::istringstream lines(data);
+		std::string line;
+		while (std::getline(lines, line)) {
+			std::istringstream tokens(line);
+			std::string type;
+			tokens >> type;
+			if (type == "v") {
+				double x = 0, y = 0, z = 0;
+				tokens >> x >> y >> z;
+				vertex.push_back(transform(x, y, z));
+			}
+			else if (type == "f") {
+				std::vector<int> face;
+				std::string v;
+				while (tokens >> v) {
+					const int k = atoi(v.c_str()); // 1-based, negative: relative to the end
+					const int id = k > 0 ? k - 1 : (int)vertex.size() + k;
+					if (id < 0 || id >= (int)vertex.size()) { throw std::runtime_error("ObstacleSet: " + path + " has an invalid face"); }
+					face.push_back(id);
+				}
+				for (size_t t = 2; t < face.size(); t++) { addTriangle(vertex[face[0]], vertex[face[t - 1]], vertex[face[t]], thickness); }
+			}
+		}
+	}
+	else { // stl: binary (80 byte header, count, 50 bytes per triangle) or ascii (facet ... vertex x y z)
+		uint32_t count = 0;
+		if (data.size() >= 84) { memcpy(&count, data.data() + 80, sizeof(count)); }
+		if (data.size() >= 84 && data.size() == 84 + 50 * (size_t)count) {
+			for (uint32_t t = 0; t < count; t++) {
+				float v[9];
+				memcpy(v, data.data() + 84 + 50 * (size_t)t + 12, sizeof(v)); // after the facet normal
+				addTriangle(transform(v[0], v[1], v[2]), transform(v[3], v[4], v[5]), transform(v[6], v[7], v[8]), thickness);
+			}
+		}
+		else if (data.compare(0, 5, "solid") == 0) {
+			std::istringstream tokens(data);
+			std::string token;
+			Vec3d corner[3];
+			int num_corner = 0;
+			while (tokens >> token) {
+				if (token != "vertex") { continue; }
+				double x = 0, y = 0, z = 0;
+				tokens >> x >> y >> z;
+				corner[num_corner++] = transform(x, y, z);
+				if (num_corner == 3) {
+					addTriangle(corner[0], corner[1], corner[2], thickness);
+					num_corner = 0;
+				}
+			}
+		}
+		else { throw std::runtime_error("ObstacleSet: " + path + " is not an stl or obj mesh"); }
+	}
+	return primitive.size() - num_before;
+}
+
+ObstacleSet ObstacleSet::clutter(int num_obstacle, double extent, uint32_t seed) {
+	ObstacleSet set;
+	set.friction_k = 0.6;
+	set.friction_s = 0.6;
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	auto random = [&](double lo, double hi) { return lo + (hi - lo) * uniform(rng); };
+	for (int k = 0; k < num_obstacle; k++) {
+		const double yaw = random(0, 2 * M_PI);
+		const Vec3d forward(cos(yaw), sin(yaw), 0), left(-sin(yaw), cos(yaw), 0);
+		const Vec3d center(random(-extent, extent), random(-extent, extent), 0);
+		const int kind = (int)(3 * uniform(rng));
+		if (kind == 0) { // step
+			const Vec3d half(random(0.05, 0.2), random(0.05, 0.2), random(0.01, 0.04));
+			set.addBox(center + Vec3d(0, 0, half.z), half, forward, left);
+		}
+		else if (kind == 1) { // ramp: a thin box tilted up along forward, its lower edge on the ground
+			const double pitch = random(5, 20) * M_PI / 180;
+			const Vec3d half(random(0.15, 0.3), random(0.1, 0.2), 0.01);
+			const Vec3d up_forward = cos(pitch) * forward + Vec3d(0, 0, sin(pitch));
+			set.addBox(center + Vec3d(0, 0, half.x * sin(pitch)), half, up_forward, left);
+		}
+		else { // log lying on the ground
+			const double radius = random(0.01, 0.03), half_length = random(0.05, 0.2);
+			set.addCapsule(center + Vec3d(0, 0, radius) - half_length * forward, center + Vec3d(0, 0, radius) + half_length * forward, radius);
+		}
+	}
+	return set;
+}
+
+namespace {
+
+/* bounding box of the contact region of a primitive */
+void bounds(const ObstaclePrimitive& p, Vec3d& lo, Vec3d& hi) {
+	if (p._type == OBSTACLE_BOX) {
+		const Vec3d& h = p._p[1];
+		const Vec3d e(std::abs(p._p[2].x) * h.x + std::abs(p._p[3].x) * h.y + std::abs(p._p[4].x) * h.z,
+			std::abs(p._p[2].y) * h.x + std::abs(p._p[3].y) * h.y + std::abs(p._p[4].y) * h.z,
+			std::abs(p._p[2].z) * h.x + std::abs(p._p[3].z) * h.y + std::abs(p._p[4].z) * h.z);
+		lo = p._p[0] - e;
+		hi = p._p[0] + e;
+		return;
+	}
+	const int num_point = p._type == OBSTACLE_CAPSULE ? 2 : 3;
+	lo = hi = p._p[0];
+	for (int k = 1; k < num_point; k++) {
+		lo = Vec3d(std::min(lo.x, p._p[k].x), std::min(lo.y, p._p[k].y), std::min(lo.z, p._p[k].z));
+		hi = Vec3d(std::max(hi.x, p._p[k].x), std::max(hi.y, p._p[k].y), std::max(hi.z, p._p[k].z));
+	}
+	const Vec3d r(p._radius, p._radius, p._radius); // capsule radius, triangle skin (any direction)
+	lo -= r;
+	hi += r;
+}
+
+inline double axis(const Vec3d& v, int k) { return k == 0 ? v.x : (k == 1 ? v.y : v.z); }
+
+/* append the node of the primitives order[begin, end) and its subtree, returns its index */
+int buildNode(std::vector<ObstacleNode>& node, std::vector<int>& order, const std::vector<Vec3d>& lo,
+	const std::vector<Vec3d>& hi, const int begin, const int end, const int leaf_size) {
+	const int index = (int)node.size();
+	node.push_back(ObstacleNode());
+	Vec3d box_lo = lo[order[begin]], box_hi = hi[order[begin]];
+	Vec3d c_lo = 0.5 * (box_lo + box_hi), c_hi = c_lo; // bounds of the centers
+	for (int k = begin + 1; k < end; k++) {
+		const Vec3d& a = lo[order[k]];
+		const Vec3d& b = hi[order[k]];
+		const Vec3d c = 0.5 * (a + b);
+		box_lo = Vec3d(std::min(box_lo.x, a.x), std::min(box_lo.y, a.y), std::min(box_lo.z, a.z));
+		box_hi = Vec3d(std::max(box_hi.x, b.x), std::max(box_hi.y, b.y), std::max(box_hi.z, b.z));
+		c_lo = Vec3d(std::min(c_lo.x, c.x), std::min(c_lo.y, c.y), std::min(c_lo.z, c.z));
+		c_hi = Vec3d(std::max(c_hi.x, c.x), std::max(c_hi.y, c.y), std::max(c_hi.z, c.z));
+	}
+	node[index]._lo = box_lo;
+	node[index]._hi = box_hi;
+	if (end - begin <= leaf_size) {
+		node[index]._first = begin;
+		node[index]._count = end - begin;
+		return index;
+	}
+	const Vec3d size = c_hi - c_lo;
+	const int k = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2); // longest axis
+	const int mid = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](int a, int b) {
+		return axis(lo[a], k) + axis(hi[a], k) < axis(lo[b], k) + axis(hi[b], k);
+	});
+	buildNode(node, order, lo, hi, begin, mid, leaf_size); // the next node
+	const int right = buildNode(node, order, lo, hi, mid, end, leaf_size);
+	node[index]._first = right;
+	node[index]._count = 0;
+	return index;
+}
+
+} // namespace
+
+void ObstacleSet::build() {
+	node.clear();
+	const int n = (int)primitive.size();
+	if (n == 0) { return; }
+	std::vector<Vec3d> lo(n), hi(n);
+	for (int k = 0; k < n; k++) { bounds(primitive[k], lo[k], hi[k]); }
+	std::vector<int> order(n);
+	std::iota(order.begin(), order.end(), 0);
+	node.reserve(2 * (size_t)n / std::max(leaf_size, 1) + 1);
+	buildNode(node, order, lo, hi, 0, n, std::max(leaf_size, 1));
+	std::vector<ObstaclePrimitive> sorted(n); // leaves index contiguous ranges
+	for (int k = 0; k < n; k++) { sorted[k] = primitive[order[k]]; }
+	primitive.swap(sorted);
+	if (depth() > CudaObstacles::OBSTACLE_MAX_DEPTH) { throw std::runtime_error("ObstacleSet: the hierarchy is too deep"); }
+}
+
+int ObstacleSet::depth() const {
+	if (node.empty()) { return 0; }
+	int max_depth = 0;
+	std::vector<std::pair<int, int>> stack = { { 0, 1 } }; // node, depth
+	while (!stack.empty()) {
+		const std::pair<int, int> top = stack.back();
+		stack.pop_back();
+		max_depth = std::max(max_depth, top.second);
+		if (node[top.first]._count == 0) {
+			stack.push_back({ top.first + 1, top.second + 1 });
+			stack.push_back({ node[top.first]._first, top.second + 1 });
+		}
+	}
+	return max_depth;
+}
+
+CudaObstacles ObstacleSet::view() const {
+	if (!primitive.empty() && node.empty()) { throw std::runtime_error("ObstacleSet: call build() after adding obstacles"); }
+	CudaObstacles v;
+	v._node = node.data();
+	v._primitive = primitive.data();
+	return v;
+}
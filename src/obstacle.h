@@ -0,0 +1,53 @@
+/*
+obstacle.h: static obstacle sets for cluttered scenes: oriented boxes (steps, ramps), capsules (logs, poles) and
+triangle meshes (stl, obj, e.g. mesh/), each with a kinetic and a static friction coefficient.
+build() sorts the primitives into a bounding volume hierarchy (median split along the longest axis, flattened
+depth first), which the simulation applies through the flat view CudaObstacles (object.h): a mass only tests
+the primitives of the few leaves whose box contains it, so the cost per mass grows with log(obstacles),
+where createPlane()/createBall() cost one test per mass and obstacle. The set is built once with the scene
+and does not move.
+A mass gets the contact force (CudaContactPlane model) of the deepest primitive it is inside. The triangles are
+one sided: a skin of the given thickness behind the face, on the side opposite to the counter-clockwise normal,
+so a closed mesh must face outwards and be thicker than a mass moves per step.
+*/
+
+#ifndef TITAN_OBSTACLE_H
+#define TITAN_OBSTACLE_H
+
+#include "vec.h"
+#include "object.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ObstacleSet {
+public:
+	double friction_k = 0; // kinetic friction coefficient of the primitives added next
+	double friction_s = 0; // static friction coefficient of the primitives added next
+	int leaf_size = 4; // maximum primitives per leaf, set before build()
+
+	std::vector<ObstaclePrimitive> primitive; // in the order of the leaves after build()
+	std::vector<ObstacleNode> node; // flattened hierarchy, empty until build()
+
+	/* box of half extents half_extent along axis_x, axis_y and their cross product (orthonormalized) */
+	void addBox(const Vec3d& center, const Vec3d& half_extent, const Vec3d& axis_x = Vec3d(1, 0, 0),
+		const Vec3d& axis_y = Vec3d(0, 1, 0));
+	void addCapsule(const Vec3d& a, const Vec3d& b, double radius); // a == b: a ball
+	void addTriangle(const Vec3d& a, const Vec3d& b, const Vec3d& c, double thickness); // outside: counter-clockwise
+	/* triangles of an stl (binary or ascii) or obj file, pos * scale + offset, returns the number of triangles,
+	   throws std::runtime_error if the file cannot be read */
+	size_t loadMesh(const std::string& path, double scale = 1, const Vec3d& offset = Vec3d(0, 0, 0), double thickness = 0.02);
+
+	/* random steps, tilted boxes (ramps) and capsules on the ground z=0 within +-extent [m] of x=y=0 */
+	static ObstacleSet clutter(int num_obstacle, double extent, uint32_t seed = 0);
+
+	void build(); // the hierarchy of the current primitives, O(n log n)
+	inline bool empty() const { return primitive.empty(); }
+	int depth() const; // of the hierarchy
+
+	/* flat view for the constraints, valid until the vectors change, throws std::runtime_error before build() */
+	CudaObstacles view() const;
+};
+
+#endif // TITAN_OBSTACLE_H
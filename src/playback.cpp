@@ -0,0 +1,219 @@
+/*
+playback.cpp: replay a recorded trajectory, see playback.h
+*/
+
+#include "playback.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+TrajectoryReader::TrajectoryReader(const std::string& path) {
+	file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) { throw std::runtime_error("TrajectoryReader: cannot open " + path); }
+	if (std::fread(&file_header, sizeof(file_header), 1, file) != 1 ||
+		memcmp(file_header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0 || file_header.version != TRAJECTORY_VERSION) {
+		std::fclose(file);
+		throw std::runtime_error("TrajectoryReader: " + path + " is not a trajectory file (version " + std::to_string(TRAJECTORY_VERSION) + ")");
+	}
+	sensor_id.resize(file_header.num_sensor);
+	if (std::fread(sensor_id.data(), sizeof(uint32_t), sensor_id.size(), file) != sensor_id.size()) {
+		std::fclose(file);
+		throw std::runtime_error("TrajectoryReader: " + path + " is truncated");
+	}
+	const long data_offset = std::ftell(file);
+	std::fseek(file, 0, SEEK_END);
+	const long size = std::ftell(file);
+
+	TrajectoryFileTrailer trailer = {};
+	bool has_index = false;
+	if (size >= data_offset + (long)sizeof(trailer)) {
+		std::fseek(file, size - (long)sizeof(trailer), SEEK_SET);
+		has_index = std::fread(&trailer, sizeof(trailer), 1, file) == 1 &&
+			memcmp(trailer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(TRAJECTORY_INDEX_MAGIC)) == 0;
+	}
+	if (has_index) {
+		index.resize(trailer.num_chunk);
+		std::fseek(file, (long)trailer.index_offset, SEEK_SET);
+		if (std::fread(index.data(), sizeof(TrajectoryIndexEntry), index.size(), file) != index.size()) {
+			std::fclose(file);
+			throw std::runtime_error("TrajectoryReader: " + path + " has a truncated index");
+		}
+		num_frame = trailer.num_frame;
+	}
+	else { // no index (the recording was interrupted): walk the complete chunks
+		long offset = data_offset;
+		TrajectoryChunkHeader chunk;
+		while (offset + (long)sizeof(chunk) <= size) {
+			std::fseek(file, offset, SEEK_SET);
+			if (std::fread(&chunk, sizeof(chunk), 1, file) != 1 ||
+				memcmp(chunk.magic, TRAJECTORY_CHUNK_MAGIC, sizeof(TRAJECTORY_CHUNK_MAGIC)) != 0) { break; }
+			const long end = offset + (long)(sizeof(chunk) + chunk.num_frame * sizeof(double) + chunk.compressed_size);
+			double T0 = 0;
+			if (end > size || std::fread(&T0, sizeof(double), 1, file) != 1) { break; }
+			index.push_back({ (uint64_t)offset, num_frame, T0 });
+			num_frame += chunk.num_frame;
+			offset = end;
+		}
+	}
+	for (size_t i = 0; i < index.size(); i++) {
+		const uint64_t next = i + 1 < index.size() ? index[i + 1].first_frame : num_frame;
+		chunk_num_frame.push_back((uint32_t)(next - index[i].first_frame));
+	}
+}
+
+TrajectoryReader::~TrajectoryReader() {
+	if (file != nullptr) { std::fclose(file); }
+}
+
+size_t TrajectoryReader::channelOffset(RecordChannel channel) const {
+	const TrajectoryFileHeader& h = file_header;
+	const size_t count[RECORD_NUM_CHANNEL] = { 3 * (size_t)h.num_mass, 3 * (size_t)h.num_sensor * h.num_instance,
+		3 * (size_t)h.num_joint, h.num_joint, 12 * (size_t)h.num_instance };
+	size_t offset = 0;
+	for (int c = 0; c < RECORD_NUM_CHANNEL && (1u << c) != channel; c++) {
+		if (h.channels & (1u << c)) { offset += count[c]; }
+	}
+	return offset;
+}
+
+size_t TrajectoryReader::chunkOf(uint64_t frame) const {
+	auto it = std::upper_bound(index.begin(), index.end(), frame,
+		[](uint64_t f, const TrajectoryIndexEntry& e) { return f < e.first_frame; });
+	return (size_t)(it - index.begin()) - 1;
+}
+
+TrajectoryReader::DecodedChunk& TrajectoryReader::decode(size_t chunk) {
+	use_count++;
+	for (DecodedChunk& c : cache) {
+		if (c.chunk == (int64_t)chunk) { c.last_use = use_count; return c; }
+	}
+	DecodedChunk& c = cache[0].last_use <= cache[1].last_use ? cache[0] : cache[1]; // least recently used
+	c.chunk = -1;
+
+	TrajectoryChunkHeader header;
+	std::fseek(file, (long)index[chunk].offset, SEEK_SET);
+	if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+		memcmp(header.magic, TRAJECTORY_CHUNK_MAGIC, sizeof(TRAJECTORY_CHUNK_MAGIC)) != 0) {
+		throw std::runtime_error("TrajectoryReader: bad chunk " + std::to_string(chunk));
+	}
+	const size_t n = header.num_frame;
+	const size_t num_value = file_header.num_value;
+	const size_t num_word = n * num_value;
+	c.T.resize(n);
+	c.value.resize(num_word);
+	compressed.resize(header.compressed_size);
+	shuffled.resize(4 * num_word);
+	uLongf size = (uLongf)shuffled.size();
+	if (std::fread(c.T.data(), sizeof(double), n, file) != n ||
+		std::fread(compressed.data(), 1, compressed.size(), file) != compressed.size() ||
+		uncompress(shuffled.data(), &size, compressed.data(), (uLong)compressed.size()) != Z_OK || size != shuffled.size()) {
+		throw std::runtime_error("TrajectoryReader: corrupt chunk " + std::to_string(chunk));
+	}
+
+	// undo the byte shuffle, the zigzag and the delta encoding of q[value][frame], see recorder.h
+	const size_t count[RECORD_NUM_CHANNEL] = { 3 * (size_t)file_header.num_mass,
+		3 * (size_t)file_header.num_sensor * file_header.num_instance, 3 * (size_t)file_header.num_joint,
+		file_header.num_joint, 12 * (size_t)file_header.num_instance };
+	size_t v = 0;
+	for (int ch = 0; ch < RECORD_NUM_CHANNEL; ch++) {
+		if (!(file_header.channels & (1u << ch))) { continue; }
+		const double resolution = file_header.resolution[ch];
+		for (size_t end = v + count[ch]; v < end; v++) {
+			int32_t q = 0;
+			for (size_t f = 0; f < n; f++) {
+				const size_t w = v * n + f;
+				const uint32_t z = (uint32_t)shuffled[w] | (uint32_t)shuffled[num_word + w] << 8 |
+					(uint32_t)shuffled[2 * num_word + w] << 16 | (uint32_t)shuffled[3 * num_word + w] << 24;
+				q += (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+				c.value[f * num_value + v] = q * resolution;
+			}
+		}
+	}
+	c.chunk = (int64_t)chunk;
+	c.last_use = use_count;
+	return c;
+}
+
+double TrajectoryReader::frameT(uint64_t frame) {
+	const size_t chunk = chunkOf(frame);
+	return decode(chunk).T[frame - index[chunk].first_frame];
+}
+
+uint64_t TrajectoryReader::frameAt(double T) {
+	if (num_frame == 0) { throw std::runtime_error("TrajectoryReader: no frames"); }
+	auto it = std::upper_bound(index.begin(), index.end(), T,
+		[](double t, const TrajectoryIndexEntry& e) { return t < e.T; });
+	if (it == index.begin()) { return 0; }
+	const size_t chunk = (size_t)(it - index.begin()) - 1;
+	const std::vector<double>& chunk_T = decode(chunk).T;
+	const size_t f = (size_t)(std::upper_bound(chunk_T.begin(), chunk_T.end(), T) - chunk_T.begin()) - 1;
+	return index[chunk].first_frame + f;
+}
+
+const double* TrajectoryReader::frame(uint64_t frame) {
+	if (frame >= num_frame) { throw std::runtime_error("TrajectoryReader: frame out of range"); }
+	const size_t chunk = chunkOf(frame);
+	return decode(chunk).value.data() + (frame - index[chunk].first_frame) * file_header.num_value;
+}
+
+TrajectoryPlayer::TrajectoryPlayer(TrajectoryReader& reader) : reader(reader) {
+	if (reader.numFrame() == 0) { throw std::runtime_error("TrajectoryPlayer: the trajectory has no frames"); }
+	T_first = reader.firstT();
+	T_last = reader.lastT();
+	T = T_first;
+}
+
+void TrajectoryPlayer::seek(double T) {
+	this->T = std::min(std::max(T, T_first), T_last);
+}
+
+void TrajectoryPlayer::stepFrame(int num_frame) {
+	const int64_t f = (int64_t)reader.frameAt(T) + num_frame;
+	T = reader.frameT((uint64_t)std::min<int64_t>(std::max<int64_t>(f, 0), (int64_t)reader.numFrame() - 1));
+}
+
+void TrajectoryPlayer::advance(double wall_dt) {
+	double t = T + speed * wall_dt;
+	const double length = T_last - T_first;
+	if (loop && length > 0 && (t > T_last || t < T_first)) { t = T_first + std::fmod(std::fmod(t - T_first, length) + length, length); }
+	seek(t);
+}
+
+void TrajectoryPlayer::positions(Vec3d* pos) {
+	if (!reader.hasChannel(RECORD_POSITION)) {
+		throw std::runtime_error("TrajectoryPlayer: the mass positions were not recorded (--record-channels position)");
+	}
+	static_assert(sizeof(Vec3d) == 3 * sizeof(double), "positions are copied as 3 doubles per Vec3d");
+	const size_t num_mass = reader.header().num_mass;
+	if (vertex_order.empty()) {
+		values(reader.channelOffset(RECORD_POSITION), 3 * num_mass, (double*)pos);
+		return;
+	}
+	const size_t num_vertex = vertex_order.size(); // masses per instance
+	if (num_mass % num_vertex != 0) {
+		throw std::runtime_error("TrajectoryPlayer: vertex_order does not fit the recorded masses");
+	}
+	original.resize(num_mass);
+	values(reader.channelOffset(RECORD_POSITION), 3 * num_mass, (double*)original.data());
+	for (size_t offset = 0; offset < num_mass; offset += num_vertex) {
+		for (size_t i = 0; i < num_vertex; i++) { pos[offset + i] = original[offset + vertex_order[i]]; }
+	}
+}
+
+void TrajectoryPlayer::values(size_t offset, size_t count, double* out) {
+	const uint64_t f0 = reader.frameAt(T);
+	const double* a = reader.frame(f0) + offset;
+	const double T0 = reader.frameT(f0);
+	if (!interpolate || f0 + 1 >= reader.numFrame() || T <= T0) {
+		std::copy(a, a + count, out);
+		return;
+	}
+	const double* b = reader.frame(f0 + 1) + offset; // a stays valid: at most two chunks are involved
+	const double T1 = reader.frameT(f0 + 1);
+	const double w = T1 > T0 ? (T - T0) / (T1 - T0) : 0;
+	for (size_t i = 0; i < count; i++) { out[i] = a[i] + w * (b[i] - a[i]); }
+}
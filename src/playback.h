@@ -0,0 +1,103 @@
+/*
+playback.h: replay a recorded trajectory (recorder.h) without computing any forces.
+	TrajectoryReader: random access to the frames of a trajectory file, a chunk is decompressed when one of
+		its frames is read, the last two decoded chunks are kept (interpolation across a chunk boundary)
+	TrajectoryPlayer: playback clock over a reader: speed (negative: backwards, 0: paused), seek, frame
+		stepping and the mass positions at any time, linearly interpolated between the recorded frames
+The topology (springs, colors) comes from the Model the trajectory was recorded with. The positions are recorded
+in the original order of the model, set TrajectoryPlayer::vertex_order to draw them on a reordered model.
+Used by Simulation::player (flexipod --play, through the vertex buffer update of update_graphics)
+and by flexipod_replay (replay.cpp, headless frame dumper).
+*/
+
+#ifndef TITAN_PLAYBACK_H
+#define TITAN_PLAYBACK_H
+
+#include "recorder.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class TrajectoryReader {
+public:
+	/* read the header and the chunk index of path (or walk the chunks of an unfinished file),
+	   throws std::runtime_error if it is not a trajectory file */
+	explicit TrajectoryReader(const std::string& path);
+	~TrajectoryReader();
+	TrajectoryReader(const TrajectoryReader&) = delete;
+	TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+	inline const TrajectoryFileHeader& header() const { return file_header; }
+	inline const std::vector<uint32_t>& sensor() const { return sensor_id; }
+	inline uint64_t numFrame() const { return num_frame; }
+	inline size_t numChunk() const { return index.size(); }
+	inline bool hasChannel(RecordChannel channel) const { return (file_header.channels & channel) != 0; }
+	/* first value of channel within a frame, see the frame layout in recorder.h */
+	size_t channelOffset(RecordChannel channel) const;
+
+	/* [s] simulation time of a frame */
+	double frameT(uint64_t frame);
+	/* the last frame at or before T (the first frame if T is before it) */
+	uint64_t frameAt(double T);
+	/* the values of frame (num_value doubles), valid until two other chunks are decoded */
+	const double* frame(uint64_t frame);
+
+	inline double firstT() { return num_frame > 0 ? frameT(0) : 0; }
+	inline double lastT() { return num_frame > 0 ? frameT(num_frame - 1) : 0; }
+
+private:
+	struct DecodedChunk {
+		int64_t chunk = -1; // index of the decoded chunk, -1: empty
+		uint64_t last_use = 0;
+		std::vector<double> T; // [num_frame]
+		std::vector<double> value; // [num_frame][num_value]
+	};
+
+	DecodedChunk& decode(size_t chunk); // decoded chunk, from the cache if possible
+	size_t chunkOf(uint64_t frame) const;
+
+	std::FILE* file = nullptr;
+	TrajectoryFileHeader file_header;
+	std::vector<uint32_t> sensor_id;
+	std::vector<TrajectoryIndexEntry> index;
+	std::vector<uint32_t> chunk_num_frame; // [numChunk()]
+	uint64_t num_frame = 0;
+	DecodedChunk cache[2];
+	uint64_t use_count = 0;
+	std::vector<uint8_t> compressed, shuffled; // decode buffers
+};
+
+class TrajectoryPlayer {
+public:
+	explicit TrajectoryPlayer(TrajectoryReader& reader);
+
+	double T = 0; // [s] playback position (simulation time of the recording)
+	double speed = 1; // simulation seconds per wall second, <0: backwards, 0: paused
+	bool loop = false; // wrap around at the ends instead of stopping there
+	bool interpolate = true; // linear interpolation between the frames, false: the frame at or before T
+	std::vector<int> vertex_order; // original index of each mass of the model played on (FlexipodIndex::vertex_order),
+	                               // positions() returns its order, empty: the recorded (original) order
+
+	void seek(double T); // clamped to the recording
+	void stepFrame(int num_frame); // move by num_frame recorded frames (<0: backwards)
+	void advance(double wall_dt); // move by speed * wall_dt [s]
+	inline bool atEnd() const { return speed >= 0 ? T >= T_last : T <= T_first; }
+	inline double firstT() const { return T_first; }
+	inline double lastT() const { return T_last; }
+
+	/* the RECORD_POSITION values at T (num_mass Vec3d) in the order of vertex_order,
+	   throws std::runtime_error if they were not recorded or vertex_order does not fit the recorded masses */
+	void positions(Vec3d* pos);
+	/* count values from offset of every frame (e.g. channelOffset()) at T into out */
+	void values(size_t offset, size_t count, double* out);
+
+	TrajectoryReader& reader;
+
+private:
+	double T_first = 0, T_last = 0;
+	std::vector<Vec3d> original; // positions() in the recorded order before applying vertex_order
+};
+
+#endif // TITAN_PLAYBACK_H
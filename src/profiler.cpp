@@ -0,0 +1,170 @@
+/*
+profiler.cpp: per-phase timers and counters, see profiler.h
+*/
+
+#include "profiler.h"
+
+#include <algorithm>
+
+namespace {
+
+const char* const PHASE_NAME[NUM_PHASE] = { "update", "dynamics", "spring", "mass", "joint_rotation", "readback",
+	"joint_measure", "joint_control", "state", "udp", "udp_wait", "reset", "record", "collision",
+	"broad_phase", "contact" };
+const char* const COUNTER_NAME[NUM_COUNTER] = { "update", "spring_update", "mass_update", "state_sent",
+	"command_received", "reset" };
+
+/* histogram bucket of a duration: PROFILE_SUB_BUCKET buckets per power of 2 */
+inline int bucketOf(uint64_t ns) {
+	if (ns < PROFILE_SUB_BUCKET) { return (int)ns; }
+	int msb = 63;
+	while (!(ns >> msb)) { msb--; }
+	const int sub = (int)(ns >> (msb - 2)) & (PROFILE_SUB_BUCKET - 1); // the 2 bits below the most significant
+	return std::min(msb * PROFILE_SUB_BUCKET + sub, PROFILE_NUM_BUCKET - 1);
+}
+
+/* [ns] middle of a bucket */
+inline double bucketValue(int bucket) {
+	if (bucket < PROFILE_SUB_BUCKET) { return bucket; }
+	const int msb = bucket / PROFILE_SUB_BUCKET;
+	const int sub = bucket % PROFILE_SUB_BUCKET;
+	return (double)(1ull << msb) * (1.0 + (sub + 0.5) / PROFILE_SUB_BUCKET);
+}
+
+inline void addRelaxed(std::atomic<uint64_t>& a, uint64_t n) { // single writer: no locked instruction
+	a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+thread_local ThreadProfile* thread_profile = nullptr;
+
+} // namespace
+
+const char* phaseName(Phase phase) { return PHASE_NAME[(int)phase]; }
+
+const char* counterName(Counter counter) { return COUNTER_NAME[(int)counter]; }
+
+Profiler& Profiler::instance() {
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler() : epoch_ns(profileClock()) {}
+
+ThreadProfile& Profiler::thread() {
+	if (thread_profile == nullptr) { thread_profile = registerThread(); }
+	return *thread_profile;
+}
+
+ThreadProfile* Profiler::registerThread() {
+	std::lock_guard<std::mutex> lock(mutex);
+	threads.emplace_back(new ThreadProfile());
+	ThreadProfile* t = threads.back().get();
+	t->id = (int)threads.size() - 1;
+	if (trace_enabled.load(std::memory_order_relaxed)) { t->trace.reserve(max_trace_event); }
+	return t;
+}
+
+void Profiler::record(Phase phase, int64_t start_ns, int64_t end_ns) {
+	ThreadProfile& t = thread();
+	ThreadProfile::PhaseStat& s = t.phase[(int)phase];
+	const uint64_t ns = (uint64_t)std::max<int64_t>(end_ns - start_ns, 0);
+	addRelaxed(s.count, 1);
+	addRelaxed(s.total_ns, ns);
+	if (ns > s.max_ns.load(std::memory_order_relaxed)) { s.max_ns.store(ns, std::memory_order_relaxed); }
+	addRelaxed(s.bucket[bucketOf(ns)], 1);
+	if (trace_enabled.load(std::memory_order_relaxed)) {
+		if (t.trace.size() < max_trace_event) { t.trace.push_back({ start_ns, end_ns - start_ns, phase }); }
+		else { t.num_trace_dropped++; }
+	}
+}
+
+void Profiler::setReportInterval(double interval_s) {
+	report_interval_ns.store((int64_t)(interval_s * 1e9), std::memory_order_relaxed);
+	next_report_ns.store(profileClock() + (int64_t)(interval_s * 1e9), std::memory_order_relaxed);
+}
+
+void Profiler::tick() {
+	const int64_t interval = report_interval_ns.load(std::memory_order_relaxed);
+	if (interval <= 0) { return; }
+	const int64_t now = profileClock();
+	int64_t next = next_report_ns.load(std::memory_order_relaxed);
+	if (now < next || !next_report_ns.compare_exchange_strong(next, now + interval)) { return; }
+	report();
+}
+
+void Profiler::enableTrace(size_t max_event) {
+	std::lock_guard<std::mutex> lock(mutex);
+	max_trace_event = max_event;
+	for (auto& t : threads) { t->trace.reserve(max_event); }
+	trace_enabled.store(true, std::memory_order_relaxed);
+}
+
+bool Profiler::writeChromeTrace(const char* path) const {
+	FILE* out = fopen(path, "w");
+	if (out == nullptr) { return false; }
+	std::lock_guard<std::mutex> lock(mutex);
+	fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	bool first = true;
+	uint64_t num_dropped = 0;
+	for (const auto& t : threads) {
+		fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+			first ? "" : ",\n", t->id, t->id);
+		first = false;
+		for (const ThreadProfile::TraceEvent& e : t->trace) { // complete events, [us]
+			fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"physics\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+				phaseName(e.phase), t->id, (e.start_ns - epoch_ns) * 1e-3, e.duration_ns * 1e-3);
+		}
+		num_dropped += t->num_trace_dropped;
+	}
+	fprintf(out, "\n], \"otherData\": {\"dropped_events\": %llu}}\n", (unsigned long long)num_dropped);
+	return fclose(out) == 0;
+}
+
+void Profiler::report(FILE* out) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	fprintf(out, "%-16s %10s %12s %10s %10s %10s %10s\n", "phase", "count", "total ms", "mean us", "p50 us", "p99 us", "max us");
+	for (int p = 0; p < NUM_PHASE; p++) {
+		uint64_t count = 0, total_ns = 0, max_ns = 0;
+		std::vector<uint64_t> bucket(PROFILE_NUM_BUCKET, 0);
+		for (const auto& t : threads) {
+			const ThreadProfile::PhaseStat& s = t->phase[p];
+			count += s.count.load(std::memory_order_relaxed);
+			total_ns += s.total_ns.load(std::memory_order_relaxed);
+			max_ns = std::max(max_ns, s.max_ns.load(std::memory_order_relaxed));
+			for (int b = 0; b < PROFILE_NUM_BUCKET; b++) { bucket[b] += s.bucket[b].load(std::memory_order_relaxed); }
+		}
+		if (count == 0) { continue; }
+		auto percentile = [&](double q) { // middle of the bucket holding the q quantile
+			uint64_t rank = (uint64_t)(q * (count - 1)), seen = 0;
+			for (int b = 0; b < PROFILE_NUM_BUCKET; b++) {
+				seen += bucket[b];
+				if (seen > rank) { return std::min(bucketValue(b), (double)max_ns); }
+			}
+			return (double)max_ns;
+		};
+		fprintf(out, "%-16s %10llu %12.2f %10.2f %10.2f %10.2f %10.2f\n", phaseName((Phase)p), (unsigned long long)count,
+			total_ns * 1e-6, total_ns * 1e-3 / count, percentile(0.5) * 1e-3, percentile(0.99) * 1e-3, max_ns * 1e-3);
+	}
+	fprintf(out, "%-16s %10s\n", "counter", "total");
+	for (int c = 0; c < NUM_COUNTER; c++) {
+		uint64_t n = 0;
+		for (const auto& t : threads) { n += t->counter[c].load(std::memory_order_relaxed); }
+		if (n > 0) { fprintf(out, "%-16s %10llu\n", counterName((Counter)c), (unsigned long long)n); }
+	}
+	fflush(out);
+}
+
+void Profiler::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& t : threads) {
+		for (ThreadProfile::PhaseStat& s : t->phase) {
+			s.count = 0;
+			s.total_ns = 0;
+			s.max_ns = 0;
+			for (auto& b : s.bucket) { b = 0; }
+		}
+		for (auto& c : t->counter) { c = 0; }
+		t->trace.clear();
+		t->num_trace_dropped = 0;
+	}
+}
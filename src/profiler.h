@@ -0,0 +1,156 @@
+/*
+profiler.h: per-phase timers and counters of the physics loop (Simulation::update_physics, CpuSimulation::update,
+stepCpu), compiled in with the PROFILE definition (cmake -DUSE_PROFILE=ON) and out otherwise:
+	PROFILE_SCOPE(Phase::SPRING);				// time the rest of the scope
+	PROFILE_COUNT(Counter::SPRING_UPDATE, n);	// add n to a counter
+	PROFILE_TICK();								// once per update: print the report every report_interval
+Each thread records into its own buffer (no lock, no shared cache line): a log-scale histogram per phase and,
+with enableTrace(), the list of the timed scopes. report() merges the threads into count/total/mean/p50/p99/max
+per phase, writeChromeTrace() writes the scopes as a chrome trace (chrome://tracing, https://ui.perfetto.dev).
+Scopes nest: the dynamics phase contains the spring, mass and joint rotation passes of the calling thread.
+*/
+
+#ifndef TITAN_PROFILER_H
+#define TITAN_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum class Phase : int {
+	UPDATE, // one physics update (NUM_QUEUED_KERNELS steps and the host side)
+	DYNAMICS, // the dynamics steps (the kernel launches for the cuda backend)
+	SPRING, // spring pass (per thread)
+	MASS, // mass pass (per thread)
+	JOINT_ROTATION, // joint rotation pass (per thread)
+	READBACK, // copy pos/vel/acc to the host (CopyPosVelAccFrom, copyPosVelAccTo)
+	JOINT_MEASURE, // joint angles and speeds (measureJoints)
+	JOINT_CONTROL, // PI controller of the joint speeds (updateJointControl) and its upload
+	STATE, // state report of each robot (measureModelState)
+	UDP, // state publish and command handoff with the transport
+	UDP_WAIT, // lockstep: waiting for the controller's next step
+	RESET, // restore the backed up state
+	RECORD, // copy a frame to the trajectory recorder (recorder.h)
+	COLLISION, // self collision contact forces (sim_collision.h, per thread)
+	BROAD_PHASE, // self collision neighbor list build (per thread)
+	CONTACT, // contact pass of the surface masses (per thread)
+	NUM_PHASE
+};
+
+enum class Counter : int {
+	UPDATE, // physics updates
+	SPRING_UPDATE, // spring evaluations
+	MASS_UPDATE, // mass integrations
+	STATE_SENT, // state reports published
+	COMMAND_RECEIVED, // commands applied
+	RESET, // resets
+	NUM_COUNTER
+};
+
+const char* phaseName(Phase phase);
+const char* counterName(Counter counter);
+
+constexpr int NUM_PHASE = (int)Phase::NUM_PHASE;
+constexpr int NUM_COUNTER = (int)Counter::NUM_COUNTER;
+constexpr int PROFILE_SUB_BUCKET = 4; // histogram buckets per power of 2 (about 19% resolution)
+constexpr int PROFILE_NUM_BUCKET = 64 * PROFILE_SUB_BUCKET;
+
+/* [ns] since the profiler epoch (steady clock) */
+inline int64_t profileClock() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* the buffer of one thread, written only by its thread (relaxed atomics: report() may read it meanwhile) */
+struct ThreadProfile {
+	struct PhaseStat {
+		std::atomic<uint64_t> count{ 0 };
+		std::atomic<uint64_t> total_ns{ 0 };
+		std::atomic<uint64_t> max_ns{ 0 };
+		std::atomic<uint64_t> bucket[PROFILE_NUM_BUCKET] = {};
+	};
+	struct TraceEvent {
+		int64_t start_ns;
+		int64_t duration_ns;
+		Phase phase;
+	};
+	int id; // registration order, the thread id of the trace
+	PhaseStat phase[NUM_PHASE];
+	std::atomic<uint64_t> counter[NUM_COUNTER] = {};
+	std::vector<TraceEvent> trace; // only with enableTrace(), at most Profiler::max_trace_event
+	uint64_t num_trace_dropped = 0; // events not recorded once trace was full
+};
+
+class Profiler {
+public:
+	/* the profiler of the process */
+	static Profiler& instance();
+
+	/* record a timed scope of the calling thread */
+	void record(Phase phase, int64_t start_ns, int64_t end_ns);
+	inline void count(Counter counter, uint64_t n = 1) {
+		std::atomic<uint64_t>& c = thread().counter[(int)counter];
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	/* print the report every interval [s] of wall time from tick(), 0: only on explicit report() */
+	void setReportInterval(double interval_s);
+	void tick(); // called once per update, prints the report when the interval has passed
+
+	/* keep the timed scopes of each thread for writeChromeTrace(), up to max_event per thread */
+	void enableTrace(size_t max_event = 1 << 20);
+	/* write the kept scopes in the chrome trace event format, returns false if the file cannot be written */
+	bool writeChromeTrace(const char* path) const;
+
+	/* merge the threads and print count, total, mean, p50, p99 and max of each phase and the counters */
+	void report(FILE* out = stdout) const;
+	/* clear all statistics and traces, no thread may record meanwhile */
+	void clear();
+
+private:
+	Profiler();
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+	ThreadProfile& thread(); // the buffer of the calling thread, registered on first use
+	ThreadProfile* registerThread();
+
+	int64_t epoch_ns; // start of the trace timeline
+	std::atomic<bool> trace_enabled{ false };
+	size_t max_trace_event = 0;
+	std::atomic<int64_t> report_interval_ns{ 0 };
+	std::atomic<int64_t> next_report_ns{ 0 };
+	mutable std::mutex mutex; // guards threads (registration and reading)
+	std::vector<std::unique_ptr<ThreadProfile> > threads;
+};
+
+inline Profiler& profiler() { return Profiler::instance(); }
+
+/* times its scope into phase */
+class ScopedTimer {
+public:
+	explicit ScopedTimer(Phase phase) : phase(phase), start_ns(profileClock()) {}
+	~ScopedTimer() { profiler().record(phase, start_ns, profileClock()); }
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+	Phase phase;
+	int64_t start_ns;
+};
+
+#define TITAN_PROFILE_CONCAT_(a, b) a##b
+#define TITAN_PROFILE_CONCAT(a, b) TITAN_PROFILE_CONCAT_(a, b)
+
+#ifdef PROFILE
+#define PROFILE_SCOPE(phase) ScopedTimer TITAN_PROFILE_CONCAT(profile_scope_, __LINE__)(phase)
+#define PROFILE_COUNT(counter, n) profiler().count(counter, n)
+#define PROFILE_TICK() profiler().tick()
+#else
+#define PROFILE_SCOPE(phase) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_TICK() ((void)0)
+#endif // PROFILE
+
+#endif // TITAN_PROFILER_H
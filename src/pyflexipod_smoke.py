@@ -0,0 +1,91 @@
+"""
+pyflexipod_smoke.py: smoke test of the pyflexipod module (python_module.cpp, -DUSE_PYTHON=ON), run by
+ctest -R pyflexipod or directly with the module on the python path:
+
+    PYTHONPATH=build python src/pyflexipod_smoke.py src/data.msgpack
+
+Constructs two instances, steps them, checks that the numpy views follow the simulation, that reset()
+and the snapshot slots restore the state (slot 0 is reserved for reset), that rollouts from a reset
+are identical, and that a flat heightfield terrain walks as the plane. Exits with 1 on the first failure.
+"""
+
+import sys
+
+import numpy as np
+
+import pyflexipod
+
+
+def check(condition, what):
+    if not condition:
+        print("FAILED:", what)
+        sys.exit(1)
+
+
+def rollout(sim, actions, num_update):
+    for _ in range(num_update):
+        sim.step(actions, 1)
+    return sim.pos.copy()
+
+
+def main(model_path):
+    sim = pyflexipod.Simulation(model_path, num_instance=2, num_threads=2, num_snapshot_slot=2)
+    n, m, j = sim.num_instance, sim.num_mass, sim.num_joint
+    check(n == 2 and m > 0 and j > 0, "construct: num_instance %d, num_mass %d, num_joint %d" % (n, m, j))
+    check(sim.pos.shape == (n, m, 3) and sim.state.shape == (n, 24), "view shapes")
+    check(sim.joint_pos.shape == (n, j), "joint view shape")
+    pos_start = sim.pos.copy()
+
+    # step: the views follow the simulation
+    actions = np.tile(np.where(np.arange(j) % 2, 10.0, -10.0), (n, 1))
+    pos = sim.pos  # a view, not a copy
+    state = sim.step(actions, 5)
+    check(sim.T > 0 and np.all(np.isfinite(state)), "step: T %g, finite state" % sim.T)
+    check(not np.array_equal(pos, pos_start), "step: the pos view follows the simulation")
+    check(np.array_equal(sim.joint_vel_desired, actions), "step: joint_vel_desired is the action")
+    try:
+        sim.step(np.zeros(j + 1), 1)
+        check(False, "step: a wrong action size is rejected")
+    except ValueError:
+        pass
+
+    # snapshots: slot 0 is the state at start
+    try:
+        sim.save_snapshot(0)
+        check(False, "save_snapshot(0) is rejected")
+    except IndexError:
+        pass
+    sim.save_snapshot(1)
+    pos_saved = sim.pos.copy()
+    sim.step(actions, 3)
+    sim.restore_snapshot(1)
+    check(np.array_equal(sim.pos, pos_saved), "restore_snapshot(1)")
+
+    # reset: one instance, then all, rollouts from a reset are identical
+    sim.reset([1])
+    check(np.array_equal(sim.pos[1], pos_start[1]) and np.array_equal(sim.pos[0], pos_saved[0]), "reset([1])")
+    sim.reset()
+    check(np.array_equal(sim.pos, pos_start), "reset()")
+    first = rollout(sim, actions, 4)
+    sim.reset()
+    second = rollout(sim, actions, 4)
+    check(np.array_equal(first, second), "identical rollouts from a reset")
+
+    # terrain: a flat heightfield at the height of the plane walks as the plane, then the plane again
+    sim.reset()
+    on_plane = rollout(sim, actions, 80)  # the robots land within 80 updates
+    sim.reset()
+    sim.set_terrain(np.zeros((201, 201)), cell=0.02)
+    on_terrain = rollout(sim, actions, 80)
+    check(np.all(np.isfinite(on_terrain)) and np.abs(on_terrain - on_plane).max() < 1e-3,
+          "step on a flat terrain: max difference to the plane %g m" % np.abs(on_terrain - on_plane).max())
+    sim.set_terrain(None)
+    sim.reset()
+    check(np.array_equal(rollout(sim, actions, 80), on_plane), "step on the plane again")
+
+    print("pyflexipod smoke test passed: %d instances of %d masses, T %.3f s" % (n, m, sim.T))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1] if len(sys.argv) > 1 else "../src/data.msgpack"))
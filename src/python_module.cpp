@@ -0,0 +1,198 @@
+/*
+python_module.cpp: python bindings of the headless cpu simulation (sim_cpu.h) with pybind11,
+built with -DUSE_PYTHON=ON as the pyflexipod module. e.g. batched rollouts of num_instance robots:
+	import pyflexipod
+	sim = pyflexipod.Simulation("src/data.msgpack", num_instance=8, num_threads=8)
+	state = sim.step(actions, num_update=1) # actions: desired joint speed [rad/s], (num_instance, num_joint)
+	sim.reset(np.flatnonzero(done)) # restore the instances from the snapshot taken at start
+The arrays (pos, vel, joint_pos, state, ...) are numpy views of the simulation buffers, not copies:
+they follow the simulation and keep it alive. step() releases the GIL while updating, the views must
+not be read by another python thread meanwhile.
+With reorder=True pos and vel are in the reordered (simulation) order, pos[:, sim.vertex_index] is the
+original order of the model and vertex_order maps back.
+*/
+
+#include "sim_cpu.h"
+#include "flexipod.h"
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+namespace py = pybind11;
+
+static_assert(sizeof(Vec3d) == 3 * sizeof(double), "Vec3d is viewed as 3 doubles");
+static_assert(sizeof(ModelState) == 24 * sizeof(double), "ModelState is viewed as 24 doubles");
+
+/* the headless simulation of one robot model, set up as flexipod_headless does */
+struct FlexipodSimulation {
+	std::unique_ptr<CpuSimulation> sim;
+
+	FlexipodSimulation(const std::string& model_path, int num_instance, int num_threads, double dt,
+		double max_rpm, bool reorder, bool reproducible, int num_snapshot_slot) {
+		MASS robot_mass; // one robot (host)
+		SPRING robot_spring;
+		JOINT robot_joint;
+		FlexipodIndex index = loadFlexipod(model_path.c_str(), reorder, robot_mass, robot_spring, robot_joint);
+		sim.reset(new CpuSimulation(robot_mass, robot_spring, robot_joint, num_instance));
+		robot_mass.release(); // packed into sim, which frees its own copy
+		robot_spring.release();
+		robot_joint.release();
+		sim->num_threads = num_threads;
+		sim->dt = dt;
+		if (reproducible) { sim->force_assembly = ForceAssembly::GATHER; } // no atomics: reproducible rollouts
+		sim->num_snapshot_slot = num_snapshot_slot;
+
+		sim->id_restable_spring_start = index.id_restable_spring_start;
+		sim->id_resetable_spring_end = index.id_resetable_spring_end;
+		sim->id_oxyz_start = index.id_oxyz_start;
+		sim->id_oxyz_end = index.id_oxyz_end;
+		sim->vertex_order = index.vertex_order;
+
+		sim->setMaxJointSpeed(max_rpm / 60. * 2 * M_PI);//max joint speed in rad/s
+		sim->global_acc = Vec3d(0, 0, -9.8); // global acceleration
+		sim->createPlane(Vec3d(0, 0, 1), 0, 0.6, 0.6);
+		sim->start();
+	}
+
+	/* copy the desired joint speed of all instances, actions has num_instance*num_joint values */
+	void setAction(const py::handle& actions) {
+		auto a = py::array_t<double, py::array::c_style | py::array::forcecast>::ensure(actions);
+		if (!a || a.size() != (py::ssize_t)sim->joint_vel_desired.size()) {
+			throw py::value_error("actions must hold num_instance*num_joint = " +
+				std::to_string(sim->joint_vel_desired.size()) + " joint speeds");
+		}
+		std::copy(a.data(), a.data() + a.size(), sim->joint_vel_desired.begin());
+	}
+};
+
+/* numpy view of data (not a copy), owner keeps the buffer alive */
+static py::array_t<double> view(double* data, std::vector<py::ssize_t> shape, py::handle owner) {
+	return py::array_t<double>(shape, data, owner);
+}
+
+static py::array_t<double> stateView(py::handle self) {
+	CpuSimulation& sim = *self.cast<FlexipodSimulation&>().sim;
+	return view((double*)sim.instance_state.data(), { sim.layout.num_instance, 24 }, self);
+}
+
+/* numpy view of the joint array of all instances, (num_instance, num_joint) */
+static py::array_t<double> jointView(py::handle self, std::vector<double> CpuSimulation::* member) {
+	CpuSimulation& sim = *self.cast<FlexipodSimulation&>().sim;
+	return view((sim.*member).data(), { sim.layout.num_instance, sim.layout.num_joint }, self);
+}
+
+/* original index of each mass of an instance (inverse: false) or the current index of each original mass
+   (inverse: true), the identity if the model was not reordered */
+static py::array_t<int> vertexOrder(const CpuSimulation& sim, bool inverse) {
+	py::array_t<int> order(sim.layout.num_mass);
+	int* o = order.mutable_data();
+	for (int i = 0; i < sim.layout.num_mass; i++) {
+		const int k = sim.vertex_order.empty() ? i : sim.vertex_order[i];
+		if (inverse) { o[k] = i; }
+		else { o[i] = k; }
+	}
+	return order;
+}
+
+/* numpy view of a mass array of all instances, (num_instance, num_mass, 3) */
+static py::array_t<double> massView(py::handle self, Vec3d* MASS::* member) {
+	CpuSimulation& sim = *self.cast<FlexipodSimulation&>().sim;
+	return view((double*)(sim.mass.*member), { sim.layout.num_instance, sim.layout.num_mass, 3 }, self);
+}
+
+PYBIND11_MODULE(pyflexipod, m) {
+	m.doc() = "headless cpu simulation of the flexipod robot (sim_cpu.h)";
+
+	py::dict columns; // columns of Simulation.state, the layout of ModelState
+	columns["com_pos"] = py::slice(0, 3, 1); // body center of mass position [m]
+	columns["com_acc"] = py::slice(3, 6, 1); // body center of mass acceleration [m/s^2]
+	columns["ox"] = py::slice(6, 9, 1); // normalized body x direction
+	columns["oy"] = py::slice(9, 12, 1); // normalized body y direction
+	columns["joint_pos"] = py::slice(12, 16, 1); // joint angle [rad]
+	columns["joint_vel"] = py::slice(16, 20, 1); // joint speed [rad/s]
+	columns["joint_vel_cmd"] = py::slice(20, 24, 1); // commended joint speed [rad/s]
+	m.attr("STATE_COLUMNS") = columns;
+
+	py::class_<FlexipodSimulation>(m, "Simulation")
+		.def(py::init<const std::string&, int, int, double, double, bool, bool, int>(),
+			py::arg("model_path"), py::arg("num_instance") = 1, py::arg("num_threads") = 0, py::arg("dt") = 5e-5,
+			py::arg("max_rpm") = 600., py::arg("reorder") = false, py::arg("reproducible") = true,
+			py::arg("num_snapshot_slot") = 1,
+			"load a msgpack or binary model and start num_instance robots on a plane, reproducible: "
+			"ForceAssembly::GATHER (bit-identical rollouts), num_snapshot_slot: slot 0 is the state at start")
+		.def("step", [](py::object self, py::object actions, int num_update) {
+				FlexipodSimulation& s = self.cast<FlexipodSimulation&>();
+				if (!actions.is_none()) { s.setAction(actions); }
+				{
+					py::gil_scoped_release release;
+					s.sim->step(num_update);
+				}
+				return stateView(self);
+			}, py::arg("actions") = py::none(), py::arg("num_update") = 1,
+			"set the desired joint speed (num_instance, num_joint) unless None, run num_update updates "
+			"(NUM_QUEUED_KERNELS*dt each) and return the state view")
+		.def("reset", [](FlexipodSimulation& s, py::object instances) {
+				if (instances.is_none()) { s.sim->resetState(); return; }
+				if (!py::isinstance<py::iterable>(instances)) { s.sim->resetInstance(instances.cast<int>()); return; }
+				for (py::handle k : instances) { s.sim->resetInstance(k.cast<int>()); }
+			}, py::arg("instances") = py::none(),
+			"restore the state at start of all instances (None), one instance or an iterable of instances")
+		.def("set_terrain", [](FlexipodSimulation& s, py::object heights, double cell, double friction_k, double friction_s) {
+				if (heights.is_none()) { // back to the ground plane
+					s.sim->clearConstraints();
+					s.sim->createPlane(Vec3d(0, 0, 1), 0, 0.6, 0.6);
+					return;
+				}
+				auto h = py::array_t<double, py::array::c_style | py::array::forcecast>::ensure(heights);
+				if (!h || h.ndim() != 2) { throw py::value_error("heights must be a 2d array (ny, nx)"); }
+				Heightfield terrain((int)h.shape(1), (int)h.shape(0), cell, h.data());
+				terrain.setFriction(friction_k, friction_s);
+				s.sim->clearConstraints();
+				s.sim->createTerrain(terrain);
+			}, py::arg("heights"), py::arg("cell") = 0.02, py::arg("friction_k") = 0.6, py::arg("friction_s") = 0.6,
+			"replace the ground plane by a heightfield (terrain.h) centered on x=y=0 between steps: heights [m] "
+			"(ny, nx) with heights[j, i] at x = (i - (nx-1)/2)*cell, y = (j - (ny-1)/2)*cell, None: the plane again")
+		.def("save_snapshot", [](FlexipodSimulation& s, int slot) { s.sim->saveSnapshot(slot); }, py::arg("slot"),
+			"save the state of all instances into slot 1 to num_snapshot_slot-1, slot 0 (the state at start) is kept for reset")
+		.def("restore_snapshot", [](FlexipodSimulation& s, int slot, py::object instance) {
+				if (instance.is_none()) { s.sim->restoreSnapshot(slot); }
+				else { s.sim->restoreSnapshot(slot, instance.cast<int>()); }
+			}, py::arg("slot"), py::arg("instance") = py::none())
+		.def_property_readonly("T", [](FlexipodSimulation& s) { return s.sim->T; }, "simulation time [s]")
+		.def_property_readonly("dt", [](FlexipodSimulation& s) { return s.sim->dt; })
+		.def_property_readonly("num_instance", [](FlexipodSimulation& s) { return s.sim->layout.num_instance; })
+		.def_property_readonly("num_mass", [](FlexipodSimulation& s) { return s.sim->layout.num_mass; }, "per instance")
+		.def_property_readonly("num_joint", [](FlexipodSimulation& s) { return s.sim->layout.num_joint; }, "per instance")
+		.def_property_readonly("max_joint_vel", [](FlexipodSimulation& s) { return s.sim->max_joint_vel; }, "[rad/s]")
+		.def_property_readonly("state", [](py::object self) { return stateView(self); },
+			"(num_instance, 24) measured state, see STATE_COLUMNS")
+		.def_property_readonly("pos", [](py::object self) { return massView(self, &MASS::pos); },
+			"(num_instance, num_mass, 3) mass position [m]")
+		.def_property_readonly("vel", [](py::object self) { return massView(self, &MASS::vel); },
+			"(num_instance, num_mass, 3) mass velocity [m/s]")
+		.def_property_readonly("vertex_order", [](FlexipodSimulation& s) { return vertexOrder(*s.sim, false); },
+			"(num_mass,) original index of each mass of pos/vel (reorder=True), the identity otherwise")
+		.def_property_readonly("vertex_index", [](FlexipodSimulation& s) { return vertexOrder(*s.sim, true); },
+			"(num_mass,) index in pos/vel of each original mass: pos[:, vertex_index] is in the original order")
+		.def_property_readonly("joint_pos", [](py::object self) { return jointView(self, &CpuSimulation::joint_pos); },
+			"(num_instance, num_joint) measured joint angle [rad]")
+		.def_property_readonly("joint_vel", [](py::object self) { return jointView(self, &CpuSimulation::joint_vel); },
+			"(num_instance, num_joint) measured joint speed [rad/s]")
+		.def_property_readonly("joint_vel_desired", [](py::object self) { return jointView(self, &CpuSimulation::joint_vel_desired); },
+			"(num_instance, num_joint) desired joint speed [rad/s], writable")
+		.def_property_readonly("joint_vel_cmd", [](py::object self) { return jointView(self, &CpuSimulation::joint_vel_cmd); },
+			"(num_instance, num_joint) commended joint speed [rad/s]")
+		.def_property_readonly("instance_T", [](py::object self) {
+				CpuSimulation& sim = *self.cast<FlexipodSimulation&>().sim;
+				return view(sim.instance_T.data(), { sim.layout.num_instance }, self);
+			}, "(num_instance,) simulation time since the last reset [s]");
+}
@@ -0,0 +1,291 @@
+/*
+recorder.cpp: streaming trajectory recorder, see recorder.h
+*/
+
+#include "recorder.h"
+#include "sim_cpu.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+static_assert(sizeof(Vec3d) == 3 * sizeof(double), "RECORD_POSITION copies Vec3d as 3 doubles");
+
+namespace {
+
+const char* const CHANNEL_NAME[RECORD_NUM_CHANNEL] = { "position", "sensor", "joint", "command", "com" };
+
+constexpr int32_t MAX_QUANTIZED = 1 << 29; // |q| bound: the difference of two frames is within +-2^30 and fits int32
+
+inline int32_t quantize(double value, double inv_resolution) {
+	const double q = std::nearbyint(value * inv_resolution);
+	if (!(q > -MAX_QUANTIZED)) { return -MAX_QUANTIZED; } // also NaN
+	return q < MAX_QUANTIZED ? (int32_t)q : MAX_QUANTIZED;
+}
+
+inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+
+} // namespace
+
+uint32_t parseRecordChannels(const char* names) {
+	uint32_t channels = 0;
+	std::string list(names);
+	size_t begin = 0;
+	while (begin <= list.size()) {
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos) { end = list.size(); }
+		const std::string name = list.substr(begin, end - begin);
+		if (name == "all") { channels |= (1u << RECORD_NUM_CHANNEL) - 1; }
+		else {
+			int c = 0;
+			while (c < RECORD_NUM_CHANNEL && name != CHANNEL_NAME[c]) { c++; }
+			if (c == RECORD_NUM_CHANNEL) { throw std::runtime_error("unknown record channel: " + name); }
+			channels |= 1u << c;
+		}
+		begin = end + 1;
+	}
+	return channels;
+}
+
+void TrajectoryRecorder::open(const std::string& path, const RecorderOptions& options, const InstanceLayout& layout, const double dt) {
+	if (file != nullptr) { throw std::runtime_error("TrajectoryRecorder: already open"); }
+	if (options.num_frame_buffer < 1 || options.num_frame_buffer > (int)RECORDER_QUEUE_SIZE) {
+		throw std::runtime_error("TrajectoryRecorder: num_frame_buffer must be in [1, RECORDER_QUEUE_SIZE]");
+	}
+	this->options = options;
+	this->options.interval = std::max(options.interval, 1);
+	this->options.frames_per_chunk = std::max(options.frames_per_chunk, 1);
+	this->layout = layout;
+	const size_t num_mass = (size_t)layout.num_mass * layout.num_instance;
+	const size_t num_joint = (size_t)layout.num_joint * layout.num_instance;
+	const size_t num_sensor = options.channels & RECORD_SENSOR ? options.sensor.size() : 0;
+	for (int id : options.sensor) {
+		if (id < 0 || id >= layout.num_mass) { throw std::runtime_error("TrajectoryRecorder: sensor mass out of range"); }
+	}
+	if (!options.vertex_order.empty()) {
+		if (options.vertex_order.size() != (size_t)layout.num_mass) {
+			throw std::runtime_error("TrajectoryRecorder: vertex_order must hold the masses of one instance");
+		}
+		for (int id : options.vertex_order) {
+			if (id < 0 || id >= layout.num_mass) { throw std::runtime_error("TrajectoryRecorder: vertex_order out of range"); }
+		}
+	}
+
+	num_value = 0;
+	if (options.channels & RECORD_POSITION) { num_value += 3 * num_mass; }
+	if (options.channels & RECORD_SENSOR) { num_value += 3 * num_sensor * layout.num_instance; }
+	if (options.channels & RECORD_JOINT) { num_value += 3 * num_joint; }
+	if (options.channels & RECORD_COMMAND) { num_value += num_joint; }
+	if (options.channels & RECORD_COM) { num_value += 12 * (size_t)layout.num_instance; }
+
+	file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr) { throw std::runtime_error("TrajectoryRecorder: cannot create " + path); }
+
+	TrajectoryFileHeader header = {};
+	memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+	header.version = TRAJECTORY_VERSION;
+	header.channels = options.channels;
+	header.num_mass = (uint32_t)num_mass;
+	header.num_joint = (uint32_t)num_joint;
+	header.num_instance = (uint32_t)layout.num_instance;
+	header.num_sensor = (uint32_t)num_sensor;
+	header.num_value = (uint32_t)num_value;
+	header.frames_per_chunk = (uint32_t)this->options.frames_per_chunk;
+	header.interval = (uint32_t)this->options.interval;
+	header.steps_per_update = NUM_QUEUED_KERNELS;
+	header.dt = dt;
+	for (int c = 0; c < RECORD_NUM_CHANNEL; c++) { header.resolution[c] = options.resolution[c]; }
+	bytes_written = 0;
+	write_failed = false;
+	write(&header, sizeof(header));
+	std::vector<uint32_t> sensor(options.sensor.begin(), options.sensor.begin() + num_sensor);
+	if (!options.vertex_order.empty()) {
+		for (uint32_t& id : sensor) { id = (uint32_t)options.vertex_order[id]; }
+	}
+	write(sensor.data(), sensor.size() * sizeof(uint32_t));
+
+	// all buffers are allocated here, record() and the writer never allocate
+	frames.assign(this->options.num_frame_buffer, Frame());
+	for (int i = 0; i < (int)frames.size(); i++) {
+		frames[i].value.resize(num_value);
+		empty.push(i);
+	}
+	last.assign(num_value, 0);
+	delta.assign(num_value * this->options.frames_per_chunk, 0);
+	chunk_T.clear();
+	chunk_T.reserve(this->options.frames_per_chunk);
+	shuffled.resize(delta.size() * sizeof(uint32_t));
+	compressed.resize(compressBound((uLong)shuffled.size()));
+	index.clear();
+	num_frame = 0;
+	num_call = num_recorded = num_dropped = 0;
+	closing = false;
+	writer = std::thread(&TrajectoryRecorder::writerLoop, this);
+}
+
+void TrajectoryRecorder::record(const RecordSource& source) {
+	if (file == nullptr || num_call++ % options.interval != 0) { return; }
+	int i;
+	if (!empty.pop(i)) { num_dropped++; return; } // the writer is behind
+	Frame& frame = frames[i];
+	frame.T = source.T;
+	double* v = frame.value.data();
+	const size_t num_mass = (size_t)layout.num_mass * layout.num_instance;
+	const size_t num_joint = (size_t)layout.num_joint * layout.num_instance;
+	if (options.channels & RECORD_POSITION) {
+		if (options.vertex_order.empty()) { memcpy(v, source.pos, num_mass * sizeof(Vec3d)); } // Vec3d is 3 doubles
+		else { // back to the original order
+			for (int k = 0; k < layout.num_instance; k++) {
+				const Vec3d* pos = source.pos + layout.massOffset(k);
+				double* out = v + 3 * (size_t)layout.massOffset(k);
+				for (int i = 0; i < layout.num_mass; i++) {
+					double* o = out + 3 * (size_t)options.vertex_order[i];
+					o[0] = pos[i].x;
+					o[1] = pos[i].y;
+					o[2] = pos[i].z;
+				}
+			}
+		}
+		v += 3 * num_mass;
+	}
+	if (options.channels & RECORD_SENSOR) {
+		for (int k = 0; k < layout.num_instance; k++) {
+			const Vec3d* pos = source.pos + layout.massOffset(k);
+			for (int id : options.sensor) {
+				*v++ = pos[id].x;
+				*v++ = pos[id].y;
+				*v++ = pos[id].z;
+			}
+		}
+	}
+	if (options.channels & RECORD_JOINT) {
+		v = std::copy(source.joint_pos, source.joint_pos + num_joint, v);
+		v = std::copy(source.joint_vel, source.joint_vel + num_joint, v);
+		v = std::copy(source.joint_vel_cmd, source.joint_vel_cmd + num_joint, v);
+	}
+	if (options.channels & RECORD_COMMAND) {
+		v = std::copy(source.joint_vel_desired, source.joint_vel_desired + num_joint, v);
+	}
+	if (options.channels & RECORD_COM) {
+		for (int k = 0; k < layout.num_instance; k++) {
+			const ModelState& s = source.state[k];
+			for (const Vec3d* u : { &s.com_pos, &s.com_acc, &s.ox, &s.oy }) {
+				*v++ = u->x;
+				*v++ = u->y;
+				*v++ = u->z;
+			}
+		}
+	}
+	filled.push(i); // cannot fail: at most frames.size() indices are in flight
+	num_recorded++;
+	// wake the writer once a quarter of the buffers are queued, a wake up per frame costs more than the copy
+	if (num_recorded % std::max<size_t>(frames.size() / 4, 1) == 0) { notifier.notify(); }
+}
+
+void TrajectoryRecorder::writerLoop() {
+	for (;;) {
+		int i;
+		if (filled.pop(i)) {
+			encodeFrame(frames[i]);
+			empty.push(i);
+			continue;
+		}
+		if (closing.load(std::memory_order_acquire)) {
+			if (filled.empty()) { break; } // record() is done before close() sets closing
+			continue;
+		}
+		notifier.waitFor([this] { return !filled.empty() || closing.load(std::memory_order_acquire); },
+			std::chrono::milliseconds(20)); // also picks up the frames queued since the last notify
+	}
+	if (!chunk_T.empty()) { flushChunk(); }
+}
+
+void TrajectoryRecorder::encodeFrame(const Frame& frame) {
+	const size_t F = options.frames_per_chunk;
+	const size_t f = chunk_T.size();
+	if (f == 0) {
+		index.push_back({ 0, num_frame, frame.T }); // offset is set when written
+	}
+	chunk_T.push_back(frame.T);
+
+	// quantization step of each value, in the channel order of record()
+	const size_t num_mass = (size_t)layout.num_mass * layout.num_instance;
+	const size_t num_joint = (size_t)layout.num_joint * layout.num_instance;
+	const size_t count[RECORD_NUM_CHANNEL] = { 3 * num_mass, 3 * options.sensor.size() * layout.num_instance,
+		3 * num_joint, num_joint, 12 * (size_t)layout.num_instance };
+	size_t v = 0;
+	for (int c = 0; c < RECORD_NUM_CHANNEL; c++) {
+		if (!(options.channels & (1u << c))) { continue; }
+		const double inv_resolution = 1.0 / options.resolution[c];
+		for (size_t end = v + count[c]; v < end; v++) {
+			const int32_t q = quantize(frame.value[v], inv_resolution);
+			delta[v * F + f] = zigzag(f == 0 ? q : q - last[v]);
+			last[v] = q;
+		}
+	}
+	num_frame++;
+	if (chunk_T.size() == F) { flushChunk(); }
+}
+
+void TrajectoryRecorder::flushChunk() {
+	const size_t F = options.frames_per_chunk;
+	const size_t n = chunk_T.size();
+	const size_t num_word = num_value * n;
+	// byte shuffle: byte b of value v, frame f at b*num_word + v*n + f, the high bytes of small deltas are zeros
+	for (size_t v = 0; v < num_value; v++) {
+		const uint32_t* d = delta.data() + v * F;
+		for (size_t f = 0; f < n; f++) {
+			const size_t w = v * n + f;
+			shuffled[w] = (uint8_t)d[f];
+			shuffled[num_word + w] = (uint8_t)(d[f] >> 8);
+			shuffled[2 * num_word + w] = (uint8_t)(d[f] >> 16);
+			shuffled[3 * num_word + w] = (uint8_t)(d[f] >> 24);
+		}
+	}
+	uLongf compressed_size = (uLongf)compressed.size();
+	if (compress2(compressed.data(), &compressed_size, shuffled.data(), (uLong)(4 * num_word), options.compression_level) != Z_OK) {
+		if (!write_failed) { fprintf(stderr, "TrajectoryRecorder: compression failed\n"); }
+		write_failed = true;
+	}
+	TrajectoryChunkHeader chunk = {};
+	memcpy(chunk.magic, TRAJECTORY_CHUNK_MAGIC, sizeof(chunk.magic));
+	chunk.num_frame = (uint32_t)n;
+	chunk.compressed_size = compressed_size;
+	index.back().offset = bytes_written.load(std::memory_order_relaxed);
+	write(&chunk, sizeof(chunk));
+	write(chunk_T.data(), n * sizeof(double));
+	write(compressed.data(), compressed_size);
+	chunk_T.clear();
+}
+
+void TrajectoryRecorder::write(const void* data, size_t size) {
+	if (write_failed) { return; }
+	if (size > 0 && std::fwrite(data, 1, size, file) != size) {
+		fprintf(stderr, "TrajectoryRecorder: write failed, the rest of the trajectory is lost\n");
+		write_failed = true;
+		return;
+	}
+	bytes_written.store(bytes_written.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+}
+
+void TrajectoryRecorder::close() {
+	if (file == nullptr) { return; }
+	closing.store(true, std::memory_order_release);
+	notifier.notify();
+	writer.join();
+
+	TrajectoryFileTrailer trailer = {};
+	trailer.index_offset = bytes_written.load(std::memory_order_relaxed);
+	trailer.num_chunk = index.size();
+	trailer.num_frame = num_frame;
+	memcpy(trailer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(trailer.magic));
+	write(index.data(), index.size() * sizeof(TrajectoryIndexEntry));
+	write(&trailer, sizeof(trailer));
+	if (std::fclose(file) != 0) { fprintf(stderr, "TrajectoryRecorder: close failed\n"); }
+	file = nullptr;
+	int i;
+	while (empty.pop(i)) {} // the frames are handed out again by the next open()
+}
@@ -0,0 +1,176 @@
+/*
+recorder.h: streaming trajectory recorder. The physics thread copies the channels of every interval-th
+update into a preallocated frame and hands it to a writer thread through a lock-free queue (SpscRing,
+channel.h); the writer quantizes, delta-encodes and compresses the frames into chunks. A full queue
+drops the frame (counted) instead of blocking the physics loop.
+Channels (RecordChannel, in this order within a frame):
+	RECORD_POSITION	double[num_mass][3]						all mass positions [m], in the original order of the model
+	RECORD_SENSOR	double[num_instance][num_sensor][3]		positions of the sensor masses of each instance [m]
+	RECORD_JOINT	double[3][num_joint]					joint_pos [rad], joint_vel, joint_vel_cmd [rad/s]
+	RECORD_COMMAND	double[num_joint]						joint_vel_desired [rad/s]
+	RECORD_COM		double[num_instance][4][3]				com_pos [m], com_acc [m/s^2], ox, oy (ModelState)
+File: a TrajectoryFileHeader, the sensor mass ids (uint32[num_sensor], original order), then the chunks, each:
+	TrajectoryChunkHeader, T (double[num_frame]), the compressed values (compressed_size bytes)
+and at close the chunk index (TrajectoryIndexEntry[num_chunk]) and a TrajectoryFileTrailer.
+The values of a chunk are int32 q = round(value / resolution[channel]), clamped to +-2^29 (NaN: -2^29), stored value-major
+(q[value][frame]), the first frame as is and the others as the difference to the previous frame,
+zigzag encoded, byte-shuffled (all lowest bytes first) and deflated with zlib.
+A file without the trailer (e.g. the process was killed) is read by walking the chunk headers.
+Read it with trajectory.py (numpy, one chunk at a time).
+*/
+
+#ifndef TITAN_RECORDER_H
+#define TITAN_RECORDER_H
+
+#include "vec.h"
+#include "model.h"
+#include "channel.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum RecordChannel : uint32_t {
+	RECORD_POSITION = 1u << 0,
+	RECORD_SENSOR = 1u << 1,
+	RECORD_JOINT = 1u << 2,
+	RECORD_COMMAND = 1u << 3,
+	RECORD_COM = 1u << 4,
+	RECORD_NUM_CHANNEL = 5
+};
+
+constexpr char TRAJECTORY_MAGIC[8] = { 'F','L','X','T','R','A','J','\0' };
+constexpr char TRAJECTORY_CHUNK_MAGIC[4] = { 'C','H','N','K' };
+constexpr char TRAJECTORY_INDEX_MAGIC[8] = { 'F','L','X','I','N','D','E','X' };
+constexpr uint32_t TRAJECTORY_VERSION = 1;
+constexpr size_t RECORDER_QUEUE_SIZE = 256; // upper bound of RecorderOptions::num_frame_buffer
+
+/* bit mask of the channels named in a comma separated list (e.g. "joint,com"), "all": every channel,
+   throws std::runtime_error on an unknown name */
+uint32_t parseRecordChannels(const char* names);
+
+struct RecorderOptions {
+	uint32_t channels = RECORD_JOINT | RECORD_COMMAND | RECORD_COM; // RecordChannel bits
+	int interval = 1; // record every interval-th update (one update: NUM_QUEUED_KERNELS steps)
+	std::vector<int> sensor; // RECORD_SENSOR: mass ids within one instance (e.g. the oxyz points)
+	std::vector<int> vertex_order; // original index of each mass of an instance if the model was reordered
+	                               // (FlexipodIndex::vertex_order): positions and sensor ids are recorded in the original order
+	// quantization step of each channel, in the unit of the channel
+	double resolution[RECORD_NUM_CHANNEL] = { 1e-5, 1e-6, 1e-5, 1e-5, 1e-5 };
+	int frames_per_chunk = 128; // frames compressed together, the unit of random access of the reader
+	int num_frame_buffer = 64; // frames queued for the writer (<= RECORDER_QUEUE_SIZE), more are dropped
+	int compression_level = 1; // zlib level, 1: fastest
+};
+
+/* what the simulation hands to record(), arrays of all instances, unused channels may be null */
+struct RecordSource {
+	double T = 0; // [s] simulation time
+	const Vec3d* pos = nullptr; // [num_mass]
+	const double* joint_pos = nullptr; // [num_joint]
+	const double* joint_vel = nullptr;
+	const double* joint_vel_cmd = nullptr;
+	const double* joint_vel_desired = nullptr;
+	const ModelState* state = nullptr; // [num_instance]
+};
+
+#pragma pack(push, 1)
+struct TrajectoryFileHeader {
+	char magic[8]; // TRAJECTORY_MAGIC
+	uint32_t version; // TRAJECTORY_VERSION
+	uint32_t channels; // RecordChannel bits
+	uint32_t num_mass; // all instances
+	uint32_t num_joint; // all instances
+	uint32_t num_instance;
+	uint32_t num_sensor; // sensor masses per instance
+	uint32_t num_value; // values per frame
+	uint32_t frames_per_chunk;
+	uint32_t interval; // updates per frame
+	uint32_t steps_per_update; // NUM_QUEUED_KERNELS
+	double dt; // [s] simulation timestep
+	double resolution[RECORD_NUM_CHANNEL];
+};
+
+struct TrajectoryChunkHeader {
+	char magic[4]; // TRAJECTORY_CHUNK_MAGIC
+	uint32_t num_frame;
+	uint64_t compressed_size; // [bytes]
+};
+
+struct TrajectoryIndexEntry {
+	uint64_t offset; // of the TrajectoryChunkHeader
+	uint64_t first_frame;
+	double T; // of the first frame
+};
+
+struct TrajectoryFileTrailer {
+	uint64_t index_offset;
+	uint64_t num_chunk;
+	uint64_t num_frame;
+	char magic[8]; // TRAJECTORY_INDEX_MAGIC
+};
+#pragma pack(pop)
+
+class TrajectoryRecorder {
+public:
+	TrajectoryRecorder() {}
+	~TrajectoryRecorder() { close(); }
+	TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+	TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+	/* create path and start the writer thread, layout: the instances of the simulation,
+	   dt: simulation timestep, throws std::runtime_error if the file cannot be created */
+	void open(const std::string& path, const RecorderOptions& options, const InstanceLayout& layout, const double dt);
+	/* physics thread: copy a frame every options.interval-th call, never blocks */
+	void record(const RecordSource& source);
+	/* write the queued frames, the last chunk and the index, join the writer thread */
+	void close();
+
+	inline bool isOpen() const { return file != nullptr; }
+	inline uint64_t numRecorded() const { return num_recorded; } // frames handed to the writer
+	inline uint64_t numDropped() const { return num_dropped; } // frames dropped on a full queue
+	inline uint64_t bytesWritten() const { return bytes_written.load(std::memory_order_relaxed); }
+	inline size_t numValue() const { return num_value; }
+
+private:
+	struct Frame {
+		double T;
+		std::vector<double> value; // [num_value]
+	};
+
+	void writerLoop();
+	void encodeFrame(const Frame& frame); // quantize and delta-encode into the chunk
+	void flushChunk(); // compress and write the chunk
+	void write(const void* data, size_t size);
+
+	RecorderOptions options;
+	InstanceLayout layout;
+	size_t num_value = 0;
+	std::FILE* file = nullptr;
+
+	std::vector<Frame> frames; // [options.num_frame_buffer]
+	SpscRing<int, RECORDER_QUEUE_SIZE> filled; // frames to encode, physics -> writer
+	SpscRing<int, RECORDER_QUEUE_SIZE> empty; // frames to reuse, writer -> physics
+	Notifier notifier; // wakes the writer
+	std::atomic<bool> closing{ false };
+	std::thread writer;
+
+	// physics thread
+	uint64_t num_call = 0;
+	uint64_t num_recorded = 0;
+	uint64_t num_dropped = 0;
+
+	// writer thread
+	std::vector<int32_t> last; // [num_value] quantized previous frame
+	std::vector<uint32_t> delta; // [num_value][frames_per_chunk] zigzag encoded
+	std::vector<double> chunk_T; // [frames in the chunk]
+	std::vector<uint8_t> shuffled, compressed;
+	std::vector<TrajectoryIndexEntry> index;
+	uint64_t num_frame = 0;
+	std::atomic<uint64_t> bytes_written{ 0 };
+	bool write_failed = false;
+};
+
+#endif // TITAN_RECORDER_H
@@ -0,0 +1,196 @@
+/*
+replay.cpp: headless playback of a recorded trajectory (playback.h), renders the springs of the model at the
+recorded mass positions to numbered ppm images, no forces are computed:
+	flexipod_replay [--reorder] [--fps 60] [--speed 1] [--start T] [--end T] [--size 960x540]
+		[--camera 0.5,-0.8,0.4] [--nearest] [--out frames] model_path trajectory
+	--reorder: reorder the model (Model::reorder), the recording is in the original order either way
+	--fps, --speed: images per second of video, simulation seconds per second of video
+	--start, --end: [s] simulation time range (default: the whole recording)
+	--camera: [m] camera position relative to the body center, which the camera looks at
+	--nearest: show the recorded frame at or before each image instead of interpolating
+	--out: output directory (must exist), the images are out/frame_000000.ppm, ...
+e.g. ffmpeg -framerate 60 -i frames/frame_%06d.ppm replay.mp4
+The trajectory must hold the mass positions (flexipod_headless --record run.trj --record-channels position,...).
+*/
+
+#include "playback.h"
+#include "flexipod.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+/* perspective camera looking at target, 70 deg vertical field of view as Simulation::computeMVP */
+struct Camera {
+	Vec3d eye, right, up, forward;
+	double focal; // [pixel]
+	int width, height;
+
+	Camera(const Vec3d& eye, const Vec3d& target, int width, int height) : eye(eye), width(width), height(height) {
+		forward = (target - eye).normalize();
+		right = cross(forward, Vec3d(0, 0, 1)).normalize();
+		up = cross(right, forward);
+		focal = 0.5 * height / tan(0.5 * 70.0 * M_PI / 180.0);
+	}
+	/* pixel coordinates and depth of p, false if p is behind the near plane */
+	inline bool project(const Vec3d& p, double& px, double& py, double& depth) const {
+		const Vec3d d = p - eye;
+		depth = dot(d, forward);
+		if (depth < 0.01) { return false; }
+		px = 0.5 * width + focal * dot(d, right) / depth;
+		py = 0.5 * height - focal * dot(d, up) / depth;
+		return true;
+	}
+};
+
+/* rgb image with a depth buffer, lines are drawn with interpolated color and depth */
+struct Image {
+	int width, height;
+	std::vector<uint8_t> rgb;
+	std::vector<float> depth;
+
+	Image(int width, int height) : width(width), height(height), rgb(3 * width * height), depth(width * height) {}
+
+	void clear() {
+		std::fill(rgb.begin(), rgb.end(), (uint8_t)0); // black as the glfw window
+		std::fill(depth.begin(), depth.end(), 1e30f);
+	}
+
+	void line(const Camera& camera, const Vec3d& a, const Vec3d& b, const Vec3d& color_a, const Vec3d& color_b) {
+		double ax, ay, az, bx, by, bz;
+		if (!camera.project(a, ax, ay, az) || !camera.project(b, bx, by, bz)) { return; }
+		const int n = (int)std::ceil(std::max(std::abs(bx - ax), std::abs(by - ay)));
+		if (n > 4 * (width + height)) { return; } // nearly behind the camera
+		for (int i = 0; i <= n; i++) {
+			const double t = n > 0 ? (double)i / n : 0;
+			const int x = (int)(ax + t * (bx - ax));
+			const int y = (int)(ay + t * (by - ay));
+			if (x < 0 || y < 0 || x >= width || y >= height) { continue; }
+			const float z = (float)(az + t * (bz - az));
+			const int p = y * width + x;
+			if (z >= depth[p]) { continue; }
+			depth[p] = z;
+			const Vec3d c = color_a + t * (color_b - color_a);
+			rgb[3 * p] = (uint8_t)(255 * std::min(std::max(c.x, 0.0), 1.0));
+			rgb[3 * p + 1] = (uint8_t)(255 * std::min(std::max(c.y, 0.0), 1.0));
+			rgb[3 * p + 2] = (uint8_t)(255 * std::min(std::max(c.z, 0.0), 1.0));
+		}
+	}
+
+	bool writePpm(const char* path) const {
+		FILE* out = fopen(path, "wb");
+		if (out == nullptr) { return false; }
+		fprintf(out, "P6\n%d %d\n255\n", width, height);
+		const bool ok = fwrite(rgb.data(), 1, rgb.size(), out) == rgb.size();
+		return fclose(out) == 0 && ok;
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	bool reorder = false;
+	double fps = 60, speed = 1, T_start = -INFINITY, T_end = INFINITY;
+	int width = 960, height = 540;
+	Vec3d camera_offset(0.5, -0.8, 0.4);
+	bool interpolate = true;
+	std::string out_dir = "frames";
+	std::vector<const char*> args; // positional arguments
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--reorder") == 0) { reorder = true; }
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) { fps = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) { speed = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) { T_start = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--end") == 0 && i + 1 < argc) { T_end = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) { sscanf(argv[++i], "%dx%d", &width, &height); }
+		else if (strcmp(argv[i], "--camera") == 0 && i + 1 < argc) {
+			sscanf(argv[++i], "%lf,%lf,%lf", &camera_offset.x, &camera_offset.y, &camera_offset.z);
+		}
+		else if (strcmp(argv[i], "--nearest") == 0) { interpolate = false; }
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) { out_dir = argv[++i]; }
+		else { args.push_back(argv[i]); }
+	}
+	if (args.size() != 2 || fps <= 0 || speed == 0 || width <= 0 || height <= 0) {
+		fprintf(stderr, "usage: flexipod_replay [--reorder] [--fps 60] [--speed 1] [--start T] [--end T] [--size 960x540] "
+			"[--camera 0.5,-0.8,0.4] [--nearest] [--out frames] model_path trajectory\n");
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	MASS mass; // the topology and colors of one robot, the positions come from the trajectory
+	SPRING spring;
+	JOINT joint;
+	const FlexipodIndex index = loadFlexipod(args[0], reorder, mass, spring, joint);
+	try {
+		TrajectoryReader reader(args[1]);
+		const TrajectoryFileHeader& h = reader.header();
+		if (h.num_instance == 0 || h.num_mass != (uint32_t)mass.num * h.num_instance) {
+			fprintf(stderr, "flexipod_replay: %s holds %u masses, the model %d per instance\n", args[1], h.num_mass, mass.num);
+			return 1;
+		}
+		TrajectoryPlayer player(reader);
+		player.interpolate = interpolate;
+		player.speed = speed;
+		player.vertex_order = index.vertex_order; // the recording is in the original order
+		std::vector<Vec3d> pos(h.num_mass);
+
+		player.seek(reader.firstT());
+		player.positions(pos.data());
+		double distance = 0; // to the model, large if the recording used another model
+		for (int i = 0; i < mass.num; i++) { distance += (pos[i] - mass.pos[i]).norm(); }
+		if (distance / mass.num > 0.05) {
+			printf("warning: the first frame is %.2f m from the model on average, was it recorded with another model?\n",
+				distance / mass.num);
+		}
+
+		const double T_begin = std::max(T_start, player.firstT());
+		const double T_stop = std::min(T_end, player.lastT());
+		const int num_image = T_stop >= T_begin ? (int)std::floor((T_stop - T_begin) / std::abs(speed) * fps) + 1 : 0;
+		Image image(width, height);
+		char path[4096];
+		for (int k = 0; k < num_image; k++) {
+			const double t = speed > 0 ? T_begin + k * speed / fps : T_stop + k * speed / fps;
+			player.seek(t);
+			player.positions(pos.data());
+			const Vec3d center = pos[index.id_oxyz_start]; // body center of instance 0
+			const Camera camera(center + camera_offset, center, width, height);
+			image.clear();
+			const Vec3d grid_color(0.25, 0.25, 0.25);
+			for (int g = -10; g <= 10; g++) { // 0.1 m grid on the ground around the robot
+				const double gx = std::round(center.x * 10) / 10 + 0.1 * g, gy = std::round(center.y * 10) / 10 + 0.1 * g;
+				image.line(camera, Vec3d(gx, center.y - 1, 0), Vec3d(gx, center.y + 1, 0), grid_color, grid_color);
+				image.line(camera, Vec3d(center.x - 1, gy, 0), Vec3d(center.x + 1, gy, 0), grid_color, grid_color);
+			}
+			for (uint32_t instance = 0; instance < h.num_instance; instance++) {
+				const Vec3d* p = pos.data() + (size_t)instance * mass.num;
+				for (int s = 0; s < spring.num; s++) {
+					const Vec2i e = spring.edge[s];
+					image.line(camera, p[e.x], p[e.y], mass.color[e.x], mass.color[e.y]);
+				}
+			}
+			snprintf(path, sizeof(path), "%s/frame_%06d.ppm", out_dir.c_str(), k);
+			if (!image.writePpm(path)) {
+				fprintf(stderr, "flexipod_replay: cannot write %s\n", path);
+				return 1;
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		const double duration = std::chrono::duration<double>(end - start).count();
+		printf("%d images of %.3f .. %.3f s (%llu frames recorded, %s) to %s/ in %.2f s (%.1f images/s)\n", num_image,
+			T_begin, T_stop, (unsigned long long)reader.numFrame(), interpolate ? "interpolated" : "nearest",
+			out_dir.c_str(), duration, num_image / duration);
+	}
+	catch (const std::runtime_error& e) {
+		fprintf(stderr, "flexipod_replay: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,278 @@
+"""
+shm_client.py: python client of the shared-memory controller transport (shm_server.h), linux only.
+Drop-in for the udp socket + msgpack of flexipod_control.ipynb when the controller runs on the same host:
+
+    client = ShmClient("/flexipod_shm")
+    version, data = client.wait_state(0, timeout=1.0)  # same list as msgpack.unpackb(sock.recv(...))
+    client.send_command(UDP_MOTOR_SPEED_COMMEND, data[ID_T], (2, 2, -2, -2))
+
+Lockstep (lockstep.h, flexipod_headless --lockstep shm|udp): step() runs exactly num_step updates
+with the joint speeds and returns the state after them, UdpClient has the same methods over udp:
+    client.send_command(UDP_RESET, 0, (0, 0, 0, 0))
+    state = client.step(10, (2, 2, -2, -2))
+
+Echo controller for bench_shm (replies to every state report with a command carrying the same T):
+    python shm_client.py echo shm [name]
+    python shm_client.py echo udp [port_local] [port_remote]
+Lockstep rollouts, twice from a reset, prints the steps/s and whether the two rollouts are identical:
+    python shm_client.py lockstep shm|udp [num_round] [num_step]
+"""
+
+import ctypes
+import ctypes.util
+import mmap
+import os
+import struct
+import sys
+import time
+
+SHM_MAGIC = b"FLXSHM\0\0"
+SHM_VERSION = 2
+HEADER_FORMAT = "<8s11I"  # ShmHeader up to closed, closed follows at HEADER_CLOSED_OFFSET
+HEADER_CLOSED_OFFSET = struct.calcsize(HEADER_FORMAT)
+
+# UdpDataSend/UdpDataReceive memory layout: int header, 4 bytes padding, then the doubles
+STATE_FORMAT = "<i4x25d"  # header, T, jointAngle[4], jointSpeed[4], acceleration[3], orientation[6], actuation[4], position[3]
+COMMAND_FORMAT = "<i4x5di4x"  # header, T, jointSpeed[4], num_step
+STATE_SHAPE = (1, 1, 4, 4, 3, 6, 4, 3)  # number of values of each member, 1: scalar
+
+UDP_RESET = 15
+UDP_ROBOT_STATE_REPORT = 14
+UDP_MOTOR_SPEED_COMMEND = 13
+UDP_MOTOR_POS_COMMEND = 12
+UDP_STEP_COMMEND = 11
+
+_SYS_FUTEX = {"x86_64": 202, "aarch64": 98}[os.uname().machine]
+_FUTEX_WAIT = 0
+_FUTEX_WAKE = 1
+_libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+
+
+class _Timespec(ctypes.Structure):
+    _fields_ = [("tv_sec", ctypes.c_long), ("tv_nsec", ctypes.c_long)]
+
+
+class ShmClient:
+    """controller side of the region of robot `robot`"""
+
+    def __init__(self, name="/flexipod_shm", robot=0, timeout=10.0):
+        path = "/dev/shm/" + name.lstrip("/")
+        deadline = time.monotonic() + timeout
+        while True:  # wait for the simulation to create the region
+            try:
+                fd = os.open(path, os.O_RDWR)
+                break
+            except FileNotFoundError:
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.01)
+        try:
+            self.mm = mmap.mmap(fd, 0)
+        finally:
+            os.close(fd)
+        (magic, version, num_robot, robot_offset, robot_stride, state_futex_offset, command_futex_offset,
+         state_offset, state_size, commands_offset, command_size, command_queue_size) = \
+            struct.unpack_from(HEADER_FORMAT, self.mm, 0)
+        if magic != SHM_MAGIC or version != SHM_VERSION:
+            raise RuntimeError(f"{path} is not a flexipod shared-memory region (version {SHM_VERSION})")
+        if state_size != struct.calcsize(STATE_FORMAT) or command_size != struct.calcsize(COMMAND_FORMAT):
+            raise RuntimeError(f"{path}: unexpected message layout")
+        if not 0 <= robot < num_robot:
+            raise ValueError(f"robot {robot} out of range, the region has {num_robot} robots")
+        base = robot_offset + robot * robot_stride
+        self.state_futex = base + state_futex_offset
+        self.command_futex = base + command_futex_offset
+        self.state_seq = base + state_offset
+        self.state_data = self.state_seq + 8
+        self.head = base + commands_offset  # SpscRing: head (written here), tail (written by the simulation)
+        self.tail = self.head + 64
+        self.slots = self.head + 128
+        self.command_size = command_size
+        self.command_queue_size = command_queue_size
+        self.num_dropped_command = 0
+        self._base_address = ctypes.addressof(ctypes.c_char.from_buffer(self.mm))
+
+    def closed(self):
+        return struct.unpack_from("<I", self.mm, HEADER_CLOSED_OFFSET)[0] != 0
+
+    def version(self):
+        """number of state reports published so far"""
+        return struct.unpack_from("<Q", self.mm, self.state_seq)[0] // 2
+
+    def read_state(self):
+        """(version, state), state is the list msgpack.unpackb returns for the udp state report"""
+        while True:  # seqlock read, retry if the simulation wrote meanwhile
+            s0 = struct.unpack_from("<Q", self.mm, self.state_seq)[0]
+            if s0 & 1:
+                continue
+            values = struct.unpack_from(STATE_FORMAT, self.mm, self.state_data)
+            if struct.unpack_from("<Q", self.mm, self.state_seq)[0] == s0:
+                break
+        state, k = [], 0
+        for n in STATE_SHAPE:
+            state.append(values[k] if n == 1 else list(values[k:k + n]))
+            k += n
+        return s0 // 2, state
+
+    def wait_state(self, version, timeout=1.0):
+        """wait up to timeout [s] for a state report newer than version, returns (version, state) or None"""
+        deadline = time.monotonic() + timeout
+        while True:
+            futex = struct.unpack_from("<I", self.mm, self.state_futex)[0]
+            if self.version() != version:
+                return self.read_state()
+            remaining = deadline - time.monotonic()
+            if remaining <= 0 or self.closed():
+                return None
+            self._futex(self.state_futex, _FUTEX_WAIT, futex, remaining)
+
+    def send_command(self, header, T, joint_speed, num_step=0):
+        """queue a command, returns False (and counts it) if the simulation has not popped the queue"""
+        head = struct.unpack_from("<Q", self.mm, self.head)[0]
+        tail = struct.unpack_from("<Q", self.mm, self.tail)[0]
+        if head - tail == self.command_queue_size:
+            self.num_dropped_command += 1
+            return False
+        slot = self.slots + (head & (self.command_queue_size - 1)) * self.command_size
+        struct.pack_into(COMMAND_FORMAT, self.mm, slot, header, T, *joint_speed, num_step)
+        struct.pack_into("<Q", self.mm, self.head, head + 1)  # publish the slot
+        futex = struct.unpack_from("<I", self.mm, self.command_futex)[0]
+        struct.pack_into("<I", self.mm, self.command_futex, (futex + 1) & 0xffffffff)
+        self._futex(self.command_futex, _FUTEX_WAKE, 0x7fffffff)
+        return True
+
+    def step(self, num_step, joint_speed, T=0.0, timeout=1.0):
+        """lockstep: run num_step updates with joint_speed, returns the state after them"""
+        return _step(self, num_step, joint_speed, T, timeout)
+
+    def close(self):
+        self.mm.close()
+
+    def _futex(self, offset, op, value, timeout=None):
+        ts = None
+        if timeout is not None:
+            ts = _Timespec(int(timeout), int((timeout - int(timeout)) * 1e9))
+        _libc.syscall(ctypes.c_long(_SYS_FUTEX), ctypes.c_void_p(self._base_address + offset), ctypes.c_int(op),
+                      ctypes.c_uint32(value), ctypes.byref(ts) if ts is not None else None, None, ctypes.c_int(0))
+
+
+class UdpClient:
+    """controller side of robot `robot` over udp (network_posix.h), same methods as ShmClient"""
+
+    def __init__(self, robot=0, port_local=32000, port_remote=32001, ip_remote="127.0.0.1"):
+        import socket
+        import msgpack
+        self.packer = msgpack.Packer(use_single_float=False, use_bin_type=True)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(("0.0.0.0", port_local + robot))  # the simulation tells the robots apart by the port
+        self.address_remote = (ip_remote, port_remote)
+        self.num_state = 0
+        self.state = None
+
+    def closed(self):
+        return False
+
+    def version(self):
+        """number of state reports received so far, including the ones waiting in the socket"""
+        self.sock.setblocking(False)
+        try:
+            while True:
+                self._receive()
+        except BlockingIOError:
+            pass
+        return self.num_state
+
+    def wait_state(self, version, timeout=1.0):
+        """wait up to timeout [s] for a state report newer than version, returns (version, state) or None"""
+        if self.version() == version:
+            self.sock.settimeout(timeout)
+            try:
+                self._receive()
+            except OSError:  # socket.timeout
+                return None
+        return self.num_state, self.state
+
+    def send_command(self, header, T, joint_speed, num_step=0):
+        self.sock.sendto(self.packer.pack((header, T, list(joint_speed), num_step)), self.address_remote)
+        return True
+
+    def step(self, num_step, joint_speed, T=0.0, timeout=1.0):
+        """lockstep: run num_step updates with joint_speed, returns the state after them"""
+        return _step(self, num_step, joint_speed, T, timeout)
+
+    def close(self):
+        self.sock.close()
+
+    def _receive(self):
+        import msgpack
+        self.state = msgpack.unpackb(self.sock.recv(512))
+        self.num_state += 1
+
+
+def _step(client, num_step, joint_speed, T, timeout):
+    version = client.version()  # read before sending: the report may come before the wait
+    client.send_command(UDP_STEP_COMMEND, T, joint_speed, num_step)
+    result = client.wait_state(version, timeout)
+    if result is None:
+        raise TimeoutError("no state report after the step")
+    return result[1]
+
+
+def lockstep_rollouts(client, num_round, num_step):
+    def rollout():
+        client.send_command(UDP_RESET, 0, (0, 0, 0, 0))
+        states = []
+        for r in range(num_round):  # alternate the leg direction every 50 rounds
+            s = 2.0 if (r // 50) % 2 == 0 else -2.0
+            states.append(client.step(num_step, (s, s, -s, -s)))
+        return states
+
+    client.step(0, (0, 0, 0, 0), timeout=60.0)  # wait for the simulation
+    start = time.monotonic()
+    first = rollout()
+    elapsed = time.monotonic() - start
+    second = rollout()
+    identical = all(a[2:] == b[2:] for a, b in zip(first, second))  # T of Simulation is not reset
+    print(f"{num_round} steps of {num_step} updates in {elapsed:.3f} s: {num_round / elapsed:.0f} steps/s, "
+          f"{num_round * num_step / elapsed:.0f} updates/s, rollouts identical: {identical}")
+    print("final position", first[-1][7])
+
+
+def echo_shm(name):
+    client = ShmClient(name)
+    version = 0
+    while not client.closed():
+        result = client.wait_state(version, timeout=1.0)
+        if result is None:
+            continue
+        version, state = result
+        client.send_command(UDP_MOTOR_SPEED_COMMEND, state[1], state[3])
+
+
+def echo_udp(port_local, port_remote):
+    import socket
+    import msgpack
+    packer = msgpack.Packer(use_single_float=False, use_bin_type=True)  # float64 to echo T exactly
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", port_local))
+    sock.settimeout(5)
+    while True:
+        try:
+            data = sock.recv(512)
+        except socket.timeout:
+            break
+        state = msgpack.unpackb(data)
+        sock.sendto(packer.pack((UDP_MOTOR_SPEED_COMMEND, state[1], state[3])), ("127.0.0.1", port_remote))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) >= 3 and sys.argv[1] == "echo" and sys.argv[2] == "shm":
+        echo_shm(sys.argv[3] if len(sys.argv) > 3 else "/flexipod_shm")
+    elif len(sys.argv) >= 3 and sys.argv[1] == "echo" and sys.argv[2] == "udp":
+        echo_udp(int(sys.argv[3]) if len(sys.argv) > 3 else 32000, int(sys.argv[4]) if len(sys.argv) > 4 else 32001)
+    elif len(sys.argv) >= 3 and sys.argv[1] == "lockstep":
+        c = ShmClient() if sys.argv[2] == "shm" else UdpClient()
+        lockstep_rollouts(c, int(sys.argv[3]) if len(sys.argv) > 3 else 1000, int(sys.argv[4]) if len(sys.argv) > 4 else 1)
+        c.close()
+    else:
+        print(__doc__)
@@ -0,0 +1,145 @@
+/*
+shm_server.cpp: shared-memory controller transport (shm_open, mmap, futex), see shm_server.h
+*/
+
+#include "shm_server.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+// the python client reads the Seqlock and SpscRing members at fixed offsets
+static_assert(sizeof(Seqlock<UdpDataSend>) == sizeof(uint64_t) + (sizeof(UdpDataSend) + 7) / 8 * 8,
+    "Seqlock<UdpDataSend> is the sequence followed by the value");
+static_assert(std::is_standard_layout<ShmRobotBlock>::value && std::is_standard_layout<ShmHeader>::value,
+    "the region layout is read by offset");
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+    "the atomics are shared between processes");
+
+/* sleep while *addr == value, up to timeout_ns (no timeout if <0), shared between processes */
+static inline void futexWait(std::atomic<uint32_t>* addr, uint32_t value, int64_t timeout_ns) {
+    timespec ts;
+    ts.tv_sec = timeout_ns / 1000000000;
+    ts.tv_nsec = timeout_ns % 1000000000;
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, value, timeout_ns >= 0 ? &ts : nullptr, nullptr, 0);
+}
+
+static inline void futexWakeAll(std::atomic<uint32_t>* addr) {
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+/* SpscRing members are private: check the offsets the client uses (head +0, tail +64, slots +128) */
+static void checkRingLayout() {
+    typedef SpscRing<UdpDataReceive, SHM_COMMAND_QUEUE_SIZE> Ring;
+    Ring* ring = new Ring();
+    UdpDataReceive msg;
+    msg.T = 1.5;
+    msg.num_step = 7;
+    ring->push(msg);
+    ring->pop(msg);
+    ring->push(msg);
+    const char* p = (const char*)ring;
+    uint64_t head, tail;
+    memcpy(&head, p, sizeof(head));
+    memcpy(&tail, p + 64, sizeof(tail));
+    UdpDataReceive slot; // compared by member, the padding is not copied
+    memcpy((void*)&slot, p + 128 + sizeof(UdpDataReceive), sizeof(slot));
+    const bool ok = sizeof(Ring) >= 128 + sizeof(UdpDataReceive) * SHM_COMMAND_QUEUE_SIZE && head == 2 && tail == 1 &&
+        slot.T == msg.T && slot.num_step == msg.num_step;
+    delete ring;
+    if (!ok) { throw std::logic_error("ShmServer: unexpected SpscRing layout"); }
+}
+
+ShmServer::ShmServer(std::string name, int num_robot) {
+    checkRingLayout();
+    this->name = name;
+    this->num_robot = num_robot;
+    const size_t robot_offset = (sizeof(ShmHeader) + 63) / 64 * 64;
+    size = robot_offset + (size_t)num_robot * sizeof(ShmRobotBlock);
+
+    shm_unlink(name.c_str()); // replace the region of a previous run, a controller still attached keeps the old one
+    const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) { throw std::system_error(errno, std::generic_category(), "ShmServer: shm_open " + name); }
+    void* addr = ftruncate(fd, size) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    const int error = errno;
+    ::close(fd); // the mapping keeps the region
+    if (addr == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::system_error(error, std::generic_category(), "ShmServer: cannot map " + name);
+    }
+    region = (char*)addr;
+
+    ShmHeader& h = *new (region) ShmHeader();
+    h.version = SHM_VERSION;
+    h.num_robot = num_robot;
+    h.robot_offset = (uint32_t)robot_offset;
+    h.robot_stride = sizeof(ShmRobotBlock);
+    h.state_futex_offset = offsetof(ShmRobotBlock, state_futex);
+    h.command_futex_offset = offsetof(ShmRobotBlock, command_futex);
+    h.state_offset = offsetof(ShmRobotBlock, state);
+    h.state_size = sizeof(UdpDataSend);
+    h.commands_offset = offsetof(ShmRobotBlock, commands);
+    h.command_size = sizeof(UdpDataReceive);
+    h.command_queue_size = SHM_COMMAND_QUEUE_SIZE;
+    h.closed = 0;
+    for (int i = 0; i < num_robot; i++) { new (&block(i)) ShmRobotBlock(); }
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(h.magic, SHM_MAGIC, sizeof(h.magic)); // written last: the client checks it before reading the layout
+}
+
+ShmServer::~ShmServer() {
+    if (region != nullptr && !flag_should_close) { close(); }
+    unmap();
+}
+
+void ShmServer::unmap() {
+    if (region != nullptr) {
+        munmap(region, size);
+        shm_unlink(name.c_str());
+    }
+    region = nullptr;
+}
+
+void ShmServer::run() {}
+
+void ShmServer::close() {
+    flag_should_close = true;
+    header().closed = 1;
+    for (int i = 0; i < num_robot; i++) { // wake the controllers and the physics threads
+        block(i).state_futex++;
+        futexWakeAll(&block(i).state_futex);
+        block(i).command_futex++;
+        futexWakeAll(&block(i).command_futex);
+    }
+    printf("shared memory server %s closed\n", name.c_str());
+}
+
+void ShmServer::publishState(const UdpDataSend& msg, int robot) {
+    ShmRobotBlock& b = block(robot);
+    b.state.store(msg);
+    b.state_futex.fetch_add(1, std::memory_order_release);
+    futexWakeAll(&b.state_futex); // the controller cannot announce its waiting without a fence, always wake
+}
+
+bool ShmServer::waitCommandFor(UdpDataReceive& msg, int64_t timeout_ns, int robot) {
+    ShmRobotBlock& b = block(robot);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+    for (;;) {
+        const uint32_t value = b.command_futex.load(std::memory_order_acquire);
+        if (b.commands.pop(msg)) { return true; }
+        const int64_t remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (flag_should_close || remaining <= 0) { return false; }
+        futexWait(&b.command_futex, value, remaining); // returns at once if a push came after value was read
+    }
+}
@@ -0,0 +1,89 @@
+/*
+shm_server.h: shared-memory transport for a controller on the same host (linux), selectable in place of
+the udp servers (network_posix.h, network.h) with the same interface. The region (shm_open name, e.g.
+/dev/shm/flexipod_shm) holds a ShmHeader followed by one ShmRobotBlock per robot:
+    state: Seqlock<UdpDataSend> (channel.h), the latest state report, no serialization
+    commands: SpscRing<UdpDataReceive> (channel.h), the controller pushes, the physics thread pops
+    state_futex/command_futex: incremented after each publish/push, the other side sleeps on it (futex)
+The layout (offsets, sizes) is written into the header for the python client (shm_client.py).
+Both sides must run on the same machine with the same byte order; the client relies on the x86 memory
+order (stores are not reordered with other stores, loads not with other loads).
+*/
+
+#ifndef SHM_SERVER_H
+#define SHM_SERVER_H
+
+#include "udp_message.h"
+#include "channel.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+constexpr char SHM_MAGIC[8] = { 'F','L','X','S','H','M','\0','\0' };
+constexpr uint32_t SHM_VERSION = 2; // 2: UdpDataReceive::num_step
+constexpr size_t SHM_COMMAND_QUEUE_SIZE = 64; // number of commands pushed and not yet popped
+
+/* one robot: the state report (sim -> controller) and the command queue (controller -> sim) */
+struct ShmRobotBlock {
+    alignas(64) std::atomic<uint32_t> state_futex{ 0 }; // incremented after each publishState()
+    alignas(64) std::atomic<uint32_t> command_futex{ 0 }; // incremented by the controller after each push
+    alignas(64) Seqlock<UdpDataSend> state;
+    alignas(64) SpscRing<UdpDataReceive, SHM_COMMAND_QUEUE_SIZE> commands;
+};
+
+/* start of the region, every offset is in bytes */
+struct ShmHeader {
+    char magic[8]; // SHM_MAGIC
+    uint32_t version; // SHM_VERSION
+    uint32_t num_robot;
+    uint32_t robot_offset; // offset of the block of robot 0 from the start of the region
+    uint32_t robot_stride; // size of a robot block
+    uint32_t state_futex_offset; // offsets within a robot block
+    uint32_t command_futex_offset;
+    uint32_t state_offset; // Seqlock: uint64 sequence (2*version, odd while writing), then the UdpDataSend
+    uint32_t state_size; // sizeof(UdpDataSend)
+    uint32_t commands_offset; // SpscRing: uint64 head at +0, uint64 tail at +64, the slots at +128
+    uint32_t command_size; // sizeof(UdpDataReceive), size of a slot
+    uint32_t command_queue_size; // number of slots, a power of 2
+    std::atomic<uint32_t> closed; // 1 after the server closed
+};
+
+class ShmServer {
+public:
+    std::string name; // shm_open name
+    int num_robot; // number of robots (blocks)
+    std::atomic<bool> flag_should_close{ false }; // flag indicating whether to stop
+
+    /* create (or replace) the region name, throws std::system_error if it cannot be created */
+    ShmServer(std::string name = "/flexipod_shm", int num_robot = 1);
+    ~ShmServer(); // unmaps and removes the region
+    ShmServer(const ShmServer&) = delete;
+    ShmServer& operator=(const ShmServer&) = delete;
+
+    /* nothing to start, the controller attaches to the region at any time */
+    void run();
+    void close();
+
+    /* physics thread of robot: publish the state report and wake the waiting controller */
+    void publishState(const UdpDataSend& msg, int robot = 0);
+    /* physics thread of robot: pop the oldest received command, returns false if there is none */
+    inline bool pollCommand(UdpDataReceive& msg, int robot = 0) { return block(robot).commands.pop(msg); }
+    /* physics thread of robot: wait up to timeout for a command, returns false on timeout or close */
+    template<class Rep, class Period>
+    bool waitCommand(UdpDataReceive& msg, const std::chrono::duration<Rep, Period>& timeout, int robot = 0) {
+        return waitCommandFor(msg, std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count(), robot);
+    }
+
+private:
+    char* region = nullptr;
+    size_t size = 0; // [bytes] size of the region
+    inline ShmHeader& header() { return *(ShmHeader*)region; }
+    inline ShmRobotBlock& block(int robot) { return *(ShmRobotBlock*)(region + header().robot_offset + (size_t)robot * sizeof(ShmRobotBlock)); }
+    bool waitCommandFor(UdpDataReceive& msg, int64_t timeout_ns, int robot);
+    void unmap();
+};
+
+#endif // SHM_SERVER_H
@@ -8,6 +8,9 @@ ref: J. Austin, R. Corrales-Fatou, S. Wyetzner, and H. Lipson, �Titan: A Paral
 
 #define GLM_FORCE_PURE
 #include "sim.h"
+#include "profiler.h"
+#include "recorder.h"
+#include "playback.h"
 
 
 #include <cuda_runtime.h>
@@ -23,8 +26,7 @@ constexpr int MAX_BLOCKS = 65535; // max number of CUDA blocks
 constexpr int THREADS_PER_BLOCK = 64;
 constexpr int MASS_THREADS_PER_BLOCK = 128;
 
-constexpr int  NUM_QUEUED_KERNELS = 40; // number of kernels to queue at a given time (this will reduce the frequency of updates from the CPU by this factor
-constexpr int NUM_UPDATE_PER_ROTATION = 4; //number of update per rotation
+// NUM_QUEUED_KERNELS and NUM_UPDATE_PER_ROTATION are defined in sim_cpu.h
 
 
 GLenum glCheckError_(const char* file, int line)
@@ -103,29 +105,35 @@ __global__ void SpringUpateReset(
 }
 
 
+/* contact forces of the global constraints on the surface masses (mass.constrain), compacted in surface,
+   added to mass.force between SpringUpate and MassUpate: the interior masses never test a contact */
+__global__ void ContactUpate(
+	const MASS mass,
+	const int* __restrict__ surface,
+	const int num_surface,
+	const CUDA_GLOBAL_CONSTRAINTS c) {
+	int s = blockIdx.x * blockDim.x + threadIdx.x;
+	if (s < num_surface) {
+		int i = surface[s];
+		Vec3d spring_force = mass.force[i] + mass.force_extern[i];
+		Vec3d force = spring_force;
+		c.applyForce(force, mass.pos[i], mass.vel[i]);
+		mass.force[i] += force - spring_force; // contact force only
+	}
+}
+
 __global__ void MassUpate(
 	const MASS mass,
-	const CUDA_GLOBAL_CONSTRAINTS c,
 	const Vec3d global_acc,
 	const double dt) {
 	int i = blockIdx.x * blockDim.x + threadIdx.x;
 	if (i < mass.num) {
 		if (mass.fixed[i] == false) {
 			double m = mass.m[i];
-			Vec3d pos = mass.pos[i];
 			Vec3d vel = mass.vel[i];
 
 			Vec3d force = mass.force[i];
-			force += mass.force_extern[i];// add spring force and external force [N]
-
-			/*if (mass.constrain)*/ {
-				for (int j = 0; j < c.num_planes; j++) { // global constraints
-					c.d_planes[j].applyForce(force, pos, vel); // todo fix this 
-				}
-				for (int j = 0; j < c.num_balls; j++) {
-					c.d_balls[j].applyForce(force, pos);
-				}
-			}
+			force += mass.force_extern[i];// add spring (and contact) force and external force [N]
 
 			// euler integration
 			force /= m;// force is now acceleration
@@ -140,6 +148,66 @@ __global__ void MassUpate(
 	}
 }
 
+__global__ void SpringForceUpate(
+	const MASS mass,
+	const SPRING spring,
+	const SpringIncidence incidence
+) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < spring.num) {
+		Vec2i e = spring.edge[i];
+		Vec3d s_vec = mass.pos[e.y] - mass.pos[e.x];// the vector from left to right
+		double length = s_vec.norm(); // current spring length
+
+		s_vec /= (length > 1e-12 ? length : 1e-12);// normalized to unit vector (direction), check instablility for small length
+
+		Vec3d force = spring.k[i] * (spring.rest[i] - length) * s_vec; // normal spring force
+		force += s_vec.dot(mass.vel[e.x] - mass.vel[e.y]) * spring.damping[i] * s_vec;// damping
+
+		incidence.force[i] = force; // force on the right mass, gathered in GatherForceUpate (no atomics)
+	}
+}
+
+__global__ void SpringForceUpateReset(
+	const MASS mass,
+	const SPRING spring,
+	const SpringIncidence incidence
+) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < spring.num) {
+		Vec2i e = spring.edge[i];
+		Vec3d s_vec = mass.pos[e.y] - mass.pos[e.x];// the vector from left to right
+		double length = s_vec.norm(); // current spring length
+		s_vec /= (length > 1e-12 ? length : 1e-12);// normalized to unit vector (direction), check instablility for small length
+
+		Vec3d force = spring.k[i] * (spring.rest[i] - length) * s_vec; // normal spring force
+		force += s_vec.dot(mass.vel[e.x] - mass.vel[e.y]) * spring.damping[i] * s_vec;// damping
+
+		incidence.force[i] = force; // force on the right mass, gathered in GatherForceUpate (no atomics)
+
+#ifdef ROTATION
+		if (spring.resetable[i]) {
+			spring.rest[i] = length;//reset the spring rest length if this spring is restable
+		}
+#endif // ROTATION
+	}
+}
+
+/* sum the forces of the incident springs in a fixed order into mass.force, then ContactUpate and
+   MassUpate as after SpringUpate: the interior masses never test a contact */
+__global__ void GatherForceUpate(
+	const MASS mass,
+	const SpringIncidence incidence) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < mass.num) {
+		Vec3d force; // zero
+		for (int k = incidence.offset[i]; k < incidence.offset[i + 1]; k++) {// add spring force, fixed order
+			force += incidence.dir[k] * incidence.force[incidence.springId[k]];
+		}
+		mass.force[i] = force; // one thread per mass, no atomics (reset by MassUpate)
+	}
+}
+
 #ifdef ROTATION
 __global__ void massUpdateAndRotate(
 	const MASS mass,
@@ -164,6 +232,8 @@ __global__ void massUpdateAndRotate(
 				for (int j = 0; j < c.num_balls; j++) {
 					c.d_balls[j].applyForce(force, pos);
 				}
+				if (c.d_terrain != nullptr) { c.d_terrain->applyForce(force, pos, vel); }
+				if (c.d_obstacles != nullptr) { c.d_obstacles->applyForce(force, pos, vel); }
 			}
 
 			// euler integration
@@ -277,11 +347,17 @@ void Simulation::getAll() {//copy from gpu
 void Simulation::setAll() {//copy form cpu
 	d_mass.copyFrom(mass, stream[NUM_CUDA_STREAM - 1]);
 	d_spring.copyFrom(spring, stream[NUM_CUDA_STREAM - 1]);
+	if (surface.update(mass)) { d_surface = surface.id; }
+	if (force_assembly == ForceAssembly::GATHER && incidence.num_spring != spring.num) {// build once
+		incidence.init(spring, mass.num);
+		d_incidence = SpringIncidence(incidence, false, stream[NUM_CUDA_STREAM - 1]);
+	}
 	//cudaDeviceSynchronize();
 }
 
 void Simulation::setMass() {
 	d_mass.copyFrom(mass, stream[NUM_CUDA_STREAM - 1]);
+	if (surface.update(mass)) { d_surface = surface.id; }
 }
 
 inline int Simulation::computeBlocksPerGrid(const int threadsPerBlock, const int num) {
@@ -337,18 +413,28 @@ void Simulation::waitForEvent() {
 }
 
 
-/*backup the robot mass/spring/joint state */
+/*backup the robot mass/spring/joint state, the backup is allocated once and reused */
 void Simulation::backupState() {
-	backup_spring = SPRING(spring, true);
-	backup_mass = MASS(mass, true);
-	backup_joint = JOINT(joint, true);
+	if (backup_mass.num != mass.num) { backup_mass = MASS(mass, true); }
+	else { backup_mass.copyFrom(mass); }
+	if (backup_spring.num != spring.num) { backup_spring = SPRING(spring, true); }
+	else { backup_spring.copyFrom(spring); }
+	if (backup_joint.size() != joint.size()) { backup_joint = JOINT(joint, true); }
+	else { backup_joint.anchors.copyThetaFrom(joint.anchors); }
 }
-/*restore the robot mass/spring/joint state to the backedup state *///TODO check if other variable needs resetting
-void Simulation::resetState() {//TODO...fix bug
-
-	d_mass.copyFrom(backup_mass, stream[NUM_CUDA_STREAM - 1]);
-	d_spring.copyFrom(backup_spring, stream[NUM_CUDA_STREAM - 1]);
-	d_joint.copyFrom(backup_joint, stream[NUM_CUDA_STREAM - 1]);
+/*restore the robot mass/spring/joint state to the backedup state, only the state changed by the
+  simulation is copied: mass pos/vel/acc/force, spring rest length and joint rotation */
+void Simulation::resetState() {
+	if (backend == Backend::CPU) {
+		mass.copyStateFrom(backup_mass, stream[NUM_CUDA_STREAM - 1]);
+		spring.copyRestFrom(backup_spring, stream[NUM_CUDA_STREAM - 1]);
+		joint.anchors.copyThetaFrom(backup_joint.anchors, stream[NUM_CUDA_STREAM - 1]);
+	}
+	else {
+		d_mass.copyStateFrom(backup_mass, stream[NUM_CUDA_STREAM - 1]);
+		d_spring.copyRestFrom(backup_spring, stream[NUM_CUDA_STREAM - 1]);
+		d_joint.anchors.copyThetaFrom(backup_joint.anchors, stream[NUM_CUDA_STREAM - 1]);
+	}
 	//size_t nbytes = joint.size() * sizeof(double);
 	//memset(joint_vel_cmd, 0, nbytes);
 	//memset(joint_vel, 0, nbytes);
@@ -395,6 +481,17 @@ void Simulation::start() {
 	d_constraints.d_planes = thrust::raw_pointer_cast(&d_planes[0]);
 	d_constraints.num_balls = d_balls.size();
 	d_constraints.num_planes = d_planes.size();
+	d_constraints.d_terrain = d_terrain.empty() ? nullptr : thrust::raw_pointer_cast(&d_terrain[0]);
+	d_constraints.d_obstacles = d_obstacles.empty() ? nullptr : thrust::raw_pointer_cast(&d_obstacles[0]);
+
+	h_constraints.d_balls = h_balls.data();
+	h_constraints.d_planes = h_planes.data();
+	h_constraints.num_balls = h_balls.size();
+	h_constraints.num_planes = h_planes.size();
+	h_terrain_view = h_terrain.view();
+	h_constraints.d_terrain = h_terrain.empty() ? nullptr : &h_terrain_view;
+	h_obstacles_view = h_obstacles.view();
+	h_constraints.d_obstacles = h_obstacles.empty() ? nullptr : &h_obstacles_view;
 
 	SHOULD_UPDATE_CONSTRAINT = false;
 
@@ -413,11 +510,16 @@ void Simulation::start() {
 	udp_server.run();
 #endif //UDP
 
-	thread_physics_update = std::thread(&Simulation::update_physics, this); //TODO: thread
+#ifdef GRAPHICS
+	pos_snapshot.assign(mass.pos, mass.pos + mass.num);
+#endif // GRAPHICS
+
+	thread_physics_update = std::thread(player != nullptr ? &Simulation::update_playback : &Simulation::update_physics, this); //TODO: thread
 #ifdef GRAPHICS
 	thread_graphics_update = std::thread(&Simulation::update_graphics, this); //TODO: thread
 #endif// Graphics
 
+	if (backend == Backend::CPU) { printf("dynamics backend: cpu\n"); }
 	{
 		int device;
 		cudaGetDevice(&device);
@@ -444,6 +546,19 @@ void Simulation::update_physics() { // repeatedly start next
 	energy_start = energy(); // compute the total energy of the system at T=0
 #endif // DEBUG_ENERGY
 
+#ifdef UDP
+	if (lockstep) { // report the initial state and wait for the first step
+		fillStateReport(msg_send, T, measureModelState(mass, id_oxyz_start, joint.anchors.num, joint_pos, joint_vel, joint_vel_cmd),
+			max_joint_vel);
+		waitStepCommand();
+		updateJointControl(joint, joint_vel_desired, joint_vel, joint_vel_error, joint_pos_error, joint_vel_cmd,
+			max_joint_vel, k_vel, k_pos, dt);
+		if (backend == Backend::CUDA) {
+			d_joint.anchors.copyThetaFrom(joint.anchors, stream[CUDA_MEMORY_STREAM]);
+			cudaDeviceSynchronize();
+		}
+	}
+#endif // UDP
 
 	while (true) {
 		if (!bpts.empty() && *bpts.begin() <= T) {// paused when a break p
@@ -454,10 +569,7 @@ void Simulation::update_physics() { // repeatedly start next
 			if (SHOULD_END) {
 				auto end = std::chrono::steady_clock::now();
 				double duration = (double)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.;//[seconds]
-				double sim_time_ratio = T / duration;
-				double spring_update_rate = ((double)spring.num) / dt * sim_time_ratio;
-				printf("Elapsed time:%.2f s for %.2f simulation time (%.2f); # %.2e spring update/s\n",
-					duration, T, sim_time_ratio, spring_update_rate);
+				printThroughput(duration, T, dt, spring.num);
 
 				//for (Constraint* c : constraints) {
 				//	delete c;
@@ -475,6 +587,9 @@ void Simulation::update_physics() { // repeatedly start next
 				GPU_DONE = true;
 				RUNNING = false;
 				printf("GPU done\n");
+#ifdef PROFILE
+				profiler().report();
+#endif // PROFILE
 				return;
 			}
 			{	// condition variable 
@@ -511,12 +626,33 @@ void Simulation::update_physics() { // repeatedly start next
 		//cudaEvent_t event_rotation;
 		//cudaEventCreateWithFlags(&event_rotation, cudaEventDisableTiming);
 
-		for (int i = 0; i < (NUM_QUEUED_KERNELS / NUM_UPDATE_PER_ROTATION); i++) {
+		PROFILE_TICK();
+		PROFILE_SCOPE(Phase::UPDATE); // the rest of the update
+		PROFILE_COUNT(Counter::UPDATE, 1);
 
-			for (int j = 0; j < NUM_UPDATE_PER_ROTATION - 1; j++) {
+		if (backend == Backend::CPU) {
+			PROFILE_SCOPE(Phase::DYNAMICS);
+			stepCpu(mass, spring, joint, h_constraints, surface, global_acc, dt, num_cpu_threads,
+				force_assembly == ForceAssembly::GATHER ? &incidence : nullptr);
+		}
+		else for (int i = 0; i < (NUM_QUEUED_KERNELS / NUM_UPDATE_PER_ROTATION); i++) {
+			PROFILE_SCOPE(Phase::DYNAMICS); // kernel launches, the kernels finish in the readback
+			const bool contact = !d_constraints.empty() && surface.size() > 0;
+			const int* d_surface_id = thrust::raw_pointer_cast(d_surface.data());
+			const int surfaceBlocksPerGrid = computeBlocksPerGrid(MASS_THREADS_PER_BLOCK, surface.size());
 
-				SpringUpate << <springBlocksPerGrid, THREADS_PER_BLOCK ,0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_spring);
-				MassUpate << <massBlocksPerGrid, MASS_THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_constraints, global_acc, dt);
+			for (int j = 0; j < NUM_UPDATE_PER_ROTATION - 1; j++) {
+				if (force_assembly == ForceAssembly::GATHER) {
+					SpringForceUpate << <springBlocksPerGrid, THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_spring, d_incidence);
+					GatherForceUpate << <massBlocksPerGrid, MASS_THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_incidence);
+				}
+				else {
+					SpringUpate << <springBlocksPerGrid, THREADS_PER_BLOCK ,0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_spring);
+				}
+				if (contact) {
+					ContactUpate << <surfaceBlocksPerGrid, MASS_THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_surface_id, surface.size(), d_constraints);
+				}
+				MassUpate << <massBlocksPerGrid, MASS_THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, global_acc, dt);
 				//gpuErrchk(cudaPeekAtLastError());
 			}
 			//cudaEventRecord(event, 0);
@@ -526,8 +662,17 @@ void Simulation::update_physics() { // repeatedly start next
 
 #ifdef ROTATION
 			rotateJoint << <jointBlocksPerGrid, MASS_THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass.pos, d_joint);
-			SpringUpateReset << <springBlocksPerGrid, THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_spring);
-			MassUpate << <massBlocksPerGrid, MASS_THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_constraints, global_acc, dt);
+			if (force_assembly == ForceAssembly::GATHER) {
+				SpringForceUpateReset << <springBlocksPerGrid, THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_spring, d_incidence);
+				GatherForceUpate << <massBlocksPerGrid, MASS_THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_incidence);
+			}
+			else {
+				SpringUpateReset << <springBlocksPerGrid, THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_spring);
+			}
+			if (contact) {
+				ContactUpate << <surfaceBlocksPerGrid, MASS_THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, d_surface_id, surface.size(), d_constraints);
+			}
+			MassUpate << <massBlocksPerGrid, MASS_THREADS_PER_BLOCK, 0, stream[CUDA_DYNAMICS_STREAM] >> > (d_mass, global_acc, dt);
 
 			//SpringUpate << <springBlocksPerGrid, THREADS_PER_BLOCK >> > (d_mass, d_spring);
 			//massUpdateAndRotate << <massBlocksPerGrid + jointBlocksPerGrid, MASS_THREADS_PER_BLOCK >> > (d_mass, d_constraints, d_joint, global_acc, dt);
@@ -543,93 +688,38 @@ void Simulation::update_physics() { // repeatedly start next
 		T += NUM_QUEUED_KERNELS * dt;
 
 		//if (fmod(T, 1. / 100.0) < NUM_QUEUED_KERNELS * dt) {
-		mass.CopyPosVelAccFrom(d_mass, stream[CUDA_MEMORY_STREAM]);
-		//cudaStreamSynchronize(stream[NUM_CUDA_STREAM - 1]);
-		cudaDeviceSynchronize();
-		//#pragma omp parallel for
-		for (int i = 0; i < joint.anchors.num; i++) // compute joint angles and angular velocity
-		{
-			Vec2i anchor_edge = joint.anchors.edge[i];
-			Vec3d rotation_axis = (mass.pos[anchor_edge.y] - mass.pos[anchor_edge.x]).normalize();
-			Vec3d x_left = mass.pos[joint.anchors.leftCoord[i] + 1] - mass.pos[joint.anchors.leftCoord[i]];//oxyz
-			Vec3d x_right = mass.pos[joint.anchors.rightCoord[i] + 1] - mass.pos[joint.anchors.rightCoord[i]];//oxyz
-			double angle = signedAngleBetween(x_left, x_right, rotation_axis); //joint angle in [-pi,pi]
-
-			double delta_angle = angle - joint_pos[i];
-			if (delta_angle > M_PI) {
-				joint_vel[i] = (delta_angle - 2 * M_PI) / (NUM_QUEUED_KERNELS * dt);
-			}
-			else if (delta_angle > -M_PI) {
-				joint_vel[i] = delta_angle / (NUM_QUEUED_KERNELS * dt);
-			}
-			else {
-				joint_vel[i] = (delta_angle + 2 * M_PI) / (NUM_QUEUED_KERNELS * dt);
-			}
-			joint_pos[i] = angle;
-
-			///// <summary>
-			///// keep the joint angle to 0 rad
-			///// </summary>
-			//joint_vel_cmd[i] = -joint_pos[i]*50;
-			//if (joint_vel_cmd[i] > max_joint_vel) { joint_vel_cmd[i] = max_joint_vel; }
-			//if (joint_vel_cmd[i] < -max_joint_vel) { joint_vel_cmd[i] = -max_joint_vel; }
-			//joint.anchors.theta[i] = NUM_UPDATE_PER_ROTATION * joint_vel_cmd[i] * dt;// update joint speed
+		if (backend == Backend::CUDA) {
+			PROFILE_SCOPE(Phase::READBACK);
+			mass.CopyPosVelAccFrom(d_mass, stream[CUDA_MEMORY_STREAM]);
+			//cudaStreamSynchronize(stream[NUM_CUDA_STREAM - 1]);
+			cudaDeviceSynchronize();
 		}
-
-		Vec3d com_pos = mass.pos[id_oxyz_start];//body center of mass position
-		Vec3d com_acc = mass.acc[id_oxyz_start];//body center of mass acceleration
-
-		Vec3d ox = (mass.pos[id_oxyz_start + 1] - com_pos).normalize();
-		Vec3d oy = mass.pos[id_oxyz_start + 2] - com_pos;
-		oy = (oy - oy.dot(ox) * ox).normalize();
+		measureJoints(mass, joint, joint_pos, joint_vel, NUM_QUEUED_KERNELS * dt); // compute joint angles and angular velocity
 
 #ifdef UDP
-		msg_send.T = T;
-		for (auto i = 0; i < 4; i++)
 		{
-			msg_send.jointAngle[i] = joint_pos[i];
-			msg_send.jointSpeed[i] = joint_vel[i];
-			msg_send.actuation[i] = joint_vel_cmd[i] / max_joint_vel;
-			
+			PROFILE_SCOPE(Phase::STATE);
+			fillStateReport(msg_send, T, measureModelState(mass, id_oxyz_start, joint.anchors.num, joint_pos, joint_vel, joint_vel_cmd),
+				max_joint_vel);
 		}
 
-		for (auto i = 0; i < 3; i++)
-		{
-			msg_send.acceleration[i] = com_acc[i];
-			msg_send.position[i] = com_pos[i];
-			msg_send.orientation[i] = ox[i];
-			msg_send.orientation[3 + i] = oy[i];
+		if (lockstep) { // report and wait for the next step once the current one is done
+			if (--num_step_remaining <= 0) { waitStepCommand(); }
 		}
-
-		udp_server.msg_send = msg_send;
-		udp_server.flag_should_send = true;
-		// receiving message
-		if (udp_server.flag_new_received) {
-			msg_rec = udp_server.msg_rec;
-			udp_server.flag_new_received = false;
-
-			if (fmod(T, 1. / 10.0) < NUM_QUEUED_KERNELS * dt) {// print only once in a while
-				printf("%3.3f \t %3.3f %3.3f %3.3f %3.3f\r\r", msg_rec.T,
-					msg_rec.jointSpeed[0],
-					msg_rec.jointSpeed[1],
-					msg_rec.jointSpeed[2],
-					msg_rec.jointSpeed[3]);
-			}
-
-			switch (msg_rec.header)
-			{
-			case UDP_HEADER::RESET: // reset
-				// set the reset flag to true, resetState() will be called 
-				// to restore the robot mass/spring/joint state to the backedup state
-				RESET = true;
-				break;
-			case UDP_HEADER::MOTOR_SPEED_COMMEND:
-				for (int i = 0; i < joint.anchors.num; i++) {//update joint speed from received udp packet
-					joint_vel_desired[i] = msg_rec.jointSpeed[i];
+		else {
+			PROFILE_SCOPE(Phase::UDP);
+			udp_server.publishState(msg_send); // sent by the udp sender thread
+			PROFILE_COUNT(Counter::STATE_SENT, 1);
+			// receiving message, the commands received since the last update in order
+			while (udp_server.pollCommand(msg_rec)) {
+				if (fmod(T, 1. / 10.0) < NUM_QUEUED_KERNELS * dt) {// print only once in a while
+					printf("%3.3f \t %3.3f %3.3f %3.3f %3.3f\r\r", msg_rec.T,
+						msg_rec.jointSpeed[0],
+						msg_rec.jointSpeed[1],
+						msg_rec.jointSpeed[2],
+						msg_rec.jointSpeed[3]);
 				}
-				break;
-			default:
-				break;
+				applyCommand(msg_rec);
 			}
 		}
 
@@ -677,34 +767,109 @@ void Simulation::update_physics() { // repeatedly start next
 
 #endif // DEBUG_ENERGY
 
-		for (int i = 0; i < joint.anchors.num; i++) // compute joint angles and angular velocity
-		{// update joint_vel_cmd
-
-			//////////joint_vel_cmd[i] = joint_vel_desired[i];
-
-			joint_vel_error[i] = joint_vel_desired[i] - joint_vel[i];
-			joint_pos_error[i] += joint_vel_error[i]; // simple proportional control
-			if (joint_pos_error[i] > max_joint_vel) { joint_pos_error[i] = max_joint_vel; }
-			if (joint_pos_error[i] < -max_joint_vel) { joint_pos_error[i] = -max_joint_vel; }
-			joint_vel_cmd[i] = k_vel * joint_vel_error[i] + k_pos * joint_pos_error[i];
-			
-			if (joint_vel_cmd[i] > max_joint_vel) { joint_vel_cmd[i] = max_joint_vel; }
-			if (joint_vel_cmd[i] < -max_joint_vel) { joint_vel_cmd[i] = -max_joint_vel; }
-			//joint.anchors.theta[i] = 0.5 * NUM_UPDATE_PER_ROTATION * joint_vel_cmd[i] * dt;// update joint speed
-			joint.anchors.theta[i] = NUM_UPDATE_PER_ROTATION * joint_vel_cmd[i] * dt;// update joint speed
+		// update joint_vel_cmd and joint.anchors.theta
+		updateJointControl(joint, joint_vel_desired, joint_vel, joint_vel_error, joint_pos_error, joint_vel_cmd,
+			max_joint_vel, k_vel, k_pos, dt);
+		// update joint speed
+		if (backend == Backend::CUDA) {
+			d_joint.anchors.copyThetaFrom(joint.anchors, stream[CUDA_MEMORY_STREAM]);
+		}
 
+		if (recorder != nullptr) {
+			PROFILE_SCOPE(Phase::RECORD);
+			ModelState state = measureModelState(mass, id_oxyz_start, joint.anchors.num, joint_pos, joint_vel, joint_vel_cmd);
+			RecordSource source;
+			source.T = T;
+			source.pos = mass.pos;
+			source.joint_pos = joint_pos;
+			source.joint_vel = joint_vel;
+			source.joint_vel_cmd = joint_vel_cmd;
+			source.joint_vel_desired = joint_vel_desired;
+			source.state = &state;
+			recorder->record(source);
 		}
-		// update joint speed
-		d_joint.anchors.copyThetaFrom(joint.anchors, stream[CUDA_MEMORY_STREAM]);
 
 		if (RESET) {
+			PROFILE_SCOPE(Phase::RESET);
+			PROFILE_COUNT(Counter::RESET, 1);
 			cudaDeviceSynchronize();
 			RESET = false;
 			resetState();// restore the robot mass/spring/joint state to the backedup state
 			cudaDeviceSynchronize();
 		}
+
+#ifdef GRAPHICS
+		if (backend == Backend::CPU) { // publish the positions of this update, the graphics thread must not read mass.pos
+			std::lock_guard<std::mutex> lck(mutex_pos_snapshot);
+			std::copy(mass.pos, mass.pos + mass.num, pos_snapshot.begin());
+		}
+#endif // GRAPHICS
+	}
+}
+
+#ifdef UDP
+void Simulation::applyCommand(const UdpDataReceive& msg) {
+	PROFILE_COUNT(Counter::COMMAND_RECEIVED, 1);
+	switch (msg.header)
+	{
+	case UDP_HEADER::RESET: // reset
+		// set the reset flag to true, resetState() will be called 
+		// to restore the robot mass/spring/joint state to the backedup state
+		RESET = true;
+		break;
+	case UDP_HEADER::STEP_COMMEND: // joint speed and number of updates (lockstep)
+		num_step_remaining = clampNumStep(msg.num_step, max_step);
+		// fall through
+	case UDP_HEADER::MOTOR_SPEED_COMMEND:
+		for (int i = 0; i < joint.anchors.num && i < 4; i++) {//update joint speed from received udp packet
+			joint_vel_desired[i] = msg.jointSpeed[i];
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void Simulation::waitStepCommand() {
+	PROFILE_SCOPE(Phase::UDP_WAIT); // the controller's turn
+	udp_server.publishState(msg_send);
+	PROFILE_COUNT(Counter::STATE_SENT, 1);
+	while (!SHOULD_END) {
+		if (!udp_server.waitCommand(msg_rec, std::chrono::milliseconds(100))) { continue; }
+		applyCommand(msg_rec);
+		if (RESET) { // reset now: resetState() clears joint_vel_desired, a following STEP_COMMEND sets it
+			PROFILE_COUNT(Counter::RESET, 1);
+			cudaDeviceSynchronize();
+			RESET = false;
+			resetState();
+			cudaDeviceSynchronize();
+		}
+		if (msg_rec.header != UDP_HEADER::STEP_COMMEND) { continue; }
+		if (num_step_remaining > 0) { return; }
+		udp_server.publishState(msg_send); // num_step 0: report only (the state of the last update)
+		PROFILE_COUNT(Counter::STATE_SENT, 1);
 	}
 }
+#endif // UDP
+
+void Simulation::update_playback() { // the graphics thread advances the player and fills mass.pos
+#ifdef GRAPHICS
+	while (!SHOULD_END) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+#else
+	printf("playback needs the GRAPHICS build, use flexipod_replay to render a trajectory headless\n");
+#endif // GRAPHICS
+	std::unique_lock<std::mutex> lck(mutex_running);
+#ifdef GRAPHICS
+	GRAPHICS_SHOULD_END = true;
+	cv_running.notify_all(); //notify others RUNNING = false
+	cv_running.wait(lck, [this] {return GRAPHICS_ENDED; });
+#endif
+	GPU_DONE = true;
+	RUNNING = false;
+	printf("playback done\n");
+}
 
 #ifdef GRAPHICS
 void Simulation::update_graphics() {
@@ -741,6 +906,11 @@ void Simulation::update_graphics() {
 	if (error != GL_NO_ERROR)
 		std::cerr << "OpenGL Error " << error << std::endl;
 
+	// playback (player != nullptr): speed and key states of the playback controls
+	auto playback_clock = std::chrono::steady_clock::now();
+	double playback_speed = player != nullptr ? player->speed : 1;
+	bool key_space = false, key_comma = false, key_period = false; // pressed in the previous frame
+
 	while (!GRAPHICS_SHOULD_END) {
 
 		std::this_thread::sleep_for(std::chrono::microseconds(int(1e6 / 120)));// TODO fix race condition
@@ -756,7 +926,36 @@ void Simulation::update_graphics() {
 
 			//T_previous_update = T;
 
-			Vec3d com_pos = mass.pos[id_oxyz_start];// center of mass position (anchored body center)
+			if (player != nullptr) { // playback: space pauses, up/down change the speed, left/right scrub, ,/. step a frame, R restarts
+				const bool space = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+				const bool comma = glfwGetKey(window, GLFW_KEY_COMMA) == GLFW_PRESS;
+				const bool period = glfwGetKey(window, GLFW_KEY_PERIOD) == GLFW_PRESS;
+				if (space && !key_space) { player->speed = player->speed != 0 ? 0 : playback_speed; }
+				if (glfwGetKey(window, GLFW_KEY_UP)) { playback_speed *= 1.02; }
+				else if (glfwGetKey(window, GLFW_KEY_DOWN)) { playback_speed /= 1.02; }
+				if (player->speed != 0) { player->speed = playback_speed; }
+				if (glfwGetKey(window, GLFW_KEY_LEFT)) { player->seek(player->T - 2 * std::abs(playback_speed) / 120); }
+				else if (glfwGetKey(window, GLFW_KEY_RIGHT)) { player->seek(player->T + 2 * std::abs(playback_speed) / 120); }
+				if (comma && !key_comma) { player->stepFrame(-1); }
+				if (period && !key_period) { player->stepFrame(1); }
+				if (glfwGetKey(window, GLFW_KEY_R)) { player->seek(player->firstT()); }
+				key_space = space;
+				key_comma = comma;
+				key_period = period;
+
+				const auto now = std::chrono::steady_clock::now();
+				player->advance(std::chrono::duration<double>(now - playback_clock).count());
+				playback_clock = now;
+				player->positions(mass.pos); // interpolated between the recorded frames
+				T = player->T;
+			}
+
+			Vec3d com_pos;// center of mass position (anchored body center)
+			if (player == nullptr && backend == Backend::CPU) {
+				std::lock_guard<std::mutex> lck(mutex_pos_snapshot);
+				com_pos = pos_snapshot[id_oxyz_start];
+			}
+			else { com_pos = mass.pos[id_oxyz_start]; }
 
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // clear screen
 
@@ -770,35 +969,37 @@ void Simulation::update_graphics() {
 			if (glfwGetKey(window, GLFW_KEY_Q)) {camera_up_offset -= 0.05;} // camera moves down
 			else if (glfwGetKey(window, GLFW_KEY_E)) {camera_up_offset += 0.05;}// camera moves up
 
-			if (glfwGetKey(window, GLFW_KEY_UP)) {
-				if (joint_vel_desired[0] < max_joint_vel) { joint_vel_desired[0] += speed_multiplier; }
-				if (joint_vel_desired[1] < max_joint_vel) { joint_vel_desired[1] += speed_multiplier; }
-				if (joint_vel_desired[2] > -max_joint_vel) { joint_vel_desired[2] -= speed_multiplier; }
-				if (joint_vel_desired[3] > -max_joint_vel) { joint_vel_desired[3] -= speed_multiplier; }
-			}
-			else if (glfwGetKey(window, GLFW_KEY_DOWN)) {
-				if (joint_vel_desired[0] > -max_joint_vel) { joint_vel_desired[0] -= speed_multiplier; }
-				if (joint_vel_desired[1] > -max_joint_vel) { joint_vel_desired[1] -= speed_multiplier; }
-				if (joint_vel_desired[2] < max_joint_vel) { joint_vel_desired[2] += speed_multiplier; }
-				if (joint_vel_desired[3] < max_joint_vel) { joint_vel_desired[3] += speed_multiplier; }
-			}
-			if (glfwGetKey(window, GLFW_KEY_LEFT)) {
-				for (int i = 0; i < joint.size(); i++)
-				{
-					if (joint_vel_desired[i] > -max_joint_vel) { joint_vel_desired[i] -= speed_multiplier; }
+			if (player == nullptr) { // joint control, the arrow keys and R control the player in playback
+				if (glfwGetKey(window, GLFW_KEY_UP)) {
+					if (joint_vel_desired[0] < max_joint_vel) { joint_vel_desired[0] += speed_multiplier; }
+					if (joint_vel_desired[1] < max_joint_vel) { joint_vel_desired[1] += speed_multiplier; }
+					if (joint_vel_desired[2] > -max_joint_vel) { joint_vel_desired[2] -= speed_multiplier; }
+					if (joint_vel_desired[3] > -max_joint_vel) { joint_vel_desired[3] -= speed_multiplier; }
 				}
-			}
-			else if (glfwGetKey(window, GLFW_KEY_RIGHT)) {
-				for (int i = 0; i < joint.size(); i++)
-				{
-					if (joint_vel_desired[i] < max_joint_vel) { joint_vel_desired[i] += speed_multiplier; }
+				else if (glfwGetKey(window, GLFW_KEY_DOWN)) {
+					if (joint_vel_desired[0] > -max_joint_vel) { joint_vel_desired[0] -= speed_multiplier; }
+					if (joint_vel_desired[1] > -max_joint_vel) { joint_vel_desired[1] -= speed_multiplier; }
+					if (joint_vel_desired[2] < max_joint_vel) { joint_vel_desired[2] += speed_multiplier; }
+					if (joint_vel_desired[3] < max_joint_vel) { joint_vel_desired[3] += speed_multiplier; }
+				}
+				if (glfwGetKey(window, GLFW_KEY_LEFT)) {
+					for (int i = 0; i < joint.size(); i++)
+					{
+						if (joint_vel_desired[i] > -max_joint_vel) { joint_vel_desired[i] -= speed_multiplier; }
+					}
+				}
+				else if (glfwGetKey(window, GLFW_KEY_RIGHT)) {
+					for (int i = 0; i < joint.size(); i++)
+					{
+						if (joint_vel_desired[i] < max_joint_vel) { joint_vel_desired[i] += speed_multiplier; }
+					}
+				}
+				else if (glfwGetKey(window, GLFW_KEY_0)) { // zero speed
+					for (int i = 0; i < joint.size(); i++) { joint_vel_desired[i] = 0.; }
+				}
+				else if (glfwGetKey(window, GLFW_KEY_R)) { // reset
+					RESET = true;
 				}
-			}
-			else if (glfwGetKey(window, GLFW_KEY_0)) { // zero speed
-				for (int i = 0; i < joint.size(); i++) { joint_vel_desired[i] = 0.; }
-			}
-			else if (glfwGetKey(window, GLFW_KEY_R)) { // reset
-				RESET = true;
 			}
 
 			// https://en.wikipedia.org/wiki/Slerp
@@ -820,6 +1021,14 @@ void Simulation::update_graphics() {
 
 			glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);// update transformation "MVP" uniform
 
+			if (player != nullptr) { // playback: mass.pos is filled by this thread
+				copyMemory(d_mass.pos, mass.pos, mass.num * sizeof(Vec3d), stream[CUDA_GRAPHICS_POS_STREAM]);
+			}
+			else if (backend == Backend::CPU) { // the positions published by the physics thread at the end of an update
+				std::lock_guard<std::mutex> lck(mutex_pos_snapshot);
+				copyMemory(d_mass.pos, pos_snapshot.data(), mass.num * sizeof(Vec3d), stream[CUDA_GRAPHICS_POS_STREAM]);
+				cudaStreamSynchronize(stream[CUDA_GRAPHICS_POS_STREAM]); // done reading pos_snapshot
+			}
 			updateBuffers();
 			//updateVertexBuffers();
 			//cudaDeviceSynchronize(); // synchronize before updating the springs and mass positions
@@ -937,6 +1146,23 @@ void Simulation::freeGPU() {
 
 	d_planes.clear();
 	d_planes.shrink_to_fit();
+
+	d_terrain.clear();
+	d_terrain.shrink_to_fit();
+	d_terrain_height.clear();
+	d_terrain_height.shrink_to_fit();
+	d_terrain_friction_k.clear();
+	d_terrain_friction_k.shrink_to_fit();
+	d_terrain_friction_s.clear();
+	d_terrain_friction_s.shrink_to_fit();
+	d_obstacles.clear();
+	d_obstacles.shrink_to_fit();
+	d_obstacle_node.clear();
+	d_obstacle_node.shrink_to_fit();
+	d_obstacle_primitive.clear();
+	d_obstacle_primitive.shrink_to_fit();
+	d_surface.clear();
+	d_surface.shrink_to_fit();
 	printf("GPU freed\n");
 
 
@@ -961,6 +1187,7 @@ void Simulation::createPlane(const Vec3d& abc, const double d, const double FRIC
 	cuda_contact_plane._FRICTION_S = FRICTION_S;
 
 	d_planes.push_back(cuda_contact_plane);
+	h_planes.push_back(cuda_contact_plane);
 
 	//d_planes.push_back(CudaContactPlane(*new_plane));
 	SHOULD_UPDATE_CONSTRAINT = true;
@@ -975,13 +1202,56 @@ void Simulation::createBall(const Vec3d& center, const double r) { // creates ba
 	cuda_ball._center = center;
 	cuda_ball._radius = r;
 	d_balls.push_back(cuda_ball);
+	h_balls.push_back(cuda_ball);
 
 	//d_balls.push_back(CudaBall(*new_ball));
 	SHOULD_UPDATE_CONSTRAINT = true;
 }
 
+void Simulation::createTerrain(const Heightfield& terrain) { // sets the heightfield terrain, replacing the previous one
+	if (ENDED) { throw std::runtime_error("The simulation has ended. New constraints cannot be added."); }
+	if (STARTED) { throw std::runtime_error("The simulation has started. Set the terrain before start()."); }
+	h_terrain = terrain;
+	d_terrain_height.assign(h_terrain.height.begin(), h_terrain.height.end());
+	d_terrain_friction_k.assign(h_terrain.friction_k.begin(), h_terrain.friction_k.end());
+	d_terrain_friction_s.assign(h_terrain.friction_s.begin(), h_terrain.friction_s.end());
+	CudaHeightfield view = h_terrain.view(); // the same grid on the device copies
+	view._height = thrust::raw_pointer_cast(d_terrain_height.data());
+	view._friction_k = thrust::raw_pointer_cast(d_terrain_friction_k.data());
+	view._friction_s = thrust::raw_pointer_cast(d_terrain_friction_s.data());
+	d_terrain.assign(h_terrain.empty() ? 0 : 1, view);
+	SHOULD_UPDATE_CONSTRAINT = true;
+}
+
+void Simulation::createObstacles(const ObstacleSet& obstacles) { // sets the static obstacles, replacing the previous ones
+	if (ENDED) { throw std::runtime_error("The simulation has ended. New constraints cannot be added."); }
+	if (STARTED) { throw std::runtime_error("The simulation has started. Set the obstacles before start()."); }
+	h_obstacles = obstacles;
+	if (h_obstacles.node.empty()) { h_obstacles.build(); }
+	d_obstacle_node.assign(h_obstacles.node.begin(), h_obstacles.node.end());
+	d_obstacle_primitive.assign(h_obstacles.primitive.begin(), h_obstacles.primitive.end());
+	CudaObstacles view; // the same hierarchy on the device copies
+	view._node = thrust::raw_pointer_cast(d_obstacle_node.data());
+	view._primitive = thrust::raw_pointer_cast(d_obstacle_primitive.data());
+	d_obstacles.assign(h_obstacles.empty() ? 0 : 1, view);
+	SHOULD_UPDATE_CONSTRAINT = true;
+}
+
 void Simulation::clearConstraints() { // clears global constraints only
 	constraints.clear();
+	h_terrain = Heightfield();
+	h_constraints.d_terrain = nullptr;
+	d_constraints.d_terrain = nullptr;
+	d_terrain.clear();
+	d_terrain_height.clear();
+	d_terrain_friction_k.clear();
+	d_terrain_friction_s.clear();
+	h_obstacles = ObstacleSet();
+	h_constraints.d_obstacles = nullptr;
+	d_constraints.d_obstacles = nullptr;
+	d_obstacles.clear();
+	d_obstacle_node.clear();
+	d_obstacle_primitive.clear();
 	SHOULD_UPDATE_CONSTRAINT = true;
 }
 
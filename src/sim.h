@@ -11,6 +11,8 @@ ref: J. Austin, R. Corrales-Fatou, S. Wyetzner, and H. Lipson, �Titan: A Paral
 
 #include "object.h"
 #include "vec.h"
+#include "model.h"
+#include "sim_cpu.h"
 #include "shader.h"
 
 #include <msgpack.hpp>
@@ -46,9 +48,17 @@ ref: J. Austin, R. Corrales-Fatou, S. Wyetzner, and H. Lipson, �Titan: A Paral
 #include <math.h>
 
 #ifdef UDP
+#include "lockstep.h"
+#if defined(SHM_TRANSPORT) // controller on the same host (shm_client.py)
+#include "shm_server.h"
+typedef ShmServer UdpServer;
+#elif defined(_WIN32)
 #include "Network.h"
 typedef WsaUdpServer UdpServer;
-
+#else
+#include "network_posix.h"
+typedef PosixUdpServer UdpServer;
+#endif // SHM_TRANSPORT
 #endif
 
 
@@ -60,347 +70,7 @@ constexpr const int CUDA_GRAPHICS_EDGE_STREAM = 3; // steam to run graphics: edg
 constexpr const int CUDA_GRAPHICS_COLOR_STREAM = 4; // steam to run graphics: color update
 
 
-#define gpuErrchk(ans) { gpuAssert((ans), __FILE__, __LINE__); }
-inline void gpuAssert(cudaError_t code, const char* file, int line, bool abort = true)
-{
-	if (code != cudaSuccess)
-	{
-		fprintf(stderr, "Cuda failure: %s %s %d\n", cudaGetErrorString(code), file, line);
-		exit(code);
-	}
-}
-
-
-
-
-
-/*  helper function to free device/host memory given host_or_device_ptr */
-using cudaFreeFcnType = cudaError_t(*)(void*); // helper type for the free memory function
-inline cudaFreeFcnType FreeMemoryFcn(void* host_or_device_ptr) {
-	cudaFreeFcnType freeMemory;
-	cudaPointerAttributes attributes;
-	gpuErrchk(cudaPointerGetAttributes(&attributes, host_or_device_ptr));
-	if (attributes.type == cudaMemoryType::cudaMemoryTypeHost) {// host memory
-		freeMemory = &cudaFreeHost;
-	}
-	else { freeMemory = &cudaFree; }// device memory
-	printf("Memory type for d_data %i\n", attributes.type);
-	return freeMemory;
-}
-
-/*  helper function to allocate device/host memory
-	choose the appropriate device/host free memory function given a array pointer, e.g:
-	cudaFreeFcnType freeMemory = FreeMemoryFcn((void*)m);
-	freeMemory((void*)m);*/
-using cudaMallocFcnType = cudaError_t(*)(void**, size_t);
-inline cudaMallocFcnType allocateMemoryFcn(bool on_host) {// ref: https://www.cprogramming.com/tutorial/function-pointers.html
-	cudaMallocFcnType allocateMemory;
-	if (on_host) { allocateMemory = &cudaMallocHost; }// if allocateMemory = cudaMallocHost: allocate on host
-	else { allocateMemory = &cudaMalloc; }
-	return allocateMemory;
-}
-
-struct StdJoint {
-	std::vector<int> left;// the indices of the left points
-	std::vector<int> right;// the indices of the right points
-	std::vector<int> anchor;// the 2 indices of the anchor points: left_anchor_id,right_anchor_id
-	int leftCoord;
-	int rightCoord;
-	MSGPACK_DEFINE(left, right, anchor, leftCoord, rightCoord);
-};
-class Model {
-public:
-	std::vector<std::vector<double> > vertices;// the mass xyzs
-	std::vector<std::vector<int> > edges;//the spring ids
-	std::vector<bool> isSurface;// whether the mass is near the surface
-	std::vector<int> idVertices;// the edge id of the vertices
-	std::vector<int> idEdges;// the edge id of the springs
-	std::vector<std::vector<double> > colors;// the mass xyzs
-	std::vector<StdJoint> Joints;// the joints
-	MSGPACK_DEFINE(vertices, edges, isSurface, idVertices, idEdges, colors, Joints) // write the member variables that you want to pack
-	Model() {}
-	Model(const char* file_path) {
-		// get the msgpack robot model
-		// Deserialize the serialized data
-		std::ifstream ifs(file_path, std::ifstream::in | std::ifstream::binary);
-		std::stringstream buffer;
-		buffer << ifs.rdbuf();
-		msgpack::unpacked upd;//unpacked data
-		msgpack::unpack(upd, buffer.str().data(), buffer.str().size());
-		//    std::cout << upd.get() << std::endl;
-		upd.get().convert(*this);
-	}
-};
-
-struct ModelState {
-	Vec3d com_pos; // (measured) position of the body com (nominal)
-	Vec3d com_acc; // (measured) acceleration of the body com (nomial)
-	Vec3d ox; // (measured) normalized ox direction of the body com (nominal)
-	Vec3d oy; // (measured) normalized oy direction of the body com (nominal)
-	double joint_pos[4]; // (measured) joint angle array in rad, initialized in start()
-	double joint_vel[4]; // (measured) joint speed array in rad/s, initialized in start()
-	double joint_vel_cmd[4]; // (commended) joint speed array in rad/s, initialized in start()
-	// TODO: change the constant "4"
-};
-
-struct MASS {
-	double* m = nullptr;
-	Vec3d* pos = nullptr;
-	Vec3d* vel = nullptr;
-	Vec3d* acc = nullptr;
-	Vec3d* force = nullptr;
-	Vec3d* force_extern = nullptr;
-	Vec3d* color = nullptr;
-	bool* fixed = nullptr;
-	bool* constrain = nullptr;//whether to apply constrain on the mass, must be set true for constraint to work
-	int num = 0;
-	inline int size() { return num; }
-
-	MASS() { }
-	MASS(int num, bool on_host) {
-		init(num, on_host);
-	}
-	/* initialize and copy the state from other MASS object. must keep the second argument*/
-	MASS(MASS other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
-		init(other.num, on_host);
-		copyFrom(other, stream);
-	}
-	void init(int num, bool on_host = true) {
-		cudaMallocFcnType allocateMemory = allocateMemoryFcn(on_host);// choose approipate malloc function
-		allocateMemory((void**)&m, num * sizeof(double));
-		allocateMemory((void**)&pos, num * sizeof(Vec3d));
-		allocateMemory((void**)&vel, num * sizeof(Vec3d));
-		allocateMemory((void**)&acc, num * sizeof(Vec3d));
-		allocateMemory((void**)&force, num * sizeof(Vec3d));
-		allocateMemory((void**)&force_extern, num * sizeof(Vec3d));
-		allocateMemory((void**)&color, num * sizeof(Vec3d));
-		allocateMemory((void**)&fixed, num * sizeof(bool));
-		allocateMemory((void**)&constrain, num * sizeof(bool));
-
-		gpuErrchk(cudaPeekAtLastError());
-		this->num = num;
-		if (on_host) {// set vel,acc to 0
-			memset(vel, 0, num * sizeof(Vec3d));
-			memset(acc, 0, num * sizeof(Vec3d));
-		}
-		else {
-			cudaMemset(vel, 0, num * sizeof(Vec3d));
-			cudaMemset(acc, 0, num * sizeof(Vec3d));
-		}
-
-
-	}
-
-	void copyFrom(const MASS& other, cudaStream_t stream = (cudaStream_t)0) {
-		cudaMemcpyAsync(m, other.m, num * sizeof(double), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(pos, other.pos, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(vel, other.vel, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(acc, other.acc, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(force, other.force, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(force_extern, other.force_extern, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(color, other.color, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(fixed, other.fixed, num * sizeof(bool), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(constrain, other.constrain, num * sizeof(bool), cudaMemcpyDefault, stream);
-
-		//this->num = other.num;
-		gpuErrchk(cudaPeekAtLastError());
-	}
-	void CopyPosVelAccFrom(MASS& other, cudaStream_t stream = (cudaStream_t)0) {
-		cudaMemcpyAsync(pos, other.pos, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(vel, other.vel, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(acc, other.acc, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		gpuErrchk(cudaPeekAtLastError());
-
-	}
-};
-
-struct SPRING {
-	double* k = nullptr; // spring constant (N/m)
-	double* rest = nullptr; // spring rest length (meters)
-	double* damping = nullptr; // damping on the masses.
-	Vec2i* edge = nullptr;// (left,right) mass indices of the spring
-	bool* resetable = nullptr; // a flag indicating whether to reset every dynamic update
-	int num = 0;
-	inline int size() { return num; }
-
-	SPRING() {}
-	SPRING(int num, bool on_host) {
-		init(num, on_host);
-	}
-	/* initialize and copy the state from other SPRING object. must keep the second argument*/
-	SPRING(SPRING other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
-		init(other.num, on_host);
-		copyFrom(other, stream);
-	}
-
-	void init(int num, bool on_host = true) { // initialize
-		cudaMallocFcnType allocateMemory = allocateMemoryFcn(on_host);// choose approipate malloc function
-		allocateMemory((void**)&k, num * sizeof(double));
-		allocateMemory((void**)&rest, num * sizeof(double));
-		allocateMemory((void**)&damping, num * sizeof(double));
-		allocateMemory((void**)&edge, num * sizeof(Vec2i));
-		allocateMemory((void**)&resetable, num * sizeof(bool));
-		gpuErrchk(cudaPeekAtLastError());
-		this->num = num;
-	}
-	void copyFrom(const SPRING& other, cudaStream_t stream = (cudaStream_t)0) { // assuming we have enough streams
-		cudaMemcpyAsync(k, other.k, num * sizeof(double), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(rest, other.rest, num * sizeof(double), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(damping, other.damping, num * sizeof(double), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(edge, other.edge, num * sizeof(Vec2i), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(resetable, other.resetable, num * sizeof(bool), cudaMemcpyDefault, stream);
-		gpuErrchk(cudaPeekAtLastError());
-		//this->num = other.num;
-	}
-};
-
-
-struct RotAnchors { // the anchors that belongs to the rotational joints
-	Vec2i* edge; // index of the (left,right) anchor of the joint
-	Vec3d* dir; // direction of the joint,normalized
-	double* theta;// the angular increment per joint update
-
-	int* leftCoord; // the index of left coordintate (oxyz) start for all joints (flat view)
-	int* rightCoord;// the index of right coordintate (oxyz) start for all joints (flat view)
-
-	int num; // num of anchor
-	inline int size() { return num; }
-
-	RotAnchors() {}
-	RotAnchors(std::vector<StdJoint> std_joints, bool on_host = true) { init(std_joints, on_host); }
-
-	/* initialize and copy the state from other RotAnchors object. must keep the second argument*/
-	RotAnchors(RotAnchors other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
-		init(other.num, on_host);
-		copyFrom(other, stream);
-	}
-	void init(int num, bool on_host) {
-		this->num = num;
-		cudaMallocFcnType allocateMemory = allocateMemoryFcn(on_host);// choose approipate malloc function
-		allocateMemory((void**)&edge, num * sizeof(Vec2i));
-		allocateMemory((void**)&dir, num * sizeof(Vec3d));
-		allocateMemory((void**)&theta, num * sizeof(double));
-		allocateMemory((void**)&leftCoord, num * sizeof(int));
-		allocateMemory((void**)&rightCoord, num * sizeof(int));
-		gpuErrchk(cudaPeekAtLastError());
-	}
-
-	void init(std::vector<StdJoint> std_joints, bool on_host = true) {
-		init(std_joints.size(), on_host);
-
-		if (on_host) { // copy the std_joints to this
-			for (int joint_id = 0; joint_id < num; joint_id++)
-			{
-				edge[joint_id] = std_joints[joint_id].anchor;
-				leftCoord[joint_id] = std_joints[joint_id].leftCoord;
-				rightCoord[joint_id] = std_joints[joint_id].rightCoord;
-			}
-		}
-	}
-
-	void copyFrom(const RotAnchors& other, cudaStream_t stream = (cudaStream_t)0) {
-		cudaMemcpyAsync(edge, other.edge, num * sizeof(Vec2i), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(dir, other.dir, num * sizeof(Vec3d), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(theta, other.theta, num * sizeof(double), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(leftCoord, other.leftCoord, num * sizeof(int), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(rightCoord, other.rightCoord, num * sizeof(int), cudaMemcpyDefault, stream);
-		gpuErrchk(cudaPeekAtLastError());
-
-	}
-	void copyThetaFrom(const RotAnchors& other, cudaStream_t stream = (cudaStream_t)0) {
-		gpuErrchk(cudaMemcpyAsync(theta, other.theta, num * sizeof(double), cudaMemcpyDefault, stream));
-	}
-};
-
-struct RotPoints { // the points that belongs to the rotational joints
-	int* massId; // index of the left mass and right mass
-	// the directional anchor index of which the mass is rotated about, 
-	int* anchorId;// e.g, k: the k-th anchor,left mass, -k: the k-th anchor, right mass
-	int* dir; // direction: left=-1,right=+1
-	int num; // the length of array "id"
-	inline int size() { return num; }
-
-	RotPoints() {}
-	RotPoints(std::vector<StdJoint> std_joints, bool on_host) { init(std_joints, on_host); }
-	/* initialize and copy the state from other RotPoints object. must keep the second argument*/
-	RotPoints(RotPoints other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
-		init(other.num, on_host);
-		copyFrom(other, stream);
-	}
-	void init(int num, bool on_host = true) {
-		this->num = num;
-		// allocate on host or device
-		cudaMallocFcnType allocateMemory = allocateMemoryFcn(on_host);// choose approipate malloc function	
-		allocateMemory((void**)&massId, num * sizeof(int));
-		allocateMemory((void**)&anchorId, num * sizeof(int));
-		allocateMemory((void**)&dir, num * sizeof(int));
-		gpuErrchk(cudaPeekAtLastError());
-	}
-	void init(std::vector<StdJoint> std_joints, bool on_host = true) {
-		num = 0;
-		for each (auto & std_joint in std_joints)
-		{
-			num += std_joint.left.size() + std_joint.right.size();
-		}// get the total number of the points in all joints
-		init(num, on_host);
-
-		if (on_host) { // copy the std_joints to this
-			size_t offset = 0;//offset the index by "offset"
-			for (auto joint_id = 0; joint_id < std_joints.size(); joint_id++)
-			{
-				StdJoint& std_joint = std_joints[joint_id];
-
-				for (auto i = 0; i < std_joint.left.size(); i++)
-				{
-					massId[offset + i] = std_joint.left[i];
-					anchorId[offset + i] = joint_id;
-					dir[offset + i] = -1;
-				}
-				offset += std_joint.left.size();//increment offset by num of left
-
-				for (auto i = 0; i < std_joint.right.size(); i++)
-				{
-					massId[offset + i] = std_joint.right[i];
-					anchorId[offset + i] = joint_id;
-					dir[offset + i] = 1;
-				}
-				offset += std_joint.right.size();//increment offset by num of right
-			}
-		}
-	}
-	void copyFrom(const RotPoints& other, cudaStream_t stream = (cudaStream_t)0) {
-		cudaMemcpyAsync(massId, other.massId, num * sizeof(int), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(anchorId, other.anchorId, num * sizeof(int), cudaMemcpyDefault, stream);
-		cudaMemcpyAsync(dir, other.dir, num * sizeof(int), cudaMemcpyDefault, stream);
-		gpuErrchk(cudaPeekAtLastError());
-
-	}
-};
-
-struct JOINT {
-	RotPoints points;
-	RotAnchors anchors;
-
-	JOINT() {};
-	JOINT(std::vector<StdJoint> std_joints, bool on_host = true) { init(std_joints, on_host); };
-
-	/* initialize and copy the state from other JOINT object. must keep the second argument*/
-	JOINT(JOINT other, bool on_host, cudaStream_t stream = (cudaStream_t)0) {
-		points = RotPoints(other.points, on_host, stream);
-		anchors = RotAnchors(other.anchors, on_host, stream);
-	}
-
-	void copyFrom(const JOINT& other, cudaStream_t stream = (cudaStream_t)0) {
-		points.copyFrom(other.points, stream); // copy from the other points
-		anchors.copyFrom(other.anchors, stream); // copy from the other anchor
-	}
-
-	void init(std::vector<StdJoint> std_joints, bool on_host = true) {
-		anchors.init(std_joints, on_host);//initialize anchor
-		points.init(std_joints, on_host);
-	}
-	inline int size() { return anchors.num; }
-};
+class TrajectoryPlayer;
 
 class Simulation {
 public:
@@ -408,6 +78,12 @@ public:
 	double T = 0; //simulation time
 	Vec3d global_acc = Vec3d(0, 0, 0); // global acceleration
 
+	Backend backend = Backend::CUDA; // dynamics update backend, set before start()
+	int num_cpu_threads = 0; // number of openmp threads for Backend::CPU, 0: use the openmp default
+	TrajectoryRecorder* recorder = nullptr; // if set, update_physics() hands it the state of each update (recorder.h)
+	TrajectoryPlayer* player = nullptr; // if set before start(), replay it instead of the dynamics (playback.h, update_playback)
+	ForceAssembly force_assembly = ForceAssembly::SCATTER; // spring force assembly, set before start()
+
 	int id_restable_spring_start = 0; // resetable springs start index (inclusive)
 	int id_resetable_spring_end = 0; // resetable springs start index (exclusive)
 
@@ -423,6 +99,11 @@ public:
 	SPRING d_spring;
 	JOINT d_joint;
 
+	SpringIncidence incidence; // springs of each mass (host), built in setAll() for ForceAssembly::GATHER
+	SpringIncidence d_incidence; // springs of each mass (device)
+	SurfaceIndex surface; // masses of the contact pass (host), rebuilt in setAll()/setMass() after mass.constrain changed
+	thrust::device_vector<int> d_surface; // device copy of surface.id
+
 	// host (backup);
 	MASS backup_mass;
 	SPRING backup_spring;
@@ -465,6 +146,10 @@ public:
 
 	std::mutex mutex_running;
 	std::condition_variable cv_running;
+#ifdef GRAPHICS
+	std::vector<Vec3d> pos_snapshot; // Backend::CPU: mass.pos at the end of the last update, the graphics thread draws this copy
+	std::mutex mutex_pos_snapshot; // guards pos_snapshot
+#endif //GRAPHICS
 
 	cudaStream_t stream[NUM_CUDA_STREAM]; // cuda stream:https://docs.nvidia.com/cuda/cuda-c-programming-guide/index.html#asynchronous-concurrent-execution
 
@@ -479,6 +164,8 @@ public:
 	// creates half-space ax + by + cz < d
 	void createPlane(const Vec3d& abc, const double d, const double FRICTION_K = 0, const double FRICTION_S = 0);
 	void createBall(const Vec3d& center, const double r); // creates ball with radius r at position center
+	void createTerrain(const Heightfield& terrain); // sets the heightfield terrain (a copy) before start(), replacing the previous one
+	void createObstacles(const ObstacleSet& obstacles); // sets the static obstacles (a copy, built) before start(), replacing the previous ones
 	void clearConstraints(); // clears global constraints only
 
 	void setBreakpoint(const double time); // tell the program to stop at a fixed time (doesn't hang).
@@ -492,6 +179,7 @@ public:
 	void resume();
 
 	void update_physics();
+	void update_playback(); // replaces update_physics() with a player: no dynamics, ends with the window
 	void update_graphics();
 	void execute(); // same as above but w/out reset
 
@@ -513,6 +201,13 @@ public:
 	UdpDataReceive msg_rec; // message that is received
 
 	UdpServer udp_server;
+
+	bool lockstep = false; // only run the updates requested by STEP_COMMEND (lockstep.h), set before start()
+	int max_step = LOCKSTEP_MAX_STEP; // lockstep: bound of the num_step of a STEP_COMMEND
+private:
+	int num_step_remaining = 0; // lockstep: updates left of the current STEP_COMMEND
+	void applyCommand(const UdpDataReceive& msg); // apply a received RESET, MOTOR_SPEED_COMMEND or STEP_COMMEND
+	void waitStepCommand(); // lockstep: report msg_send, then apply the commands until a STEP_COMMEND or SHOULD_END
 #endif //UDP
 
 private:
@@ -537,8 +232,20 @@ private:
 	std::vector<Constraint*> constraints;
 	thrust::device_vector<CudaContactPlane> d_planes; // used for constraints
 	thrust::device_vector<CudaBall> d_balls; // used for constraints
+	thrust::device_vector<double> d_terrain_height, d_terrain_friction_k, d_terrain_friction_s; // device copy of h_terrain
+	thrust::device_vector<CudaHeightfield> d_terrain; // view of the device copy, empty: no terrain
+	thrust::device_vector<ObstacleNode> d_obstacle_node; // device copy of h_obstacles
+	thrust::device_vector<ObstaclePrimitive> d_obstacle_primitive;
+	thrust::device_vector<CudaObstacles> d_obstacles; // view of the device copy, empty: no obstacles
 
 	CUDA_GLOBAL_CONSTRAINTS d_constraints;
+	std::vector<CudaContactPlane> h_planes; // host copy of d_planes, used by Backend::CPU
+	std::vector<CudaBall> h_balls; // host copy of d_balls, used by Backend::CPU
+	Heightfield h_terrain; // used for constraints if not empty
+	CudaHeightfield h_terrain_view; // flat view of h_terrain, used by Backend::CPU
+	ObstacleSet h_obstacles; // used for constraints if not empty
+	CudaObstacles h_obstacles_view; // flat view of h_obstacles, used by Backend::CPU
+	CUDA_GLOBAL_CONSTRAINTS h_constraints; // flat view of h_planes, h_balls, h_terrain and h_obstacles
 	bool SHOULD_UPDATE_CONSTRAINT = true; // a flag indicating whether constraint should be updated
 
 #ifdef GRAPHICS
@@ -0,0 +1,235 @@
+/*
+sim_collision.cpp: spatial hash self collision of the surface masses, see sim_collision.h
+*/
+
+#include "sim_collision.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+/* hash of a grid cell (and of the instance when the instances do not collide with each other) */
+inline uint32_t cellHash(const int x, const int y, const int z, const int w) {
+	return (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u ^ (uint32_t)w * 2654435761u;
+}
+
+/* grid coordinate, clamped so that a diverged position (inf, nan) is not undefined */
+inline int cellOf(const double x, const double inv_cell) {
+	const double c = std::floor(x * inv_cell);
+	return c > -1e9 ? (c < 1e9 ? (int)c : 1000000000) : -1000000000;
+}
+
+/* sorted unique partners of each surface mass as offset/list */
+void flatten(std::vector<std::vector<int>>& partner, std::vector<int>& offset, std::vector<int>& list) {
+	offset.assign(partner.size() + 1, 0);
+	list.clear();
+	for (size_t s = 0; s < partner.size(); s++) {
+		std::vector<int>& p = partner[s];
+		std::sort(p.begin(), p.end());
+		p.erase(std::unique(p.begin(), p.end()), p.end());
+		list.insert(list.end(), p.begin(), p.end());
+		offset[s + 1] = (int)list.size();
+	}
+}
+
+} // namespace
+
+void SelfCollision::init(const MASS& mass, const SPRING& spring, const InstanceLayout& layout, const int num_threads) {
+	std::vector<int> surface_id(mass.num, -1); // surface index of each mass
+	surface.clear();
+	instance.clear();
+	for (int i = 0; i < mass.num; i++) {
+		if (!mass.constrain[i]) { continue; }
+		surface_id[i] = (int)surface.size();
+		surface.push_back(i);
+		instance.push_back(layout.num_mass > 0 ? i / layout.num_mass : 0);
+	}
+	const int n = (int)surface.size();
+	uint32_t num_slot = 2;
+	while (num_slot < 2 * (uint32_t)n) { num_slot *= 2; } // at most 50% load
+	table_mask = num_slot - 1;
+	pos_build.resize(n);
+	key.resize(n);
+	cell_offset.resize(num_slot + 1);
+	cell_next.resize(num_slot);
+	cell_mass.resize(n);
+	neighbor_offset.resize(n + 1);
+#ifdef _OPENMP
+	const int n_threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#endif
+
+	// excluded pairs: joined by a spring ...
+	std::vector<std::vector<int>> partner(n);
+	for (int i = 0; i < spring.num; i++) {
+		const int a = surface_id[spring.edge[i].x], b = surface_id[spring.edge[i].y];
+		if (a >= 0 && b >= 0 && a != b) {
+			partner[a].push_back(b);
+			partner[b].push_back(a);
+		}
+	}
+	flatten(partner, exclude_offset, exclude);
+	// ... or neighbors in the mesh: closer than rest_exclusion * radius now, found by a build with that cutoff
+	const bool between = between_instances;
+	if (rest_exclusion > 0) {
+		cell_size = rest_exclusion * radius;
+		between_instances = false;
+#pragma omp parallel num_threads(n_threads)
+		build(mass);
+		between_instances = between;
+		for (int s = 0; s < n; s++) {
+			partner[s].insert(partner[s].end(), neighbor.begin() + neighbor_offset[s], neighbor.begin() + neighbor_offset[s + 1]);
+		}
+		flatten(partner, exclude_offset, exclude);
+	}
+
+	cell_size = radius + skin;
+#pragma omp parallel num_threads(n_threads)
+	build(mass);
+	num_build = 0;
+}
+
+bool SelfCollision::excluded(const int s, const int t) const {
+	return std::binary_search(exclude.begin() + exclude_offset[s], exclude.begin() + exclude_offset[s + 1], t);
+}
+
+void SelfCollision::exclusiveScan(int* a, const int n) {
+#ifdef _OPENMP
+	const int tid = omp_get_thread_num(), nt = omp_get_num_threads();
+#else
+	const int tid = 0, nt = 1;
+#endif
+#pragma omp single
+	scan_sum.assign(nt + 1, 0);
+	// each thread scans a block, then adds the sum of the blocks before it
+	const int begin = (int)((long long)n * tid / nt), end = (int)((long long)n * (tid + 1) / nt);
+	int sum = 0;
+	for (int i = begin; i < end; i++) {
+		const int v = a[i];
+		a[i] = sum;
+		sum += v;
+	}
+	scan_sum[tid + 1] = sum;
+#pragma omp barrier
+#pragma omp single
+	for (int t = 0; t < nt; t++) { scan_sum[t + 1] += scan_sum[t]; }
+	for (int i = begin; i < end; i++) { a[i] += scan_sum[tid]; }
+#pragma omp single
+	a[n] = scan_sum[nt];
+}
+
+void SelfCollision::build(const MASS& mass) {
+	PROFILE_SCOPE(Phase::BROAD_PHASE);
+	const int n = (int)surface.size();
+	const int num_slot = (int)table_mask + 1;
+	const double inv_cell = 1.0 / cell_size;
+	const double cutoff2 = cell_size * cell_size;
+	const bool by_instance = !between_instances; // the packed instances overlap, hash them apart
+#ifdef _OPENMP
+	const int tid = omp_get_thread_num(), nt = omp_get_num_threads();
+#else
+	const int tid = 0, nt = 1;
+#endif
+#pragma omp single
+	if ((int)thread_neighbor.size() < nt) { thread_neighbor.resize(nt); }
+
+	// counting sort of the surface masses by hash table slot
+#pragma omp for schedule(static)
+	for (int b = 0; b <= num_slot; b++) { cell_offset[b] = 0; }
+#pragma omp for schedule(static)
+	for (int s = 0; s < n; s++) {
+		const Vec3d p = mass.pos[surface[s]];
+		pos_build[s] = p;
+		key[s] = cellHash(cellOf(p.x, inv_cell), cellOf(p.y, inv_cell), cellOf(p.z, inv_cell), by_instance ? instance[s] : 0) & table_mask;
+#pragma omp atomic
+		cell_offset[key[s]]++;
+	}
+	exclusiveScan(cell_offset.data(), num_slot);
+#pragma omp for schedule(static)
+	for (int b = 0; b < num_slot; b++) { cell_next[b] = cell_offset[b]; }
+#pragma omp for schedule(static)
+	for (int s = 0; s < n; s++) {
+		int slot;
+#pragma omp atomic capture
+		slot = cell_next[key[s]]++;
+		cell_mass[slot] = s;
+	}
+#pragma omp for schedule(static)
+	for (int b = 0; b < num_slot; b++) { // the order of the atomics varies, the neighbor lists do not
+		std::sort(cell_mass.begin() + cell_offset[b], cell_mass.begin() + cell_offset[b + 1]);
+	}
+
+	// neighbor lists: the surface masses closer than cell_size in the 27 cells around each one
+	std::vector<int>& list = thread_neighbor[tid];
+	list.clear();
+	int first = -1; // first surface mass of this thread
+#pragma omp for schedule(static)
+	for (int s = 0; s < n; s++) {
+		if (first < 0) { first = s; }
+		const Vec3d p = pos_build[s];
+		const int cx = cellOf(p.x, inv_cell), cy = cellOf(p.y, inv_cell), cz = cellOf(p.z, inv_cell);
+		const int w = by_instance ? instance[s] : 0;
+		const size_t begin = list.size();
+		uint32_t visited[27];
+		int num_visited = 0;
+		for (int dz = -1; dz <= 1; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					const uint32_t b = cellHash(cx + dx, cy + dy, cz + dz, w) & table_mask;
+					if (std::find(visited, visited + num_visited, b) != visited + num_visited) { continue; } // two cells in one slot
+					visited[num_visited++] = b;
+					for (int c = cell_offset[b]; c < cell_offset[b + 1]; c++) {
+						const int t = cell_mass[c];
+						if (t == s || (by_instance && instance[t] != instance[s])) { continue; }
+						if ((pos_build[t] - p).SquaredSum() >= cutoff2 || excluded(s, t)) { continue; }
+						list.push_back(t);
+					}
+				}
+			}
+		}
+		neighbor_offset[s] = (int)(list.size() - begin);
+	}
+	exclusiveScan(neighbor_offset.data(), n);
+#pragma omp single
+	neighbor.resize(neighbor_offset[n]);
+	if (first >= 0) { std::copy(list.begin(), list.end(), neighbor.begin() + neighbor_offset[first]); } // blocks in order
+#pragma omp barrier
+#pragma omp single
+	{
+		num_build++;
+		moved.store(false, std::memory_order_relaxed);
+	}
+}
+
+void SelfCollision::applyForce(const MASS& mass) {
+	if (moved.load(std::memory_order_relaxed)) { build(mass); } // set in the previous step, the same for all threads
+	PROFILE_SCOPE(Phase::COLLISION);
+	const int n = (int)surface.size();
+	const double radius2 = radius * radius;
+	const double max_move2 = 0.25 * skin * skin;
+	bool has_moved = false;
+#pragma omp for schedule(static)
+	for (int s = 0; s < n; s++) {
+		const int i = surface[s];
+		const Vec3d p = mass.pos[i];
+		has_moved |= (p - pos_build[s]).SquaredSum() > max_move2;
+		Vec3d force(0, 0, 0);
+		for (int c = neighbor_offset[s]; c < neighbor_offset[s + 1]; c++) {
+			const int j = surface[neighbor[c]];
+			const Vec3d d = p - mass.pos[j];
+			const double dist2 = d.SquaredSum();
+			if (dist2 >= radius2 || dist2 < 1e-24) { continue; }
+			const double dist = sqrt(dist2);
+			const Vec3d normal = d / dist; // from j to i, the force on j is computed the same way with -normal
+			const double f = k * (radius - dist) - damping * dot(mass.vel[i] - mass.vel[j], normal);
+			if (f > 0) { force += f * normal; } // penalty pushes only
+		}
+		mass.force[i] += force; // one thread per mass, after the spring pass
+	}
+	if (has_moved) { moved.store(true, std::memory_order_relaxed); } // read by all threads after the mass pass
+}
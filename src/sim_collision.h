@@ -0,0 +1,70 @@
+/*
+sim_collision.h: self collision of the surface masses (mass.constrain) for the cpu backend, so that the legs
+do not pass through each other or the body, and the packed instances (InstanceLayout) can touch each other.
+Broad phase: the surface masses are hashed into a uniform grid (cell size radius + skin) by a parallel
+counting sort, then each surface mass lists its neighbors closer than radius + skin from the 27 cells around
+it (Verlet list). The lists are rebuilt only after a surface mass moved skin/2 since the last build, which the
+narrow phase checks every step, so a build is amortized over many steps.
+Narrow phase: every step, each surface mass sums the penalty forces of its listed neighbors closer than radius
+(stiffness k, damping along the normal), no atomics and in a fixed order. Pairs joined by a spring and pairs
+closer than rest_exclusion * radius at init() (neighbors in the mesh) are excluded.
+*/
+
+#ifndef TITAN_SIM_COLLISION_H
+#define TITAN_SIM_COLLISION_H
+
+#include "vec.h"
+#include "object.h"
+#include "model.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+class SelfCollision {
+public:
+	double radius = 0.006; // [m] contact distance of two surface masses, about half their spacing in data.msgpack
+	double skin = 0.002; // [m] margin of the neighbor lists
+	double k = 1000; // [N/m] penalty stiffness, of the order of the springs
+	double damping = DAMPING_NORMAL; // [N s/m] damping of the normal relative velocity
+	double rest_exclusion = 2; // pairs of an instance closer than rest_exclusion * radius at init() never collide
+	bool between_instances = false; // also collide the instances with each other (place them apart first), set before init()
+
+	long long num_build = 0; // broad phase builds since init()
+	inline int numSurface() const { return (int)surface.size(); }
+	inline size_t numNeighbor() const { return neighbor.size(); } // entries of the neighbor lists (each pair twice)
+	inline size_t numExcluded() const { return exclude.size() / 2; } // excluded pairs
+
+	/* collect the surface masses and the excluded pairs of the current (rest) state, then build the neighbor
+	   lists, num_threads: number of openmp threads, 0: use the openmp default */
+	void init(const MASS& mass, const SPRING& spring, const InstanceLayout& layout, const int num_threads = 0);
+
+	/* add the contact forces of the surface masses to mass.force, rebuild the neighbor lists first if a surface
+	   mass moved skin/2 (orphaned "omp for", call it inside "omp parallel" between the spring and mass passes) */
+	void applyForce(const MASS& mass);
+
+	/* rebuild the neighbor lists (orphaned "omp for") */
+	void build(const MASS& mass);
+
+private:
+	double cell_size = 0; // [m] grid cell and neighbor list cutoff
+	uint32_t table_mask = 0; // hash table size - 1 (power of 2)
+	std::vector<int> surface; // mass id of each surface mass
+	std::vector<int> instance; // instance of each surface mass
+	std::vector<int> exclude_offset, exclude; // excluded partners (surface index, ascending) of each surface mass
+	std::vector<Vec3d> pos_build; // position of each surface mass at the last build
+	std::vector<uint32_t> key; // hash table slot of each surface mass
+	std::vector<int> cell_offset; // start of the surface masses of each slot in cell_mass, size table+1
+	std::vector<int> cell_next; // scatter position of each slot
+	std::vector<int> cell_mass; // surface masses sorted by slot (ascending within a slot)
+	std::vector<int> neighbor_offset, neighbor; // neighbor lists (surface index) of each surface mass
+	std::vector<std::vector<int>> thread_neighbor; // neighbor lists found by each thread
+	std::vector<int> scan_sum; // per thread sums of exclusiveScan()
+	std::atomic<bool> moved{ false }; // a surface mass moved skin/2 since the last build
+
+	/* a[i] = sum of a[0..i), a[n] = total (orphaned, all threads of the region call it) */
+	void exclusiveScan(int* a, const int n);
+	bool excluded(const int s, const int t) const;
+};
+
+#endif // TITAN_SIM_COLLISION_H
@@ -0,0 +1,667 @@
+/*
+sim_cpu.cpp: headless multi-core (OpenMP) cpu backend, see sim_cpu.h
+*/
+
+#include "sim_cpu.h"
+#include "profiler.h"
+#include "recorder.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <cassert>
+#include <algorithm>
+#include <cstring>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+void SpringUpdateCpu(const MASS& mass, const SPRING& spring, const bool reset) {
+	PROFILE_SCOPE(Phase::SPRING); // per thread, with the wait at the barrier
+#pragma omp for schedule(static)
+	for (int i = 0; i < spring.num; i++) {
+		Vec2i e = spring.edge[i];
+		Vec3d s_vec = mass.pos[e.y] - mass.pos[e.x];// the vector from left to right
+		double length = s_vec.norm(); // current spring length
+
+		s_vec /= (length > 1e-12 ? length : 1e-12);// normalized to unit vector (direction), check instablility for small length
+
+		Vec3d force = spring.k[i] * (spring.rest[i] - length) * s_vec; // normal spring force
+		force += s_vec.dot(mass.vel[e.x] - mass.vel[e.y]) * spring.damping[i] * s_vec;// damping
+
+		mass.force[e.y].atomicVecAdd(force); // need atomics here
+		mass.force[e.x].atomicVecAdd(-force);
+
+#ifdef ROTATION
+		if (reset && spring.resetable[i]) {
+			spring.rest[i] = length;//reset the spring rest length if this spring is restable
+		}
+#endif // ROTATION
+	}
+}
+
+bool SurfaceIndex::update(const MASS& mass) {
+	size_t k = 0; // surface masses checked against id
+	bool same = true;
+	for (int i = 0; i < mass.num && same; i++) {
+		if (mass.constrain[i]) { same = k < id.size() && id[k++] == i; }
+	}
+	if (same && k == id.size()) { return false; }
+	id.clear();
+	for (int i = 0; i < mass.num; i++) {
+		if (mass.constrain[i]) { id.push_back(i); }
+	}
+	return true;
+}
+
+void ContactForceCpu(const MASS& mass, const SurfaceIndex& surface, const CUDA_GLOBAL_CONSTRAINTS& c) {
+	PROFILE_SCOPE(Phase::CONTACT);
+	const int* id = surface.id.data();
+#pragma omp for schedule(static)
+	for (int s = 0; s < surface.size(); s++) {
+		const int i = id[s];
+		const Vec3d spring_force = mass.force[i] + mass.force_extern[i];
+		Vec3d force = spring_force;
+		c.applyForce(force, mass.pos[i], mass.vel[i]);
+		mass.force[i] += force - spring_force; // contact force only, one thread per mass after the spring pass
+	}
+}
+
+void MassUpdateCpu(const MASS& mass, const Vec3d& global_acc, const double dt) {
+	PROFILE_SCOPE(Phase::MASS);
+#pragma omp for schedule(static)
+	for (int i = 0; i < mass.num; i++) {
+		if (mass.fixed[i] == false) {
+			double m = mass.m[i];
+			Vec3d vel = mass.vel[i];
+
+			Vec3d force = mass.force[i];
+			force += mass.force_extern[i];// add spring (and contact) force and external force [N]
+
+			// euler integration
+			force /= m;// force is now acceleration
+			force += global_acc;// add global accleration
+			vel += force * dt; // vel += acc*dt
+			mass.acc[i] = force; // update acceleration
+			mass.vel[i] = vel; // update velocity
+			mass.pos[i] += vel * dt; // update position
+			mass.force[i].setZero(); // reset force
+		}
+	}
+}
+
+void SpringForceCpu(const MASS& mass, const SPRING& spring, const SpringIncidence& incidence, const bool reset) {
+	PROFILE_SCOPE(Phase::SPRING);
+#pragma omp for schedule(static)
+	for (int i = 0; i < spring.num; i++) {
+		Vec2i e = spring.edge[i];
+		Vec3d s_vec = mass.pos[e.y] - mass.pos[e.x];// the vector from left to right
+		double length = s_vec.norm(); // current spring length
+
+		s_vec /= (length > 1e-12 ? length : 1e-12);// normalized to unit vector (direction), check instablility for small length
+
+		Vec3d force = spring.k[i] * (spring.rest[i] - length) * s_vec; // normal spring force
+		force += s_vec.dot(mass.vel[e.x] - mass.vel[e.y]) * spring.damping[i] * s_vec;// damping
+
+		incidence.force[i] = force; // force on the right mass, no write conflict
+
+#ifdef ROTATION
+		if (reset && spring.resetable[i]) {
+			spring.rest[i] = length;//reset the spring rest length if this spring is restable
+		}
+#endif // ROTATION
+	}
+}
+
+void GatherForceCpu(const MASS& mass, const SpringIncidence& incidence) {
+	PROFILE_SCOPE(Phase::MASS);
+#pragma omp for schedule(static)
+	for (int i = 0; i < mass.num; i++) {
+		Vec3d force; // zero
+		for (int k = incidence.offset[i]; k < incidence.offset[i + 1]; k++) {// add spring force, fixed order
+			force += incidence.dir[k] * incidence.force[incidence.springId[k]];
+		}
+		mass.force[i] = force; // one thread per mass, no atomics (reset by MassUpdateCpu)
+	}
+}
+
+void rotateJointCpu(const MASS& mass, const JOINT& joint) {
+	PROFILE_SCOPE(Phase::JOINT_ROTATION);
+#pragma omp for schedule(static)
+	for (int i = 0; i < joint.points.num; i++) {
+		int anchor_id = joint.points.anchorId[i];
+		int mass_id = joint.points.massId[i];
+		Vec2i anchor_edge = joint.anchors.edge[anchor_id]; // mass id of the achor edge point
+		mass.pos[mass_id] = AxisAngleRotaion(
+			mass.pos[anchor_edge.x],
+			mass.pos[anchor_edge.y], mass.pos[mass_id],
+			joint.anchors.theta[anchor_id] * joint.points.dir[i]);
+	}
+}
+
+void stepCpu(const MASS& mass, const SPRING& spring, const JOINT& joint,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const SurfaceIndex& surface, const Vec3d& global_acc, const double dt, const int num_threads,
+	const SpringIncidence* incidence, SelfCollision* collision) {
+	// one parallel region for all queued updates, the implicit barrier at the end of
+	// each "omp for" orders the passes the same way as the kernels in a cuda stream
+#ifdef _OPENMP
+	const int n_threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#endif
+	const bool contact = !c.empty();
+#pragma omp parallel num_threads(n_threads)
+	{
+		auto step = [&](const bool reset) {
+			if (incidence) {
+				SpringForceCpu(mass, spring, *incidence, reset);
+				GatherForceCpu(mass, *incidence);
+			}
+			else {
+				SpringUpdateCpu(mass, spring, reset);
+			}
+			if (collision) { collision->applyForce(mass); }
+			if (contact) { ContactForceCpu(mass, surface, c); } // surface masses only, no branch in the mass pass
+			MassUpdateCpu(mass, global_acc, dt);
+		};
+		for (int i = 0; i < (NUM_QUEUED_KERNELS / NUM_UPDATE_PER_ROTATION); i++) {
+			for (int j = 0; j < NUM_UPDATE_PER_ROTATION - 1; j++) {
+				step(false);
+			}
+#ifdef ROTATION
+			rotateJointCpu(mass, joint);
+			step(true);
+#endif // ROTATION
+		}
+	}
+	PROFILE_COUNT(Counter::SPRING_UPDATE, (uint64_t)spring.num * NUM_QUEUED_KERNELS);
+	PROFILE_COUNT(Counter::MASS_UPDATE, (uint64_t)mass.num * NUM_QUEUED_KERNELS);
+}
+
+void measureJoints(const MASS& mass, const JOINT& joint, double* joint_pos, double* joint_vel, const double dt_update) {
+	PROFILE_SCOPE(Phase::JOINT_MEASURE);
+	for (int i = 0; i < joint.anchors.num; i++) // compute joint angles and angular velocity
+	{
+		Vec2i anchor_edge = joint.anchors.edge[i];
+		Vec3d rotation_axis = (mass.pos[anchor_edge.y] - mass.pos[anchor_edge.x]).normalize();
+		Vec3d x_left = mass.pos[joint.anchors.leftCoord[i] + 1] - mass.pos[joint.anchors.leftCoord[i]];//oxyz
+		Vec3d x_right = mass.pos[joint.anchors.rightCoord[i] + 1] - mass.pos[joint.anchors.rightCoord[i]];//oxyz
+		double angle = signedAngleBetween(x_left, x_right, rotation_axis); //joint angle in [-pi,pi]
+
+		double delta_angle = angle - joint_pos[i];
+		if (delta_angle > M_PI) {
+			joint_vel[i] = (delta_angle - 2 * M_PI) / dt_update;
+		}
+		else if (delta_angle > -M_PI) {
+			joint_vel[i] = delta_angle / dt_update;
+		}
+		else {
+			joint_vel[i] = (delta_angle + 2 * M_PI) / dt_update;
+		}
+		joint_pos[i] = angle;
+	}
+}
+
+void updateJointControl(const JOINT& joint,
+	const double* joint_vel_desired, const double* joint_vel,
+	double* joint_vel_error, double* joint_pos_error, double* joint_vel_cmd,
+	const double max_joint_vel, const double k_vel, const double k_pos, const double dt) {
+	PROFILE_SCOPE(Phase::JOINT_CONTROL);
+	for (int i = 0; i < joint.anchors.num; i++) // compute joint angles and angular velocity
+	{// update joint_vel_cmd
+		joint_vel_error[i] = joint_vel_desired[i] - joint_vel[i];
+		joint_pos_error[i] += joint_vel_error[i]; // simple proportional control
+		if (joint_pos_error[i] > max_joint_vel) { joint_pos_error[i] = max_joint_vel; }
+		if (joint_pos_error[i] < -max_joint_vel) { joint_pos_error[i] = -max_joint_vel; }
+		joint_vel_cmd[i] = k_vel * joint_vel_error[i] + k_pos * joint_pos_error[i];
+
+		if (joint_vel_cmd[i] > max_joint_vel) { joint_vel_cmd[i] = max_joint_vel; }
+		if (joint_vel_cmd[i] < -max_joint_vel) { joint_vel_cmd[i] = -max_joint_vel; }
+		joint.anchors.theta[i] = NUM_UPDATE_PER_ROTATION * joint_vel_cmd[i] * dt;// update joint speed
+	}
+}
+
+ModelState measureModelState(const MASS& mass, const int id_oxyz_start, const int num_joint,
+	const double* joint_pos, const double* joint_vel, const double* joint_vel_cmd) {
+	ModelState state;
+	state.com_pos = mass.pos[id_oxyz_start];//body center of mass position
+	state.com_acc = mass.acc[id_oxyz_start];//body center of mass acceleration
+	state.ox = (mass.pos[id_oxyz_start + 1] - state.com_pos).normalize();
+	Vec3d oy = mass.pos[id_oxyz_start + 2] - state.com_pos;
+	state.oy = (oy - oy.dot(state.ox) * state.ox).normalize();
+	for (int i = 0; i < 4; i++) {
+		state.joint_pos[i] = i < num_joint ? joint_pos[i] : 0.;
+		state.joint_vel[i] = i < num_joint ? joint_vel[i] : 0.;
+		state.joint_vel_cmd[i] = i < num_joint ? joint_vel_cmd[i] : 0.;
+	}
+	return state;
+}
+
+void printThroughput(const double duration, const double T, const double dt, const int num_spring) {
+	double sim_time_ratio = T / duration;
+	double spring_update_rate = ((double)num_spring) / dt * sim_time_ratio;
+	printf("Elapsed time:%.2f s for %.2f simulation time (%.2f); # %.2e spring update/s\n",
+		duration, T, sim_time_ratio, spring_update_rate);
+}
+
+
+CpuSimulation::CpuSimulation(size_t num_mass, size_t num_spring) {
+	mass = MASS(num_mass, true);
+	spring = SPRING(num_spring, true);
+}
+
+CpuSimulation::CpuSimulation(const MASS& robot_mass, const SPRING& robot_spring, const JOINT& robot_joint, int num_instance) {
+	if (num_instance < 1) { throw std::runtime_error("The number of instances must be at least 1."); }
+	layout = packInstances(robot_mass, robot_spring, robot_joint, num_instance, mass, spring, joint);
+}
+
+CpuSimulation::~CpuSimulation() {
+	mass.release();
+	spring.release();
+	joint.release();
+	incidence.release();
+	soa_mass.release();
+	soa_spring.release();
+	soa_mass_mixed.release();
+	soa_mass_fp32.release();
+	soa_spring_fp32.release();
+}
+
+void CpuSimulation::setMaxJointSpeed(double max_joint_vel) {
+	this->max_joint_vel = max_joint_vel;
+	max_joint_vel_error = max_joint_vel / k_vel;
+	max_joint_pos_error = max_joint_vel / k_pos;
+}
+
+void CpuSimulation::createPlane(const Vec3d& abc, const double d, const double FRICTION_K, const double FRICTION_S) {
+	assert(FRICTION_K >= 0);// make sure the friction coefficient are meaningful values
+	assert(FRICTION_S >= 0);
+	CudaContactPlane plane;
+	plane._normal = abc / abc.norm();
+	plane._offset = d;
+	plane._FRICTION_K = FRICTION_K;
+	plane._FRICTION_S = FRICTION_S;
+	planes.push_back(plane);
+	updateConstraints();
+}
+
+void CpuSimulation::createBall(const Vec3d& center, const double r) {
+	CudaBall ball;
+	ball._center = center;
+	ball._radius = r;
+	balls.push_back(ball);
+	updateConstraints();
+}
+
+void CpuSimulation::createTerrain(const Heightfield& terrain) {
+	this->terrain = terrain;
+	updateConstraints();
+}
+
+void CpuSimulation::createObstacles(const ObstacleSet& obstacles) {
+	this->obstacles = obstacles;
+	if (this->obstacles.node.empty()) { this->obstacles.build(); }
+	updateConstraints();
+}
+
+void CpuSimulation::clearConstraints() {
+	planes.clear();
+	balls.clear();
+	terrain = Heightfield();
+	obstacles = ObstacleSet();
+	updateConstraints();
+}
+
+void CpuSimulation::updateConstraints() {
+	constraints.d_planes = planes.data();
+	constraints.d_balls = balls.data();
+	constraints.num_planes = planes.size();
+	constraints.num_balls = balls.size();
+	terrain_view = terrain.view();
+	constraints.d_terrain = terrain.empty() ? nullptr : &terrain_view;
+	obstacles_view = obstacles.view();
+	constraints.d_obstacles = obstacles.empty() ? nullptr : &obstacles_view;
+}
+
+void CpuSimulation::saveSnapshot(int slot) {
+	if (!STARTED) { throw std::runtime_error("Simulation has not started. Call start() before saveSnapshot()."); }
+	if (slot == 0) { throw std::out_of_range("saveSnapshot: slot 0 holds the state at start(), use slots 1 to num_snapshot_slot-1."); }
+	if (slot < 0 || slot >= (int)snapshot.size()) { throw std::out_of_range("saveSnapshot: invalid snapshot slot."); }
+	saveSlot(snapshot[slot]);
+}
+
+void CpuSimulation::saveSlot(StateSlot& state) {
+	if (data_layout == DataLayout::SOA) { storeSoaRest(); } // mass is updated after each update(), spring.rest is not
+	std::copy(mass.pos, mass.pos + mass.num, state.pos.begin());
+	std::copy(mass.vel, mass.vel + mass.num, state.vel.begin());
+	std::copy(mass.acc, mass.acc + mass.num, state.acc.begin());
+	std::copy(mass.force, mass.force + mass.num, state.force.begin());
+	for (size_t i = 0; i < resetable_spring.size(); i++) { state.rest[i] = spring.rest[resetable_spring[i]]; }
+	memcpy(state.theta.data(), joint.anchors.theta, joint.size() * sizeof(double));
+	state.joint_pos = joint_pos; // same size, no allocation
+	state.joint_vel = joint_vel;
+	state.joint_vel_desired = joint_vel_desired;
+	state.joint_vel_cmd = joint_vel_cmd;
+	state.joint_vel_error = joint_vel_error;
+	state.joint_pos_error = joint_pos_error;
+	state.instance_T = instance_T;
+	state.valid = true;
+}
+
+void CpuSimulation::restoreSlot(const StateSlot& state, int begin, int end) {
+	PROFILE_SCOPE(Phase::RESET);
+	PROFILE_COUNT(Counter::RESET, end - begin);
+	const int mass_begin = layout.massOffset(begin), num_mass = layout.massOffset(end) - mass_begin;
+	std::copy(state.pos.begin() + mass_begin, state.pos.begin() + mass_begin + num_mass, mass.pos + mass_begin);
+	std::copy(state.vel.begin() + mass_begin, state.vel.begin() + mass_begin + num_mass, mass.vel + mass_begin);
+	std::copy(state.acc.begin() + mass_begin, state.acc.begin() + mass_begin + num_mass, mass.acc + mass_begin);
+	std::copy(state.force.begin() + mass_begin, state.force.begin() + mass_begin + num_mass, mass.force + mass_begin);
+	for (int i = resetable_offset[begin]; i < resetable_offset[end]; i++) { spring.rest[resetable_spring[i]] = state.rest[i]; }
+	const int joint_begin = layout.jointOffset(begin), num_joint = layout.jointOffset(end) - joint_begin;
+	const size_t joint_bytes = num_joint * sizeof(double);
+	memcpy(joint.anchors.theta + joint_begin, state.theta.data() + joint_begin, joint_bytes);
+	memcpy(joint_pos.data() + joint_begin, state.joint_pos.data() + joint_begin, joint_bytes);
+	memcpy(joint_vel.data() + joint_begin, state.joint_vel.data() + joint_begin, joint_bytes);
+	memcpy(joint_vel_desired.data() + joint_begin, state.joint_vel_desired.data() + joint_begin, joint_bytes);
+	memcpy(joint_vel_cmd.data() + joint_begin, state.joint_vel_cmd.data() + joint_begin, joint_bytes);
+	memcpy(joint_vel_error.data() + joint_begin, state.joint_vel_error.data() + joint_begin, joint_bytes);
+	memcpy(joint_pos_error.data() + joint_begin, state.joint_pos_error.data() + joint_begin, joint_bytes);
+	for (int k = begin; k < end; k++) { instance_T[k] = state.instance_T[k]; }
+	if (data_layout == DataLayout::SOA) { loadSoaState(begin, end); }
+}
+
+void CpuSimulation::restoreSnapshot(int slot) {
+	if (slot < 0 || slot >= (int)snapshot.size() || !snapshot[slot].valid) {
+		throw std::out_of_range("restoreSnapshot: invalid or empty snapshot slot.");
+	}
+	auto start_time = std::chrono::steady_clock::now();
+	restoreSlot(snapshot[slot], 0, layout.num_instance);
+	recordReset(start_time);
+}
+
+void CpuSimulation::restoreSnapshot(int slot, int instance) {
+	if (slot < 0 || slot >= (int)snapshot.size() || !snapshot[slot].valid) {
+		throw std::out_of_range("restoreSnapshot: invalid or empty snapshot slot.");
+	}
+	if (instance < 0 || instance >= layout.num_instance) { throw std::out_of_range("restoreSnapshot: invalid instance."); }
+	auto start_time = std::chrono::steady_clock::now();
+	restoreSlot(snapshot[slot], instance, instance + 1);
+	recordReset(start_time);
+}
+
+void CpuSimulation::recordReset(const std::chrono::steady_clock::time_point& start_time) {
+	double duration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count();
+	num_reset++;
+	reset_time_us += duration;
+	max_reset_time_us = std::max(max_reset_time_us, duration);
+}
+
+void CpuSimulation::backupState() { saveSlot(snapshot[0]); }
+
+void CpuSimulation::resetState() { restoreSnapshot(0); }
+
+void CpuSimulation::resetInstance(int instance) { restoreSnapshot(0, instance); }
+
+void CpuSimulation::start() {
+	if (mass.num == 0) { throw std::runtime_error("No masses have been added. Please add masses before starting the simulation."); }
+	if (layout.num_mass == 0) { layout = InstanceLayout(1, mass.num, spring.num, joint.size(), joint.points.num); }
+	printf("Starting cpu simulation with %d instances, %d masses and %d springs\n", layout.num_instance, mass.num, spring.num);
+	STARTED = true;
+	T = 0;
+	if (dt == 0.0) { // if dt hasn't been set by the user.
+		dt = 0.01; // min delta
+	}
+	updateConstraints();
+	if (integrator != Integrator::EXPLICIT && data_layout != DataLayout::AOS) {
+		throw std::runtime_error("The implicit and xpbd integrators require DataLayout::AOS.");
+	}
+	if ((force_assembly == ForceAssembly::GATHER || data_layout == DataLayout::SOA || integrator == Integrator::IMPLICIT)
+		&& incidence.num_spring != spring.num) {
+		incidence.init(spring, mass.num);
+	}
+	if (integrator == Integrator::IMPLICIT) {
+		implicit.init(mass.num, spring.num);
+		printf("implicit integrator: dt=%.2e, max %d CG iterations, tolerance %.1e\n", dt, implicit.max_iter, implicit.tolerance);
+	}
+	if (integrator == Integrator::XPBD) {
+		xpbd.init(spring, mass.num);
+		printf("xpbd integrator: dt=%.2e, %d iterations, %d spring colors (%d parallel)\n",
+			dt, xpbd.num_iter, xpbd.numColor(), xpbd.num_parallel_color);
+	}
+	if (self_collision) {
+		if (integrator != Integrator::EXPLICIT || data_layout != DataLayout::AOS) {
+			throw std::runtime_error("Self collision requires the explicit integrator and DataLayout::AOS.");
+		}
+		collision.init(mass, spring, layout, num_threads);
+		printf("self collision: %d surface masses, radius %.1f mm, %zu excluded pairs, %zu neighbors (%s)\n",
+			collision.numSurface(), collision.radius * 1e3, collision.numExcluded(), collision.numNeighbor(),
+			collision.between_instances ? "within and between instances" : "within each instance");
+	}
+	if (data_layout == DataLayout::SOA) {
+		initSoa();
+		printf("soa kernels: %s, precision: %s\n",
+			simdIsaName(precision == Precision::FP64 ? simd_isa : SimdIsa::SCALAR), precisionName(precision));
+	}
+
+	size_t num_joint = joint.size();
+	joint_pos.assign(num_joint, 0.);
+	joint_vel.assign(num_joint, 0.);
+	joint_vel_desired.assign(num_joint, 0.);
+	joint_vel_cmd.assign(num_joint, 0.);
+	joint_vel_error.assign(num_joint, 0.);
+	joint_pos_error.assign(num_joint, 0.);
+
+	instance_T.assign(layout.num_instance, 0.);
+	instance_reset.assign(layout.num_instance, false);
+	instance_state.resize(layout.num_instance);
+
+	resetable_spring.clear();
+	for (int i = 0; i < spring.num; i++) {
+		if (spring.resetable[i]) { resetable_spring.push_back(i); }
+	}
+	resetable_offset.resize(layout.num_instance + 1);
+	for (int k = 0; k <= layout.num_instance; k++) {
+		resetable_offset[k] = (int)(std::lower_bound(resetable_spring.begin(), resetable_spring.end(),
+			layout.springOffset(k)) - resetable_spring.begin());
+	}
+	snapshot.resize(std::max(num_snapshot_slot, 1));
+	for (StateSlot& state : snapshot) { // preallocate the slots
+		state.pos.resize(mass.num);
+		state.vel.resize(mass.num);
+		state.acc.resize(mass.num);
+		state.force.resize(mass.num);
+		state.rest.resize(resetable_spring.size());
+		state.theta.resize(num_joint);
+		state.valid = false;
+	}
+	num_reset = 0;
+	reset_time_us = 0;
+	max_reset_time_us = 0;
+
+	backupState();// backup the robot mass/spring/joint state
+}
+
+void CpuSimulation::update() {
+	if (!STARTED) { throw std::runtime_error("Simulation has not started. Call start() before update()."); }
+	PROFILE_TICK();
+	PROFILE_SCOPE(Phase::UPDATE);
+	PROFILE_COUNT(Counter::UPDATE, 1);
+	{
+		PROFILE_SCOPE(Phase::DYNAMICS);
+		if (integrator == Integrator::IMPLICIT) {
+			implicit.step(mass, spring, joint, incidence, constraints, global_acc, dt, num_threads);
+		}
+		else if (integrator == Integrator::XPBD) {
+			xpbd.step(mass, spring, joint, constraints, global_acc, dt, num_threads);
+		}
+		else if (data_layout == DataLayout::SOA) {
+			updateSoa();
+		}
+		else {
+			surface.update(mass); // no-op unless mass.constrain changed
+			stepCpu(mass, spring, joint, constraints, surface, global_acc, dt, num_threads,
+				force_assembly == ForceAssembly::GATHER ? &incidence : nullptr, self_collision ? &collision : nullptr);
+		}
+	}
+	T += NUM_QUEUED_KERNELS * dt;
+
+	// the joints of all instances are measured and controlled in one pass
+	measureJoints(mass, joint, joint_pos.data(), joint_vel.data(), NUM_QUEUED_KERNELS * dt);
+	updateJointControl(joint, joint_vel_desired.data(), joint_vel.data(),
+		joint_vel_error.data(), joint_pos_error.data(), joint_vel_cmd.data(),
+		max_joint_vel, k_vel, k_pos, dt);
+
+	for (int k = 0; k < layout.num_instance; k++) {
+		PROFILE_SCOPE(Phase::STATE);
+		instance_T[k] += NUM_QUEUED_KERNELS * dt;
+		int offset = layout.jointOffset(k);
+		instance_state[k] = measureModelState(mass, id_oxyz_start + layout.massOffset(k), layout.num_joint,
+			joint_pos.data() + offset, joint_vel.data() + offset, joint_vel_cmd.data() + offset);
+	}
+
+	if (recorder != nullptr) {
+		PROFILE_SCOPE(Phase::RECORD);
+		RecordSource source;
+		source.T = T;
+		source.pos = mass.pos;
+		source.joint_pos = joint_pos.data();
+		source.joint_vel = joint_vel.data();
+		source.joint_vel_cmd = joint_vel_cmd.data();
+		source.joint_vel_desired = joint_vel_desired.data();
+		source.state = instance_state.data();
+		recorder->record(source);
+	}
+
+	bool should_reset = RESET;
+	for (int k = 0; k < layout.num_instance; k++) { should_reset |= instance_reset[k]; }
+	if (!should_reset) { return; }
+	auto reset_start = std::chrono::steady_clock::now();
+	if (RESET) {
+		RESET = false;
+		restoreSlot(snapshot[0], 0, layout.num_instance);// restore the robot mass/spring/joint state to the backedup state
+	}
+	for (int k = 0; k < layout.num_instance; k++) {
+		if (instance_reset[k]) {
+			instance_reset[k] = false;
+			restoreSlot(snapshot[0], k, k + 1);
+		}
+	}
+	recordReset(reset_start);
+}
+
+const std::vector<ModelState>& CpuSimulation::step(const int num_update, const double* joint_vel_desired) {
+	if (joint_vel_desired != nullptr) {
+		std::copy(joint_vel_desired, joint_vel_desired + joint.size(), this->joint_vel_desired.begin());
+	}
+	for (int i = 0; i < num_update; i++) { update(); }
+	return instance_state;
+}
+
+void CpuSimulation::initSoa() {
+	switch (precision) {
+	case Precision::MIXED:
+		soa_mass_mixed.init(mass.num);
+		soa_spring_fp32.init(spring.num);
+		break;
+	case Precision::FP32:
+		soa_mass_fp32.init(mass.num);
+		soa_spring_fp32.init(spring.num);
+		break;
+	default:
+		soa_mass.init(mass.num);
+		soa_spring.init(spring.num);
+	}
+	loadSoa();
+}
+
+void CpuSimulation::loadSoa() {
+	switch (precision) {
+	case Precision::MIXED:
+		soa_mass_mixed.copyFrom(mass);
+		soa_spring_fp32.copyFrom(spring);
+		break;
+	case Precision::FP32:
+		soa_mass_fp32.copyFrom(mass);
+		soa_spring_fp32.copyFrom(spring);
+		break;
+	default:
+		soa_mass.copyFrom(mass);
+		soa_spring.copyFrom(spring);
+	}
+}
+
+void CpuSimulation::loadSoaState(int begin, int end) {
+	const int mass_begin = layout.massOffset(begin), mass_end = layout.massOffset(end);
+	const int* ids = resetable_spring.data() + resetable_offset[begin];
+	const int count = resetable_offset[end] - resetable_offset[begin];
+	switch (precision) {
+	case Precision::MIXED:
+		soa_mass_mixed.copyStateFrom(mass, mass_begin, mass_end);
+		soa_spring_fp32.copyRestFrom(spring, ids, count);
+		break;
+	case Precision::FP32:
+		soa_mass_fp32.copyStateFrom(mass, mass_begin, mass_end);
+		soa_spring_fp32.copyRestFrom(spring, ids, count);
+		break;
+	default:
+		soa_mass.copyStateFrom(mass, mass_begin, mass_end);
+		soa_spring.copyRestFrom(spring, ids, count);
+	}
+}
+
+void CpuSimulation::storeSoaRest() {
+	if (precision == Precision::FP64) { soa_spring.copyRestTo(spring); }
+	else { soa_spring_fp32.copyRestTo(spring); }
+}
+
+void CpuSimulation::updateSoa() {
+	if (surface.update(mass)) { // mass.constrain changed
+		switch (precision) {
+		case Precision::MIXED: soa_mass_mixed.copyConstrainFrom(mass); break;
+		case Precision::FP32: soa_mass_fp32.copyConstrainFrom(mass); break;
+		default: soa_mass.copyConstrainFrom(mass);
+		}
+	}
+	switch (precision) {
+	case Precision::MIXED: {
+		stepSoa(soa_mass_mixed, soa_spring_fp32, joint, incidence, constraints, global_acc, dt, num_threads);
+		PROFILE_SCOPE(Phase::READBACK);
+		soa_mass_mixed.copyPosVelAccTo(mass);
+		break;
+	}
+	case Precision::FP32: {
+		stepSoa(soa_mass_fp32, soa_spring_fp32, joint, incidence, constraints, global_acc, dt, num_threads);
+		PROFILE_SCOPE(Phase::READBACK);
+		soa_mass_fp32.copyPosVelAccTo(mass);
+		break;
+	}
+	default: {
+		stepSoa(soa_mass, soa_spring, joint, incidence, constraints, global_acc, dt, simd_isa, num_threads);
+		PROFILE_SCOPE(Phase::READBACK);
+		soa_mass.copyPosVelAccTo(mass);
+	}
+	}
+}
+
+void CpuSimulation::run(const double runtime) {
+	if (!STARTED) { start(); }
+	auto start_time = std::chrono::steady_clock::now();
+	double T_start = T;
+	while (T < runtime) {
+		update();
+	}
+	auto end_time = std::chrono::steady_clock::now();
+	double duration = (double)std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() / 1000.;//[seconds]
+	printThroughput(duration, T - T_start, dt, spring.num);
+	if (integrator == Integrator::IMPLICIT && implicit.num_step > 0) {
+		printf("implicit integrator: %.1f CG iterations per step\n", (double)implicit.num_iter / implicit.num_step);
+	}
+	if (self_collision) {
+		printf("self collision: %lld neighbor list builds, %zu neighbors\n", collision.num_build, collision.numNeighbor());
+	}
+	if (num_reset > 0) {
+		printf("reset: %lld resets, %.1f us mean, %.1f us max\n", num_reset, reset_time_us / num_reset, max_reset_time_us);
+	}
+}
@@ -0,0 +1,260 @@
+/*
+sim_cpu.h: headless multi-core (OpenMP) cpu backend of the simulation.
+It runs the same step pipeline as the cuda kernels in sim.cu
+(SpringUpate, ContactUpate, MassUpate, rotateJoint, SpringUpateReset) on host memory,
+and does not depend on CUDA, GLFW or GLEW when built with CPU_ONLY.
+The step functions are used by CpuSimulation (headless) and by Simulation when
+Simulation::backend == Backend::CPU.
+*/
+
+#ifndef TITAN_SIM_CPU_H
+#define TITAN_SIM_CPU_H
+
+#include "vec.h"
+#include "object.h"
+#include "model.h"
+#include "sim_soa.h"
+#include "sim_implicit.h"
+#include "sim_xpbd.h"
+#include "sim_collision.h"
+#include "terrain.h"
+#include "obstacle.h"
+
+#include <vector>
+#include <set>
+#include <chrono>
+
+class TrajectoryRecorder;
+
+constexpr int NUM_QUEUED_KERNELS = 40; // number of kernels to queue at a given time (this will reduce the frequency of updates from the CPU by this factor
+constexpr int NUM_UPDATE_PER_ROTATION = 4; //number of update per rotation
+constexpr int LOCKSTEP_MAX_STEP = 100000; // default bound of the num_step of a lockstep STEP_COMMEND (lockstep.h)
+
+enum class Backend {
+	CUDA, // dynamics update with the cuda kernels (default)
+	CPU // dynamics update on the host with openmp threads
+};
+
+enum class DataLayout {
+	AOS, // MASS/SPRING arrays of Vec3d (default)
+	SOA // MASS_SOA/SPRING_SOA with vectorized kernels (sim_soa.h), always gathers the spring forces
+};
+
+enum class Integrator {
+	EXPLICIT, // symplectic euler (MassUpate), needs dt~5e-5 for the silicone stiffness (default)
+	IMPLICIT, // linearized backward euler solved with preconditioned CG (sim_implicit.h), stable at larger dt
+	XPBD // position based, graph-colored spring constraints (sim_xpbd.h), stable at larger dt
+};
+
+enum class ForceAssembly {
+	SCATTER, // each spring adds its force to both masses with atomics (default)
+	GATHER // each spring writes its force to a buffer, each mass sums the forces of its springs (SpringIncidence), no atomics, reproducible
+};
+
+/* compacted ids of the surface masses (mass.constrain), the only masses that can touch the global constraints:
+   the contact pass runs over them alone and the mass pass integrates all masses without contact tests */
+struct SurfaceIndex {
+	std::vector<int> id; // mass id of each surface mass (ascending)
+	inline int size() const { return (int)id.size(); }
+	/* rebuild id if mass.constrain changed since the last call (O(mass.num) check), return true if rebuilt */
+	bool update(const MASS& mass);
+};
+
+/*------------- step pipeline on host memory, same as the cuda kernels in sim.cu -------------*/
+// NOTE: these use orphaned "omp for", call them inside an "omp parallel" region (e.g. stepCpu())
+
+/* compute the spring forces and accumulate to the masses, if reset==true reset the
+   rest length of the resetable springs (SpringUpateReset) */
+void SpringUpdateCpu(const MASS& mass, const SPRING& spring, const bool reset = false);
+
+/* add the forces of the constraints c to mass.force of the surface masses, after the spring pass (ContactUpate) */
+void ContactForceCpu(const MASS& mass, const SurfaceIndex& surface, const CUDA_GLOBAL_CONSTRAINTS& c);
+
+/* euler integration of the spring, contact and external forces (MassUpate) */
+void MassUpdateCpu(const MASS& mass, const Vec3d& global_acc, const double dt);
+
+/* ForceAssembly::GATHER: compute the spring forces into incidence.force (SpringForceUpate),
+   if reset==true reset the rest length of the resetable springs */
+void SpringForceCpu(const MASS& mass, const SPRING& spring, const SpringIncidence& incidence, const bool reset = false);
+
+/* ForceAssembly::GATHER: sum the forces of the incident springs of each mass in a fixed order into
+   mass.force (GatherForceUpate), then ContactForceCpu and MassUpdateCpu as after SpringUpdateCpu */
+void GatherForceCpu(const MASS& mass, const SpringIncidence& incidence);
+
+/* rotate the joint points about the joint anchors by joint.anchors.theta (rotateJoint) */
+void rotateJointCpu(const MASS& mass, const JOINT& joint);
+
+/* run NUM_QUEUED_KERNELS dynamics updates on the host (one update_physics() iteration),
+   num_threads: number of openmp threads, 0: use the openmp default
+   surface: the masses that get the contact forces of c (ContactForceCpu)
+   incidence: gather the spring forces with it (ForceAssembly::GATHER) if not null, otherwise scatter with atomics
+   collision: add the self collision forces of the surface masses between the spring and mass passes if not null */
+void stepCpu(const MASS& mass, const SPRING& spring, const JOINT& joint,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const SurfaceIndex& surface, const Vec3d& global_acc, const double dt, const int num_threads = 0,
+	const SpringIncidence* incidence = nullptr, SelfCollision* collision = nullptr);
+
+/*------------- host helpers shared by Simulation and CpuSimulation -------------*/
+
+/* compute the joint angles [rad] and joint speed [rad/s] from the mass positions,
+   dt_update: simulation time elapsed since the last call */
+void measureJoints(const MASS& mass, const JOINT& joint, double* joint_pos, double* joint_vel, const double dt_update);
+
+/* PI control of the joint speed, update joint_vel_cmd and the rotation increment joint.anchors.theta */
+void updateJointControl(const JOINT& joint,
+	const double* joint_vel_desired, const double* joint_vel,
+	double* joint_vel_error, double* joint_pos_error, double* joint_vel_cmd,
+	const double max_joint_vel, const double k_vel, const double k_pos, const double dt);
+
+/* measure the body state (com position/acceleration, ox, oy) from the oxyz coordinate at id_oxyz_start
+   and copy the joint states of the first (up to 4) joints */
+ModelState measureModelState(const MASS& mass, const int id_oxyz_start, const int num_joint,
+	const double* joint_pos, const double* joint_vel, const double* joint_vel_cmd);
+
+/* print the elapsed time and the spring update rate, duration: wall time [s], T: simulation time [s] */
+void printThroughput(const double duration, const double T, const double dt, const int num_spring);
+
+
+/* one preallocated snapshot slot of CpuSimulation, holds only the state changed by the simulation:
+   mass pos/vel/acc/force, the rest length of the resetable springs, the joint rotation and the
+   joint controller state of all instances. The immutable arrays (m, k, edge, color, ...) are not copied */
+struct StateSlot {
+	std::vector<Vec3d> pos, vel, acc, force; // [mass.num]
+	std::vector<double> rest; // [resetable_spring.size()], rest length of the resetable springs
+	std::vector<double> theta; // [joint.size()], joint.anchors.theta
+	std::vector<double> joint_pos, joint_vel, joint_vel_desired, joint_vel_cmd, joint_vel_error, joint_pos_error; // [joint.size()]
+	std::vector<double> instance_T; // [layout.num_instance]
+	bool valid = false; // whether a snapshot was saved in this slot
+};
+
+/* headless simulation on the cpu, no graphics, no cuda.
+   It can hold num_instance independent copies of one robot packed in mass/spring/joint (see InstanceLayout),
+   all instances are stepped together, each has its own joint control, simulation time, reset flag and state */
+class CpuSimulation {
+public:
+	double dt = 0.0001;
+	double T = 0; //simulation time
+	Vec3d global_acc = Vec3d(0, 0, 0); // global acceleration
+
+	// index within one instance, add layout.massOffset(i) for instance i
+	int id_restable_spring_start = 0; // resetable springs start index (inclusive)
+	int id_resetable_spring_end = 0; // resetable springs start index (exclusive)
+
+	int id_oxyz_start = 0;// coordinate oxyz start index (inclusive)
+	int id_oxyz_end = 0; // coordinate oxyz end index (exclusive)
+	std::vector<int> vertex_order; // original index of each mass if the model was reordered (FlexipodIndex::vertex_order), empty otherwise
+
+	InstanceLayout layout; // index offsets of the packed instances, a single instance if not set by the constructor
+
+	int num_threads = 0; // number of openmp threads, 0: use the openmp default
+	ForceAssembly force_assembly = ForceAssembly::SCATTER; // spring force assembly, set before start()
+	DataLayout data_layout = DataLayout::AOS; // storage of the dynamics update, set before start()
+	SimdIsa simd_isa = detectSimdIsa(); // kernels for DataLayout::SOA, the widest supported by default
+	Precision precision = Precision::FP64; // scalar type of the DataLayout::SOA storage, MIXED/FP32 use the scalar kernels
+	Integrator integrator = Integrator::EXPLICIT; // set before start(), IMPLICIT and XPBD require DataLayout::AOS
+	bool self_collision = false; // collide the surface masses (sim_collision.h), set before start(), requires DataLayout::AOS and Integrator::EXPLICIT
+
+	MASS mass; // a flat fiew of all masses (host)
+	SPRING spring; // a flat fiew of all springs (host)
+	JOINT joint;// a flat view of all joints (host)
+	SpringIncidence incidence; // springs of each mass, built in start() for ForceAssembly::GATHER, DataLayout::SOA or Integrator::IMPLICIT
+	SurfaceIndex surface; // masses of the contact pass, rebuilt in update() after mass.constrain changed
+	ImplicitSolver implicit; // Integrator::IMPLICIT solver, set implicit.max_iter/tolerance before start()
+	XpbdSolver xpbd; // Integrator::XPBD solver, set xpbd.num_iter before update()
+	SelfCollision collision; // self_collision: set collision.radius/between_instances before start()
+	MASS_SOA soa_mass; // DataLayout::SOA storage (Precision::FP64), mass is updated from it after each update()
+	SPRING_SOA soa_spring; // DataLayout::SOA storage (Precision::FP64)
+	MASS_SOA_MIXED soa_mass_mixed; // Precision::MIXED
+	MASS_SOA_FP32 soa_mass_fp32; // Precision::FP32
+	SPRING_SOA_FP32 soa_spring_fp32; // Precision::MIXED and Precision::FP32
+
+	// snapshots of the state, slot 0 holds the state at start() (the backup restored by resetState())
+	int num_snapshot_slot = 1; // number of preallocated slots including slot 0, set before start()
+	std::vector<StateSlot> snapshot; // allocated in start()
+	std::vector<int> resetable_spring; // indices of the resetable springs (ascending), built in start()
+	std::vector<int> resetable_offset; // start of the resetable springs of each instance in resetable_spring, size num_instance+1
+
+	void saveSnapshot(int slot); // capture the state of all instances into slot (1 to num_snapshot_slot-1)
+	void restoreSnapshot(int slot); // restore the state of all instances from slot
+	void restoreSnapshot(int slot, int instance); // restore the state of one instance from slot
+
+	// reset latency statistics since start(), restoreSnapshot() or the resets in update()
+	long long num_reset = 0; // number of resets (restores)
+	double reset_time_us = 0; // [us] total wall time of the resets
+	double max_reset_time_us = 0; // [us] longest reset
+
+	void backupState();//backup the robot mass/spring/joint state into slot 0
+	void resetState();// restore the robot mass/spring/joint state to the backedup state (restoreSnapshot(0))
+
+	// joint arrays of all instances, instance i starts at layout.jointOffset(i)
+	std::vector<double> joint_pos; // (measured) joint angle array in rad, initialized in start()
+	std::vector<double> joint_vel; // (measured) joint speed array in rad/s, initialized in start()
+	std::vector<double> joint_vel_desired; // (desired) joint speed array in rad/s, initialized in start()
+	std::vector<double> joint_vel_cmd; // (commended) joint speed array in rad/s, initialized in start()
+	std::vector<double> joint_vel_error; // difference between joint_vel_cm and joint_vel
+	std::vector<double> joint_pos_error; // integral of the error between joint_vel_cm and joint_vel
+
+	double max_joint_vel = 1e-4; // [rad/s] maximum joint speed
+	double max_joint_vel_error = 2e-4; // [rad/s] maximum joint speed error
+	double max_joint_pos_error = 4e-4; // [rad/s] maximum joint speed error integral
+	double k_vel = 0.5; // coefficient for PI control
+	double k_pos = 0.25; // coefficient for PD control
+	void setMaxJointSpeed(double max_joint_vel);
+
+	std::vector<double> instance_T; // simulation time of each instance since its last reset, initialized in start()
+	std::vector<bool> instance_reset; // reset flag of each instance, cleared after the reset
+	std::vector<ModelState> instance_state; // (measured) state of each instance, updated in update()
+
+	bool STARTED = false;
+	bool RESET = false;// reset flag (all instances)
+
+	TrajectoryRecorder* recorder = nullptr; // if set, update() hands it the state after the joint control (recorder.h)
+
+	CpuSimulation() {}
+	CpuSimulation(size_t num_mass, size_t num_spring);
+	/* pack num_instance copies of the (host) robot robot_mass, robot_spring, robot_joint */
+	CpuSimulation(const MASS& robot_mass, const SPRING& robot_spring, const JOINT& robot_joint, int num_instance);
+	~CpuSimulation(); // frees mass, spring, joint, incidence and the SoA storage
+	CpuSimulation(const CpuSimulation&) = delete; // owns the arrays of its flat views
+	CpuSimulation& operator=(const CpuSimulation&) = delete;
+
+	void resetInstance(int instance);// restore the backedup state of one instance (restoreSnapshot(0, instance))
+	inline double* jointVelDesired(int instance) { return joint_vel_desired.data() + layout.jointOffset(instance); }
+
+	// creates half-space ax + by + cz < d
+	void createPlane(const Vec3d& abc, const double d, const double FRICTION_K = 0, const double FRICTION_S = 0);
+	void createBall(const Vec3d& center, const double r); // creates ball with radius r at position center
+	void createTerrain(const Heightfield& terrain); // sets the heightfield terrain (a copy), replacing the previous one
+	void createObstacles(const ObstacleSet& obstacles); // sets the static obstacles (a copy, built), replacing the previous ones
+	void clearConstraints(); // clears global constraints only
+
+	void start(); // initialize the joint control arrays and backup the state
+	void update(); // one physics update: NUM_QUEUED_KERNELS dynamics updates, joint measurement and control
+	void run(const double runtime); // update until simulation time runtime [s], then print the throughput
+	/* lockstep: set the desired joint speed of all instances (joint.size() values, nullptr: unchanged),
+	   run num_update update()s and return the measured state of each instance. Repeated rollouts from the
+	   same snapshot are bit-identical with ForceAssembly::GATHER, DataLayout::SOA or num_threads=1 */
+	const std::vector<ModelState>& step(const int num_update, const double* joint_vel_desired = nullptr);
+
+private:
+	std::vector<CudaContactPlane> planes; // used for constraints
+	std::vector<CudaBall> balls; // used for constraints
+	Heightfield terrain; // used for constraints if not empty
+	CudaHeightfield terrain_view; // flat view of terrain
+	ObstacleSet obstacles; // used for constraints if not empty
+	CudaObstacles obstacles_view; // flat view of obstacles
+	CUDA_GLOBAL_CONSTRAINTS constraints; // flat view of planes, balls, terrain and obstacles
+	void updateConstraints();
+
+	void saveSlot(StateSlot& slot); // copy the state of all instances to slot
+	/* copy slot to the state of the instances [begin,end), and to the SoA storage for DataLayout::SOA */
+	void restoreSlot(const StateSlot& slot, int begin, int end);
+	void recordReset(const std::chrono::steady_clock::time_point& start_time); // update the reset latency statistics
+
+	void initSoa(); // allocate the SoA storage of precision and copy mass/spring to it
+	void loadSoa(); // copy mass/spring to the SoA storage
+	void loadSoaState(int begin, int end); // copy the state of the instances [begin,end) to the SoA storage
+	void storeSoaRest(); // copy the SoA rest length back to spring
+	void updateSoa(); // NUM_QUEUED_KERNELS dynamics updates on the SoA storage, then copy the state back to mass
+};
+
+#endif // TITAN_SIM_CPU_H
@@ -0,0 +1,238 @@
+/*
+sim_implicit.cpp: implicit integration with a matrix-free preconditioned conjugate gradient, see sim_implicit.h
+*/
+
+#include "sim_implicit.h"
+#include "sim_cpu.h" // NUM_QUEUED_KERNELS, NUM_UPDATE_PER_ROTATION, rotateJointCpu
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+Sym3 Sym3::inverse() const {
+	Sym3 inv; // adjugate / determinant
+	inv.xx = yy * zz - yz * yz;
+	inv.xy = xz * yz - xy * zz;
+	inv.xz = xy * yz - xz * yy;
+	inv.yy = xx * zz - xz * xz;
+	inv.yz = xy * xz - xx * yz;
+	inv.zz = xx * yy - xy * xy;
+	double det = xx * inv.xx + xy * inv.xy + xz * inv.xz;
+	double s = det != 0 ? 1. / det : 0.;
+	inv.xx *= s; inv.xy *= s; inv.xz *= s;
+	inv.yy *= s; inv.yz *= s; inv.zz *= s;
+	return inv;
+}
+
+void ImplicitSolver::init(int num_mass, int num_spring) {
+	dir.assign(num_spring, Vec3d());
+	k_axial.assign(num_spring, 0.);
+	c_axial.assign(num_spring, 0.);
+	k_trans.assign(num_spring, 0.);
+	product.assign(num_spring, Vec3d());
+
+	contact.assign(num_mass, Sym3());
+	contact_k.assign(num_mass, Sym3());
+	precond.assign(num_mass, Sym3());
+	rhs.assign(num_mass, Vec3d());
+	dv.assign(num_mass, Vec3d()); // kept between steps as the initial guess
+	r.assign(num_mass, Vec3d());
+	z.assign(num_mass, Vec3d());
+	p.assign(num_mass, Vec3d());
+	q.assign(num_mass, Vec3d());
+	num_step = 0;
+	num_iter = 0;
+}
+
+void ImplicitSolver::linearize(const MASS& mass, const SPRING& spring, const SpringIncidence& incidence,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const bool reset) {
+	const double dt2 = dt * dt;
+#pragma omp parallel num_threads(n_threads)
+	{
+#pragma omp for schedule(static)
+		for (int i = 0; i < spring.num; i++) {
+			Vec2i e = spring.edge[i];
+			Vec3d s_vec = mass.pos[e.y] - mass.pos[e.x];// the vector from left to right
+			double length = s_vec.norm(); // current spring length
+			double d = length > 1e-12 ? length : 1e-12; // check instablility for small length
+			s_vec /= d;// normalized to unit vector (direction)
+
+			Vec3d force = spring.k[i] * (spring.rest[i] - length) * s_vec; // normal spring force
+			force += s_vec.dot(mass.vel[e.x] - mass.vel[e.y]) * spring.damping[i] * s_vec;// damping
+			incidence.force[i] = force; // force on the right mass
+
+			dir[i] = s_vec;
+			k_axial[i] = dt2 * spring.k[i];
+			c_axial[i] = dt * spring.damping[i];
+			k_trans[i] = dt2 * spring.k[i] * std::max(0., 1. - spring.rest[i] / d);
+#ifdef ROTATION
+			if (reset && spring.resetable[i]) {
+				spring.rest[i] = length;//reset the spring rest length if this spring is restable
+			}
+#endif // ROTATION
+		}
+
+#pragma omp for schedule(static)
+		for (int i = 0; i < mass.num; i++) {
+			if (mass.fixed[i]) {
+				rhs[i] = Vec3d();
+				dv[i] = Vec3d();
+				continue;
+			}
+			Vec3d pos = mass.pos[i];
+			Vec3d vel = mass.vel[i];
+			Vec3d force = mass.force_extern[i];// external force [N]
+			Sym3 block; // diagonal block of the system
+			for (int k = incidence.offset[i]; k < incidence.offset[i + 1]; k++) {// add spring force, fixed order
+				int s = incidence.springId[k];
+				force += incidence.dir[k] * incidence.force[s];
+				block.addOuter(dir[s], k_axial[s] + c_axial[s] - k_trans[s]);
+				block.addDiagonal(k_trans[s]);
+			}
+
+			Sym3 ck, ckc; // jacobians of the normal contact force
+			if (mass.constrain[i]) { // global constraints, surface masses only
+				for (int j = 0; j < c.num_planes; j++) {
+					c.d_planes[j].applyForce(force, pos, vel);
+					if (c.d_planes[j]._normal.dot(pos) - c.d_planes[j]._offset < 0) {// if inside the plane
+						ck.addOuter(c.d_planes[j]._normal, dt2 * K_NORMAL);
+						ckc.addOuter(c.d_planes[j]._normal, dt2 * K_NORMAL + dt * DAMPING_NORMAL);
+					}
+				}
+				for (int j = 0; j < c.num_balls; j++) {
+					c.d_balls[j].applyForce(force, pos);
+				}
+				Vec3d normal;
+				double disp, friction_k, friction_s;
+				if (c.d_terrain != nullptr && c.d_terrain->contact(pos, normal, disp, friction_k, friction_s)) { // the plane tangent to the terrain
+					applyContactForce(force, vel, normal, disp, friction_k, friction_s);
+					ck.addOuter(normal, dt2 * K_NORMAL);
+					ckc.addOuter(normal, dt2 * K_NORMAL + dt * DAMPING_NORMAL);
+				}
+				if (c.d_obstacles != nullptr && c.d_obstacles->contact(pos, normal, disp, friction_k, friction_s)) { // the deepest obstacle
+					applyContactForce(force, vel, normal, disp, friction_k, friction_s);
+					ck.addOuter(normal, dt2 * K_NORMAL);
+					ckc.addOuter(normal, dt2 * K_NORMAL + dt * DAMPING_NORMAL);
+				}
+			}
+			contact_k[i] = ck;
+			contact[i] = ckc;
+
+			block.addDiagonal(mass.m[i]);
+			block.xx += ckc.xx; block.xy += ckc.xy; block.xz += ckc.xz;
+			block.yy += ckc.yy; block.yz += ckc.yz; block.zz += ckc.zz;
+			precond[i] = block.inverse();
+			rhs[i] = dt * (force + mass.m[i] * global_acc);
+		}
+	}
+	multiply(mass, incidence, mass.vel, q, true); // q = dt^2*K*v
+#pragma omp parallel for schedule(static) num_threads(n_threads)
+	for (int i = 0; i < mass.num; i++) { rhs[i] -= q[i]; }
+}
+
+void ImplicitSolver::multiply(const MASS& mass, const SpringIncidence& incidence, const Vec3d* x,
+	std::vector<Vec3d>& q, const bool stiffness_only) {
+	const int num_spring = (int)dir.size();
+#pragma omp parallel num_threads(n_threads)
+	{
+#pragma omp for schedule(static)
+		for (int i = 0; i < num_spring; i++) {
+			Vec2i e = edge[i];
+			const Vec3d& d = dir[i];
+			Vec3d delta = x[e.y] - x[e.x];
+			double k = stiffness_only ? k_axial[i] : k_axial[i] + c_axial[i];
+			product[i] = (k - k_trans[i]) * dot(d, delta) * d + k_trans[i] * delta;
+		}
+
+#pragma omp for schedule(static)
+		for (int i = 0; i < mass.num; i++) {
+			if (mass.fixed[i]) {
+				q[i] = Vec3d();
+				continue;
+			}
+			Vec3d y = stiffness_only ? contact_k[i] * x[i] : mass.m[i] * x[i] + contact[i] * x[i];
+			for (int k = incidence.offset[i]; k < incidence.offset[i + 1]; k++) {// fixed order
+				y += incidence.dir[k] * product[incidence.springId[k]];
+			}
+			q[i] = y;
+		}
+	}
+}
+
+double ImplicitSolver::innerProduct(const std::vector<Vec3d>& a, const std::vector<Vec3d>& b) const {
+	const int num = (int)a.size();
+	double sum = 0;
+#pragma omp parallel for schedule(static) reduction(+:sum) num_threads(n_threads)
+	for (int i = 0; i < num; i++) { sum += a[i].x * b[i].x + a[i].y * b[i].y + a[i].z * b[i].z; }
+	return sum;
+}
+
+int ImplicitSolver::solve(const MASS& mass, const SpringIncidence& incidence) {
+	const int num = mass.num;
+	multiply(mass, incidence, dv.data(), q, false); // start from the previous dv
+#pragma omp parallel for schedule(static) num_threads(n_threads)
+	for (int i = 0; i < num; i++) {
+		r[i] = rhs[i] - q[i];
+		z[i] = precond[i] * r[i];
+		p[i] = z[i];
+	}
+	const double tol2 = tolerance * tolerance * innerProduct(rhs, rhs);
+	double rz = innerProduct(r, z);
+	int iter = 0;
+	for (; iter < max_iter && innerProduct(r, r) > tol2; iter++) {
+		multiply(mass, incidence, p.data(), q, false);
+		const double alpha = rz / innerProduct(p, q);
+#pragma omp parallel for schedule(static) num_threads(n_threads)
+		for (int i = 0; i < num; i++) {
+			dv[i] += alpha * p[i];
+			r[i] -= alpha * q[i];
+			z[i] = precond[i] * r[i];
+		}
+		const double rz_new = innerProduct(r, z);
+		const double beta = rz_new / rz;
+		rz = rz_new;
+#pragma omp parallel for schedule(static) num_threads(n_threads)
+		for (int i = 0; i < num; i++) { p[i] = z[i] + beta * p[i]; }
+	}
+	return iter;
+}
+
+void ImplicitSolver::integrate(const MASS& mass, const double dt) {
+#pragma omp parallel for schedule(static) num_threads(n_threads)
+	for (int i = 0; i < mass.num; i++) {
+		if (mass.fixed[i] == false) {
+			mass.vel[i] += dv[i]; // update velocity
+			mass.acc[i] = dv[i] / dt; // update acceleration
+			mass.pos[i] += mass.vel[i] * dt; // update position
+		}
+	}
+}
+
+void ImplicitSolver::step(const MASS& mass, const SPRING& spring, const JOINT& joint, const SpringIncidence& incidence,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const int num_threads) {
+#ifdef _OPENMP
+	n_threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#endif
+	edge = spring.edge;
+	for (int i = 0; i < (NUM_QUEUED_KERNELS / NUM_UPDATE_PER_ROTATION); i++) {
+		for (int j = 0; j < NUM_UPDATE_PER_ROTATION - 1; j++) {
+			stepOnce(mass, spring, incidence, c, global_acc, dt, false);
+		}
+#ifdef ROTATION
+#pragma omp parallel num_threads(n_threads)
+		rotateJointCpu(mass, joint);
+		stepOnce(mass, spring, incidence, c, global_acc, dt, true);
+#endif // ROTATION
+	}
+}
+
+void ImplicitSolver::stepOnce(const MASS& mass, const SPRING& spring, const SpringIncidence& incidence,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const bool reset) {
+	linearize(mass, spring, incidence, c, global_acc, dt, reset);
+	num_iter += solve(mass, incidence);
+	integrate(mass, dt);
+	num_step++;
+}
@@ -0,0 +1,82 @@
+/*
+sim_implicit.h: implicit (linearized backward euler) integration of the masses for the cpu backend.
+Each step solves
+	(M + dt*C + dt^2*K) dv = dt*(f + M*g - dt*K*v)
+for the velocity change dv, then v += dv, pos += v*dt.
+K = -df/dx and C = -df/dv are the stiffness and damping jacobians of the springs (SPRING::k/rest/damping/edge)
+and of the contact planes and the plane tangent to the terrain (normal direction only, friction stays explicit).
+They are never assembled: the product is computed per spring and summed per mass with SpringIncidence
+(no atomics), the system is solved with a block-jacobi (3x3 per mass) preconditioned conjugate gradient (PCG) on openmp threads.
+The transverse spring stiffness is clamped at zero (compressed springs) to keep the system positive definite.
+*/
+
+#ifndef TITAN_SIM_IMPLICIT_H
+#define TITAN_SIM_IMPLICIT_H
+
+#include "vec.h"
+#include "object.h"
+#include "model.h"
+
+#include <vector>
+
+/* symmetric 3x3 matrix */
+struct Sym3 {
+	double xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;
+	inline Vec3d operator*(const Vec3d& v) const {
+		return Vec3d(xx * v.x + xy * v.y + xz * v.z, xy * v.x + yy * v.y + yz * v.z, xz * v.x + yz * v.y + zz * v.z);
+	}
+	inline void addOuter(const Vec3d& d, double a) { // += a * d * d^T
+		xx += a * d.x * d.x; xy += a * d.x * d.y; xz += a * d.x * d.z;
+		yy += a * d.y * d.y; yz += a * d.y * d.z; zz += a * d.z * d.z;
+	}
+	inline void addDiagonal(double a) { xx += a; yy += a; zz += a; } // += a * I
+	Sym3 inverse() const;
+};
+
+class ImplicitSolver {
+public:
+	int max_iter = 20; // maximum number of CG iterations per step
+	double tolerance = 1e-2; // CG stops when |residual| < tolerance*|rhs|
+
+	// statistics since init()
+	long long num_step = 0; // number of implicit steps
+	long long num_iter = 0; // number of CG iterations of all steps
+
+	void init(int num_mass, int num_spring);
+
+	/* run NUM_QUEUED_KERNELS implicit steps (one update_physics() iteration), rotate the joints and reset
+	   the rest length every NUM_UPDATE_PER_ROTATION steps as stepCpu(),
+	   num_threads: number of openmp threads, 0: use the openmp default */
+	void step(const MASS& mass, const SPRING& spring, const JOINT& joint, const SpringIncidence& incidence,
+		const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const int num_threads = 0);
+
+private:
+	// per spring
+	const Vec2i* edge = nullptr; // spring.edge
+	std::vector<Vec3d> dir; // unit vector from left to right
+	std::vector<double> k_axial; // dt^2*k: stiffness along dir
+	std::vector<double> c_axial; // dt*damping: damping along dir
+	std::vector<double> k_trans; // dt^2*k*max(0,1-rest/length): stiffness normal to dir
+	std::vector<Vec3d> product; // per-spring product, applied on the right mass (+) and the left mass (-)
+
+	// per mass
+	std::vector<Sym3> contact; // dt*C + dt^2*K of the contact planes
+	std::vector<Sym3> contact_k; // dt^2*K of the contact planes
+	std::vector<Sym3> precond; // inverse of the diagonal block of the system
+	std::vector<Vec3d> rhs, dv, r, z, p, q;
+
+	int n_threads = 1;
+
+	void linearize(const MASS& mass, const SPRING& spring, const SpringIncidence& incidence,
+		const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const bool reset);
+	/* q = (M + dt*C + dt^2*K) x, or q = dt^2*K x if stiffness_only==true, q=0 for fixed masses */
+	void multiply(const MASS& mass, const SpringIncidence& incidence, const Vec3d* x,
+		std::vector<Vec3d>& q, const bool stiffness_only);
+	double innerProduct(const std::vector<Vec3d>& a, const std::vector<Vec3d>& b) const;
+	int solve(const MASS& mass, const SpringIncidence& incidence); // PCG, returns the number of iterations
+	void integrate(const MASS& mass, const double dt);
+	void stepOnce(const MASS& mass, const SPRING& spring, const SpringIncidence& incidence,
+		const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const bool reset);
+};
+
+#endif // TITAN_SIM_IMPLICIT_H
@@ -0,0 +1,226 @@
+/*
+sim_soa.cpp: SoA storage, runtime dispatch and the scalar reference kernels, see sim_soa.h
+*/
+
+#include "sim_soa.h"
+#include "sim_cpu.h" // NUM_QUEUED_KERNELS, NUM_UPDATE_PER_ROTATION
+
+#include <cmath>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(TITAN_SIMD_AVX2) || defined(TITAN_SIMD_AVX512))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+/*------------- runtime dispatch -------------*/
+
+static bool cpuSupports(SimdIsa isa) {
+#if defined(_MSC_VER) && (defined(TITAN_SIMD_AVX2) || defined(TITAN_SIMD_AVX512))
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) { return false; }
+	__cpuid(info, 1);
+	const bool osxsave = info[2] & (1 << 27);
+	const bool fma = info[2] & (1 << 12);
+	if (!osxsave) { return false; }
+	const unsigned long long xcr0 = _xgetbv(0); // registers enabled by the os
+	__cpuidex(info, 7, 0);
+	if (isa == SimdIsa::AVX2) { return fma && (info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6; }
+	if (isa == SimdIsa::AVX512) { return (info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6; }
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (isa == SimdIsa::AVX2) { return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"); }
+	if (isa == SimdIsa::AVX512) { return __builtin_cpu_supports("avx512f"); }
+#endif
+	return isa == SimdIsa::SCALAR;
+}
+
+SimdIsa detectSimdIsa() {
+#ifdef TITAN_SIMD_AVX512
+	if (cpuSupports(SimdIsa::AVX512)) { return SimdIsa::AVX512; }
+#endif
+#ifdef TITAN_SIMD_AVX2
+	if (cpuSupports(SimdIsa::AVX2)) { return SimdIsa::AVX2; }
+#endif
+	return SimdIsa::SCALAR;
+}
+
+const char* simdIsaName(SimdIsa isa) {
+	switch (isa) {
+	case SimdIsa::AVX2: return "avx2";
+	case SimdIsa::AVX512: return "avx512";
+	default: return "scalar";
+	}
+}
+
+const char* precisionName(Precision precision) {
+	switch (precision) {
+	case Precision::MIXED: return "mixed";
+	case Precision::FP32: return "fp32";
+	default: return "fp64";
+	}
+}
+
+SoaKernels soaKernels(SimdIsa isa) {
+	switch (isa) {
+#ifdef TITAN_SIMD_AVX512
+	case SimdIsa::AVX512: return { &soa_avx512::springForce, &soa_avx512::massUpdate };
+#endif
+#ifdef TITAN_SIMD_AVX2
+	case SimdIsa::AVX2: return { &soa_avx2::springForce, &soa_avx2::massUpdate };
+#endif
+	default: return { &soa_scalar::springForce, &soa_scalar::massUpdate };
+	}
+}
+
+
+/*------------- scalar reference kernels, same as SpringForceCpu, GatherForceCpu, ContactForceCpu and MassUpdateCpu -------------*/
+/* templated on the storage precision, the spring force is computed in ForceReal from the position
+   and velocity differences taken in Real, the constraints and integration are computed in double */
+
+template<class Real, class ForceReal>
+static void springForceScalar(const MassSoaT<Real, ForceReal>& mass, const SpringSoaT<ForceReal>& spring, bool reset) {
+#pragma omp for schedule(static)
+	for (int i = 0; i < spring.num; i++) {
+		int l = spring.left[i];
+		int r = spring.right[i];
+		// the vector from left to right
+		ForceReal sx = (ForceReal)(mass.pos.x[r] - mass.pos.x[l]);
+		ForceReal sy = (ForceReal)(mass.pos.y[r] - mass.pos.y[l]);
+		ForceReal sz = (ForceReal)(mass.pos.z[r] - mass.pos.z[l]);
+		ForceReal length = std::sqrt(sx * sx + sy * sy + sz * sz); // current spring length
+
+		const ForceReal d = length > ForceReal(1e-12) ? length : ForceReal(1e-12); // check instablility for small length
+		sx /= d; sy /= d; sz /= d; // normalized to unit vector (direction)
+
+		ForceReal f = spring.k[i] * (spring.rest[i] - length); // normal spring force
+		ForceReal proj = sx * (ForceReal)(mass.vel.x[l] - mass.vel.x[r]) +
+			sy * (ForceReal)(mass.vel.y[l] - mass.vel.y[r]) +
+			sz * (ForceReal)(mass.vel.z[l] - mass.vel.z[r]);
+		ForceReal g = proj * spring.damping[i]; // damping
+		spring.force.x[i] = f * sx + g * sx;
+		spring.force.y[i] = f * sy + g * sy;
+		spring.force.z[i] = f * sz + g * sz;
+
+#ifdef ROTATION
+		if (reset && spring.resetable[i]) {
+			spring.rest[i] = length;//reset the spring rest length if this spring is restable
+		}
+#endif // ROTATION
+	}
+}
+
+template<class Real, class ForceReal>
+static void massUpdateScalar(const MassSoaT<Real, ForceReal>& mass, const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, double dt) {
+#pragma omp for schedule(static)
+	for (int i = 0; i < mass.num; i++) {
+		if (mass.fixed[i] == 0) {
+			Vec3d pos = mass.pos.get(i);
+			Vec3d vel = mass.vel.get(i);
+			Vec3d force = mass.force.get(i);
+
+			if (mass.constrain[i]) { c.applyForce(force, pos, vel); } // global constraints, surface masses only
+
+			// euler integration
+			force /= (double)mass.m[i];// force is now acceleration
+			force += global_acc;// add global accleration
+			vel += force * dt; // vel += acc*dt
+			mass.acc.set(i, force); // update acceleration
+			mass.vel.set(i, vel); // update velocity
+			mass.pos.set(i, pos + vel * dt); // update position
+		}
+	}
+}
+
+/* sum the forces of the incident springs (and the external force) into mass.force */
+template<class Real, class ForceReal>
+static void gatherForceSoa(const MassSoaT<Real, ForceReal>& mass, const SpringSoaT<ForceReal>& spring, const SpringIncidence& incidence) {
+#pragma omp for schedule(static)
+	for (int i = 0; i < mass.num; i++) {
+		ForceReal fx = mass.force_extern.x[i];
+		ForceReal fy = mass.force_extern.y[i];
+		ForceReal fz = mass.force_extern.z[i];
+		for (int k = incidence.offset[i]; k < incidence.offset[i + 1]; k++) {// fixed order
+			int s = incidence.springId[k];
+			ForceReal dir = incidence.dir[k];
+			fx += dir * spring.force.x[s];
+			fy += dir * spring.force.y[s];
+			fz += dir * spring.force.z[s];
+		}
+		mass.force.x[i] = fx;
+		mass.force.y[i] = fy;
+		mass.force.z[i] = fz;
+	}
+}
+
+/* rotate the joint points about the joint anchors by joint.anchors.theta (rotateJoint) */
+template<class Real, class ForceReal>
+static void rotateJointSoa(const MassSoaT<Real, ForceReal>& mass, const JOINT& joint) {
+#pragma omp for schedule(static)
+	for (int i = 0; i < joint.points.num; i++) {
+		int anchor_id = joint.points.anchorId[i];
+		int mass_id = joint.points.massId[i];
+		Vec2i anchor_edge = joint.anchors.edge[anchor_id]; // mass id of the achor edge point
+		Vec3d pos = AxisAngleRotaion(
+			mass.pos.get(anchor_edge.x),
+			mass.pos.get(anchor_edge.y), mass.pos.get(mass_id),
+			joint.anchors.theta[anchor_id] * joint.points.dir[i]);
+		mass.pos.set(mass_id, pos);
+	}
+}
+
+void soa_scalar::springForce(const MASS_SOA& mass, const SPRING_SOA& spring, bool reset) {
+	springForceScalar(mass, spring, reset);
+}
+
+void soa_scalar::massUpdate(const MASS_SOA& mass, const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, double dt) {
+	massUpdateScalar(mass, c, global_acc, dt);
+}
+
+
+template<class Real, class ForceReal, class SpringForce, class MassUpdate>
+static void stepSoaWith(const MassSoaT<Real, ForceReal>& mass, const SpringSoaT<ForceReal>& spring, const JOINT& joint,
+	const SpringIncidence& incidence, const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt,
+	SpringForce springForce, MassUpdate massUpdate, const int num_threads) {
+#ifdef _OPENMP
+	const int n_threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#endif
+#pragma omp parallel num_threads(n_threads)
+	{
+		for (int i = 0; i < (NUM_QUEUED_KERNELS / NUM_UPDATE_PER_ROTATION); i++) {
+			for (int j = 0; j < NUM_UPDATE_PER_ROTATION - 1; j++) {
+				springForce(mass, spring, false);
+				gatherForceSoa(mass, spring, incidence);
+				massUpdate(mass, c, global_acc, dt);
+			}
+#ifdef ROTATION
+			rotateJointSoa(mass, joint);
+			springForce(mass, spring, true);
+			gatherForceSoa(mass, spring, incidence);
+			massUpdate(mass, c, global_acc, dt);
+#endif // ROTATION
+		}
+	}
+}
+
+void stepSoa(const MASS_SOA& mass, const SPRING_SOA& spring, const JOINT& joint, const SpringIncidence& incidence,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const SimdIsa isa, const int num_threads) {
+	const SoaKernels kernels = soaKernels(isa);
+	stepSoaWith(mass, spring, joint, incidence, c, global_acc, dt, kernels.springForce, kernels.massUpdate, num_threads);
+}
+
+void stepSoa(const MASS_SOA_MIXED& mass, const SPRING_SOA_FP32& spring, const JOINT& joint, const SpringIncidence& incidence,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const int num_threads) {
+	stepSoaWith(mass, spring, joint, incidence, c, global_acc, dt,
+		&springForceScalar<double, float>, &massUpdateScalar<double, float>, num_threads);
+}
+
+void stepSoa(const MASS_SOA_FP32& mass, const SPRING_SOA_FP32& spring, const JOINT& joint, const SpringIncidence& incidence,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const int num_threads) {
+	stepSoaWith(mass, spring, joint, incidence, c, global_acc, dt,
+		&springForceScalar<float, float>, &massUpdateScalar<float, float>, num_threads);
+}
@@ -0,0 +1,246 @@
+/*
+sim_soa.h: structure-of-arrays (SoA) storage of the masses and springs for the cpu backend,
+and the explicitly vectorized (AVX2/AVX-512) spring, contact and integration loops.
+The kernel set is picked at runtime (detectSimdIsa()) from the widest instruction set supported
+by the cpu, the AVX2/AVX-512 kernels are compiled in their own translation units
+(sim_soa_avx2.cpp, sim_soa_avx512.cpp) so that the rest of the build does not require them.
+The spring forces are assembled with the mass-centric incidence (ForceAssembly::GATHER), see model.h
+The storage is templated on the scalar type (Precision), the vectorized kernels are for double only,
+the float storage (Precision::MIXED, Precision::FP32) uses the scalar kernels
+*/
+
+#ifndef TITAN_SIM_SOA_H
+#define TITAN_SIM_SOA_H
+
+#include "vec.h"
+#include "object.h"
+#include "model.h"
+
+#include <cstdint>
+#include <new>
+
+constexpr int SOA_PADDING = 8; // [doubles] arrays are padded to a multiple of the widest vector (AVX-512)
+
+enum class SimdIsa {
+	SCALAR, // plain c++ loops on the SoA storage
+	AVX2, // 4 doubles per vector (AVX2 + FMA)
+	AVX512 // 8 doubles per vector (AVX-512F)
+};
+
+enum class Precision {
+	FP64, // double positions, velocities and spring forces (default)
+	MIXED, // double positions and velocities, float spring parameters and spring forces
+	FP32 // float positions, velocities, spring parameters and spring forces
+};
+
+/* the widest instruction set supported by this cpu (and this build) */
+SimdIsa detectSimdIsa();
+const char* simdIsaName(SimdIsa isa);
+const char* precisionName(Precision precision);
+
+/* allocate num_padded T aligned to HOST_MEMORY_ALIGNMENT, set to zero */
+template<class T>
+inline T* allocateSoa(int num_padded) {
+	T* ptr = static_cast<T*>(::operator new(num_padded * sizeof(T), std::align_val_t(HOST_MEMORY_ALIGNMENT)));
+	for (int i = 0; i < num_padded; i++) { ptr[i] = T(0); }
+	return ptr;
+}
+/* free an array of allocateSoa(), nullptr is ignored, ptr is set to nullptr */
+template<class T>
+inline void freeSoa(T*& ptr) {
+	if (ptr != nullptr) { ::operator delete(ptr, std::align_val_t(HOST_MEMORY_ALIGNMENT)); }
+	ptr = nullptr;
+}
+inline int padSoa(int num) { return (num + SOA_PADDING - 1) / SOA_PADDING * SOA_PADDING; }
+
+/* x,y,z components in separate (aligned, padded) arrays */
+template<class T>
+struct Vec3ArrayT {
+	T* x = nullptr;
+	T* y = nullptr;
+	T* z = nullptr;
+	void init(int num_padded) {
+		x = allocateSoa<T>(num_padded);
+		y = allocateSoa<T>(num_padded);
+		z = allocateSoa<T>(num_padded);
+	}
+	void release() {
+		freeSoa(x);
+		freeSoa(y);
+		freeSoa(z);
+	}
+	inline Vec3d get(int i) const { return Vec3d(x[i], y[i], z[i]); }
+	inline void set(int i, const Vec3d& v) const { x[i] = (T)v.x; y[i] = (T)v.y; z[i] = (T)v.z; }
+};
+using Vec3Array = Vec3ArrayT<double>;
+
+/* host masses in SoA storage, num_padded masses are allocated, the padding masses are fixed,
+   Real: mass, position, velocity and acceleration, ForceReal: force */
+template<class Real, class ForceReal>
+struct MassSoaT {
+	Real* m = nullptr;
+	Vec3ArrayT<Real> pos;
+	Vec3ArrayT<Real> vel;
+	Vec3ArrayT<Real> acc;
+	Vec3ArrayT<ForceReal> force; // spring force + external force, assembled before the mass update
+	Vec3ArrayT<ForceReal> force_extern;
+	int32_t* fixed = nullptr; // 0: free, 1: fixed
+	int32_t* constrain = nullptr; // 1: surface mass (mass.constrain), the only masses that get the contact forces
+	int num = 0;
+	int num_padded = 0;
+
+	MassSoaT() {}
+	MassSoaT(int num) { init(num); }
+	void init(int num) {
+		this->num = num;
+		num_padded = padSoa(num);
+		m = allocateSoa<Real>(num_padded);
+		pos.init(num_padded);
+		vel.init(num_padded);
+		acc.init(num_padded);
+		force.init(num_padded);
+		force_extern.init(num_padded);
+		fixed = allocateSoa<int32_t>(num_padded);
+		constrain = allocateSoa<int32_t>(num_padded);
+		for (int i = num; i < num_padded; i++) { // padding: fixed unit masses
+			m[i] = 1;
+			fixed[i] = 1;
+		}
+	}
+	void release() { // free the arrays of init(), the copies of a MassSoaT are views of the same arrays
+		freeSoa(m);
+		pos.release();
+		vel.release();
+		acc.release();
+		force.release();
+		force_extern.release();
+		freeSoa(fixed);
+		freeSoa(constrain);
+		num = num_padded = 0;
+	}
+	void copyFrom(const MASS& mass) { // copy from the (host) AoS masses
+		for (int i = 0; i < num; i++) {
+			m[i] = (Real)mass.m[i];
+			pos.set(i, mass.pos[i]);
+			vel.set(i, mass.vel[i]);
+			acc.set(i, mass.acc[i]);
+			force.set(i, mass.force[i]);
+			force_extern.set(i, mass.force_extern[i]);
+			fixed[i] = mass.fixed[i] ? 1 : 0;
+			constrain[i] = mass.constrain[i] ? 1 : 0;
+		}
+	}
+	void copyConstrainFrom(const MASS& mass) {
+		for (int i = 0; i < num; i++) { constrain[i] = mass.constrain[i] ? 1 : 0; }
+	}
+	void copyStateFrom(const MASS& mass, int begin, int end) { // copy pos/vel/acc/force of the masses [begin,end)
+		for (int i = begin; i < end; i++) {
+			pos.set(i, mass.pos[i]);
+			vel.set(i, mass.vel[i]);
+			acc.set(i, mass.acc[i]);
+			force.set(i, mass.force[i]);
+		}
+	}
+	void copyPosVelAccTo(MASS& mass) const { // copy the state back to the (host) AoS masses
+		for (int i = 0; i < num; i++) {
+			mass.pos[i] = pos.get(i);
+			mass.vel[i] = vel.get(i);
+			mass.acc[i] = acc.get(i);
+		}
+	}
+};
+using MASS_SOA = MassSoaT<double, double>; // Precision::FP64
+using MASS_SOA_MIXED = MassSoaT<double, float>; // Precision::MIXED
+using MASS_SOA_FP32 = MassSoaT<float, float>; // Precision::FP32
+
+/* host springs in SoA storage, the padding springs connect mass 0 to itself with k=0,
+   ForceReal: spring parameters and force */
+template<class ForceReal>
+struct SpringSoaT {
+	ForceReal* k = nullptr;
+	ForceReal* rest = nullptr;
+	ForceReal* damping = nullptr;
+	int32_t* left = nullptr; // edge.x
+	int32_t* right = nullptr; // edge.y
+	int32_t* resetable = nullptr; // 0: not resetable, 1: resetable
+	Vec3ArrayT<ForceReal> force; // per-spring force buffer, force on the right mass
+	int num = 0;
+	int num_padded = 0;
+
+	SpringSoaT() {}
+	SpringSoaT(int num) { init(num); }
+	void init(int num) {
+		this->num = num;
+		num_padded = padSoa(num);
+		k = allocateSoa<ForceReal>(num_padded);
+		rest = allocateSoa<ForceReal>(num_padded);
+		damping = allocateSoa<ForceReal>(num_padded);
+		left = allocateSoa<int32_t>(num_padded);
+		right = allocateSoa<int32_t>(num_padded);
+		resetable = allocateSoa<int32_t>(num_padded);
+		force.init(num_padded);
+	}
+	void release() { // free the arrays of init(), the copies of a SpringSoaT are views of the same arrays
+		freeSoa(k);
+		freeSoa(rest);
+		freeSoa(damping);
+		freeSoa(left);
+		freeSoa(right);
+		freeSoa(resetable);
+		force.release();
+		num = num_padded = 0;
+	}
+	void copyFrom(const SPRING& spring) { // copy from the (host) AoS springs
+		for (int i = 0; i < num; i++) {
+			k[i] = (ForceReal)spring.k[i];
+			rest[i] = (ForceReal)spring.rest[i];
+			damping[i] = (ForceReal)spring.damping[i];
+			left[i] = spring.edge[i].x;
+			right[i] = spring.edge[i].y;
+			resetable[i] = spring.resetable[i] ? 1 : 0;
+		}
+	}
+	void copyRestFrom(const SPRING& spring, const int* ids, int count) { // copy the rest length of the springs ids[0,count)
+		for (int i = 0; i < count; i++) { rest[ids[i]] = (ForceReal)spring.rest[ids[i]]; }
+	}
+	void copyRestTo(SPRING& spring) const { // copy the (reset) rest length back to the (host) AoS springs
+		for (int i = 0; i < num; i++) { spring.rest[i] = rest[i]; }
+	}
+};
+using SPRING_SOA = SpringSoaT<double>; // Precision::FP64
+using SPRING_SOA_FP32 = SpringSoaT<float>; // Precision::MIXED and Precision::FP32
+
+/* the vectorized loops, one set per instruction set, called inside an "omp parallel" region (orphaned "omp for") */
+struct SoaKernels {
+	/* compute the spring forces into spring.force, if reset==true reset the rest length of the resetable springs */
+	void (*springForce)(const MASS_SOA& mass, const SPRING_SOA& spring, bool reset);
+	/* apply the constraints to the surface masses (mass.constrain) and euler integration of mass.force */
+	void (*massUpdate)(const MASS_SOA& mass, const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, double dt);
+};
+SoaKernels soaKernels(SimdIsa isa);
+
+namespace soa_scalar { // sim_soa.cpp
+void springForce(const MASS_SOA& mass, const SPRING_SOA& spring, bool reset);
+void massUpdate(const MASS_SOA& mass, const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, double dt);
+}
+namespace soa_avx2 { // sim_soa_avx2.cpp
+void springForce(const MASS_SOA& mass, const SPRING_SOA& spring, bool reset);
+void massUpdate(const MASS_SOA& mass, const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, double dt);
+}
+namespace soa_avx512 { // sim_soa_avx512.cpp
+void springForce(const MASS_SOA& mass, const SPRING_SOA& spring, bool reset);
+void massUpdate(const MASS_SOA& mass, const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, double dt);
+}
+
+/* run NUM_QUEUED_KERNELS dynamics updates on the SoA storage with the kernels of isa,
+   same as stepCpu(..., incidence), num_threads: number of openmp threads, 0: use the openmp default */
+void stepSoa(const MASS_SOA& mass, const SPRING_SOA& spring, const JOINT& joint, const SpringIncidence& incidence,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const SimdIsa isa, const int num_threads = 0);
+
+/* same as above in Precision::MIXED and Precision::FP32 (scalar kernels) */
+void stepSoa(const MASS_SOA_MIXED& mass, const SPRING_SOA_FP32& spring, const JOINT& joint, const SpringIncidence& incidence,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const int num_threads = 0);
+void stepSoa(const MASS_SOA_FP32& mass, const SPRING_SOA_FP32& spring, const JOINT& joint, const SpringIncidence& incidence,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const int num_threads = 0);
+
+#endif // TITAN_SIM_SOA_H
@@ -0,0 +1,188 @@
+/*
+sim_soa_avx2.cpp: AVX2 (4 doubles per vector) spring, contact and integration loops on the SoA storage,
+see sim_soa.h. This file is compiled with AVX2 and FMA enabled (-mavx2 -mfma or /arch:AVX2),
+its functions are only called after detectSimdIsa() found AVX2 on the cpu
+*/
+
+#include "sim_soa.h"
+
+#include <immintrin.h>
+
+#ifndef __AVX2__
+#error "sim_soa_avx2.cpp must be compiled with AVX2 enabled (-mavx2 -mfma or /arch:AVX2)"
+#endif
+
+constexpr int W = 4; // doubles per vector
+
+static inline __m256d dot3(__m256d ax, __m256d ay, __m256d az, __m256d bx, __m256d by, __m256d bz) {
+	return _mm256_fmadd_pd(az, bz, _mm256_fmadd_pd(ay, by, _mm256_mul_pd(ax, bx)));
+}
+
+void soa_avx2::springForce(const MASS_SOA& mass, const SPRING_SOA& spring, bool reset) {
+	const __m256d one = _mm256_set1_pd(1.);
+	const __m256d eps = _mm256_set1_pd(1e-12);
+#pragma omp for schedule(static)
+	for (int i = 0; i < spring.num_padded; i += W) {
+		const __m128i l = _mm_load_si128((const __m128i*)(spring.left + i));
+		const __m128i r = _mm_load_si128((const __m128i*)(spring.right + i));
+
+		// the vector from left to right
+		__m256d dx = _mm256_sub_pd(_mm256_i32gather_pd(mass.pos.x, r, 8), _mm256_i32gather_pd(mass.pos.x, l, 8));
+		__m256d dy = _mm256_sub_pd(_mm256_i32gather_pd(mass.pos.y, r, 8), _mm256_i32gather_pd(mass.pos.y, l, 8));
+		__m256d dz = _mm256_sub_pd(_mm256_i32gather_pd(mass.pos.z, r, 8), _mm256_i32gather_pd(mass.pos.z, l, 8));
+		const __m256d length = _mm256_sqrt_pd(dot3(dx, dy, dz, dx, dy, dz)); // current spring length
+
+		const __m256d inv_length = _mm256_div_pd(one, _mm256_max_pd(length, eps)); // check instablility for small length
+		dx = _mm256_mul_pd(dx, inv_length); // normalized to unit vector (direction)
+		dy = _mm256_mul_pd(dy, inv_length);
+		dz = _mm256_mul_pd(dz, inv_length);
+
+		const __m256d dvx = _mm256_sub_pd(_mm256_i32gather_pd(mass.vel.x, l, 8), _mm256_i32gather_pd(mass.vel.x, r, 8));
+		const __m256d dvy = _mm256_sub_pd(_mm256_i32gather_pd(mass.vel.y, l, 8), _mm256_i32gather_pd(mass.vel.y, r, 8));
+		const __m256d dvz = _mm256_sub_pd(_mm256_i32gather_pd(mass.vel.z, l, 8), _mm256_i32gather_pd(mass.vel.z, r, 8));
+
+		const __m256d rest = _mm256_load_pd(spring.rest + i);
+		__m256d f = _mm256_mul_pd(_mm256_load_pd(spring.k + i), _mm256_sub_pd(rest, length)); // normal spring force
+		f = _mm256_fmadd_pd(dot3(dx, dy, dz, dvx, dvy, dvz), _mm256_load_pd(spring.damping + i), f); // damping
+
+		_mm256_store_pd(spring.force.x + i, _mm256_mul_pd(f, dx));
+		_mm256_store_pd(spring.force.y + i, _mm256_mul_pd(f, dy));
+		_mm256_store_pd(spring.force.z + i, _mm256_mul_pd(f, dz));
+
+#ifdef ROTATION
+		if (reset) {//reset the spring rest length if this spring is restable
+			const __m256d resetable = _mm256_cvtepi32_pd(_mm_load_si128((const __m128i*)(spring.resetable + i)));
+			const __m256d mask = _mm256_cmp_pd(resetable, _mm256_setzero_pd(), _CMP_NEQ_OQ);
+			_mm256_store_pd(spring.rest + i, _mm256_blendv_pd(rest, length, mask));
+		}
+#endif // ROTATION
+	}
+}
+
+void soa_avx2::massUpdate(const MASS_SOA& mass, const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, double dt) {
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d k_normal = _mm256_set1_pd(K_NORMAL);
+	const __m256d damping_normal = _mm256_set1_pd(DAMPING_NORMAL);
+	const __m256d v_t_min = _mm256_set1_pd(1e-8);
+	const __m256d gx = _mm256_set1_pd(global_acc.x);
+	const __m256d gy = _mm256_set1_pd(global_acc.y);
+	const __m256d gz = _mm256_set1_pd(global_acc.z);
+	const __m256d dt_v = _mm256_set1_pd(dt);
+#pragma omp for schedule(static)
+	for (int i = 0; i < mass.num_padded; i += W) {
+		const __m256d px = _mm256_load_pd(mass.pos.x + i);
+		const __m256d py = _mm256_load_pd(mass.pos.y + i);
+		const __m256d pz = _mm256_load_pd(mass.pos.z + i);
+		__m256d vx = _mm256_load_pd(mass.vel.x + i);
+		__m256d vy = _mm256_load_pd(mass.vel.y + i);
+		__m256d vz = _mm256_load_pd(mass.vel.z + i);
+		__m256d fx = _mm256_load_pd(mass.force.x + i);
+		__m256d fy = _mm256_load_pd(mass.force.y + i);
+		__m256d fz = _mm256_load_pd(mass.force.z + i);
+		const __m256d surface = _mm256_cmp_pd(_mm256_cvtepi32_pd(_mm_load_si128((const __m128i*)(mass.constrain + i))), zero, _CMP_NEQ_OQ);
+
+		for (int j = 0; j < c.num_planes; j++) { // same contact model as CudaContactPlane::applyForce
+			const CudaContactPlane& plane = c.d_planes[j];
+			const __m256d nx = _mm256_set1_pd(plane._normal.x);
+			const __m256d ny = _mm256_set1_pd(plane._normal.y);
+			const __m256d nz = _mm256_set1_pd(plane._normal.z);
+			const __m256d disp = _mm256_sub_pd(dot3(nx, ny, nz, px, py, pz), _mm256_set1_pd(plane._offset)); // displacement into the plane
+			const __m256d inside = _mm256_and_pd(_mm256_cmp_pd(disp, zero, _CMP_LT_OQ), surface);
+			if (_mm256_movemask_pd(inside) == 0) { continue; } // no surface mass inside the plane
+
+			const __m256d kd = _mm256_mul_pd(disp, k_normal);
+			const __m256d fnx = _mm256_mul_pd(_mm256_sub_pd(zero, _mm256_mul_pd(disp, nx)), k_normal); // ground spring model
+			const __m256d fny = _mm256_mul_pd(_mm256_sub_pd(zero, _mm256_mul_pd(disp, ny)), k_normal);
+			const __m256d fnz = _mm256_mul_pd(_mm256_sub_pd(zero, _mm256_mul_pd(disp, nz)), k_normal);
+			const __m256d fn_norm = _mm256_sqrt_pd(dot3(fnx, fny, fnz, fnx, fny, fnz));
+
+			const __m256d vn = dot3(nx, ny, nz, vx, vy, vz);
+			const __m256d vnx = _mm256_mul_pd(vn, nx); // velocity normal to the plane
+			const __m256d vny = _mm256_mul_pd(vn, ny);
+			const __m256d vnz = _mm256_mul_pd(vn, nz);
+			const __m256d vtx = _mm256_sub_pd(vx, vnx); // velocity tangential to the plane
+			const __m256d vty = _mm256_sub_pd(vy, vny);
+			const __m256d vtz = _mm256_sub_pd(vz, vnz);
+			const __m256d vt_norm = _mm256_sqrt_pd(dot3(vtx, vty, vtz, vtx, vty, vtz));
+
+			const __m256d ftx = _mm256_sub_pd(fx, fnx); //  force tangential to the plain
+			const __m256d fty = _mm256_sub_pd(fy, fny);
+			const __m256d ftz = _mm256_sub_pd(fz, fnz);
+			const __m256d ft_norm = _mm256_sqrt_pd(dot3(ftx, fty, ftz, ftx, fty, ftz));
+
+			// kinetic friction unless the tangential velocity is small and static friction holds
+			const __m256d kinetic = _mm256_cmp_pd(vt_norm, v_t_min, _CMP_GT_OQ);
+			const __m256d holds = _mm256_cmp_pd(_mm256_mul_pd(_mm256_set1_pd(plane._FRICTION_S), fn_norm), ft_norm, _CMP_GT_OQ);
+			const __m256d use_static = _mm256_andnot_pd(kinetic, holds);
+			const __m256d friction = _mm256_div_pd(_mm256_mul_pd(_mm256_set1_pd(plane._FRICTION_K), fn_norm), vt_norm);
+
+			__m256d fx_new = _mm256_sub_pd(fx, _mm256_blendv_pd(_mm256_mul_pd(friction, vtx), ftx, use_static));
+			__m256d fy_new = _mm256_sub_pd(fy, _mm256_blendv_pd(_mm256_mul_pd(friction, vty), fty, use_static));
+			__m256d fz_new = _mm256_sub_pd(fz, _mm256_blendv_pd(_mm256_mul_pd(friction, vtz), ftz, use_static));
+			fx_new = _mm256_sub_pd(_mm256_sub_pd(fx_new, _mm256_mul_pd(kd, nx)), _mm256_mul_pd(vnx, damping_normal));// displacement force, damping
+			fy_new = _mm256_sub_pd(_mm256_sub_pd(fy_new, _mm256_mul_pd(kd, ny)), _mm256_mul_pd(vny, damping_normal));
+			fz_new = _mm256_sub_pd(_mm256_sub_pd(fz_new, _mm256_mul_pd(kd, nz)), _mm256_mul_pd(vnz, damping_normal));
+
+			fx = _mm256_blendv_pd(fx, fx_new, inside); // only for the masses inside the plane
+			fy = _mm256_blendv_pd(fy, fy_new, inside);
+			fz = _mm256_blendv_pd(fz, fz_new, inside);
+		}
+		for (int j = 0; j < c.num_balls; j++) { // same as CudaBall::applyForce
+			const CudaBall& ball = c.d_balls[j];
+			const __m256d dx = _mm256_sub_pd(px, _mm256_set1_pd(ball._center.x));
+			const __m256d dy = _mm256_sub_pd(py, _mm256_set1_pd(ball._center.y));
+			const __m256d dz = _mm256_sub_pd(pz, _mm256_set1_pd(ball._center.z));
+			const __m256d dist = _mm256_sqrt_pd(dot3(dx, dy, dz, dx, dy, dz));
+			const __m256d inside = _mm256_and_pd(_mm256_cmp_pd(dist, _mm256_set1_pd(ball._radius), _CMP_LT_OQ), surface);
+			const __m256d scale = _mm256_and_pd(_mm256_div_pd(k_normal, dist), inside);
+			fx = _mm256_fmadd_pd(scale, dx, fx);
+			fy = _mm256_fmadd_pd(scale, dy, fy);
+			fz = _mm256_fmadd_pd(scale, dz, fz);
+		}
+		if ((c.d_terrain != nullptr || c.d_obstacles != nullptr) && _mm256_movemask_pd(surface) != 0) { // applyForce() per lane
+			alignas(32) double p[3][W], v[3][W], f[3][W];
+			_mm256_store_pd(p[0], px);
+			_mm256_store_pd(p[1], py);
+			_mm256_store_pd(p[2], pz);
+			_mm256_store_pd(v[0], vx);
+			_mm256_store_pd(v[1], vy);
+			_mm256_store_pd(v[2], vz);
+			_mm256_store_pd(f[0], fx);
+			_mm256_store_pd(f[1], fy);
+			_mm256_store_pd(f[2], fz);
+			for (int l = 0; l < W; l++) {
+				if (!mass.constrain[i + l]) { continue; }
+				Vec3d force(f[0][l], f[1][l], f[2][l]);
+				const Vec3d pos(p[0][l], p[1][l], p[2][l]), vel(v[0][l], v[1][l], v[2][l]);
+				if (c.d_terrain != nullptr) { c.d_terrain->applyForce(force, pos, vel); }
+				if (c.d_obstacles != nullptr) { c.d_obstacles->applyForce(force, pos, vel); }
+				f[0][l] = force.x;
+				f[1][l] = force.y;
+				f[2][l] = force.z;
+			}
+			fx = _mm256_load_pd(f[0]);
+			fy = _mm256_load_pd(f[1]);
+			fz = _mm256_load_pd(f[2]);
+		}
+
+		// euler integration
+		const __m256d m = _mm256_load_pd(mass.m + i);
+		const __m256d ax = _mm256_add_pd(_mm256_div_pd(fx, m), gx); // acceleration
+		const __m256d ay = _mm256_add_pd(_mm256_div_pd(fy, m), gy);
+		const __m256d az = _mm256_add_pd(_mm256_div_pd(fz, m), gz);
+		vx = _mm256_fmadd_pd(ax, dt_v, vx); // vel += acc*dt
+		vy = _mm256_fmadd_pd(ay, dt_v, vy);
+		vz = _mm256_fmadd_pd(az, dt_v, vz);
+
+		const __m256d free = _mm256_cmp_pd(_mm256_cvtepi32_pd(_mm_load_si128((const __m128i*)(mass.fixed + i))), zero, _CMP_EQ_OQ);
+		_mm256_store_pd(mass.acc.x + i, _mm256_blendv_pd(_mm256_load_pd(mass.acc.x + i), ax, free));
+		_mm256_store_pd(mass.acc.y + i, _mm256_blendv_pd(_mm256_load_pd(mass.acc.y + i), ay, free));
+		_mm256_store_pd(mass.acc.z + i, _mm256_blendv_pd(_mm256_load_pd(mass.acc.z + i), az, free));
+		_mm256_store_pd(mass.vel.x + i, _mm256_blendv_pd(_mm256_load_pd(mass.vel.x + i), vx, free));
+		_mm256_store_pd(mass.vel.y + i, _mm256_blendv_pd(_mm256_load_pd(mass.vel.y + i), vy, free));
+		_mm256_store_pd(mass.vel.z + i, _mm256_blendv_pd(_mm256_load_pd(mass.vel.z + i), vz, free));
+		_mm256_store_pd(mass.pos.x + i, _mm256_blendv_pd(px, _mm256_fmadd_pd(vx, dt_v, px), free));
+		_mm256_store_pd(mass.pos.y + i, _mm256_blendv_pd(py, _mm256_fmadd_pd(vy, dt_v, py), free));
+		_mm256_store_pd(mass.pos.z + i, _mm256_blendv_pd(pz, _mm256_fmadd_pd(vz, dt_v, pz), free));
+	}
+}
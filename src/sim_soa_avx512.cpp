@@ -0,0 +1,188 @@
+/*
+sim_soa_avx512.cpp: AVX-512 (8 doubles per vector) spring, contact and integration loops on the SoA storage,
+same as sim_soa_avx2.cpp. This file is compiled with AVX-512F enabled (-mavx512f or /arch:AVX512),
+its functions are only called after detectSimdIsa() found AVX-512F on the cpu
+*/
+
+#include "sim_soa.h"
+
+#include <immintrin.h>
+
+#ifndef __AVX512F__
+#error "sim_soa_avx512.cpp must be compiled with AVX-512F enabled (-mavx512f or /arch:AVX512)"
+#endif
+
+constexpr int W = 8; // doubles per vector
+
+static inline __m512d dot3(__m512d ax, __m512d ay, __m512d az, __m512d bx, __m512d by, __m512d bz) {
+	return _mm512_fmadd_pd(az, bz, _mm512_fmadd_pd(ay, by, _mm512_mul_pd(ax, bx)));
+}
+
+void soa_avx512::springForce(const MASS_SOA& mass, const SPRING_SOA& spring, bool reset) {
+	const __m512d one = _mm512_set1_pd(1.);
+	const __m512d eps = _mm512_set1_pd(1e-12);
+#pragma omp for schedule(static)
+	for (int i = 0; i < spring.num_padded; i += W) {
+		const __m256i l = _mm256_load_si256((const __m256i*)(spring.left + i));
+		const __m256i r = _mm256_load_si256((const __m256i*)(spring.right + i));
+
+		// the vector from left to right
+		__m512d dx = _mm512_sub_pd(_mm512_i32gather_pd(r, mass.pos.x, 8), _mm512_i32gather_pd(l, mass.pos.x, 8));
+		__m512d dy = _mm512_sub_pd(_mm512_i32gather_pd(r, mass.pos.y, 8), _mm512_i32gather_pd(l, mass.pos.y, 8));
+		__m512d dz = _mm512_sub_pd(_mm512_i32gather_pd(r, mass.pos.z, 8), _mm512_i32gather_pd(l, mass.pos.z, 8));
+		const __m512d length = _mm512_sqrt_pd(dot3(dx, dy, dz, dx, dy, dz)); // current spring length
+
+		const __m512d inv_length = _mm512_div_pd(one, _mm512_max_pd(length, eps)); // check instablility for small length
+		dx = _mm512_mul_pd(dx, inv_length); // normalized to unit vector (direction)
+		dy = _mm512_mul_pd(dy, inv_length);
+		dz = _mm512_mul_pd(dz, inv_length);
+
+		const __m512d dvx = _mm512_sub_pd(_mm512_i32gather_pd(l, mass.vel.x, 8), _mm512_i32gather_pd(r, mass.vel.x, 8));
+		const __m512d dvy = _mm512_sub_pd(_mm512_i32gather_pd(l, mass.vel.y, 8), _mm512_i32gather_pd(r, mass.vel.y, 8));
+		const __m512d dvz = _mm512_sub_pd(_mm512_i32gather_pd(l, mass.vel.z, 8), _mm512_i32gather_pd(r, mass.vel.z, 8));
+
+		const __m512d rest = _mm512_load_pd(spring.rest + i);
+		__m512d f = _mm512_mul_pd(_mm512_load_pd(spring.k + i), _mm512_sub_pd(rest, length)); // normal spring force
+		f = _mm512_fmadd_pd(dot3(dx, dy, dz, dvx, dvy, dvz), _mm512_load_pd(spring.damping + i), f); // damping
+
+		_mm512_store_pd(spring.force.x + i, _mm512_mul_pd(f, dx));
+		_mm512_store_pd(spring.force.y + i, _mm512_mul_pd(f, dy));
+		_mm512_store_pd(spring.force.z + i, _mm512_mul_pd(f, dz));
+
+#ifdef ROTATION
+		if (reset) {//reset the spring rest length if this spring is restable
+			const __m512d resetable = _mm512_cvtepi32_pd(_mm256_load_si256((const __m256i*)(spring.resetable + i)));
+			const __mmask8 mask = _mm512_cmp_pd_mask(resetable, _mm512_setzero_pd(), _CMP_NEQ_OQ);
+			_mm512_store_pd(spring.rest + i, _mm512_mask_blend_pd(mask, rest, length));
+		}
+#endif // ROTATION
+	}
+}
+
+void soa_avx512::massUpdate(const MASS_SOA& mass, const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, double dt) {
+	const __m512d zero = _mm512_setzero_pd();
+	const __m512d k_normal = _mm512_set1_pd(K_NORMAL);
+	const __m512d damping_normal = _mm512_set1_pd(DAMPING_NORMAL);
+	const __m512d v_t_min = _mm512_set1_pd(1e-8);
+	const __m512d gx = _mm512_set1_pd(global_acc.x);
+	const __m512d gy = _mm512_set1_pd(global_acc.y);
+	const __m512d gz = _mm512_set1_pd(global_acc.z);
+	const __m512d dt_v = _mm512_set1_pd(dt);
+#pragma omp for schedule(static)
+	for (int i = 0; i < mass.num_padded; i += W) {
+		const __m512d px = _mm512_load_pd(mass.pos.x + i);
+		const __m512d py = _mm512_load_pd(mass.pos.y + i);
+		const __m512d pz = _mm512_load_pd(mass.pos.z + i);
+		__m512d vx = _mm512_load_pd(mass.vel.x + i);
+		__m512d vy = _mm512_load_pd(mass.vel.y + i);
+		__m512d vz = _mm512_load_pd(mass.vel.z + i);
+		__m512d fx = _mm512_load_pd(mass.force.x + i);
+		__m512d fy = _mm512_load_pd(mass.force.y + i);
+		__m512d fz = _mm512_load_pd(mass.force.z + i);
+		const __mmask8 surface = _mm512_cmp_pd_mask(_mm512_cvtepi32_pd(_mm256_load_si256((const __m256i*)(mass.constrain + i))), zero, _CMP_NEQ_OQ);
+
+		for (int j = 0; j < c.num_planes; j++) { // same contact model as CudaContactPlane::applyForce
+			const CudaContactPlane& plane = c.d_planes[j];
+			const __m512d nx = _mm512_set1_pd(plane._normal.x);
+			const __m512d ny = _mm512_set1_pd(plane._normal.y);
+			const __m512d nz = _mm512_set1_pd(plane._normal.z);
+			const __m512d disp = _mm512_sub_pd(dot3(nx, ny, nz, px, py, pz), _mm512_set1_pd(plane._offset)); // displacement into the plane
+			const __mmask8 inside = _mm512_mask_cmp_pd_mask(surface, disp, zero, _CMP_LT_OQ);
+			if (inside == 0) { continue; } // no surface mass inside the plane
+
+			const __m512d kd = _mm512_mul_pd(disp, k_normal);
+			const __m512d fnx = _mm512_mul_pd(_mm512_sub_pd(zero, _mm512_mul_pd(disp, nx)), k_normal); // ground spring model
+			const __m512d fny = _mm512_mul_pd(_mm512_sub_pd(zero, _mm512_mul_pd(disp, ny)), k_normal);
+			const __m512d fnz = _mm512_mul_pd(_mm512_sub_pd(zero, _mm512_mul_pd(disp, nz)), k_normal);
+			const __m512d fn_norm = _mm512_sqrt_pd(dot3(fnx, fny, fnz, fnx, fny, fnz));
+
+			const __m512d vn = dot3(nx, ny, nz, vx, vy, vz);
+			const __m512d vnx = _mm512_mul_pd(vn, nx); // velocity normal to the plane
+			const __m512d vny = _mm512_mul_pd(vn, ny);
+			const __m512d vnz = _mm512_mul_pd(vn, nz);
+			const __m512d vtx = _mm512_sub_pd(vx, vnx); // velocity tangential to the plane
+			const __m512d vty = _mm512_sub_pd(vy, vny);
+			const __m512d vtz = _mm512_sub_pd(vz, vnz);
+			const __m512d vt_norm = _mm512_sqrt_pd(dot3(vtx, vty, vtz, vtx, vty, vtz));
+
+			const __m512d ftx = _mm512_sub_pd(fx, fnx); //  force tangential to the plain
+			const __m512d fty = _mm512_sub_pd(fy, fny);
+			const __m512d ftz = _mm512_sub_pd(fz, fnz);
+			const __m512d ft_norm = _mm512_sqrt_pd(dot3(ftx, fty, ftz, ftx, fty, ftz));
+
+			// kinetic friction unless the tangential velocity is small and static friction holds
+			const __mmask8 kinetic = _mm512_cmp_pd_mask(vt_norm, v_t_min, _CMP_GT_OQ);
+			const __mmask8 holds = _mm512_cmp_pd_mask(_mm512_mul_pd(_mm512_set1_pd(plane._FRICTION_S), fn_norm), ft_norm, _CMP_GT_OQ);
+			const __mmask8 use_static = (__mmask8)(~kinetic & holds);
+			const __m512d friction = _mm512_div_pd(_mm512_mul_pd(_mm512_set1_pd(plane._FRICTION_K), fn_norm), vt_norm);
+
+			__m512d fx_new = _mm512_sub_pd(fx, _mm512_mask_blend_pd(use_static, _mm512_mul_pd(friction, vtx), ftx));
+			__m512d fy_new = _mm512_sub_pd(fy, _mm512_mask_blend_pd(use_static, _mm512_mul_pd(friction, vty), fty));
+			__m512d fz_new = _mm512_sub_pd(fz, _mm512_mask_blend_pd(use_static, _mm512_mul_pd(friction, vtz), ftz));
+			fx_new = _mm512_sub_pd(_mm512_sub_pd(fx_new, _mm512_mul_pd(kd, nx)), _mm512_mul_pd(vnx, damping_normal));// displacement force, damping
+			fy_new = _mm512_sub_pd(_mm512_sub_pd(fy_new, _mm512_mul_pd(kd, ny)), _mm512_mul_pd(vny, damping_normal));
+			fz_new = _mm512_sub_pd(_mm512_sub_pd(fz_new, _mm512_mul_pd(kd, nz)), _mm512_mul_pd(vnz, damping_normal));
+
+			fx = _mm512_mask_blend_pd(inside, fx, fx_new); // only for the masses inside the plane
+			fy = _mm512_mask_blend_pd(inside, fy, fy_new);
+			fz = _mm512_mask_blend_pd(inside, fz, fz_new);
+		}
+		for (int j = 0; j < c.num_balls; j++) { // same as CudaBall::applyForce
+			const CudaBall& ball = c.d_balls[j];
+			const __m512d dx = _mm512_sub_pd(px, _mm512_set1_pd(ball._center.x));
+			const __m512d dy = _mm512_sub_pd(py, _mm512_set1_pd(ball._center.y));
+			const __m512d dz = _mm512_sub_pd(pz, _mm512_set1_pd(ball._center.z));
+			const __m512d dist = _mm512_sqrt_pd(dot3(dx, dy, dz, dx, dy, dz));
+			const __mmask8 inside = _mm512_mask_cmp_pd_mask(surface, dist, _mm512_set1_pd(ball._radius), _CMP_LT_OQ);
+			const __m512d scale = _mm512_maskz_div_pd(inside, k_normal, dist);
+			fx = _mm512_fmadd_pd(scale, dx, fx);
+			fy = _mm512_fmadd_pd(scale, dy, fy);
+			fz = _mm512_fmadd_pd(scale, dz, fz);
+		}
+		if ((c.d_terrain != nullptr || c.d_obstacles != nullptr) && surface != 0) { // applyForce() per lane
+			alignas(64) double p[3][W], v[3][W], f[3][W];
+			_mm512_store_pd(p[0], px);
+			_mm512_store_pd(p[1], py);
+			_mm512_store_pd(p[2], pz);
+			_mm512_store_pd(v[0], vx);
+			_mm512_store_pd(v[1], vy);
+			_mm512_store_pd(v[2], vz);
+			_mm512_store_pd(f[0], fx);
+			_mm512_store_pd(f[1], fy);
+			_mm512_store_pd(f[2], fz);
+			for (int l = 0; l < W; l++) {
+				if (!mass.constrain[i + l]) { continue; }
+				Vec3d force(f[0][l], f[1][l], f[2][l]);
+				const Vec3d pos(p[0][l], p[1][l], p[2][l]), vel(v[0][l], v[1][l], v[2][l]);
+				if (c.d_terrain != nullptr) { c.d_terrain->applyForce(force, pos, vel); }
+				if (c.d_obstacles != nullptr) { c.d_obstacles->applyForce(force, pos, vel); }
+				f[0][l] = force.x;
+				f[1][l] = force.y;
+				f[2][l] = force.z;
+			}
+			fx = _mm512_load_pd(f[0]);
+			fy = _mm512_load_pd(f[1]);
+			fz = _mm512_load_pd(f[2]);
+		}
+
+		// euler integration
+		const __m512d m = _mm512_load_pd(mass.m + i);
+		const __m512d ax = _mm512_add_pd(_mm512_div_pd(fx, m), gx); // acceleration
+		const __m512d ay = _mm512_add_pd(_mm512_div_pd(fy, m), gy);
+		const __m512d az = _mm512_add_pd(_mm512_div_pd(fz, m), gz);
+		vx = _mm512_fmadd_pd(ax, dt_v, vx); // vel += acc*dt
+		vy = _mm512_fmadd_pd(ay, dt_v, vy);
+		vz = _mm512_fmadd_pd(az, dt_v, vz);
+
+		const __mmask8 free = _mm512_cmp_pd_mask(_mm512_cvtepi32_pd(_mm256_load_si256((const __m256i*)(mass.fixed + i))), zero, _CMP_EQ_OQ);
+		_mm512_store_pd(mass.acc.x + i, _mm512_mask_blend_pd(free, _mm512_load_pd(mass.acc.x + i), ax));
+		_mm512_store_pd(mass.acc.y + i, _mm512_mask_blend_pd(free, _mm512_load_pd(mass.acc.y + i), ay));
+		_mm512_store_pd(mass.acc.z + i, _mm512_mask_blend_pd(free, _mm512_load_pd(mass.acc.z + i), az));
+		_mm512_store_pd(mass.vel.x + i, _mm512_mask_blend_pd(free, _mm512_load_pd(mass.vel.x + i), vx));
+		_mm512_store_pd(mass.vel.y + i, _mm512_mask_blend_pd(free, _mm512_load_pd(mass.vel.y + i), vy));
+		_mm512_store_pd(mass.vel.z + i, _mm512_mask_blend_pd(free, _mm512_load_pd(mass.vel.z + i), vz));
+		_mm512_store_pd(mass.pos.x + i, _mm512_mask_blend_pd(free, px, _mm512_fmadd_pd(vx, dt_v, px)));
+		_mm512_store_pd(mass.pos.y + i, _mm512_mask_blend_pd(free, py, _mm512_fmadd_pd(vy, dt_v, py)));
+		_mm512_store_pd(mass.pos.z + i, _mm512_mask_blend_pd(free, pz, _mm512_fmadd_pd(vz, dt_v, pz)));
+	}
+}
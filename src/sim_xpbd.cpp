@@ -0,0 +1,213 @@
+/*
+sim_xpbd.cpp: XPBD solver with graph-colored springs, see sim_xpbd.h
+*/
+
+#include "sim_xpbd.h"
+#include "sim_cpu.h" // NUM_QUEUED_KERNELS, NUM_UPDATE_PER_ROTATION, rotateJointCpu
+
+#include <algorithm>
+#include <initializer_list>
+#include <numeric>
+#include <cmath>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+void XpbdSolver::init(const SPRING& spring, int num_mass) {
+	// greedy edge coloring: each spring gets the smallest color not used by its two masses
+	std::vector<std::vector<int>> mass_colors(num_mass); // colors used by the springs of each mass
+	std::vector<int> color(spring.num);
+	int num_color = 0;
+	for (int i = 0; i < spring.num; i++) {
+		const std::vector<int>& cl = mass_colors[spring.edge[i].x];
+		const std::vector<int>& cr = mass_colors[spring.edge[i].y];
+		int k = 0;
+		while (std::find(cl.begin(), cl.end(), k) != cl.end() || std::find(cr.begin(), cr.end(), k) != cr.end()) { k++; }
+		color[i] = k;
+		mass_colors[spring.edge[i].x].push_back(k);
+		mass_colors[spring.edge[i].y].push_back(k);
+		num_color = std::max(num_color, k + 1);
+	}
+	// relabel the colors by decreasing size, the hub masses (joint anchors) have ~200 springs,
+	// so the last colors are small and projected by one thread instead of one "omp for" each
+	std::vector<int> size(num_color, 0);
+	for (int i = 0; i < spring.num; i++) { size[color[i]]++; }
+	std::vector<int> order(num_color);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&size](int a, int b) { return size[a] > size[b]; });
+	std::vector<int> label(num_color);
+	for (int k = 0; k < num_color; k++) { label[order[k]] = k; }
+	num_parallel_color = 0;
+	while (num_parallel_color < num_color && size[order[num_parallel_color]] >= min_color_size) { num_parallel_color++; }
+	for (int i = 0; i < spring.num; i++) { color[i] = label[color[i]]; }
+
+	color_offset.assign(num_color + 1, 0); // counting sort by color
+	for (int i = 0; i < spring.num; i++) { color_offset[color[i] + 1]++; }
+	for (int k = 0; k < num_color; k++) { color_offset[k + 1] += color_offset[k]; }
+	color_spring.resize(spring.num);
+	std::vector<int> next(color_offset.begin(), color_offset.end() - 1);
+	for (int i = 0; i < spring.num; i++) { color_spring[next[color[i]]++] = i; }
+
+	num_plane = 0; // lambda_contact is sized to the planes in step()
+	lambda_contact.clear();
+	pos_prev.assign(num_mass, Vec3d());
+	vel_prev.assign(num_mass, Vec3d());
+	lambda.assign(spring.num, 0.);
+	terrain_contact.assign(num_mass, SurfaceContact());
+	obstacle_contact.assign(num_mass, SurfaceContact());
+}
+
+namespace {
+
+/* velocity-level friction of a contact, dv_normal: normal impulse per mass */
+inline void applyFriction(Vec3d& vel, const Vec3d& normal, const double dv_normal, const double friction_k, const double friction_s) {
+	Vec3d v_t = vel - dot(normal, vel) * normal; // velocity tangential to the contact
+	const double v_t_norm = v_t.norm();
+	if (v_t_norm <= friction_s * dv_normal) { vel -= v_t; } // static friction
+	else { vel -= std::min(friction_k * dv_normal, v_t_norm) / v_t_norm * v_t; } // kinetic friction
+}
+
+} // namespace
+
+inline void XpbdSolver::projectContact(const MASS& mass, const int i, const Vec3d& normal, const double disp, double& l,
+	const double w, const double dt) {
+	const double alpha = 1. / (K_NORMAL * (dt * dt));
+	const double gamma = DAMPING_NORMAL / (K_NORMAL * dt);
+	const double dC = dot(normal, mass.pos[i] - pos_prev[i]);
+	const double d_lambda = (-disp - alpha * l - gamma * dC) / ((1 + gamma) * w + alpha);
+	l += d_lambda;
+	mass.pos[i] += (w * d_lambda) * normal;
+}
+
+void XpbdSolver::step(const MASS& mass, const SPRING& spring, const JOINT& joint,
+	const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const int num_threads) {
+	if (num_plane != (int)c.num_planes) { // planes added or cleared since the last step
+		num_plane = (int)c.num_planes;
+		lambda_contact.assign(pos_prev.size() * num_plane, 0.);
+	}
+#ifdef _OPENMP
+	const int n_threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#endif
+#pragma omp parallel num_threads(n_threads)
+	{
+		for (int i = 0; i < (NUM_QUEUED_KERNELS / NUM_UPDATE_PER_ROTATION); i++) {
+			for (int j = 0; j < NUM_UPDATE_PER_ROTATION - 1; j++) {
+				stepOnce(mass, spring, c, global_acc, dt, false);
+			}
+#ifdef ROTATION
+			rotateJointCpu(mass, joint);
+			stepOnce(mass, spring, c, global_acc, dt, true);
+#endif // ROTATION
+		}
+	}
+}
+
+inline void XpbdSolver::projectSpring(const MASS& mass, const SPRING& spring, const int i, const double dt) {
+	const Vec2i e = spring.edge[i];
+	const double w_l = mass.fixed[e.x] ? 0. : 1. / mass.m[e.x];
+	const double w_r = mass.fixed[e.y] ? 0. : 1. / mass.m[e.y];
+	if (w_l + w_r == 0 || spring.k[i] == 0) { return; }
+	Vec3d s_vec = mass.pos[e.y] - mass.pos[e.x];// the vector from left to right
+	const double length = s_vec.norm(); // current spring length
+	if (length < 1e-12) { return; } // check instablility for small length
+	s_vec /= length;// normalized to unit vector (direction), the gradient of C wrt the right mass
+
+	const double C = length - spring.rest[i]; // constraint
+	const double alpha = 1. / (spring.k[i] * dt * dt); // compliance
+	const double gamma = spring.damping[i] / (spring.k[i] * dt); // damping
+	const double dC = s_vec.dot((mass.pos[e.y] - pos_prev[e.y]) - (mass.pos[e.x] - pos_prev[e.x]));
+	const double d_lambda = (-C - alpha * lambda[i] - gamma * dC) / ((1 + gamma) * (w_l + w_r) + alpha);
+	lambda[i] += d_lambda;
+	mass.pos[e.y] += (w_r * d_lambda) * s_vec;
+	mass.pos[e.x] -= (w_l * d_lambda) * s_vec;
+}
+
+void XpbdSolver::stepOnce(const MASS& mass, const SPRING& spring, const CUDA_GLOBAL_CONSTRAINTS& c,
+	const Vec3d& global_acc, const double dt, const bool reset) {
+#pragma omp for schedule(static)
+	for (int i = 0; i < spring.num; i++) {
+		lambda[i] = 0;
+#ifdef ROTATION
+		if (reset && spring.resetable[i]) {//reset the spring rest length if this spring is restable
+			spring.rest[i] = (mass.pos[spring.edge[i].y] - mass.pos[spring.edge[i].x]).norm();
+		}
+#endif // ROTATION
+	}
+
+#pragma omp for schedule(static)
+	for (int i = 0; i < mass.num; i++) { // predict the positions with the external forces
+		pos_prev[i] = mass.pos[i];
+		vel_prev[i] = mass.vel[i];
+		for (int j = 0; j < num_plane; j++) { lambda_contact[(size_t)i * num_plane + j] = 0; }
+		terrain_contact[i].lambda = 0;
+		obstacle_contact[i].lambda = 0;
+		if (mass.fixed[i] == false) {
+			Vec3d force = mass.force_extern[i];
+			for (int j = 0; j < c.num_balls; j++) {
+				c.d_balls[j].applyForce(force, mass.pos[i]);
+			}
+			mass.vel[i] += (force / mass.m[i] + global_acc) * dt;
+			mass.pos[i] += mass.vel[i] * dt;
+		}
+	}
+
+	for (int it = 0; it < num_iter; it++) {
+		for (int k = 0; k < num_parallel_color; k++) { // springs of one color share no mass
+#pragma omp for schedule(static)
+			for (int n = color_offset[k]; n < color_offset[k + 1]; n++) {
+				projectSpring(mass, spring, color_spring[n], dt);
+			}
+		}
+#pragma omp single
+		for (int n = color_offset[num_parallel_color]; n < color_offset[numColor()]; n++) { // small colors
+			projectSpring(mass, spring, color_spring[n], dt);
+		}
+
+#pragma omp for schedule(static)
+		for (int i = 0; i < mass.num; i++) { // contact planes, one mass per constraint
+			if (mass.fixed[i] || !mass.constrain[i]) { continue; } // surface masses only
+			const double w = 1. / mass.m[i];
+			for (int j = 0; j < num_plane; j++) {
+				const CudaContactPlane& plane = c.d_planes[j];
+				const double disp = dot(plane._normal, mass.pos[i]) - plane._offset; // displacement into the plane
+				if (disp >= 0) { continue; }
+				projectContact(mass, i, plane._normal, disp, lambda_contact[(size_t)i * num_plane + j], w, dt);
+			}
+			Vec3d normal;
+			double disp, friction_k, friction_s;
+			if (c.d_terrain != nullptr && c.d_terrain->contact(mass.pos[i], normal, disp, friction_k, friction_s)) { // the plane tangent to the terrain
+				SurfaceContact& s = terrain_contact[i];
+				projectContact(mass, i, normal, disp, s.lambda, w, dt);
+				s.normal = normal;
+				s.friction_k = friction_k;
+				s.friction_s = friction_s;
+			}
+			if (c.d_obstacles != nullptr && c.d_obstacles->contact(mass.pos[i], normal, disp, friction_k, friction_s)) { // the deepest obstacle
+				SurfaceContact& s = obstacle_contact[i];
+				projectContact(mass, i, normal, disp, s.lambda, w, dt);
+				s.normal = normal;
+				s.friction_k = friction_k;
+				s.friction_s = friction_s;
+			}
+		}
+	}
+
+#pragma omp for schedule(static)
+	for (int i = 0; i < mass.num; i++) { // update the velocity, then apply friction
+		if (mass.fixed[i]) { continue; }
+		Vec3d vel = (mass.pos[i] - pos_prev[i]) / dt;
+		for (int j = 0; j < num_plane; j++) {
+			const double l = lambda_contact[(size_t)i * num_plane + j];
+			if (l <= 0) { continue; }
+			const CudaContactPlane& plane = c.d_planes[j];
+			applyFriction(vel, plane._normal, l / (dt * mass.m[i]), plane._FRICTION_K, plane._FRICTION_S);
+		}
+		for (const SurfaceContact* s : { &terrain_contact[i], &obstacle_contact[i] }) { // with the normal of the last projection
+			if (s->lambda > 0) { applyFriction(vel, s->normal, s->lambda / (dt * mass.m[i]), s->friction_k, s->friction_s); }
+		}
+		mass.acc[i] = (vel - vel_prev[i]) / dt; // update acceleration
+		mass.vel[i] = vel; // update velocity
+		mass.pos[i] = pos_prev[i] + vel * dt; // update position (after friction)
+	}
+}
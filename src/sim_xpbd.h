@@ -0,0 +1,64 @@
+/*
+sim_xpbd.h: extended position based dynamics (XPBD) solver for the cpu backend.
+Each spring is a compliant distance constraint (compliance 1/k, damping from SPRING::damping) and each
+contact plane a compliant contact constraint (K_NORMAL, DAMPING_NORMAL) with velocity-level friction, as are
+the heightfield terrain and the deepest static obstacle along their normal at each mass.
+The springs are graph-colored once in init(): no two springs of a color share a mass, so each color is
+projected in parallel (openmp) without atomics, the colors are projected one after another (Gauss-Seidel).
+XPBD is unconditionally stable, a larger dt with a few iterations trades stiffness for throughput.
+ref: M. Macklin, M. Mueller, and N. Chentanez, "XPBD: Position-Based Simulation of Compliant
+Constrained Dynamics," MIG 2016.
+*/
+
+#ifndef TITAN_SIM_XPBD_H
+#define TITAN_SIM_XPBD_H
+
+#include "vec.h"
+#include "object.h"
+#include "model.h"
+
+#include <vector>
+
+class XpbdSolver {
+public:
+	int num_iter = 10; // number of constraint projection iterations per step
+	int min_color_size = 256; // colors with fewer springs are projected by one thread, set before init()
+
+	// spring coloring, built in init()
+	std::vector<int> color_offset; // start of the springs of each color in color_spring, size num_color+1
+	std::vector<int> color_spring; // spring ids sorted by color size (ascending id within a color)
+	int num_parallel_color = 0; // the first num_parallel_color colors are projected in parallel, the rest serially
+	inline int numColor() const { return (int)color_offset.size() - 1; }
+
+	void init(const SPRING& spring, int num_mass);
+
+	/* run NUM_QUEUED_KERNELS XPBD steps (one update_physics() iteration), rotate the joints and reset
+	   the rest length every NUM_UPDATE_PER_ROTATION steps as stepCpu(),
+	   num_threads: number of openmp threads, 0: use the openmp default */
+	void step(const MASS& mass, const SPRING& spring, const JOINT& joint,
+		const CUDA_GLOBAL_CONSTRAINTS& c, const Vec3d& global_acc, const double dt, const int num_threads = 0);
+
+private:
+	std::vector<Vec3d> pos_prev; // position at the start of the step
+	std::vector<Vec3d> vel_prev; // velocity at the start of the step
+	std::vector<double> lambda; // lagrange multiplier of each spring
+	std::vector<double> lambda_contact; // lagrange multiplier of each mass and contact plane
+	int num_plane = 0; // of lambda_contact, follows CUDA_GLOBAL_CONSTRAINTS::num_planes
+	struct SurfaceContact { // contact of a mass with the terrain or the obstacles at its last projection
+		double lambda = 0; // lagrange multiplier
+		Vec3d normal;
+		double friction_k = 0, friction_s = 0;
+	};
+	std::vector<SurfaceContact> terrain_contact, obstacle_contact; // of each mass
+
+	/* project the distance constraint of spring i */
+	void projectSpring(const MASS& mass, const SPRING& spring, const int i, const double dt);
+	/* project the contact constraint of mass i (inverse mass w) displaced disp < 0 along normal */
+	void projectContact(const MASS& mass, const int i, const Vec3d& normal, const double disp, double& l,
+		const double w, const double dt);
+	/* one step in an "omp parallel" region (orphaned "omp for") */
+	void stepOnce(const MASS& mass, const SPRING& spring, const CUDA_GLOBAL_CONSTRAINTS& c,
+		const Vec3d& global_acc, const double dt, const bool reset);
+};
+
+#endif // TITAN_SIM_XPBD_H
@@ -0,0 +1,152 @@
+/*
+terrain.cpp: heightfield terrain, see terrain.h
+*/
+
+#include "terrain.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+
+Heightfield::Heightfield(int nx, int ny, double cell, const double* height) : cell(cell), nx(nx), ny(ny) {
+	if (nx < 2 || ny < 2 || !(cell > 0)) {
+		throw std::runtime_error("Heightfield: the grid needs at least 2 x 2 heights and a positive spacing");
+	}
+	if (height != nullptr) { this->height.assign(height, height + (size_t)nx * ny); }
+	else { this->height.assign((size_t)nx * ny, 0.); }
+	setFriction(0, 0);
+	center();
+}
+
+namespace {
+
+/* next whitespace separated token of a pgm header, skipping the # comments */
+bool pgmToken(FILE* in, std::string& token) {
+	token.clear();
+	int ch = fgetc(in);
+	while (ch != EOF && (isspace(ch) || ch == '#')) {
+		if (ch == '#') { while (ch != EOF && ch != '\n') { ch = fgetc(in); } }
+		ch = fgetc(in);
+	}
+	while (ch != EOF && !isspace(ch)) {
+		token.push_back((char)ch);
+		ch = fgetc(in);
+	}
+	return !token.empty(); // the single whitespace after the last header token is consumed
+}
+
+} // namespace
+
+Heightfield Heightfield::loadPgm(const std::string& path, double cell, double max_height) {
+	FILE* in = fopen(path.c_str(), "rb");
+	if (in == nullptr) { throw std::runtime_error("Heightfield: cannot open " + path); }
+	std::string magic, w, h, maxval;
+	if (!pgmToken(in, magic) || (magic != "P2" && magic != "P5") || !pgmToken(in, w) || !pgmToken(in, h) || !pgmToken(in, maxval)) {
+		fclose(in);
+		throw std::runtime_error("Heightfield: " + path + " is not a pgm image (P2 or P5)");
+	}
+	const int width = atoi(w.c_str()), rows = atoi(h.c_str()), max_value = atoi(maxval.c_str());
+	if (width < 2 || rows < 2 || max_value <= 0 || max_value > 65535) {
+		fclose(in);
+		throw std::runtime_error("Heightfield: " + path + " must be at least 2 x 2 pixels of 8 or 16 bit");
+	}
+	std::vector<int> value((size_t)width * rows);
+	bool ok = true;
+	if (magic == "P5") {
+		const int bytes = max_value < 256 ? 1 : 2; // 16 bit values are big endian
+		std::vector<uint8_t> raw(value.size() * bytes);
+		ok = fread(raw.data(), 1, raw.size(), in) == raw.size();
+		for (size_t k = 0; ok && k < value.size(); k++) { value[k] = bytes == 1 ? raw[k] : raw[2 * k] << 8 | raw[2 * k + 1]; }
+	}
+	else {
+		std::string token;
+		for (size_t k = 0; ok && k < value.size(); k++) {
+			ok = pgmToken(in, token);
+			value[k] = atoi(token.c_str());
+		}
+	}
+	fclose(in);
+	if (!ok) { throw std::runtime_error("Heightfield: " + path + " is truncated"); }
+
+	Heightfield terrain(width, rows, cell);
+	for (int r = 0; r < rows; r++) {
+		const int j = rows - 1 - r; // the top row is the largest y
+		for (int i = 0; i < width; i++) {
+			terrain.height[(size_t)j * width + i] = max_height * std::min(value[(size_t)r * width + i], max_value) / max_value;
+		}
+	}
+	return terrain;
+}
+
+Heightfield Heightfield::rough(int nx, int ny, double cell, double amplitude, double wavelength, uint32_t seed) {
+	Heightfield terrain(nx, ny, cell);
+	// random values on a lattice of spacing wavelength, smoothstep interpolated between them
+	const double step = std::max(wavelength / cell, 1.0); // lattice spacing in cells
+	const int lx = (int)std::ceil((nx - 1) / step) + 2, ly = (int)std::ceil((ny - 1) / step) + 2;
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	std::vector<double> lattice((size_t)lx * ly);
+	for (double& value : lattice) { value = uniform(rng); }
+	auto smooth = [](double t) { return t * t * (3 - 2 * t); };
+	for (int j = 0; j < ny; j++) {
+		const double v = j / step;
+		const int b = (int)v;
+		const double fv = smooth(v - b);
+		for (int i = 0; i < nx; i++) {
+			const double u = i / step;
+			const int a = (int)u;
+			const double fu = smooth(u - a);
+			const double* l = lattice.data() + (size_t)b * lx + a;
+			terrain.height[(size_t)j * nx + i] = amplitude *
+				((1 - fv) * ((1 - fu) * l[0] + fu * l[1]) + fv * ((1 - fu) * l[lx] + fu * l[lx + 1]));
+		}
+	}
+	return terrain;
+}
+
+void Heightfield::setFriction(double friction_k, double friction_s) {
+	this->friction_k.assign((size_t)(nx - 1) * (ny - 1), friction_k);
+	this->friction_s.assign((size_t)(nx - 1) * (ny - 1), friction_s);
+}
+
+void Heightfield::setFriction(int i, int j, double friction_k, double friction_s) {
+	if (i < 0 || j < 0 || i >= nx - 1 || j >= ny - 1) { throw std::out_of_range("Heightfield::setFriction: invalid cell"); }
+	this->friction_k[(size_t)j * (nx - 1) + i] = friction_k;
+	this->friction_s[(size_t)j * (nx - 1) + i] = friction_s;
+}
+
+void Heightfield::center(double x, double y) {
+	x0 = x - 0.5 * sizeX();
+	y0 = y - 0.5 * sizeY();
+}
+
+double Heightfield::heightAt(double x, double y) const {
+	const double u = std::min(std::max((x - x0) / cell, 0.0), nx - 1.0);
+	const double v = std::min(std::max((y - y0) / cell, 0.0), ny - 1.0);
+	const int i = std::min((int)u, nx - 2), j = std::min((int)v, ny - 2);
+	const double fu = u - i, fv = v - j;
+	const double* h = height.data() + (size_t)j * nx + i;
+	return (1 - fv) * ((1 - fu) * h[0] + fu * h[1]) + fv * ((1 - fu) * h[nx] + fu * h[nx + 1]);
+}
+
+double Heightfield::maxHeight() const {
+	return height.empty() ? 0 : *std::max_element(height.begin(), height.end());
+}
+
+CudaHeightfield Heightfield::view() const {
+	CudaHeightfield v;
+	v._x0 = x0;
+	v._y0 = y0;
+	v._inv_cell = 1 / cell;
+	v._nx = nx;
+	v._ny = ny;
+	v._height = height.data();
+	v._z_max = maxHeight();
+	v._friction_k = friction_k.data();
+	v._friction_s = friction_s.data();
+	return v;
+}
@@ -0,0 +1,54 @@
+/*
+terrain.h: heightfield terrain for the global constraints: heights on a regular grid with a kinetic and a
+static friction coefficient per cell, from an array, a pgm image or generated rough ground.
+The simulation keeps a copy and applies it through the flat view CudaHeightfield (object.h): each mass
+looks up its cell in O(1), so a terrain of any size costs about one contact plane per step, where the same
+ground built from createPlane()/createBall() costs one test per mass and obstacle.
+The x, y axes of the grid are the world x, y axes, z is up; outside the grid the border heights extend flat.
+*/
+
+#ifndef TITAN_TERRAIN_H
+#define TITAN_TERRAIN_H
+
+#include "vec.h"
+#include "object.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Heightfield {
+public:
+	double x0 = 0, y0 = 0; // [m] position of height[0][0] (minimum x and y)
+	double cell = 0.01; // [m] grid spacing
+	int nx = 0, ny = 0; // number of heights along x and y
+	std::vector<double> height; // [m] [ny][nx]
+	std::vector<double> friction_k; // kinetic friction coefficient of each cell [ny-1][nx-1]
+	std::vector<double> friction_s; // static friction coefficient of each cell [ny-1][nx-1]
+
+	Heightfield() {}
+	/* nx x ny heights (nullptr: flat at z=0) with spacing cell, centered on x=y=0, no friction,
+	   throws std::runtime_error if nx or ny < 2 */
+	Heightfield(int nx, int ny, double cell, const double* height = nullptr);
+
+	/* 8 or 16 bit grayscale pgm (P2 or P5): one height per pixel, black 0 and white max_height [m],
+	   the first row of the image is the largest y (seen from above, x to the right) */
+	static Heightfield loadPgm(const std::string& path, double cell, double max_height);
+	/* random ground: smooth value noise of the given wavelength [m] with heights in [0, amplitude] [m] */
+	static Heightfield rough(int nx, int ny, double cell, double amplitude, double wavelength, uint32_t seed = 0);
+
+	void setFriction(double friction_k, double friction_s); // of all cells
+	void setFriction(int i, int j, double friction_k, double friction_s); // of cell (i, j), x index i
+	void center(double x = 0, double y = 0); // move the center of the grid to x, y
+
+	inline bool empty() const { return nx == 0; }
+	inline double sizeX() const { return (nx - 1) * cell; } // [m]
+	inline double sizeY() const { return (ny - 1) * cell; } // [m]
+	double heightAt(double x, double y) const; // [m] bilinear surface height at x, y
+	double maxHeight() const; // [m]
+
+	/* flat view for the constraints, valid until the vectors change */
+	CudaHeightfield view() const;
+};
+
+#endif // TITAN_TERRAIN_H
@@ -21,10 +21,8 @@ public:
 
 		s.run();
 
-		UdpDataSend& msg_send = s.msg_send;
-		auto& T = msg_send.T;
-
-		UdpDataReceive& msg_rec = s.msg_rec;
+		UdpDataSend msg_send;
+		UdpDataReceive msg_rec;
 
 		while (1) {
 
@@ -41,17 +39,15 @@ public:
 				msg_send.acceleration[i] = tan(T + i);
 				msg_send.position[i] = sin(T + i + 1);
 			}
-			s.flag_should_send = true;
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
-
+			s.publishState(msg_send);
 
-			if (s.flag_new_received) {//new massg
+			// wait up to 10 ms for a command instead of sleeping
+			if (s.waitCommand(msg_rec, std::chrono::milliseconds(10))) {//new massg
 				printf("%7.3f \t %3.3f %3.3f %3.3f %3.3f\n", msg_rec.T,
 					msg_rec.jointSpeed[0],
 					msg_rec.jointSpeed[1],
 					msg_rec.jointSpeed[2],
 					msg_rec.jointSpeed[3]);
-				s.flag_new_received = false;
 			}
 
 			if (_kbhit())
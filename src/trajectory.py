@@ -0,0 +1,217 @@
+"""
+trajectory.py: reader of the trajectory files of the recorder (recorder.h, flexipod_headless --record path).
+Only the header and the chunk index are read when opening, the frames are decompressed one chunk at a time:
+
+    traj = Trajectory("run.trj")
+    print(len(traj), traj.channels, traj.dt_frame)
+    com = traj.read("com_pos")                      # (num_frame, num_instance, 3) [m], the whole run
+    T, pos = traj.read(["T", "position"], 1000, 2000)  # frames [1000, 2000), position: (1000, num_mass, 3)
+    for chunk in traj.chunks(["joint_pos"]):        # constant memory over a long run
+        chunk["joint_pos"]
+
+Fields: T [s], position (num_mass, 3), sensor (num_instance, num_sensor, 3), joint_pos, joint_vel,
+joint_vel_cmd, joint_vel_desired (num_joint), com_pos, com_acc, ox, oy (num_instance, 3).
+The values are quantized to the resolution of their channel (traj.resolution).
+
+Print a summary:
+    python trajectory.py run.trj
+"""
+
+import os
+import struct
+import sys
+import zlib
+
+import numpy as np
+
+MAGIC = b"FLXTRAJ\0"
+CHUNK_MAGIC = b"CHNK"
+INDEX_MAGIC = b"FLXINDEX"
+VERSION = 1
+
+HEADER_FORMAT = "<8s10I6d"  # TrajectoryFileHeader
+CHUNK_FORMAT = "<4sIQ"  # TrajectoryChunkHeader
+INDEX_FORMAT = "<QQd"  # TrajectoryIndexEntry
+TRAILER_FORMAT = "<QQQ8s"  # TrajectoryFileTrailer
+
+CHANNELS = ("position", "sensor", "joint", "command", "com")  # RecordChannel bit order
+
+
+class Trajectory:
+    """a trajectory file, the frames are read on demand"""
+
+    def __init__(self, path):
+        self.path = path
+        self.file = open(path, "rb")
+        header = self.file.read(struct.calcsize(HEADER_FORMAT))
+        (magic, version, channels, self.num_mass, self.num_joint, self.num_instance, self.num_sensor,
+         self.num_value, self.frames_per_chunk, self.interval, steps_per_update, self.dt, *resolution) = \
+            struct.unpack(HEADER_FORMAT, header)
+        if magic != MAGIC or version != VERSION:
+            raise RuntimeError(f"{path} is not a flexipod trajectory (version {VERSION})")
+        self.channels = [name for c, name in enumerate(CHANNELS) if channels & (1 << c)]
+        self.resolution = dict(zip(CHANNELS, resolution))
+        self.sensor = np.frombuffer(self.file.read(4 * self.num_sensor), dtype="<u4").astype(np.int64)
+        self.dt_frame = self.dt * steps_per_update * self.interval  # [s] simulation time between frames
+        self._data_offset = self.file.tell()
+        self._fields = self._layout()
+        self._index = self._read_index()
+        self._starts = np.array([first for _, first, _ in self._index] + [self.num_frame], dtype=np.int64)
+
+    def close(self):
+        self.file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __len__(self):
+        return self.num_frame
+
+    @property
+    def fields(self):
+        """names of the recorded fields (T and those of the recorded channels)"""
+        return ["T"] + list(self._fields)
+
+    @property
+    def num_chunk(self):
+        return len(self._index)
+
+    def _layout(self):
+        """field name -> (channel, first value, shape of one frame), in the frame order of recorder.h"""
+        shapes = {
+            "position": [("position", (self.num_mass, 3))],
+            "sensor": [("sensor", (self.num_instance, self.num_sensor, 3))],
+            "joint": [(name, (self.num_joint,)) for name in ("joint_pos", "joint_vel", "joint_vel_cmd")],
+            "command": [("joint_vel_desired", (self.num_joint,))],
+            "com": [("com", (self.num_instance, 4, 3))],
+        }
+        fields, v = {}, 0
+        for channel in self.channels:
+            for name, shape in shapes[channel]:
+                fields[name] = (channel, v, shape)
+                v += int(np.prod(shape))
+        if v != self.num_value:
+            raise RuntimeError(f"{self.path}: {self.num_value} values per frame, expected {v}")
+        return fields
+
+    def _read_index(self):
+        """[(offset, first_frame, T)] of the chunks, from the trailer or by walking the chunk headers"""
+        size = os.fstat(self.file.fileno()).st_size
+        trailer_size = struct.calcsize(TRAILER_FORMAT)
+        if size >= self._data_offset + trailer_size:
+            self.file.seek(size - trailer_size)
+            index_offset, num_chunk, num_frame, magic = struct.unpack(TRAILER_FORMAT, self.file.read(trailer_size))
+            if magic == INDEX_MAGIC:
+                self.file.seek(index_offset)
+                entry_size = struct.calcsize(INDEX_FORMAT)
+                data = self.file.read(num_chunk * entry_size)
+                self.num_frame = num_frame
+                return [struct.unpack_from(INDEX_FORMAT, data, i * entry_size) for i in range(num_chunk)]
+        # no trailer (the recording was interrupted): walk the complete chunks
+        index, offset, first = [], self._data_offset, 0
+        chunk_size = struct.calcsize(CHUNK_FORMAT)
+        while offset + chunk_size <= size:
+            self.file.seek(offset)
+            magic, n, compressed_size = struct.unpack(CHUNK_FORMAT, self.file.read(chunk_size))
+            end = offset + chunk_size + 8 * n + compressed_size
+            if magic != CHUNK_MAGIC or end > size:
+                break
+            T0 = struct.unpack("<d", self.file.read(8))[0] if n > 0 else 0.0
+            index.append((offset, first, T0))
+            offset, first = end, first + n
+        self.num_frame = first
+        return index
+
+    def read_chunk(self, i):
+        """(T, values) of chunk i, values: float64 (num_frame, num_value)"""
+        offset = self._index[i][0]
+        self.file.seek(offset)
+        magic, n, compressed_size = struct.unpack(CHUNK_FORMAT, self.file.read(struct.calcsize(CHUNK_FORMAT)))
+        if magic != CHUNK_MAGIC:
+            raise RuntimeError(f"{self.path}: bad chunk at {offset}")
+        T = np.frombuffer(self.file.read(8 * n), dtype="<f8")
+        raw = np.frombuffer(zlib.decompress(self.file.read(compressed_size)), dtype=np.uint8)
+        # undo the byte shuffle, the zigzag encoding and the delta encoding (q[value][frame])
+        z = raw.reshape(4, -1).T.copy().view("<u4").reshape(self.num_value, n).astype(np.int64)
+        q = np.cumsum((z >> 1) ^ -(z & 1), axis=1)
+        values = np.empty((n, self.num_value))
+        for channel, v, shape in self._fields.values():
+            end = v + int(np.prod(shape))
+            values[:, v:end] = q[v:end].T * self.resolution[channel]
+        return T, values
+
+    def _split(self, T, values, names):
+        out = {}
+        for name in names:
+            if name == "T":
+                out[name] = T
+                continue
+            key = "com" if name in ("com_pos", "com_acc", "ox", "oy") else name
+            if key not in self._fields:
+                raise KeyError(f"{name} is not recorded, the fields are {self.fields}")
+            _, v, shape = self._fields[key]
+            a = values[:, v:v + int(np.prod(shape))].reshape((len(T),) + shape)
+            if key == "com":
+                a = a[:, :, ("com_pos", "com_acc", "ox", "oy").index(name)] if name != "com" else a
+            out[name] = a
+        return out
+
+    def chunks(self, names=None):
+        """yield a dict of the fields names (default: all) for each chunk"""
+        names = self._names(names)
+        for i in range(self.num_chunk):
+            yield self._split(*self.read_chunk(i), names)
+
+    def read(self, names=None, start=0, stop=None):
+        """fields of the frames [start, stop): an array for one name, a tuple for a list, a dict for None"""
+        single = isinstance(names, str)
+        keys = self._names(names)
+        stop = self.num_frame if stop is None else min(stop, self.num_frame)
+        start = max(start, 0)
+        parts = {name: [] for name in keys}
+        if start < stop:
+            first = int(np.searchsorted(self._starts, start, side="right")) - 1
+            last = int(np.searchsorted(self._starts, stop, side="left"))
+            for i in range(first, last):
+                chunk = self._split(*self.read_chunk(i), keys)
+                a, b = max(start - self._starts[i], 0), stop - self._starts[i]
+                for name in keys:
+                    parts[name].append(chunk[name][a:b])
+        out = {name: np.concatenate(p) if p else np.empty((0,)) for name, p in parts.items()}
+        if single:
+            return out[names]
+        return out if names is None else tuple(out[name] for name in keys)
+
+    def _names(self, names):
+        if names is None:
+            names = self.fields
+        elif isinstance(names, str):
+            names = [names]
+        return list(names)
+
+
+def main(argv):
+    if len(argv) != 2:
+        print("usage: python trajectory.py run.trj")
+        return 1
+    with Trajectory(argv[1]) as traj:
+        size = os.path.getsize(argv[1])
+        raw = 8 * len(traj) * (traj.num_value + 1)
+        print(f"{argv[1]}: {len(traj)} frames in {traj.num_chunk} chunks, every {traj.dt_frame * 1e3:.1f} ms, "
+              f"{traj.num_value} values per frame, channels {','.join(traj.channels)}")
+        print(f"{size * 1e-6:.2f} MB ({raw / max(size, 1):.1f}x smaller than float64)")
+        if len(traj) > 0:
+            T = traj.read("T")
+            print(f"T: {T[0]:.4f} .. {T[-1]:.4f} s")
+            if "com" in traj.channels:
+                com = traj.read("com_pos", len(traj) - 1)[0]
+                for k, p in enumerate(com):
+                    print(f"instance {k}: final com_pos {p[0]:+.4f} {p[1]:+.4f} {p[2]:+.4f} m")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
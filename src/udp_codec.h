@@ -0,0 +1,234 @@
+/*
+udp_codec.h: allocation-free msgpack encoding of the udp messages (udp_message.h)
+    packUdpData(msg, buffer): writes msg into a caller buffer of at least UDP_PACKED_MAX_SIZE bytes, returns the size
+    unpackUdpData(data, size, msg): parses msg in place from the received bytes, returns false if it is malformed
+The wire format is the one of MSGPACK_DEFINE: an array of the members, the double arrays as arrays of float64,
+so the packed bytes are identical to msgpack::pack(). The decoder accepts every msgpack int/float encoding for
+the numbers, e.g. the python controller (flexipod_control.ipynb) packs with use_single_float=True (float32)
+and sends the joint speeds as small ints.
+Header only, C++14 (also included by the cuda sources).
+*/
+
+#ifndef UDP_CODEC_H
+#define UDP_CODEC_H
+
+#include "udp_message.h"
+
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <stdlib.h> // _byteswap_uint64
+#endif
+
+/* convert between the host and the big endian (msgpack) byte order */
+static inline uint64_t bigEndian64(uint64_t v) {
+#if defined(_MSC_VER)
+    return _byteswap_uint64(v);
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return v;
+#else
+    return __builtin_bswap64(v);
+#endif
+}
+
+/* [bytes] upper bound of the packed UdpDataSend/UdpDataReceive: array of 8 members,
+   header (int64 at most), T and 6 arrays holding 24 doubles (float64), UdpDataReceive is smaller */
+constexpr size_t UDP_PACKED_MAX_SIZE = 1 + 9 + 25 * 9 + 6;
+
+/* msgpack encoder writing into a preallocated buffer, the caller guarantees the buffer is large enough */
+class MsgpackWriter {
+public:
+    explicit MsgpackWriter(char* buffer) : begin((uint8_t*)buffer), p((uint8_t*)buffer) {}
+
+    inline void arrayHeader(uint32_t n) { // n<65536
+        if (n < 16) { *p++ = (uint8_t)(0x90 | n); }
+        else { *p++ = 0xdc; storeBe(n, 2); }
+    }
+    inline void integer(int64_t v) { // smallest encoding, as msgpack-c packs a signed integer
+        if (v >= 0) {
+            if (v < 128) { *p++ = (uint8_t)v; } // positive fixint
+            else if (v < 0x100) { *p++ = 0xcc; storeBe((uint64_t)v, 1); } // uint8
+            else if (v < 0x10000) { *p++ = 0xcd; storeBe((uint64_t)v, 2); } // uint16
+            else if (v < 0x100000000LL) { *p++ = 0xce; storeBe((uint64_t)v, 4); } // uint32
+            else { *p++ = 0xcf; storeBe((uint64_t)v, 8); } // uint64
+        }
+        else if (v >= -32) { *p++ = (uint8_t)(0xe0 | (v + 32)); } // negative fixint
+        else if (v >= INT8_MIN) { *p++ = 0xd0; storeBe((uint64_t)v, 1); } // int8
+        else if (v >= INT16_MIN) { *p++ = 0xd1; storeBe((uint64_t)v, 2); } // int16
+        else if (v >= INT32_MIN) { *p++ = 0xd2; storeBe((uint64_t)v, 4); } // int32
+        else { *p++ = 0xd3; storeBe((uint64_t)v, 8); } // int64
+    }
+    inline void float64(double v) {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        *p++ = 0xcb;
+        storeBe(bits, 8);
+    }
+    template<size_t N>
+    inline void array(const double(&a)[N]) {
+        arrayHeader((uint32_t)N);
+        for (size_t i = 0; i < N; i++) { float64(a[i]); }
+    }
+    inline size_t size() const { return p - begin; }
+
+private:
+    uint8_t* begin;
+    uint8_t* p;
+    inline void storeBe(uint64_t v, int num_byte) { // the num_byte low bytes of v, big endian
+        const uint64_t be = bigEndian64(v << (8 * (8 - num_byte)));
+        memcpy(p, &be, num_byte);
+        p += num_byte;
+    }
+};
+
+/* msgpack decoder reading in place, every read returns false on a type mismatch or truncated data */
+class MsgpackReader {
+public:
+    MsgpackReader(const char* data, size_t size) : p((const uint8_t*)data), end((const uint8_t*)data + size) {}
+
+    inline bool arrayHeader(uint32_t& n) {
+        if (p >= end) { return false; }
+        const uint8_t t = *p++;
+        if ((t & 0xf0) == 0x90) { n = t & 0x0f; return true; } // fixarray
+        uint64_t v;
+        if (t == 0xdc && loadBe(v, 2)) { n = (uint32_t)v; return true; }
+        if (t == 0xdd && loadBe(v, 4)) { n = (uint32_t)v; return true; }
+        return false;
+    }
+    /* any msgpack int or float */
+    inline bool number(double& value) {
+        if (p >= end) { return false; }
+        const uint8_t t = *p++;
+        if (t < 0x80) { value = t; return true; } // positive fixint
+        if (t >= 0xe0) { value = (int8_t)t; return true; } // negative fixint
+        uint64_t v;
+        switch (t) {
+        case 0xca: { // float32
+            if (!loadBe(v, 4)) { return false; }
+            const uint32_t bits = (uint32_t)v;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            value = f;
+            return true;
+        }
+        case 0xcb: { // float64
+            if (!loadBe(v, 8)) { return false; }
+            memcpy(&value, &v, sizeof(value));
+            return true;
+        }
+        case 0xcc: if (!loadBe(v, 1)) { return false; } value = (double)v; return true; // uint8
+        case 0xcd: if (!loadBe(v, 2)) { return false; } value = (double)v; return true; // uint16
+        case 0xce: if (!loadBe(v, 4)) { return false; } value = (double)v; return true; // uint32
+        case 0xcf: if (!loadBe(v, 8)) { return false; } value = (double)v; return true; // uint64
+        case 0xd0: if (!loadBe(v, 1)) { return false; } value = (int8_t)v; return true; // int8
+        case 0xd1: if (!loadBe(v, 2)) { return false; } value = (int16_t)v; return true; // int16
+        case 0xd2: if (!loadBe(v, 4)) { return false; } value = (int32_t)v; return true; // int32
+        case 0xd3: if (!loadBe(v, 8)) { return false; } value = (double)(int64_t)v; return true; // int64
+        default: return false;
+        }
+    }
+    /* any msgpack int within the int range (e.g. the UDP_HEADER enum), a larger one fails the decode */
+    inline bool integer(int& value) {
+        const uint8_t* start = p;
+        double v;
+        if (p >= end || *p == 0xca || *p == 0xcb || !number(v) ||
+            !std::isfinite(v) || v < (double)INT_MIN || v > (double)INT_MAX || v != std::trunc(v)) {
+            p = start;
+            return false;
+        }
+        value = (int)v;
+        return true;
+    }
+    /* an array of at most N numbers, like msgpack-c the elements not sent keep their value */
+    template<size_t N>
+    inline bool array(double(&a)[N]) {
+        uint32_t n;
+        if (!arrayHeader(n) || n > N) { return false; }
+        for (uint32_t i = 0; i < n; i++) {
+            if (!number(a[i])) { return false; }
+        }
+        return true;
+    }
+
+private:
+    const uint8_t* p;
+    const uint8_t* end;
+    inline bool loadBe(uint64_t& v, int num_byte) { // big endian
+        if (end - p < num_byte) { return false; }
+        uint64_t be = 0;
+        memcpy(&be, p, num_byte);
+        v = bigEndian64(be) >> (8 * (8 - num_byte));
+        p += num_byte;
+        return true;
+    }
+};
+
+inline size_t packUdpData(const UdpDataSend& msg, char* buffer) {
+    MsgpackWriter w(buffer);
+    w.arrayHeader(8);
+    w.integer(msg.header);
+    w.float64(msg.T);
+    w.array(msg.jointAngle);
+    w.array(msg.jointSpeed);
+    w.array(msg.acceleration);
+    w.array(msg.orientation);
+    w.array(msg.actuation);
+    w.array(msg.position);
+    return w.size();
+}
+
+inline size_t packUdpData(const UdpDataReceive& msg, char* buffer) {
+    MsgpackWriter w(buffer);
+    w.arrayHeader(4);
+    w.integer(msg.header);
+    w.float64(msg.T);
+    w.array(msg.jointSpeed);
+    w.integer(msg.num_step);
+    return w.size();
+}
+
+/* like MSGPACK_DEFINE, the members not sent keep their value and extra members are ignored,
+   msg is only modified if the data is valid */
+inline bool unpackUdpData(const char* data, size_t size, UdpDataSend& msg) {
+    MsgpackReader r(data, size);
+    UdpDataSend m = msg;
+    uint32_t n;
+    int header = m.header;
+    if (!r.arrayHeader(n) ||
+        (n > 0 && !r.integer(header)) ||
+        (n > 1 && !r.number(m.T)) ||
+        (n > 2 && !r.array(m.jointAngle)) ||
+        (n > 3 && !r.array(m.jointSpeed)) ||
+        (n > 4 && !r.array(m.acceleration)) ||
+        (n > 5 && !r.array(m.orientation)) ||
+        (n > 6 && !r.array(m.actuation)) ||
+        (n > 7 && !r.array(m.position))) {
+        return false;
+    }
+    m.header = (UDP_HEADER)header;
+    msg = m;
+    return true;
+}
+
+inline bool unpackUdpData(const char* data, size_t size, UdpDataReceive& msg) {
+    MsgpackReader r(data, size);
+    UdpDataReceive m = msg;
+    uint32_t n;
+    int header = m.header;
+    if (!r.arrayHeader(n) ||
+        (n > 0 && !r.integer(header)) ||
+        (n > 1 && !r.number(m.T)) ||
+        (n > 2 && !r.array(m.jointSpeed)) ||
+        (n > 3 && !r.integer(m.num_step))) {
+        return false;
+    }
+    m.header = (UDP_HEADER)header;
+    msg = m;
+    return true;
+}
+
+#endif // UDP_CODEC_H
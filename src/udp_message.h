@@ -0,0 +1,118 @@
+/*
+udp_message.h: the udp messages between the simulation and the high level controller (msgpack),
+and UdpChannels, the lock-free hand-off (channel.h) between the physics thread and the udp threads,
+shared by the Winsock/asio servers (network.h) and the linux server (network_posix.h)
+*/
+
+#ifndef UDP_MESSAGE_H
+#define UDP_MESSAGE_H
+
+#include <msgpack.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "channel.h"
+
+enum UDP_HEADER:int{
+    RESET=15,
+    ROBOT_STATE_REPORT=14,
+    MOTOR_SPEED_COMMEND=13,
+    MOTOR_POS_COMMEND=12,
+    STEP_COMMEND=11}; // lockstep: set the joint speeds, run num_step updates, then report the state (lockstep.h)
+MSGPACK_ADD_ENUM(UDP_HEADER); // msgpack macro,refer to https://github.com/msgpack/msgpack-c/blob/cpp_master/example/cpp03/enum.cpp
+
+class UdpDataSend {/*the info to be sent to the high level controller*/
+public:
+    UDP_HEADER header = UDP_HEADER::ROBOT_STATE_REPORT;
+    double T = 0;
+    double jointAngle[4] = { 0 };
+    double jointSpeed[4] = { 0 };
+    double acceleration[3] = { 0 };
+    double orientation[6] = { 0 };
+    double actuation[4] = { 0 };
+    double position[3] = { 0 };
+    MSGPACK_DEFINE(header, T, jointAngle, jointSpeed, acceleration,orientation, actuation, position)
+};
+
+class UdpDataReceive {/*the high level command to be received */
+public:
+    UDP_HEADER header = UDP_HEADER::MOTOR_SPEED_COMMEND;
+    double T;
+    double jointSpeed[4] = { 0 };
+    int num_step = 0; // STEP_COMMEND: number of updates (NUM_QUEUED_KERNELS*dt each), 0: report the latest state
+    MSGPACK_DEFINE(header, T, jointSpeed, num_step)
+};
+
+
+/* robot state report stamped with the time the physics thread published it */
+struct StampedState {
+    UdpDataSend msg;
+    std::chrono::steady_clock::time_point publish_time;
+};
+
+/* lock-free hand-off between the physics thread and the udp threads (channel.h):
+   the physics thread publishes the latest state report (seqlock, the sender sends the newest one)
+   and polls the received commands (spsc queue, in order), the udp threads block instead of spinning */
+class UdpChannels {
+public:
+    static constexpr size_t COMMAND_QUEUE_SIZE = 64; // number of received commands not yet polled
+
+    LatencyHistogram send_latency; // time from publishState() to the bytes leaving the socket
+    std::atomic<uint64_t> num_dropped_command{ 0 }; // commands dropped because the queue was full
+    std::atomic<bool> flag_should_close{ false }; // flag indicating whether to stop sending/receiving
+
+    /* physics thread: publish the state report, replaces the one not yet sent */
+    void publishState(const UdpDataSend& msg) {
+        StampedState stamped;
+        stamped.msg = msg;
+        stamped.publish_time = std::chrono::steady_clock::now();
+        state.store(stamped);
+        state_notifier.notify();
+    }
+    /* physics thread: pop the oldest received command, returns false if there is none */
+    bool pollCommand(UdpDataReceive& msg) { return commands.pop(msg); }
+    /* physics thread: wait up to timeout for a command, returns false on timeout or close */
+    template<class Rep, class Period>
+    bool waitCommand(UdpDataReceive& msg, const std::chrono::duration<Rep, Period>& timeout) {
+        command_notifier.waitFor([this] {return !commands.empty() || flag_should_close; }, timeout);
+        return commands.pop(msg);
+    }
+
+protected:
+    Seqlock<StampedState> state; // latest state report
+    Notifier state_notifier;
+    SpscRing<UdpDataReceive, COMMAND_QUEUE_SIZE> commands; // received commands
+    Notifier command_notifier;
+
+    /* receiver thread: queue a received command */
+    void pushCommand(const UdpDataReceive& msg) {
+        if (commands.push(msg)) { command_notifier.notify(); }
+        else { num_dropped_command++; }
+    }
+    /* sender thread: if there is a state report newer than version, copy it to stamped and update version */
+    bool takeState(StampedState& stamped, uint64_t& version) {
+        if (state.version() == version) { return false; }
+        version = state.load(stamped);
+        return true;
+    }
+    /* sender thread: wait up to timeout for a state report newer than version,
+       returns false on timeout or close, otherwise copies it to stamped and updates version */
+    template<class Rep, class Period>
+    bool waitState(StampedState& stamped, uint64_t& version, const std::chrono::duration<Rep, Period>& timeout) {
+        if (!state_notifier.waitFor([this, &version] {return flag_should_close || state.version() != version; }, timeout)
+            || flag_should_close) {
+            return false;
+        }
+        return takeState(stamped, version);
+    }
+    /* wake the udp threads and the waiting physics thread to close */
+    void requestClose() {
+        flag_should_close = true;
+        state_notifier.notify();
+        command_notifier.notify();
+    }
+};
+
+#endif // UDP_MESSAGE_H
@@ -32,10 +32,12 @@ ref: J. Austin, R. Corrales-Fatou, S. Wyetzner, and H. Lipson, “Titan: A Paral
 #include <cmath>
 #include <vector>
 
+#ifndef CPU_ONLY // headless (cpu only) build does not need the cuda toolkit
 #include <cuda_runtime.h>
 #include <cuda.h>
 #include <cuda_device_runtime_api.h>
 #include <device_launch_parameters.h>
+#endif // !CPU_ONLY
 
 #include <msgpack.hpp>
 
@@ -292,36 +294,97 @@ struct MY_ALIGN(8) Vec3d {
 	}
 
 
-	inline CUDA_DEVICE void Vec3d::atomicVecAdd(const Vec3d& v) {
+	inline CUDA_DEVICE void atomicVecAdd(const Vec3d& v) {
 #if defined(__CUDA_ARCH__) && __CUDA_ARCH__ >= 600
 		atomicAdd(&x, v.x);
 		atomicAdd(&y, v.y);
 		atomicAdd(&z, v.z);
+#elif !defined(__CUDA_ARCH__) // host (cpu backend), openmp threads
+#pragma omp atomic
+		x += v.x;
+#pragma omp atomic
+		y += v.y;
+#pragma omp atomic
+		z += v.z;
 #endif
 	}
 
 	// https://en.wikipedia.org/wiki/Rodrigues%27_rotation_formula
 	// rotate a vector {v_} with rotation axis {k} anchored at point {offset} by {theta} [rad]
-	friend CUDA_CALLABLE_MEMBER Vec3d AxisAngleRotaion(const Vec3d& k, const Vec3d& v_, const double& theta, const Vec3d& offset);
+	inline friend CUDA_CALLABLE_MEMBER Vec3d AxisAngleRotaion(const Vec3d& k, const Vec3d& v_, const double& theta, const Vec3d& offset);
 
 	/* rotate a vector {v_} with rotation axis {axis_end-axis_start} by {theta} [rad] */
-	friend CUDA_CALLABLE_MEMBER Vec3d AxisAngleRotaion(const Vec3d& axis_start, const Vec3d& axis_end, const Vec3d& v_, const double& theta);
+	inline friend CUDA_CALLABLE_MEMBER Vec3d AxisAngleRotaion(const Vec3d& axis_start, const Vec3d& axis_end, const Vec3d& v_, const double& theta);
 
 	inline friend CUDA_CALLABLE_MEMBER double angleBetween(Vec3d p0, Vec3d p1) {
 		return acos(p0.dot(p1) / (p0.norm() * p1.norm()));
 	}
 
-	friend CUDA_CALLABLE_MEMBER double signedAngleBetween(Vec3d p0, Vec3d p1, Vec3d normal);
+	inline friend CUDA_CALLABLE_MEMBER double signedAngleBetween(Vec3d p0, Vec3d p1, Vec3d normal);
 
 	// linear interpolation
-	friend CUDA_CALLABLE_MEMBER Vec3d lerp(Vec3d p0, Vec3d p1, double t);
+	inline friend CUDA_CALLABLE_MEMBER Vec3d lerp(Vec3d p0, Vec3d p1, double t);
 
 	// spherical linear interpolation
-	friend CUDA_CALLABLE_MEMBER Vec3d slerp(Vec3d p0, Vec3d p1, double t);
+	inline friend CUDA_CALLABLE_MEMBER Vec3d slerp(Vec3d p0, Vec3d p1, double t);
 };
 
-
-
-
+/* the helper functions below are defined inline (previously in vec.cu),
+   so that both the cuda kernels and the host (cpu backend) can use them */
+// https://en.wikipedia.org/wiki/Rodrigues%27_rotation_formula
+/* rotate a vector {v_} with rotation axis {k} anchored at point {offset} by {theta} [rad]
+   k is a (unit) direction vector */
+inline CUDA_CALLABLE_MEMBER Vec3d AxisAngleRotaion(const Vec3d& k, const Vec3d& v_, const double& theta, const Vec3d& offset) {
+	Vec3d v = v_ - offset;
+	double c = cos(theta);
+	//Vec3d v_rot = v * c + cross(k, v) * sin(theta) + dot(k,v) * (1 - c) * k;
+	Vec3d v_rot = cross(k, v);
+	v_rot *= sin(theta);
+	v_rot += v * c;
+	v_rot += dot(k, v) * (1 - c) * k;
+
+	v_rot += offset;
+	return v_rot;
+}
+
+// https://en.wikipedia.org/wiki/Rodrigues%27_rotation_formula
+/* rotate a vector {v_} with rotation axis {axis_end-axis_start} by {theta} [rad] */
+inline CUDA_CALLABLE_MEMBER Vec3d AxisAngleRotaion(const Vec3d& axis_start,const Vec3d& axis_end, const Vec3d& v_, const double& theta) {
+	Vec3d k = (axis_end - axis_start).normalize(); // rotation axis{ k } is a (unit) direction vector
+	Vec3d v = v_ - axis_start;
+	double c = cos(theta);
+	//Vec3d v_rot = v * c + cross(k, v) * sin(theta) + dot(k,v) * (1 - c) * k;
+	Vec3d v_rot = cross(k, v);
+	v_rot *= sin(theta);
+	v_rot += v * c;
+	v_rot += dot(k, v) * (1 - c) * k;
+
+	v_rot += axis_start;
+	return v_rot;
+}
+
+inline CUDA_CALLABLE_MEMBER Vec3d lerp(Vec3d p0, Vec3d p1, double t) {
+	// Vec3d p_lerp = (p1-p0)*t + p0;
+	Vec3d p_lerp = p1; 
+	p_lerp -=p0;
+	p_lerp *= t;
+	p_lerp += p0;
+	return p_lerp;
+}
+
+
+inline CUDA_CALLABLE_MEMBER Vec3d slerp(Vec3d p0, Vec3d p1, double t) {
+	double w = angleBetween(p0, p1);//total angle
+	double s = sin(w);
+	//fixed numerical instability
+	Vec3d p_lerp = fabs(s)>1e-10? sin((1 - t) * w) / s * p0 + sin(t * w) / s * p1 : p1;
+	return p_lerp;
+}
+
+// https://stackoverflow.com/questions/14066933/direct-way-of-computing-clockwise-angle-between-2-vectors
+/*compute the clockwise angle between p0 and p1 robtated about the normal, NOTE: normal must be normalized!*/
+inline CUDA_CALLABLE_MEMBER double signedAngleBetween(Vec3d p0, Vec3d p1, Vec3d normal) {
+	return atan2(cross(p0, p1).dot(normal), p0.dot(p1));
+}
 
 #endif